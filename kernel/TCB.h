@@ -87,7 +87,10 @@ struct TCB {
   struct Node* cwd;
   char *cwd_path;
 
-  struct VME* vme_list;
+  struct VME* vme_list; // sorted by start address
+  struct VME* vme_root; // AVL index over vme_list
+  struct VME* vme_cache; // last VME returned by vme_find()
+  unsigned swap_hand; // next user address the swap clock looks at
 
   int pending_signals;
 
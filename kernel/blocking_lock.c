@@ -31,6 +31,21 @@ void blocking_lock_acquire(struct BlockingLock* lock){
   lock->is_held = true;
 }
 
+// attempt to acquire the lock without blocking
+// returns true with preemption disabled on success, false otherwise
+bool blocking_lock_try_acquire(struct BlockingLock* lock){
+  assert(lock != NULL, "blocking lock try acquire: lock is NULL.\n");
+  bool was_preempt = preemption_disable();
+  if (!sem_try_down(&lock->semaphore)){
+    preemption_restore(was_preempt);
+    return false;
+  }
+
+  lock->preempt = was_preempt;
+  lock->is_held = true;
+  return true;
+}
+
 // release lock and restore preemption state
 void blocking_lock_release(struct BlockingLock* lock){
   assert(lock != NULL, "blocking lock release: lock is NULL.\n"); 
@@ -17,6 +17,10 @@ void blocking_lock_init(struct BlockingLock* lock);
 // acquiring a blocking lock disables preemption
 void blocking_lock_acquire(struct BlockingLock* lock);
 
+// attempt to acquire the lock without blocking
+// returns true with preemption disabled on success, false otherwise
+bool blocking_lock_try_acquire(struct BlockingLock* lock);
+
 // release lock and restore preemption state
 void blocking_lock_release(struct BlockingLock* lock);
 
@@ -12,6 +12,7 @@ struct Config {
   unsigned num_cores;
   bool use_vga; // otherwise use UART for output
   bool use_audio; // non-zero when the emulator host audio sink is enabled
+  unsigned swap_blocks; // SD0 blocks reserved for swap after the kernel image, 0 disables swap
 };
 
 extern struct Config CONFIG;
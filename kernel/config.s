@@ -13,5 +13,6 @@ CONFIG:
   .fill NUM_CORES
   .fill USE_VGA
   .fill USE_AUDIO
+  .fill SWAP_BLOCKS
 
   
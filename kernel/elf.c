@@ -3,6 +3,7 @@
 #include "heap.h"
 #include "print.h"
 #include "vmem.h"
+#include "physmem.h"
 
 #define ELF_MAGIC_0 0x7F
 #define ELF_MAGIC_1 'E'
@@ -92,7 +93,7 @@ bool elf_validate_image(void* elf_image, unsigned image_size){
 }
  
 // mmap a program segment described by a program header into memory
-void program_header_load(void* elf_image, unsigned phoff){
+void program_header_load(void* elf_image, struct Node* file, unsigned phoff){
   struct ElfProgramHeader* ph = (struct ElfProgramHeader*)((unsigned char*)elf_image + phoff);
   unsigned vaddr = ph->p_vaddr;
   unsigned memsz = ph->p_memsz;
@@ -111,9 +112,28 @@ void program_header_load(void* elf_image, unsigned phoff){
     mmap_flags |= MMAP_EXEC;
   }
 
-  struct VME* vme = mmap_at(memsz, NULL, offset, MMAP_READ | MMAP_WRITE | MMAP_USER, vaddr);
+  // Pages made entirely of file bytes are mapped privately from the file, so
+  // they fault in straight from the page cache and are only copied if written.
+  // File mappings need a page-aligned offset; the partial last page and any
+  // bss must be copied/zeroed into an anonymous mapping instead.
+  unsigned file_mapped = 0;
+  if (file != NULL && (offset % FRAME_SIZE) == 0){
+    file_mapped = filesz & ~(FRAME_SIZE - 1);
+  }
+
+  if (file_mapped != 0){
+    mmap_at(file_mapped, file, offset, mmap_flags, vaddr);
+  }
+
+  if (memsz <= file_mapped){
+    return;
+  }
+
+  unsigned anon_vaddr = vaddr + file_mapped;
+  struct VME* vme = mmap_at(memsz - file_mapped, NULL, 0,
+    MMAP_READ | MMAP_WRITE | MMAP_USER, anon_vaddr);
   
-  for (int i = 0; i < filesz; i++){
+  for (int i = file_mapped; i < filesz; i++){
     ((char*)vaddr)[i] = ((char*)elf_image)[offset + i];
   }
 
@@ -121,13 +141,13 @@ void program_header_load(void* elf_image, unsigned phoff){
 }
 
 // load an ELF image in the layout described by its program headers
-unsigned elf_load(void* elf_image){
+unsigned elf_load(void* elf_image, struct Node* file){
   struct ElfHeader* header = malloc(sizeof(struct ElfHeader));
   memcpy(header, elf_image, sizeof(struct ElfHeader));
 
   unsigned entry = header->e_entry;
   for (int i = 0; i < header->e_phnum; i++){
-    program_header_load(elf_image, header->e_phoff + i * header->e_phentsize);
+    program_header_load(elf_image, file, header->e_phoff + i * header->e_phentsize);
   }
 
   free(header);
@@ -49,8 +49,13 @@ struct ElfProgramHeader {
   unsigned p_align;
 };
 
+struct Node;
+
 bool elf_validate_image(void* elf_image, unsigned image_size);
 
-unsigned elf_load(void* elf_image);
+// load an ELF image in the layout described by its program headers.
+// `file` is the node `elf_image` was mapped from; whole pages of each segment
+// are mapped privately from it so read-only pages share the page cache.
+unsigned elf_load(void* elf_image, struct Node* file);
 
 #endif // ELF_H
@@ -4,9 +4,17 @@
 #include "debug.h"
 #include "heap.h"
 #include "string.h"
+#include "page_cache.h"
+#include "physmem.h"
+#include "constants.h"
+#include "threads.h"
+#include "vmalloc.h"
 
 struct Ext2 fs;
 
+// typed cache for every heap-owned Node wrapper; fs.root is embedded instead
+static struct KmemCache* node_cache = NULL;
+
 #define EXT2_SUPERBLOCK_SECTOR 2
 #define EXT2_SUPERBLOCK_SECTORS 2
 #define EXT2_DIR_ENTRY_HEADER_SIZE 8
@@ -35,6 +43,10 @@ static unsigned node_read_all_locked(struct Node* node, unsigned offset, unsigne
 static void node_write_block_locked(struct Node* node, unsigned block_num, char* src, unsigned offset, unsigned size);
 
 static void dealloc_inode(struct Node* node);
+static void ext2_wake_flusher(struct Ext2* fs);
+static void node_block_map_set(struct CachedInode* cached, unsigned index, unsigned block_num);
+static unsigned node_map_block(struct Node* node, unsigned index);
+static void dir_index_free(struct DirIndex* index);
 
 // ext2 block and inode bitmaps can end mid-byte when the per-group count is not
 // divisible by 8, so scans must round up to cover the partial final byte.
@@ -113,8 +125,8 @@ static unsigned ext2_sectors_per_block(struct Ext2* fs){
   return ext2_get_block_size(fs) / SD_SECTOR_SIZE_BYTES;
 }
 
-// The allocator mutates free counts in the primary superblock, so callers must
-// flush it after every successful block or inode allocation.
+// The allocator mutates free counts in the primary superblock; the flush
+// writes it back. Caller holds metadata_lock.
 static void ext2_write_superblock(struct Ext2* fs){
   int rc = sd_write_blocks(SD_DRIVE_1, EXT2_SUPERBLOCK_SECTOR,
     EXT2_SUPERBLOCK_SECTORS, (char*)&fs->superblock);
@@ -131,6 +143,110 @@ static void ext2_write_bgd_table(struct Ext2* fs){
   assert(rc == 0, "ext2_write_bgd_table: failed to write block group descriptor table.\n");
 }
 
+static void ext2_write_bitmap(struct Ext2* fs, unsigned block_num, char* bitmap){
+  unsigned block_size = ext2_get_block_size(fs);
+  int rc = sd_write_blocks(SD_DRIVE_1, block_num * block_size / SD_SECTOR_SIZE_BYTES,
+    block_size / SD_SECTOR_SIZE_BYTES, bitmap);
+  assert(rc == 0, "ext2_write_bitmap: failed to write an allocation bitmap.\n");
+}
+
+// Record that one group's bitmap changed along with the superblock and BGD
+// counters. Caller holds metadata_lock.
+static void ext2_mark_group_dirty(struct Ext2* fs, char* bitmap_dirty, unsigned group){
+  fs->metadata_dirty = true;
+  bitmap_dirty[group] = 1;
+  ext2_wake_flusher(fs);
+}
+
+// Write the superblock, BGD table and every dirty bitmap. Holding
+// metadata_lock across the writes keeps an allocation from slipping in
+// between the counters and the bitmaps they summarize.
+static void ext2_flush_metadata(struct Ext2* fs){
+  blocking_lock_acquire(&fs->metadata_lock);
+  if (fs->metadata_dirty){
+    for (unsigned i = 0; i < fs->num_block_groups; ++i){
+      if (fs->inode_bitmap_dirty[i]){
+        ext2_write_bitmap(fs, fs->bgd_table[i].inode_bitmap, fs->inode_bitmaps[i]);
+        fs->inode_bitmap_dirty[i] = 0;
+      }
+      if (fs->block_bitmap_dirty[i]){
+        ext2_write_bitmap(fs, fs->bgd_table[i].block_bitmap, fs->block_bitmaps[i]);
+        fs->block_bitmap_dirty[i] = 0;
+      }
+    }
+    ext2_write_bgd_table(fs);
+    ext2_write_superblock(fs);
+    fs->metadata_dirty = false;
+  }
+  blocking_lock_release(&fs->metadata_lock);
+}
+
+// Buffers go first so the inode tables and pointer blocks that reference newly
+// allocated blocks are on disk no later than the bitmaps that claim them.
+void ext2_sync(struct Ext2* fs){
+  bcache_flush(&fs->bcache);
+  ext2_flush_metadata(fs);
+}
+
+// Runs while anything is dirty. Each pass waits EXT2_FLUSH_JIFFIES so a burst
+// of small writes to the same blocks reaches the disk once, then syncs. The
+// thread counts as active, so the kernel cannot shut down under a flush, and
+// it exits once a pass ends with nothing newly dirtied.
+static void ext2_flusher(void* arg){
+  struct Ext2* fs = *(struct Ext2**)arg;
+
+  while (true){
+    sleep(EXT2_FLUSH_JIFFIES);
+
+    blocking_lock_acquire(&fs->flusher_lock);
+    __atomic_store_n(&fs->flush_pending, false);
+    blocking_lock_release(&fs->flusher_lock);
+
+    ext2_sync(fs);
+
+    blocking_lock_acquire(&fs->flusher_lock);
+    if (!__atomic_load_n(&fs->flush_pending)){
+      fs->flusher_running = false;
+      blocking_lock_release(&fs->flusher_lock);
+      return;
+    }
+    blocking_lock_release(&fs->flusher_lock);
+  }
+}
+
+// Called after anything is dirtied. While flush_pending is already set, the
+// running flusher has not started its pass yet and will pick this change up.
+static void ext2_wake_flusher(struct Ext2* fs){
+  if (__atomic_load_n(&fs->flush_pending)){
+    return;
+  }
+
+  blocking_lock_acquire(&fs->flusher_lock);
+  __atomic_store_n(&fs->flush_pending, true);
+  bool start = !fs->flusher_running && fs->flusher_enabled;
+  if (start){
+    fs->flusher_running = true;
+  }
+  blocking_lock_release(&fs->flusher_lock);
+
+  if (start){
+    // free_fun() frees the argument when the thread exits, so pass a copy
+    struct Ext2** arg = malloc(sizeof(struct Ext2*));
+    *arg = fs;
+    struct Fun* fun = malloc(sizeof(struct Fun));
+    fun->func = ext2_flusher;
+    fun->arg = arg;
+    thread_(fun, LOW_PRIORITY, ANY_CORE);
+  }
+}
+
+void ext2_flusher_stop(struct Ext2* fs){
+  blocking_lock_acquire(&fs->flusher_lock);
+  assert(!fs->flusher_running, "ext2_flusher_stop: the flusher is still running.\n");
+  fs->flusher_enabled = false;
+  blocking_lock_release(&fs->flusher_lock);
+}
+
 // Inode writeback is explicit in this filesystem implementation. Any helper
 // that mutates on-disk inode fields must call this after the final state is set.
 static void node_sync_inode(struct Node* node){
@@ -150,25 +266,16 @@ static unsigned ext2_count_indirect_entries(unsigned* block, unsigned entries_pe
   return count;
 }
 
-// Clear a newly allocated pointer block before publishing it. That guarantees
-// later scans stop at the first unused entry instead of reading heap garbage as
-// block numbers.
-static void ext2_zero_pointer_block(unsigned* block, unsigned entries_per_block){
-  memset(block, 0, entries_per_block * sizeof(unsigned));
-}
-
 // Directory sizes are tracked in bytes, while node_add_block needs the count of
 // logical data blocks already attached to the inode. ext2 i_blocks cannot be
 // used for that because it counts 512-byte sectors for both file data and
 // metadata blocks such as indirect pointer blocks.
 static unsigned node_scan_data_block_count(struct Node* node){
+  struct BlockCache* bcache = &node->filesystem->bcache;
   unsigned block_size = ext2_get_block_size(node->filesystem);
   unsigned entries_per_block = block_size / 4;
   unsigned count = 0;
   unsigned single_count = 0;
-  unsigned* single_indirect = NULL;
-  unsigned* double_indirect = NULL;
-  unsigned* triple_indirect = NULL;
 
   // ext2 files in this implementation only grow by appending blocks, so each
   // addressing tier is packed from the front. That lets us count blocks by
@@ -182,80 +289,74 @@ static unsigned node_scan_data_block_count(struct Node* node){
     return count;
   }
 
-  single_indirect = malloc(block_size);
   // Count the single-indirect leaf. If it is not full, the append-only layout
   // guarantees there cannot be any live blocks in deeper tiers yet.
-  bcache_get(&node->filesystem->bcache, node->cached->inode.block[12], (char*)single_indirect);
-  single_count = ext2_count_indirect_entries(single_indirect, entries_per_block);
+  struct Buffer* single = bget(bcache, node->cached->inode.block[12]);
+  single_count = ext2_count_indirect_entries((unsigned*)single->data, entries_per_block);
+  brelse(bcache, single);
   count += single_count;
   if (single_count < entries_per_block || node->cached->inode.block[13] == 0){
-    free(single_indirect);
     return count;
   }
 
-  double_indirect = malloc(block_size);
-  bcache_get(&node->filesystem->bcache, node->cached->inode.block[13], (char*)double_indirect);
+  struct Buffer* dbl = bget(bcache, node->cached->inode.block[13]);
+  unsigned* double_indirect = (unsigned*)dbl->data;
   // Each live entry in the double-indirect root points at one single-indirect
   // leaf. Stop when we reach an unused root slot or a partially-filled leaf.
   for (unsigned outer = 0; outer < entries_per_block; ++outer){
     if (double_indirect[outer] == 0){
-      free(double_indirect);
-      free(single_indirect);
+      brelse(bcache, dbl);
       return count;
     }
 
-    bcache_get(&node->filesystem->bcache, double_indirect[outer], (char*)single_indirect);
-    single_count = ext2_count_indirect_entries(single_indirect, entries_per_block);
+    single = bget(bcache, double_indirect[outer]);
+    single_count = ext2_count_indirect_entries((unsigned*)single->data, entries_per_block);
+    brelse(bcache, single);
     count += single_count;
     if (single_count < entries_per_block){
-      free(double_indirect);
-      free(single_indirect);
+      brelse(bcache, dbl);
       return count;
     }
   }
+  brelse(bcache, dbl);
 
   if (node->cached->inode.block[14] == 0){
-    free(double_indirect);
-    free(single_indirect);
     return count;
   }
 
-  triple_indirect = malloc(block_size);
-  bcache_get(&node->filesystem->bcache, node->cached->inode.block[14], (char*)triple_indirect);
+  struct Buffer* triple = bget(bcache, node->cached->inode.block[14]);
+  unsigned* triple_indirect = (unsigned*)triple->data;
   // The triple-indirect walk follows the same packed layout one tier deeper:
   // stop at the first unused outer pointer or the first partially-filled leaf.
   for (unsigned outer = 0; outer < entries_per_block; ++outer){
     if (triple_indirect[outer] == 0){
-      free(triple_indirect);
-      free(double_indirect);
-      free(single_indirect);
+      brelse(bcache, triple);
       return count;
     }
 
-    bcache_get(&node->filesystem->bcache, triple_indirect[outer], (char*)double_indirect);
+    dbl = bget(bcache, triple_indirect[outer]);
+    double_indirect = (unsigned*)dbl->data;
     for (unsigned middle = 0; middle < entries_per_block; ++middle){
       if (double_indirect[middle] == 0){
-        free(triple_indirect);
-        free(double_indirect);
-        free(single_indirect);
+        brelse(bcache, dbl);
+        brelse(bcache, triple);
         return count;
       }
 
-      bcache_get(&node->filesystem->bcache, double_indirect[middle], (char*)single_indirect);
-      single_count = ext2_count_indirect_entries(single_indirect, entries_per_block);
+      single = bget(bcache, double_indirect[middle]);
+      single_count = ext2_count_indirect_entries((unsigned*)single->data, entries_per_block);
+      brelse(bcache, single);
       count += single_count;
       if (single_count < entries_per_block){
-        free(triple_indirect);
-        free(double_indirect);
-        free(single_indirect);
+        brelse(bcache, dbl);
+        brelse(bcache, triple);
         return count;
       }
     }
+    brelse(bcache, dbl);
   }
 
-  free(triple_indirect);
-  free(double_indirect);
-  free(single_indirect);
+  brelse(bcache, triple);
   return count;
 }
 
@@ -263,6 +364,10 @@ void ext2_init(struct Ext2* fs){
   // Bootstrap the in-memory ext2 view from disk before any cache or node code
   // runs. After this, higher-level helpers can assume the descriptor table,
   // allocation bitmaps, and root inode are available.
+  if (node_cache == NULL){
+    node_cache = kmem_cache_create("node", sizeof(struct Node), 4, NULL);
+  }
+
   // start by reading superblock
   int rc = sd_read_blocks(SD_DRIVE_1, 2, 2, &fs->superblock);
   assert(rc == 0, "ext2_init: failed to read ext2 superblock.\n");
@@ -319,9 +424,19 @@ void ext2_init(struct Ext2* fs){
   icache_init(&fs->icache);
   fs->bcache.fs = fs;
   bcache_init(&fs->bcache, block_size);
+  dcache_init(&fs->dcache);
 
   blocking_lock_init(&fs->metadata_lock);
-  blocking_lock_init(&fs->inode_lock);
+  fs->metadata_dirty = false;
+  fs->inode_bitmap_dirty = malloc(fs->num_block_groups);
+  fs->block_bitmap_dirty = malloc(fs->num_block_groups);
+  memset(fs->inode_bitmap_dirty, 0, fs->num_block_groups);
+  memset(fs->block_bitmap_dirty, 0, fs->num_block_groups);
+
+  blocking_lock_init(&fs->flusher_lock);
+  fs->flusher_running = false;
+  fs->flusher_enabled = true;
+  fs->flush_pending = false;
 
   // Read the root inode through the inode cache so bootstrap uses the same
   // inode size and block-size rules as every other inode lookup.
@@ -342,20 +457,26 @@ void ext2_destroy(struct Ext2* fs){
 
   fs->initialized = false;
 
-  free(fs->bgd_table);
   node_destroy(&fs->root);
 
+  // everything still dirty goes out before the caches and bitmaps are freed
+  ext2_sync(fs);
+
+  free(fs->bgd_table);
   for (unsigned i = 0; i < fs->num_block_groups; ++i){
     free(fs->inode_bitmaps[i]);
     free(fs->block_bitmaps[i]);
   }
   free(fs->inode_bitmaps);
   free(fs->block_bitmaps);
+  free(fs->inode_bitmap_dirty);
+  free(fs->block_bitmap_dirty);
 
   icache_destroy(&fs->icache);
   blocking_lock_destroy(&fs->metadata_lock);
-  blocking_lock_destroy(&fs->inode_lock);
+  blocking_lock_destroy(&fs->flusher_lock);
   bcache_destroy(&fs->bcache);
+  dcache_destroy(&fs->dcache);
 }
 
 void ext2_free(struct Ext2* fs){
@@ -444,7 +565,7 @@ static void ext2_free_pending_path(struct RingBuf* path){
 static struct Node* ext2_open_parent_dir(struct Node* node){
   struct Ext2* fs = node->filesystem;
   struct CachedInode* cached = icache_get(&fs->icache, node->parent_inumber);
-  struct Node* parent = malloc(sizeof(struct Node));
+  struct Node* parent = kmem_cache_alloc(node_cache);
 
   node_init(parent, cached, EXT2_BAD_INO, fs);
   assert(node_is_dir(parent),
@@ -457,7 +578,7 @@ static struct Node* ext2_open_parent_dir(struct Node* node){
 // return contract uniform: every successful lookup returns a heap-owned node.
 static struct Node* ext2_open_root_dir(struct Ext2* fs){
   struct CachedInode* cached = icache_get(&fs->icache, fs->root.cached->inumber);
-  struct Node* root = malloc(sizeof(struct Node));
+  struct Node* root = kmem_cache_alloc(node_cache);
 
   node_init(root, cached, EXT2_BAD_INO, fs);
   assert(node_is_dir(root), "ext2_open_root_dir: root inode is not a directory.\n");
@@ -543,7 +664,7 @@ struct Node* node_find(struct Node* dir, char* name){
 
     if (!dir_owned){
       struct CachedInode* cached = icache_get(&dir->filesystem->icache, dir->cached->inumber);
-      result = malloc(sizeof(struct Node));
+      result = kmem_cache_alloc(node_cache);
       node_init(result, cached, dir->parent_inumber, dir->filesystem);
     }
 
@@ -670,16 +791,7 @@ unsigned alloc_inumber(struct Ext2* fs, short mode){
         fs->bgd_table[i].used_dirs_count += 1;
       }
 
-      // for now, double-locking seems necessary to avoid the case of
-      // an old superblock accidentally being written back after a newer one
-      // TODO: refactor to avoid this
-      ext2_write_bgd_table(fs);
-      ext2_write_superblock(fs);
-
-      // write back updated bitmap
-      int rc = sd_write_blocks(SD_DRIVE_1, fs->bgd_table[i].inode_bitmap * ext2_get_block_size(fs) / SD_SECTOR_SIZE_BYTES,
-        ext2_get_block_size(fs) / SD_SECTOR_SIZE_BYTES, fs->inode_bitmaps[i]);
-      assert(rc == 0, "alloc_inumber: failed to write back inode bitmap.\n");
+      ext2_mark_group_dirty(fs, fs->inode_bitmap_dirty, i);
 
       blocking_lock_release(&fs->metadata_lock);
       
@@ -711,16 +823,7 @@ void dealloc_inumber(struct Ext2* fs, unsigned inumber, short mode) {
     fs->bgd_table[group_index].used_dirs_count -= 1;
   }
 
-  // for now, double-locking seems necessary to avoid the case of
-  // an old superblock accidentally being written back after a newer one
-  // TODO: refactor to avoid this
-  ext2_write_bgd_table(fs);
-  ext2_write_superblock(fs);
-
-  // write back updated bitmap
-  int rc = sd_write_blocks(SD_DRIVE_1, fs->bgd_table[group_index].inode_bitmap * ext2_get_block_size(fs) / SD_SECTOR_SIZE_BYTES,
-    ext2_get_block_size(fs) / SD_SECTOR_SIZE_BYTES, fs->inode_bitmaps[group_index]);
-  assert(rc == 0, "alloc_inumber: failed to write back inode bitmap.\n");
+  ext2_mark_group_dirty(fs, fs->inode_bitmap_dirty, group_index);
 
   blocking_lock_release(&fs->metadata_lock);
 }
@@ -762,17 +865,12 @@ unsigned alloc_block(struct Ext2* fs){
         if (block_num != -1) break;
       }
 
-      ext2_write_bgd_table(fs);
-      ext2_write_superblock(fs);
-
-      // write back updated bitmap
-      int rc = sd_write_blocks(SD_DRIVE_1, fs->bgd_table[i].block_bitmap * ext2_get_block_size(fs) / SD_SECTOR_SIZE_BYTES,
-        ext2_get_block_size(fs) / SD_SECTOR_SIZE_BYTES, fs->block_bitmaps[i]);
-      assert(rc == 0, "alloc_block: failed to write back block bitmap.\n");
+      ext2_mark_group_dirty(fs, fs->block_bitmap_dirty, i);
 
       // A reused block may still contain bytes from the inode that previously
       // owned it, both on disk and in the block cache. Zero it before returning
-      // so later partial writes and gap reads observe a clean block image.
+      // so later partial writes and gap reads observe a clean block image, and
+      // so node_add_block() can use a new pointer block without clearing it.
       char* zero_block = malloc(ext2_get_block_size(fs));
       memset(zero_block, 0, ext2_get_block_size(fs));
       bcache_set(&fs->bcache, block_num, zero_block, 0, ext2_get_block_size(fs));
@@ -804,13 +902,7 @@ void dealloc_block(struct Ext2* fs, unsigned block_num) {
   fs->bgd_table[group_index].free_blocks_count += 1;
   fs->superblock.free_blocks_count += 1;
 
-  ext2_write_bgd_table(fs);
-  ext2_write_superblock(fs);
-
-  // write back updated bitmap
-  int rc = sd_write_blocks(SD_DRIVE_1, fs->bgd_table[group_index].block_bitmap * ext2_get_block_size(fs) / SD_SECTOR_SIZE_BYTES,
-    ext2_get_block_size(fs) / SD_SECTOR_SIZE_BYTES, fs->block_bitmaps[group_index]);
-  assert(rc == 0, "dealloc_block: failed to write back block bitmap.\n");
+  ext2_mark_group_dirty(fs, fs->block_bitmap_dirty, group_index);
 
   blocking_lock_release(&fs->metadata_lock);
 }
@@ -821,12 +913,12 @@ void dealloc_block(struct Ext2* fs, unsigned block_num) {
 static void ext2_free_indirect_tree(struct Ext2* fs, unsigned pointer_block_num, unsigned levels){
   unsigned block_size = ext2_get_block_size(fs);
   unsigned entries_per_block = block_size / sizeof(unsigned);
-  unsigned* pointers = malloc(block_size);
 
   assert(levels >= 1 && levels <= 3, "ext2_free_indirect_tree: invalid indirect level.\n");
   assert(pointer_block_num != 0, "ext2_free_indirect_tree: pointer block number is zero.\n");
 
-  bcache_get(&fs->bcache, pointer_block_num, (char*)pointers);
+  struct Buffer* buf = bget(&fs->bcache, pointer_block_num);
+  unsigned* pointers = (unsigned*)buf->data;
 
   for (unsigned i = 0; i < entries_per_block; ++i){
     if (pointers[i] == 0) continue;
@@ -838,7 +930,7 @@ static void ext2_free_indirect_tree(struct Ext2* fs, unsigned pointer_block_num,
     }
   }
 
-  free(pointers);
+  brelse(&fs->bcache, buf);
   dealloc_block(fs, pointer_block_num);
 }
 
@@ -873,6 +965,7 @@ static void node_dealloc_blocks(struct Node* node){
   node->cached->inode.blocks = 0;
   node->cached->inode.size = 0;
   node->cached->data_block_count = 0;
+  node->cached->block_map_count = 0;
 }
 
 struct CachedInode* make_inode(short mode, unsigned inumber){
@@ -902,6 +995,7 @@ struct CachedInode* make_inode(short mode, unsigned inumber){
 }
 
 bool node_add_block(struct Node* node, unsigned block_num){
+  struct BlockCache* bcache = &node->filesystem->bcache;
   unsigned block_size = ext2_get_block_size(node->filesystem);
   unsigned sectors_per_block = ext2_sectors_per_block(node->filesystem);
   unsigned entries_per_block = block_size / 4;
@@ -925,28 +1019,25 @@ bool node_add_block(struct Node* node, unsigned block_num){
     node->cached->data_block_count += 1;
     return true;
   } else if (logical_block < single_limit){
-    unsigned* single_indirect = malloc(block_size);
     // The first append past the direct region also needs the single-indirect
-    // pointer block itself.
+    // pointer block itself. alloc_block() hands it back already zeroed.
     if (logical_block == 12){
       unsigned new_block = alloc_block(node->filesystem);
       if (new_block == -1){
-        free(single_indirect);
         return false;
       }
       node->cached->inode.block[12] = new_block;
-      ext2_zero_pointer_block(single_indirect, entries_per_block);
       reserved_blocks += 1;
-    } else {
-      bcache_get(&node->filesystem->bcache, node->cached->inode.block[12], (char*)single_indirect);
     }
 
     // Store the new data block in the next free slot of the single-indirect leaf.
-    single_indirect[logical_block - 12] = block_num;
-    bcache_set(&node->filesystem->bcache, node->cached->inode.block[12], (char*)single_indirect, 0, block_size);
+    struct Buffer* single = bget(bcache, node->cached->inode.block[12]);
+    ((unsigned*)single->data)[logical_block - 12] = block_num;
+    bdwrite(bcache, single);
+    brelse(bcache, single);
+    node_block_map_set(node->cached, logical_block, block_num);
     node->cached->inode.blocks += reserved_blocks * sectors_per_block;
     node->cached->data_block_count += 1;
-    free(single_indirect);
     return true;
   } else if (logical_block < double_limit){
     // Rebase the logical index so 0 means "first block in the double-indirect
@@ -954,50 +1045,44 @@ bool node_add_block(struct Node* node, unsigned block_num){
     unsigned double_index = logical_block - single_limit;
     unsigned indirect_index = double_index / entries_per_block;
     unsigned direct_index = double_index % entries_per_block;
-    unsigned* double_indirect = malloc(block_size);
-    unsigned* single_indirect = malloc(block_size);
 
     // Double-indirect growth may need two metadata allocations: the top-level
     // double-indirect block, and a leaf single-indirect block for this span.
     if (logical_block == single_limit){
       unsigned new_double_block = alloc_block(node->filesystem);
       if (new_double_block == -1){
-        free(double_indirect);
-        free(single_indirect);
         return false;
       }
       node->cached->inode.block[13] = new_double_block;
-      ext2_zero_pointer_block(double_indirect, entries_per_block);
       reserved_blocks += 1;
-    } else {
-      bcache_get(&node->filesystem->bcache, node->cached->inode.block[13], (char*)double_indirect);
     }
 
+    struct Buffer* dbl = bget(bcache, node->cached->inode.block[13]);
+    unsigned* double_indirect = (unsigned*)dbl->data;
+
     // A leaf slot of 0 means this append is the first entry in a new
     // single-indirect leaf under the double-indirect root.
     if (direct_index == 0){
       unsigned new_block = alloc_block(node->filesystem);
       if (new_block == -1){
-        free(double_indirect);
-        free(single_indirect);
+        brelse(bcache, dbl);
         return false;
       }
 
       double_indirect[indirect_index] = new_block;
       reserved_blocks += 1;
-      bcache_set(&node->filesystem->bcache, node->cached->inode.block[13], (char*)double_indirect, 0, block_size);
-      ext2_zero_pointer_block(single_indirect, entries_per_block);
-    } else {
-      bcache_get(&node->filesystem->bcache, double_indirect[indirect_index], (char*)single_indirect);
+      bdwrite(bcache, dbl);
     }
 
     // Once the metadata path exists, the final write is just one leaf update.
-    single_indirect[direct_index] = block_num;
-    bcache_set(&node->filesystem->bcache, double_indirect[indirect_index], (char*)single_indirect, 0, block_size);
+    struct Buffer* single = bget(bcache, double_indirect[indirect_index]);
+    ((unsigned*)single->data)[direct_index] = block_num;
+    bdwrite(bcache, single);
+    brelse(bcache, single);
+    node_block_map_set(node->cached, logical_block, block_num);
+    brelse(bcache, dbl);
     node->cached->inode.blocks += reserved_blocks * sectors_per_block;
     node->cached->data_block_count += 1;
-    free(double_indirect);
-    free(single_indirect);
     return true;
   } else if (logical_block < triple_limit){
     // Rebase into the triple-indirect region, then split the index into
@@ -1006,94 +1091,344 @@ bool node_add_block(struct Node* node, unsigned block_num){
     unsigned outer_index = triple_index / double_span;
     unsigned middle_index = (triple_index / entries_per_block) % entries_per_block;
     unsigned direct_index = triple_index % entries_per_block;
-    unsigned* triple_indirect = malloc(block_size);
-    unsigned* double_indirect = malloc(block_size);
-    unsigned* single_indirect = malloc(block_size);
 
     // Triple-indirect growth follows the same pattern one level deeper.
     if (logical_block == double_limit){
       unsigned new_triple_block = alloc_block(node->filesystem);
       if (new_triple_block == -1){
-        free(triple_indirect);
-        free(double_indirect);
-        free(single_indirect);
         return false;
       }
       node->cached->inode.block[14] = new_triple_block;
-      ext2_zero_pointer_block(triple_indirect, entries_per_block);
       reserved_blocks += 1;
-    } else {
-      bcache_get(&node->filesystem->bcache, node->cached->inode.block[14], (char*)triple_indirect);
     }
 
+    struct Buffer* triple = bget(bcache, node->cached->inode.block[14]);
+    unsigned* triple_indirect = (unsigned*)triple->data;
+
     // Every multiple of one full double-span starts a new double-indirect node
     // hanging from the triple-indirect root.
     if (triple_index % double_span == 0){
       unsigned new_block = alloc_block(node->filesystem);
       if (new_block == -1){
-        free(triple_indirect);
-        free(double_indirect);
-        free(single_indirect);
+        brelse(bcache, triple);
         return false;
       }
 
       triple_indirect[outer_index] = new_block;
       reserved_blocks += 1;
-      bcache_set(&node->filesystem->bcache, node->cached->inode.block[14], (char*)triple_indirect, 0, block_size);
-      ext2_zero_pointer_block(double_indirect, entries_per_block);
-    } else {
-      bcache_get(&node->filesystem->bcache, triple_indirect[outer_index], (char*)double_indirect);
+      bdwrite(bcache, triple);
     }
 
+    struct Buffer* dbl = bget(bcache, triple_indirect[outer_index]);
+    unsigned* double_indirect = (unsigned*)dbl->data;
+
     // Every 0 leaf offset starts a new single-indirect node under that
     // double-indirect subtree.
     if (direct_index == 0){
       unsigned new_block = alloc_block(node->filesystem);
       if (new_block == -1){
-        free(triple_indirect);
-        free(double_indirect);
-        free(single_indirect);
+        brelse(bcache, dbl);
+        brelse(bcache, triple);
         return false;
       }
 
       double_indirect[middle_index] = new_block;
       reserved_blocks += 1;
-      bcache_set(&node->filesystem->bcache, triple_indirect[outer_index], (char*)double_indirect, 0, block_size);
-      ext2_zero_pointer_block(single_indirect, entries_per_block);
-    } else {
-      bcache_get(&node->filesystem->bcache, double_indirect[middle_index], (char*)single_indirect);
+      bdwrite(bcache, dbl);
     }
 
     // After the metadata chain is present, publish the new data block in the leaf.
-    single_indirect[direct_index] = block_num;
-    bcache_set(&node->filesystem->bcache, double_indirect[middle_index], (char*)single_indirect, 0, block_size);
+    struct Buffer* single = bget(bcache, double_indirect[middle_index]);
+    ((unsigned*)single->data)[direct_index] = block_num;
+    bdwrite(bcache, single);
+    brelse(bcache, single);
+    node_block_map_set(node->cached, logical_block, block_num);
+    brelse(bcache, dbl);
+    brelse(bcache, triple);
     node->cached->inode.blocks += reserved_blocks * sectors_per_block;
     node->cached->data_block_count += 1;
-    free(triple_indirect);
-    free(double_indirect);
-    free(single_indirect);
     return true;
   } else {
     return false;
   }
 }
 
+/*
+  Directory scanning
+
+  Directory records are read in place: a DirIter walks one logical block at a
+  time, holding a reference to that block's cache buffer and handing out
+  pointers to the records inside it. Nothing is copied or allocated per
+  record. Updates work the same way, patching the record in the buffer and
+  marking it dirty with bdwrite(). All of this runs under the directory's
+  inode lock, which keeps the records from changing underneath a walk.
+
+  A directory of at least EXT2_DIR_INDEX_MIN_BLOCKS blocks also gets a
+  DirIndex the first time a lookup, add or remove needs to scan it. The index
+  maps each live name to its record's offset and keeps, for every block, the
+  largest new record the block could still take. A lookup or remove then goes
+  straight to one record, and an add only opens a block that has room.
+  dir_add_entry_locked() and dir_remove_entry_locked() keep it current, which
+  is easy because neither ever moves a live record: an add splits slack off
+  an existing record or fills a hole, and a remove clears the inode field and
+  merges the record into the one before it.
+*/
+
+// Position in a block-at-a-time walk over a directory's records
+struct DirIter {
+  struct Node* dir;
+  unsigned block_size;
+  unsigned block_index; // logical block being walked
+  unsigned block_count;
+  unsigned offset; // offset of the next record inside the block
+  unsigned record; // offset of the record last returned inside the block
+  struct Buffer* buf; // referenced buffer of block_index, or NULL
+};
+
+// Caller must hold dir->cached->lock until dir_iter_end().
+static void dir_iter_init(struct DirIter* it, struct Node* dir){
+  assert(dir->cached->lock.is_held, "dir_iter_init: caller must hold the directory lock.\n");
+  it->dir = dir;
+  it->block_size = ext2_get_block_size(dir->filesystem);
+  it->block_index = 0;
+  it->block_count = node_size_in_bytes(dir) / it->block_size;
+  it->offset = 0;
+  it->record = 0;
+  it->buf = NULL;
+}
+
+// Return the next record, live or a hole, or NULL after the last one. The
+// record points into the cached block and stays valid until the next call.
+static struct DirEntry* dir_iter_next(struct DirIter* it){
+  struct BlockCache* bcache = &it->dir->filesystem->bcache;
+
+  if (it->buf != NULL && it->offset == it->block_size){
+    brelse(bcache, it->buf);
+    it->buf = NULL;
+    it->block_index++;
+    it->offset = 0;
+  }
+  if (it->buf == NULL){
+    if (it->block_index >= it->block_count){
+      return NULL;
+    }
+    unsigned block_num = node_map_block(it->dir, it->block_index);
+    assert(block_num != 0, "dir_iter_next: directory block is a hole.\n");
+    it->buf = bget(bcache, block_num);
+  }
+
+  struct DirEntry* entry = (struct DirEntry*)(it->buf->data + it->offset);
+  assert(entry->rec_len >= EXT2_DIR_ENTRY_HEADER_SIZE,
+    "dir_iter_next: invalid directory record length.\n");
+  assert(entry->rec_len % EXT2_DIR_ENTRY_ALIGN_SIZE == 0,
+    "dir_iter_next: directory record is not 4-byte aligned.\n");
+  assert(it->offset + entry->rec_len <= it->block_size,
+    "dir_iter_next: directory record crosses the block boundary.\n");
+
+  it->record = it->offset;
+  it->offset += entry->rec_len;
+  return entry;
+}
+
+// byte offset in the directory of the record last returned by dir_iter_next()
+static unsigned dir_iter_position(struct DirIter* it){
+  return it->block_index * it->block_size + it->record;
+}
+
+// release the walk's buffer, which is only needed when it stops early
+static void dir_iter_end(struct DirIter* it){
+  if (it->buf != NULL){
+    brelse(&it->dir->filesystem->bcache, it->buf);
+    it->buf = NULL;
+  }
+  it->block_index = it->block_count;
+}
+
+static bool dir_entry_is(struct DirEntry* entry, char* name, unsigned name_len){
+  return entry->inode != 0 && entry->name_len == name_len &&
+    strneq((char*)entry->name, name, name_len);
+}
+
+// The largest new record a block can take: a hole's whole rec_len, or the
+// slack past a live record's name.
+static unsigned dir_block_free_space(char* block, unsigned block_size){
+  unsigned best = 0;
+  unsigned offset = 0;
+  while (offset < block_size){
+    struct DirEntry* entry = (struct DirEntry*)(block + offset);
+    unsigned room = entry->inode == 0 ? entry->rec_len :
+      entry->rec_len - ext2_dir_entry_min_size(entry->name_len);
+    if (room > best){
+      best = room;
+    }
+    offset += entry->rec_len;
+  }
+  return best;
+}
+
+static unsigned dir_index_hash(char* name, unsigned name_len){
+  unsigned hash = 5381;
+  for (unsigned i = 0; i < name_len; ++i){
+    hash = hash * 33 + (unsigned char)name[i];
+  }
+  return hash;
+}
+
+static struct DirIndexEntry* dir_index_find(struct DirIndex* index, char* name, unsigned name_len){
+  unsigned hash = dir_index_hash(name, name_len);
+  struct DirIndexEntry* entry = index->buckets[hash & index->bucket_mask];
+  while (entry != NULL){
+    if (entry->hash == hash && entry->name_len == name_len && strneq(entry->name, name, name_len)){
+      return entry;
+    }
+    entry = entry->next;
+  }
+  return NULL;
+}
+
+// double the bucket count once chains average more than two entries
+static void dir_index_grow(struct DirIndex* index){
+  unsigned old_count = index->bucket_mask + 1;
+  struct DirIndexEntry** old_buckets = index->buckets;
+  unsigned new_count = old_count * 2;
+
+  index->buckets = malloc(new_count * sizeof(struct DirIndexEntry*));
+  for (unsigned i = 0; i < new_count; ++i){
+    index->buckets[i] = NULL;
+  }
+  index->bucket_mask = new_count - 1;
+
+  for (unsigned i = 0; i < old_count; ++i){
+    struct DirIndexEntry* entry = old_buckets[i];
+    while (entry != NULL){
+      struct DirIndexEntry* next = entry->next;
+      entry->next = index->buckets[entry->hash & index->bucket_mask];
+      index->buckets[entry->hash & index->bucket_mask] = entry;
+      entry = next;
+    }
+  }
+  free(old_buckets);
+}
+
+static void dir_index_add(struct DirIndex* index, char* name, unsigned name_len,
+    unsigned offset, unsigned inumber){
+  struct DirIndexEntry* entry = malloc(sizeof(struct DirIndexEntry));
+  entry->hash = dir_index_hash(name, name_len);
+  entry->offset = offset;
+  entry->inumber = inumber;
+  entry->name_len = name_len;
+  entry->name = malloc(name_len);
+  memcpy(entry->name, name, name_len);
+
+  entry->next = index->buckets[entry->hash & index->bucket_mask];
+  index->buckets[entry->hash & index->bucket_mask] = entry;
+  index->entries++;
+
+  if (index->entries > 2 * (index->bucket_mask + 1)){
+    dir_index_grow(index);
+  }
+}
+
+static void dir_index_remove(struct DirIndex* index, struct DirIndexEntry* entry){
+  struct DirIndexEntry** link = &index->buckets[entry->hash & index->bucket_mask];
+  while (*link != entry){
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+  index->entries--;
+  free(entry->name);
+  free(entry);
+}
+
+// record the free space of a block added at the end of the directory
+static void dir_index_append_block(struct DirIndex* index, unsigned free_space){
+  if (index->block_count == index->block_capacity){
+    unsigned* grown = malloc(2 * index->block_capacity * sizeof(unsigned));
+    memcpy(grown, index->free_space, index->block_count * sizeof(unsigned));
+    free(index->free_space);
+    index->free_space = grown;
+    index->block_capacity *= 2;
+  }
+  index->free_space[index->block_count++] = free_space;
+}
+
+static void dir_index_free(struct DirIndex* index){
+  for (unsigned i = 0; i <= index->bucket_mask; ++i){
+    struct DirIndexEntry* entry = index->buckets[i];
+    while (entry != NULL){
+      struct DirIndexEntry* next = entry->next;
+      free(entry->name);
+      free(entry);
+      entry = next;
+    }
+  }
+  free(index->buckets);
+  free(index->free_space);
+  free(index);
+}
+
+// Return the directory's index, building it with one walk if the directory
+// has grown large enough to need one, or NULL for a small directory.
+// Caller must hold dir->cached->lock.
+static struct DirIndex* dir_get_index(struct Node* dir){
+  if (dir->cached->dir_index != NULL){
+    return dir->cached->dir_index;
+  }
+
+  unsigned block_size = ext2_get_block_size(dir->filesystem);
+  unsigned blocks = node_size_in_bytes(dir) / block_size;
+  if (blocks < EXT2_DIR_INDEX_MIN_BLOCKS){
+    return NULL;
+  }
+
+  struct DirIndex* index = malloc(sizeof(struct DirIndex));
+  unsigned buckets = 64;
+  index->buckets = malloc(buckets * sizeof(struct DirIndexEntry*));
+  for (unsigned i = 0; i < buckets; ++i){
+    index->buckets[i] = NULL;
+  }
+  index->bucket_mask = buckets - 1;
+  index->entries = 0;
+  index->block_count = 0;
+  index->block_capacity = blocks;
+  index->free_space = malloc(blocks * sizeof(unsigned));
+
+  struct DirIter it;
+  dir_iter_init(&it, dir);
+  struct DirEntry* entry;
+  while ((entry = dir_iter_next(&it)) != NULL){
+    if (entry->inode != 0){
+      dir_index_add(index, (char*)entry->name, entry->name_len, dir_iter_position(&it), entry->inode);
+    }
+    if (it.offset == block_size){
+      dir_index_append_block(index, dir_block_free_space(it.buf->data, block_size));
+    }
+  }
+
+  dir->cached->dir_index = index;
+  return index;
+}
+
 // Search one directory data block for slack in an existing record. ext2 grows a
 // directory by splitting the last record that has spare rec_len bytes; only a
-// completely full directory needs a new data block.
+// completely full directory needs a new data block. Returns the new record's
+// offset inside the block, or -1 if the block has no room. If the directory is
+// indexed, the block's free space is updated too.
 // Caller must hold dir->cached->lock.
-static bool dir_insert_entry_in_existing_block(struct Node* dir, unsigned block_index, char* name, unsigned inumber){
+static int dir_insert_entry_in_existing_block(struct Node* dir, unsigned block_index, char* name, unsigned inumber){
+  struct BlockCache* bcache = &dir->filesystem->bcache;
   unsigned block_size = ext2_get_block_size(dir->filesystem);
   unsigned new_entry_size = ext2_dir_entry_min_size(strlen(name));
-  char* block_buf = malloc(block_size);
 
   assert(dir->cached->lock.is_held,
     "dir_insert_entry_in_existing_block: caller must hold the directory lock.\n");
-  node_read_block_locked(dir, block_index, block_buf);
+  struct Buffer* buf = bget(bcache, node_map_block(dir, block_index));
+  char* block = buf->data;
 
   unsigned offset = 0;
+  int inserted = -1;
   while (offset < block_size){
-    struct DirEntry* existing = (struct DirEntry*)(block_buf + offset);
+    struct DirEntry* existing = (struct DirEntry*)(block + offset);
     unsigned record_length = existing->rec_len;
 
     assert(record_length >= EXT2_DIR_ENTRY_HEADER_SIZE,
@@ -1107,10 +1442,9 @@ static bool dir_insert_entry_in_existing_block(struct Node* dir, unsigned block_
       // Deleted entries leave holes with inode == 0. Reuse the hole directly
       // if its record is already large enough for the new name.
       if (record_length >= new_entry_size){
-        ext2_write_dir_entry(block_buf + offset, record_length, name, inumber);
-        node_write_block_locked(dir, block_index, block_buf, 0, block_size);
-        free(block_buf);
-        return true;
+        ext2_write_dir_entry(block + offset, record_length, name, inumber);
+        inserted = offset;
+        break;
       }
     } else {
       unsigned ideal_length = ext2_dir_entry_min_size(existing->name_len);
@@ -1118,21 +1452,27 @@ static bool dir_insert_entry_in_existing_block(struct Node* dir, unsigned block_
       // record to its ideal size and place the new entry in the freed suffix.
       if (record_length >= ideal_length + new_entry_size){
         existing->rec_len = ideal_length;
-        ext2_write_dir_entry(block_buf + offset + ideal_length,
+        ext2_write_dir_entry(block + offset + ideal_length,
           record_length - ideal_length, name, inumber);
-        node_write_block_locked(dir, block_index, block_buf, 0, block_size);
-        free(block_buf);
-        return true;
+        inserted = offset + ideal_length;
+        break;
       }
     }
 
     offset += record_length;
   }
 
-  assert(offset == block_size,
-    "dir_insert_entry_in_existing_block: directory block did not terminate at the block boundary.\n");
-  free(block_buf);
-  return false;
+  if (inserted >= 0){
+    bdwrite(bcache, buf);
+  } else {
+    assert(offset == block_size,
+      "dir_insert_entry_in_existing_block: directory block did not terminate at the block boundary.\n");
+  }
+  if (dir->cached->dir_index != NULL){
+    dir->cached->dir_index->free_space[block_index] = dir_block_free_space(block, block_size);
+  }
+  brelse(bcache, buf);
+  return inserted;
 }
 
 // Add an entry to a directory while the caller already owns the directory lock.
@@ -1149,8 +1489,21 @@ static bool dir_add_entry_locked(struct Node* dir, char* name, unsigned inumber)
   assert(dir->cached->lock.is_held,
     "dir_add_entry_locked: caller must hold the directory lock.\n");
 
+  unsigned name_len = strlen(name);
+  unsigned new_entry_size = ext2_dir_entry_min_size(name_len);
+  struct DirIndex* index = dir_get_index(dir);
+
   for (unsigned i = 0; i < logical_block_count; ++i){
-    if (dir_insert_entry_in_existing_block(dir, i, name, inumber)){
+    // the free-space map rules out full blocks without reading them
+    if (index != NULL && index->free_space[i] < new_entry_size){
+      continue;
+    }
+    int offset = dir_insert_entry_in_existing_block(dir, i, name, inumber);
+    if (offset >= 0){
+      if (index != NULL){
+        dir_index_add(index, name, name_len, i * block_size + offset, inumber);
+      }
+      dcache_set(&dir->filesystem->dcache, dir->cached->inumber, name, inumber);
       return true;
     }
   }
@@ -1171,6 +1524,12 @@ static bool dir_add_entry_locked(struct Node* dir, char* name, unsigned inumber)
   dir->cached->inode.size += block_size;
   node_sync_inode(dir);
 
+  if (index != NULL){
+    dir_index_append_block(index, block_size - new_entry_size);
+    dir_index_add(index, name, name_len, logical_block_count * block_size, inumber);
+  }
+
+  dcache_set(&dir->filesystem->dcache, dir->cached->inumber, name, inumber);
   return true;
 }
 
@@ -1183,6 +1542,56 @@ static bool dir_add_entry(struct Node* dir, char* name, unsigned inumber){
   return rc;
 }
 
+// Remove `name` from one directory block if it is there. Returns false if the
+// block has no live entry with that name.
+// Caller must hold dir->cached->lock.
+static bool dir_remove_entry_in_block(struct Node* dir, unsigned block_index, char* name){
+  struct BlockCache* bcache = &dir->filesystem->bcache;
+  unsigned block_size = ext2_get_block_size(dir->filesystem);
+  unsigned name_len = strlen(name);
+
+  struct Buffer* buf = bget(bcache, node_map_block(dir, block_index));
+  char* block = buf->data;
+
+  unsigned offset = 0;
+  struct DirEntry* prev = NULL;
+  while (offset < block_size){
+    struct DirEntry* existing = (struct DirEntry*)(block + offset);
+    unsigned record_length = existing->rec_len;
+
+    assert(record_length >= EXT2_DIR_ENTRY_HEADER_SIZE,
+      "dir_remove_entry: invalid directory record length.\n");
+    assert(record_length % EXT2_DIR_ENTRY_ALIGN_SIZE == 0,
+      "dir_remove_entry: directory record is not 4-byte aligned.\n");
+    assert(offset + record_length <= block_size,
+      "dir_remove_entry: directory record crosses the block boundary.\n");
+
+    if (dir_entry_is(existing, name, name_len)) {
+      // ext2 deletions clear the inode field. If there is a previous record,
+      // merge this record's rec_len into it so later inserts see one
+      // contiguous reusable hole.
+      existing->inode = 0;
+      if (prev != NULL){
+        prev->rec_len += existing->rec_len;
+      }
+      bdwrite(bcache, buf);
+      if (dir->cached->dir_index != NULL){
+        dir->cached->dir_index->free_space[block_index] = dir_block_free_space(block, block_size);
+      }
+      brelse(bcache, buf);
+      return true;
+    }
+
+    offset += record_length;
+    prev = existing;
+  }
+
+  assert(offset == block_size,
+    "dir_remove_entry: directory block did not terminate at the block boundary.\n");
+  brelse(bcache, buf);
+  return false;
+}
+
 // Remove an entry from a directory while the caller already owns the directory
 // lock. The lock stays held across the full scan and potential record merge.
 static bool dir_remove_entry_locked(struct Node* dir, char* name){
@@ -1196,51 +1605,27 @@ static bool dir_remove_entry_locked(struct Node* dir, char* name){
   assert(dir->cached->lock.is_held,
     "dir_remove_entry_locked: caller must hold the directory lock.\n");
 
-  for (unsigned i = 0; i < logical_block_count; ++i){
-    char* block_buf = malloc(block_size);
-
-    node_read_block_locked(dir, i, block_buf);
-
-    unsigned offset = 0;
-    struct DirEntry* prev = NULL;
-    while (offset < block_size){
-      struct DirEntry* existing = (struct DirEntry*)(block_buf + offset);
-      unsigned record_length = existing->rec_len;
-
-      assert(record_length >= EXT2_DIR_ENTRY_HEADER_SIZE,
-        "dir_remove_entry: invalid directory record length.\n");
-      assert(record_length % EXT2_DIR_ENTRY_ALIGN_SIZE == 0,
-        "dir_remove_entry: directory record is not 4-byte aligned.\n");
-      assert(offset + record_length <= block_size,
-        "dir_remove_entry: directory record crosses the block boundary.\n");
-
-      if (existing->inode != 0 && existing->name_len == strlen(name) &&
-          strneq((char*)existing->name, name, existing->name_len)) {
-        // ext2 deletions clear the inode field. If there is a previous record,
-        // merge this record's rec_len into it so later inserts see one
-        // contiguous reusable hole.
-        existing->inode = 0;
-        if (prev != NULL){
-          prev->rec_len += existing->rec_len;
-        }
-        node_write_block_locked(dir, i, block_buf, 0, block_size);
-        free(block_buf);
-
-        return true;
-      }
-      
-
-      offset += record_length;
-      prev = existing;
+  bool removed = false;
+  struct DirIndex* index = dir_get_index(dir);
+  if (index != NULL){
+    // the index knows the one block holding the name
+    struct DirIndexEntry* entry = dir_index_find(index, name, strlen(name));
+    if (entry != NULL){
+      removed = dir_remove_entry_in_block(dir, entry->offset / block_size, name);
+      assert(removed, "dir_remove_entry: the name index points at the wrong block.\n");
+      dir_index_remove(index, entry);
+    }
+  } else {
+    for (unsigned i = 0; i < logical_block_count && !removed; ++i){
+      removed = dir_remove_entry_in_block(dir, i, name);
     }
-
-    assert(offset == block_size,
-      "dir_remove_entry: directory block did not terminate at the block boundary.\n");
-
-    free(block_buf);
   }
 
-  return false;
+  if (removed){
+    // the name is gone, which is worth remembering too
+    dcache_set(&dir->filesystem->dcache, dir->cached->inumber, name, 0);
+  }
+  return removed;
 }
 
 // Remove an entry from a directory, acquiring the directory lock internally for
@@ -1252,37 +1637,67 @@ static bool dir_remove_entry(struct Node* dir, char* name){
   return rc;
 }
 
+// Find one exact basename and return its inumber, or 0 if no live entry has
+// that name. Caller must hold dir->cached->lock.
+static unsigned dir_scan_for_name(struct Node* dir, char* name){
+  unsigned name_len = strlen(name);
+
+  struct DirIndex* index = dir_get_index(dir);
+  if (index != NULL){
+    struct DirIndexEntry* entry = dir_index_find(index, name, name_len);
+    return entry == NULL ? 0 : entry->inumber;
+  }
+
+  struct DirIter it;
+  dir_iter_init(&it, dir);
+  struct DirEntry* entry;
+  while ((entry = dir_iter_next(&it)) != NULL){
+    if (dir_entry_is(entry, name, name_len)){
+      unsigned inumber = entry->inode;
+      dir_iter_end(&it);
+      return inumber;
+    }
+  }
+
+  return 0;
+}
+
+// Resolve one basename to an inumber, or 0 if it does not exist. The dentry
+// cache answers repeated lookups, including repeated misses, without reading
+// the directory; a scan's answer is cached for the next caller. Caller must
+// hold dir->cached->lock, which keeps the answer current until released.
+static unsigned dir_lookup_locked(struct Node* dir, char* name){
+  struct DentryCache* dcache = &dir->filesystem->dcache;
+  unsigned inumber;
+
+  if (dcache_lookup(dcache, dir->cached->inumber, name, &inumber)){
+    return inumber;
+  }
+
+  inumber = dir_scan_for_name(dir, name);
+  dcache_set(dcache, dir->cached->inumber, name, inumber);
+  return inumber;
+}
+
 // Look up one exact basename while the caller already owns the directory lock.
 // Successful lookups take an extra cached-inode reference before returning so
 // the result remains valid after the caller drops the directory lock.
 static struct Node* dir_find_entry_locked(struct Node* dir, char* name){
-  unsigned index = 0;
-  unsigned name_len = strlen(name);
-  struct DirEntry entry;
-
   assert(node_is_dir(dir), "dir_find_entry: target node is not a directory.\n");
   assert(name != NULL, "dir_find_entry: name is NULL.\n");
   assert(dir->cached->lock.is_held,
     "dir_find_entry_locked: caller must hold the directory lock.\n");
 
-  while (index < node_size_in_bytes(dir)){
-    int cnt = node_read_all_locked(dir, index, sizeof(struct DirEntry), (char*)&entry);
-    assert(cnt >= 4, "dir_find_entry: failed to read directory entry.\n");
-    assert(entry.rec_len >= EXT2_DIR_ENTRY_HEADER_SIZE,
-      "dir_find_entry: invalid directory record length.\n");
-
-    index += entry.rec_len;
-    if (entry.inode != 0 && entry.name_len == name_len &&
-        strneq((char*)entry.name, name, name_len)) {
-      struct CachedInode* inode = icache_get(&dir->filesystem->icache, entry.inode);
-      struct Node* node = malloc(sizeof(struct Node));
-
-      node_init(node, inode, dir->cached->inumber, dir->filesystem);
-      return node;
-    }
+  unsigned inumber = dir_lookup_locked(dir, name);
+  if (inumber == 0){
+    return NULL;
   }
 
-  return NULL;
+  struct CachedInode* inode = icache_get(&dir->filesystem->icache, inumber);
+  struct Node* node = kmem_cache_alloc(node_cache);
+
+  node_init(node, inode, dir->cached->inumber, dir->filesystem);
+  return node;
 }
 
 // Look up one exact basename, acquiring the directory lock internally for
@@ -1297,28 +1712,12 @@ static struct Node* dir_find_entry(struct Node* dir, char* name){
 // Duplicate names are rejected before allocation so failed creates do not
 // consume inode numbers or mutate the parent directory on disk.
 static bool dir_has_entry_name(struct Node* dir, char* name){
-  unsigned index = 0;
-  unsigned name_len = strlen(name);
-  struct DirEntry entry;
-
   assert(node_is_dir(dir), "dir_has_entry_name: target node is not a directory.\n");
   assert(name != NULL, "dir_has_entry_name: name is NULL.\n");
   assert(dir->cached->lock.is_held,
     "dir_has_entry_name: caller must hold the parent directory lock.\n");
 
-  while (index < node_size_in_bytes(dir)){
-    int cnt = node_read_all_locked(dir, index, sizeof(struct DirEntry), (char*)&entry);
-    assert(cnt >= 4, "dir_has_entry_name: failed to read directory entry.\n");
-    assert(entry.rec_len >= 8, "dir_has_entry_name: invalid directory record length.\n");
-
-    index += entry.rec_len;
-    if (entry.inode != 0 && entry.name_len == name_len &&
-        strneq((char*)entry.name, name, name_len)) {
-      return true;
-    }
-  }
-
-  return false;
+  return dir_lookup_locked(dir, name) != 0;
 }
 
 // ext2 directories are empty when every live entry is either "." or "..".
@@ -1326,34 +1725,23 @@ static bool dir_has_entry_name(struct Node* dir, char* name){
 // non-empty.
 // Caller must hold dir->cached->lock
 static bool dir_is_empty_locked(struct Node* dir){
-  assert(dir->cached->lock.is_held,
-    "dir_is_empty: caller must hold the candidate directory lock.\n");
-
-  unsigned index = 0;
-  struct DirEntry entry;
-
   assert(node_is_dir(dir), "dir_is_empty: target node is not a directory.\n");
   assert(dir->cached->lock.is_held,
     "dir_is_empty: caller must hold the candidate directory lock.\n");
 
-  while (index < node_size_in_bytes(dir)){
-    int cnt = node_read_all_locked(dir, index, sizeof(struct DirEntry), (char*)&entry);
-    assert(cnt >= 4, "dir_is_empty: failed to read directory entry.\n");
-    assert(entry.rec_len >= EXT2_DIR_ENTRY_HEADER_SIZE,
-      "dir_is_empty: invalid directory record length.\n");
-    assert(entry.rec_len % EXT2_DIR_ENTRY_ALIGN_SIZE == 0,
-      "dir_is_empty: directory record is not 4-byte aligned.\n");
-
-    if (entry.inode != 0){
-      bool is_dot = entry.name_len == 1 && strneq((char*)entry.name, ".", 1);
-      bool is_dot_dot = entry.name_len == 2 && strneq((char*)entry.name, "..", 2);
+  struct DirIter it;
+  dir_iter_init(&it, dir);
+  struct DirEntry* entry;
+  while ((entry = dir_iter_next(&it)) != NULL){
+    if (entry->inode != 0){
+      bool is_dot = entry->name_len == 1 && strneq((char*)entry->name, ".", 1);
+      bool is_dot_dot = entry->name_len == 2 && strneq((char*)entry->name, "..", 2);
 
       if (!is_dot && !is_dot_dot){
+        dir_iter_end(&it);
         return false;
       }
     }
-
-    index += entry.rec_len;
   }
 
   return true;
@@ -1363,37 +1751,10 @@ static bool dir_is_empty_locked(struct Node* dir){
 // Removed entries with inode == 0 are free space and do not make the directory
 // non-empty.
 bool dir_is_empty(struct Node* dir){
-  unsigned index = 0;
-  struct DirEntry entry;
-
   blocking_lock_acquire(&dir->cached->lock);
-
-  assert(node_is_dir(dir), "dir_is_empty: target node is not a directory.\n");
-
-  while (index < node_size_in_bytes(dir)){
-    int cnt = node_read_all_locked(dir, index, sizeof(struct DirEntry), (char*)&entry);
-    assert(cnt >= 4, "dir_is_empty: failed to read directory entry.\n");
-    assert(entry.rec_len >= EXT2_DIR_ENTRY_HEADER_SIZE,
-      "dir_is_empty: invalid directory record length.\n");
-    assert(entry.rec_len % EXT2_DIR_ENTRY_ALIGN_SIZE == 0,
-      "dir_is_empty: directory record is not 4-byte aligned.\n");
-
-    if (entry.inode != 0){
-      bool is_dot = entry.name_len == 1 && strneq((char*)entry.name, ".", 1);
-      bool is_dot_dot = entry.name_len == 2 && strneq((char*)entry.name, "..", 2);
-
-      if (!is_dot && !is_dot_dot){
-        blocking_lock_release(&dir->cached->lock);
-        return false;
-      }
-    }
-
-    index += entry.rec_len;
-  }
-
+  bool empty = dir_is_empty_locked(dir);
   blocking_lock_release(&dir->cached->lock);
-
-  return true;
+  return empty;
 }
 
 struct Node* alloc_inode(struct Ext2* fs, struct Node* dir, char* name, short mode){
@@ -1432,7 +1793,7 @@ struct Node* alloc_inode(struct Ext2* fs, struct Node* dir, char* name, short mo
   // directory tree so later lookups can reuse the same cached object.
   icache_insert(&fs->icache, cached);
 
-  struct Node* node = malloc(sizeof(struct Node));
+  struct Node* node = kmem_cache_alloc(node_cache);
 
   node_init(node, cached, dir->cached->inumber, fs);
 
@@ -1469,11 +1830,21 @@ static void cached_inode_init(struct CachedInode* cached, unsigned inumber){
   cached->refcount = 1;
   cached->valid = false; // invalid until the inode data is read in from disk
   cached->delete_pending = false;
+  cached->block_map = NULL;
+  cached->block_map_first = 0;
+  cached->block_map_count = 0;
+  cached->dir_index = NULL;
   blocking_lock_init(&cached->lock);
   gate_init(&cached->valid_gate);
 }
 
 static void cached_inode_destroy(struct CachedInode* cached){
+  if (cached->block_map != NULL){
+    free(cached->block_map);
+  }
+  if (cached->dir_index != NULL){
+    dir_index_free(cached->dir_index);
+  }
   gate_destroy(&cached->valid_gate);
   blocking_lock_destroy(&cached->lock);
 }
@@ -1496,9 +1867,8 @@ struct CachedInode* icache_get(struct InodeCache* cache, unsigned inumber){
   unsigned inodes_per_block = block_size / inode_size;
   unsigned block_group = (inumber - 1) / cache->fs->superblock.inodes_per_group;
   unsigned block_group_inode_index = (inumber - 1) % cache->fs->superblock.inodes_per_group;
-  unsigned inode_table_sector =
-    (cache->fs->bgd_table[block_group].inode_table + block_group_inode_index / inodes_per_block) *
-    block_size / SD_SECTOR_SIZE_BYTES;
+  unsigned inode_table_block =
+    cache->fs->bgd_table[block_group].inode_table + block_group_inode_index / inodes_per_block;
   unsigned inode_offset = inode_size * (block_group_inode_index % inodes_per_block);
 
   blocking_lock_acquire(&cache->lock);
@@ -1547,26 +1917,24 @@ struct CachedInode* icache_get(struct InodeCache* cache, unsigned inumber){
     return old;
   }
 
-  // Allocate the temporary inode-table buffer only on a cache miss so hot-path
-  // inode hits do not contend on the heap for an unused scratch block.
-  char* inode_table_buf = malloc(block_size);
-
-  int rc = sd_read_blocks(SD_DRIVE_1, inode_table_sector,
-    block_size / SD_SECTOR_SIZE_BYTES, inode_table_buf);
-  assert(rc == 0, "icache_get: failed to read inode table block.\n");
+  // The inode-table block may hold a newer copy than the disk until the
+  // flusher runs, so read it through the block cache.
+  struct Buffer* table = bget(&cache->fs->bcache, inode_table_block);
 
+  blocking_lock_acquire(&table->lock);
   blocking_lock_acquire(&cache->lock);
 
   // Copy the inode into the published placeholder, then mark it valid and wake
   // every waiter that raced on the same miss.
-  memcpy(&new_cache_entry->inode, (struct Inode*)(inode_table_buf + inode_offset), sizeof(struct Inode));
+  memcpy(&new_cache_entry->inode, (struct Inode*)(table->data + inode_offset), sizeof(struct Inode));
 
   new_cache_entry->valid = true;
   blocking_lock_release(&cache->lock);
+  blocking_lock_release(&table->lock);
 
-  gate_signal(&new_cache_entry->valid_gate);
+  brelse(&cache->fs->bcache, table);
 
-  free(inode_table_buf);
+  gate_signal(&new_cache_entry->valid_gate);
 
   return new_cache_entry;
 }
@@ -1586,31 +1954,15 @@ void icache_set(struct InodeCache* cache, struct CachedInode* cached){
   unsigned inodes_per_block = block_size / inode_size;
   unsigned block_group = (cached->inumber - 1) / cache->fs->superblock.inodes_per_group;
   unsigned block_group_inode_index = (cached->inumber - 1) % cache->fs->superblock.inodes_per_group;
-  unsigned inode_table_sector =
-    (cache->fs->bgd_table[block_group].inode_table + block_group_inode_index / inodes_per_block) *
-    block_size / SD_SECTOR_SIZE_BYTES;
+  unsigned inode_table_block =
+    cache->fs->bgd_table[block_group].inode_table + block_group_inode_index / inodes_per_block;
   unsigned inode_offset = inode_size * (block_group_inode_index % inodes_per_block);
-  char* inode_table_buf = malloc(block_size);
-
-  // Read-modify-write the containing inode-table block so neighboring inodes in
-  // the same block are preserved. This needs to be atomic to avoid losing updated
-  // if two threads change different inodes in the same block
-
-  blocking_lock_acquire(&cache->fs->inode_lock);
-
-  int rc = sd_read_blocks(SD_DRIVE_1, inode_table_sector,
-    block_size / SD_SECTOR_SIZE_BYTES, inode_table_buf);
-  assert(rc == 0, "icache_set: failed to read inode table block.\n");
 
-  memcpy(inode_table_buf + inode_offset, &cached->inode, sizeof(struct Inode));
-
-  rc = sd_write_blocks(SD_DRIVE_1, inode_table_sector,
-    block_size / SD_SECTOR_SIZE_BYTES, inode_table_buf);
-  assert(rc == 0, "icache_set: failed to write inode table block.\n");
-
-  blocking_lock_release(&cache->fs->inode_lock);
-
-  free(inode_table_buf);
+  // bcache_set() patches the inode into its table block under the buffer
+  // lock, so neighboring inodes in the same block are preserved, and leaves
+  // the block dirty for the flusher.
+  bcache_set(&cache->fs->bcache, inode_table_block, (char*)&cached->inode,
+    inode_offset, sizeof(struct Inode));
 }
 
 // decrement refcount, free if it hits 0
@@ -1657,156 +2009,717 @@ void icache_free(struct InodeCache* cache){
 
 void bcache_init(struct BlockCache* cache, unsigned block_size){
   blocking_lock_init(&cache->lock);
+  blocking_lock_init(&cache->flush_lock);
+  cond_var_init(&cache->buffer_freed);
+  cache->freed_waiters = 0;
+  cache->dirty_count = 0;
   cache->block_size = block_size;
-  cache->block_cache = malloc(BCACHE_SIZE * block_size);
-  for (unsigned i = 0; i < BCACHE_SIZE; ++i){
-    // Clear tags so a freshly initialized cache cannot report a stale hit.
-    cache->tags[i] = -1;
-    cache->ages[i] = i;
-  }
-}
-
-// On a miss, drop the cache lock for SD IO and then install the fetched block
-// back into the cache before returning the data to the caller.
-void bcache_get(struct BlockCache* cache, unsigned block_num, char* dest){
-  blocking_lock_acquire(&cache->lock);
-  bool found = false;
-  unsigned result = 0;
-  for (unsigned i = 0; i < BCACHE_SIZE; ++i){
-    if (block_num == cache->tags[i]){
-      found = true;
-      result = i;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+  cache->writebacks = 0;
+  cache->flush_writes = 0;
+  cache->direct_blocks = 0;
+  cache->direct_transfers = 0;
+  cache->flush_batch = malloc(BCACHE_FLUSH_BATCH * sizeof(struct Buffer*));
+  cache->flush_staging = physmem_alloc_order(BCACHE_FLUSH_ORDER);
+
+  // Block data lives in whole frames so buffers never straddle a frame and
+  // the SD engine can read and write them in place.
+  unsigned per_frame = FRAME_SIZE / block_size;
+  unsigned frames = PHYS_FRAME_COUNT / BCACHE_RAM_FRACTION;
+  if (frames * per_frame < BCACHE_MIN_BLOCKS){
+    frames = (BCACHE_MIN_BLOCKS + per_frame - 1) / per_frame;
+  }
+  cache->buffer_count = frames * per_frame;
+  // The descriptors run to dozens of pages but are only touched by the CPU,
+  // so they come from vmalloc() instead of one high-order buddy block.
+  cache->buffers = vmalloc(cache->buffer_count * sizeof(struct Buffer));
+
+  // about two buffers per hash chain
+  unsigned buckets = 1;
+  while (buckets * 2 < cache->buffer_count){
+    buckets *= 2;
+  }
+  cache->bucket_mask = buckets - 1;
+  cache->buckets = vmalloc(buckets * sizeof(struct Buffer*));
+  for (unsigned i = 0; i < buckets; ++i){
+    cache->buckets[i] = NULL;
+  }
+
+  char* frame = NULL;
+  for (unsigned i = 0; i < cache->buffer_count; ++i){
+    struct Buffer* buf = &cache->buffers[i];
+    if (i % per_frame == 0){
+      frame = physmem_alloc();
     }
+    buf->block_num = UINT_MAX;
+    buf->refcount = 0;
+    buf->valid = false;
+    buf->dirty = false;
+    buf->data = frame + (i % per_frame) * block_size;
+    buf->hash_next = NULL;
+    blocking_lock_init(&buf->lock);
+    gate_init(&buf->valid_gate);
+
+    // every buffer starts out unused on the LRU list
+    buf->lru_prev = i == 0 ? NULL : &cache->buffers[i - 1];
+    buf->lru_next = i == cache->buffer_count - 1 ? NULL : &cache->buffers[i + 1];
   }
+  cache->lru_head = &cache->buffers[0];
+  cache->lru_tail = &cache->buffers[cache->buffer_count - 1];
+}
 
-  if (found){
-    // Lower ages mean "more recently used". On a hit, age every hotter entry
-    // by one step and reset this entry back to most-recently-used.
-    for (unsigned i = 0; i < BCACHE_SIZE; ++i){
-      if (cache->ages[i] < cache->ages[result]){
-        cache->ages[i]++;
-      }
-    }
-    cache->ages[result] = 0;
+static void bcache_lru_remove(struct BlockCache* cache, struct Buffer* buf){
+  if (buf->lru_prev != NULL) buf->lru_prev->lru_next = buf->lru_next;
+  else cache->lru_head = buf->lru_next;
+  if (buf->lru_next != NULL) buf->lru_next->lru_prev = buf->lru_prev;
+  else cache->lru_tail = buf->lru_prev;
+  buf->lru_prev = NULL;
+  buf->lru_next = NULL;
+}
 
-    // copy from buffer into inode
-    memcpy(dest, cache->block_cache + result * cache->block_size, cache->block_size);
+static void bcache_lru_push(struct BlockCache* cache, struct Buffer* buf){
+  buf->lru_prev = NULL;
+  buf->lru_next = cache->lru_head;
+  if (cache->lru_head != NULL) cache->lru_head->lru_prev = buf;
+  else cache->lru_tail = buf;
+  cache->lru_head = buf;
+}
 
-    blocking_lock_release(&cache->lock);
+// put an unreferenced buffer back at the cold end. caller holds cache lock
+static void bcache_lru_push_tail(struct BlockCache* cache, struct Buffer* buf){
+  buf->lru_next = NULL;
+  buf->lru_prev = cache->lru_tail;
+  if (cache->lru_tail != NULL) cache->lru_tail->lru_next = buf;
+  else cache->lru_head = buf;
+  cache->lru_tail = buf;
+}
 
-    return;
-  } 
+static void bcache_write_batch(struct BlockCache* cache, struct Buffer** batch, unsigned count);
 
-  // was not in cache, need to read in block
+// take one more reference to a buffer that is already hashed. caller holds cache lock
+static void bcache_ref_locked(struct BlockCache* cache, struct Buffer* buf){
+  if (buf->refcount == 0){
+    bcache_lru_remove(cache, buf);
+  }
+  buf->refcount += 1;
+}
+
+static void bcache_unhash(struct BlockCache* cache, struct Buffer* buf){
+  struct Buffer** link = &cache->buckets[buf->block_num & cache->bucket_mask];
+  while (*link != buf){
+    assert(*link != NULL, "bcache_unhash: buffer is missing from its hash chain.\n");
+    link = &(*link)->hash_next;
+  }
+  *link = buf->hash_next;
+  buf->hash_next = NULL;
+}
+
+static void bcache_write_blocks(struct BlockCache* cache, unsigned first_block, unsigned count, char* src){
+  int rc = sd_write_blocks(SD_DRIVE_1, first_block * cache->block_size / SD_SECTOR_SIZE_BYTES,
+    count * cache->block_size / SD_SECTOR_SIZE_BYTES, src);
+  assert(rc == 0, "bcache: failed to write filesystem blocks.\n");
+  __atomic_fetch_add(&cache->writebacks, (int)count);
+  __atomic_fetch_add(&cache->flush_writes, 1);
+}
+
+// Write one referenced buffer back if it is still dirty. A writer that
+// dirties it again afterwards waits for the lock, so its update is never
+// lost behind the older disk image.
+static void bcache_write_back(struct BlockCache* cache, struct Buffer* buf){
+  blocking_lock_acquire(&buf->lock);
+  if (buf->dirty){
+    buf->dirty = false;
+    __atomic_fetch_add(&cache->dirty_count, -1);
+    bcache_write_blocks(cache, buf->block_num, 1, buf->data);
+  }
+  blocking_lock_release(&buf->lock);
+}
 
-  // can't read from sd while holding the lock since it's a blocking call
+// Mark a referenced buffer dirty. Caller holds buf->lock.
+static void bcache_mark_dirty(struct BlockCache* cache, struct Buffer* buf){
+  if (!buf->dirty){
+    buf->dirty = true;
+    __atomic_fetch_add(&cache->dirty_count, 1);
+  }
+}
+
+// Take a reference to the buffer for block_num. On a miss a clean buffer near
+// the cold end of the LRU list is renamed to block_num before the cache lock
+// is dropped, so concurrent misses on one block find it and wait on its gate
+// instead of reading the block twice. `*installed` tells the caller it must
+// fill the buffer and publish it with bcache_publish().
+// Write back up to BCACHE_DIRTY_SCAN dirty buffers at the cold end of the LRU
+// list as one sorted batch, then put each back at the cold end in its old
+// order, so the next look finds them clean without promoting them. caller
+// holds cache lock, which this drops and retakes
+static void bcache_clean_cold_locked(struct BlockCache* cache){
+  struct Buffer* cold[BCACHE_DIRTY_SCAN];
+  unsigned count = 0;
+  while (cache->lru_tail != NULL && cache->lru_tail->dirty && count < BCACHE_DIRTY_SCAN){
+    cold[count] = cache->lru_tail;
+    bcache_ref_locked(cache, cold[count]);
+    count++;
+  }
   blocking_lock_release(&cache->lock);
 
-  int rc = sd_read_blocks(SD_DRIVE_1, block_num * cache->block_size / SD_SECTOR_SIZE_BYTES,
-    cache->block_size / SD_SECTOR_SIZE_BYTES, dest);
-  assert(rc == 0, "bcache_get: failed to read filesystem block.\n");
+  // The staging area belongs to whoever holds flush_lock. If a flush is
+  // running it is cleaning buffers too, so write these one by one instead of
+  // waiting for it.
+  if (blocking_lock_try_acquire(&cache->flush_lock)){
+    for (unsigned i = 0; i < count; ++i){
+      cache->flush_batch[i] = cold[i];
+    }
+    bcache_write_batch(cache, cache->flush_batch, count);
+    blocking_lock_release(&cache->flush_lock);
+  } else {
+    for (unsigned i = 0; i < count; ++i){
+      bcache_write_back(cache, cold[i]);
+    }
+  }
 
-  // Reinstall the fetched block into the oldest cache line now that the IO is
-  // complete and the cache lock can be held again.
+  // cold[0] was the coldest, so it goes back last
   blocking_lock_acquire(&cache->lock);
-  for (unsigned i = 0; i < BCACHE_SIZE; ++i){
-    cache->ages[i]++;
-    if (cache->ages[i] == BCACHE_SIZE) result = i;
+  for (unsigned i = count; i > 0; --i){
+    struct Buffer* buf = cold[i - 1];
+    buf->refcount -= 1;
+    if (buf->refcount == 0){
+      bcache_lru_push_tail(cache, buf);
+      if (cache->freed_waiters > 0){
+        cond_var_signal(&cache->buffer_freed, &cache->lock);
+      }
+    }
   }
-  cache->ages[result] = 0;
-  cache->tags[result] = block_num;
+}
+
+static struct Buffer* bcache_pin(struct BlockCache* cache, unsigned block_num, bool* installed){
+  blocking_lock_acquire(&cache->lock);
+
+  struct Buffer* buf;
+  while (true){
+    buf = cache->buckets[block_num & cache->bucket_mask];
+    while (buf != NULL && buf->block_num != block_num){
+      buf = buf->hash_next;
+    }
+
+    if (buf != NULL){
+      bcache_ref_locked(cache, buf);
+      cache->hits += 1;
+      blocking_lock_release(&cache->lock);
+      *installed = false;
+      return buf;
+    }
+
+    // every buffer is referenced; wait for a brelse() and look again, since the
+    // block may have been installed by someone else in the meantime
+    if (cache->lru_tail == NULL){
+      cache->freed_waiters += 1;
+      while (cache->lru_tail == NULL){
+        cond_var_wait(&cache->buffer_freed, &cache->lock);
+      }
+      cache->freed_waiters -= 1;
+      continue;
+    }
+
+    // Unreferenced buffers cannot change their dirty bit, so it is stable here.
+    // If the cold end is all dirty, clean it in one batch and look again.
+    buf = cache->lru_tail;
+    for (unsigned scanned = 0; buf != NULL && buf->dirty && scanned < BCACHE_DIRTY_SCAN; ++scanned){
+      buf = buf->lru_prev;
+    }
+    if (buf != NULL && !buf->dirty){
+      break;
+    }
+    bcache_clean_cold_locked(cache);
+  }
+
+  bcache_lru_remove(cache, buf);
+  if (buf->block_num != UINT_MAX){
+    bcache_unhash(cache, buf);
+    cache->evictions += 1;
+  }
+
+  buf->block_num = block_num;
+  buf->refcount = 1;
+  buf->valid = false;
+  gate_reset(&buf->valid_gate);
+  struct Buffer** bucket = &cache->buckets[block_num & cache->bucket_mask];
+  buf->hash_next = *bucket;
+  *bucket = buf;
+  cache->misses += 1;
 
-  memcpy(cache->block_cache + result * cache->block_size, dest, cache->block_size);
-      
   blocking_lock_release(&cache->lock);
-} 
+  *installed = true;
+  return buf;
+}
+
+// mark a freshly installed buffer as filled and wake its waiters
+static void bcache_publish(struct Buffer* buf){
+  buf->valid = true;
+  gate_signal(&buf->valid_gate);
+}
+
+struct Buffer* bget(struct BlockCache* cache, unsigned block_num){
+  bool installed;
+  struct Buffer* buf = bcache_pin(cache, block_num, &installed);
+
+  if (installed){
+    // can't read from sd while holding the cache lock since it's a blocking
+    // call; the buffer is referenced, so it cannot be reused meanwhile
+    int rc = sd_read_blocks(SD_DRIVE_1, block_num * cache->block_size / SD_SECTOR_SIZE_BYTES,
+      cache->block_size / SD_SECTOR_SIZE_BYTES, buf->data);
+    assert(rc == 0, "bget: failed to read filesystem block.\n");
+    bcache_publish(buf);
+  } else {
+    gate_wait(&buf->valid_gate);
+  }
+
+  return buf;
+}
+
+void brelse(struct BlockCache* cache, struct Buffer* buf){
+  blocking_lock_acquire(&cache->lock);
+  assert(buf->refcount > 0, "brelse: buffer is not referenced.\n");
+  buf->refcount -= 1;
+  if (buf->refcount == 0){
+    bcache_lru_push(cache, buf);
+    if (cache->freed_waiters > 0){
+      cond_var_signal(&cache->buffer_freed, &cache->lock);
+    }
+  }
+  blocking_lock_release(&cache->lock);
+}
 
-// Write-through path: update the cached block image if present, then push the
-// final bytes to disk so later readers observe the new contents.
+void bdwrite(struct BlockCache* cache, struct Buffer* buf){
+  assert(buf->refcount > 0, "bdwrite: buffer is not referenced.\n");
+
+  blocking_lock_acquire(&buf->lock);
+  bcache_mark_dirty(cache, buf);
+  blocking_lock_release(&buf->lock);
+
+  ext2_wake_flusher(cache->fs);
+}
+
+void bcache_get(struct BlockCache* cache, unsigned block_num, char* dest){
+  struct Buffer* buf = bget(cache, block_num);
+  memcpy(dest, buf->data, cache->block_size);
+  brelse(cache, buf);
+}
+
+// Patch the cached block image and leave the disk write to the flusher. Only
+// partial writes of a block that is not cached need to read it first.
 void bcache_set(struct BlockCache* cache, unsigned block_num, char* src, unsigned offset, unsigned size){
-  char* block_buf = malloc(cache->block_size);
+  unsigned write_size = size >= (cache->block_size - offset) ? (cache->block_size - offset) : size;
+  bool installed = false;
+  struct Buffer* buf;
+
+  if (offset == 0 && write_size == cache->block_size){
+    // every byte is replaced by src, so a miss skips the read
+    buf = bcache_pin(cache, block_num, &installed);
+    if (!installed){
+      gate_wait(&buf->valid_gate);
+    }
+  } else {
+    buf = bget(cache, block_num);
+  }
 
+  blocking_lock_acquire(&buf->lock);
+  memcpy(buf->data + offset, src, write_size);
+  if (installed){
+    bcache_publish(buf);
+  }
+  bcache_mark_dirty(cache, buf);
+  blocking_lock_release(&buf->lock);
+
+  brelse(cache, buf);
+  ext2_wake_flusher(cache->fs);
+}
+
+// Take references to whichever blocks of [first_block, first_block + count)
+// are cached, leaving NULL for the rest.
+static void bcache_pin_run(struct BlockCache* cache, unsigned first_block, unsigned count,
+    struct Buffer** cached){
   blocking_lock_acquire(&cache->lock);
-  bool found = false;
-  unsigned result = 0;
-  for (unsigned i = 0; i < BCACHE_SIZE; ++i){
-    if (block_num == cache->tags[i]){
-      found = true;
-      result = i;
+  for (unsigned i = 0; i < count; ++i){
+    struct Buffer* buf = cache->buckets[(first_block + i) & cache->bucket_mask];
+    while (buf != NULL && buf->block_num != first_block + i){
+      buf = buf->hash_next;
+    }
+    if (buf != NULL){
+      bcache_ref_locked(cache, buf);
     }
+    cached[i] = buf;
   }
+  blocking_lock_release(&cache->lock);
+}
 
-  if (found || (size >= cache->block_size && offset == 0)){
-    // Cache hits already have a complete block image in memory. Full-block
-    // overwrites also do not need a read-before-write path because every byte
-    // in the block will be replaced by src.
-    if (found){
-      for (unsigned i = 0; i < BCACHE_SIZE; ++i){
-        if (cache->ages[i] < cache->ages[result]){
-          cache->ages[i]++;
-        }
+void bcache_read_run(struct BlockCache* cache, unsigned first_block, unsigned count, char* dest){
+  assert(count <= BCACHE_RUN_MAX, "bcache_read_run: run is too long.\n");
+  struct Buffer* cached[BCACHE_RUN_MAX];
+  bcache_pin_run(cache, first_block, count, cached);
+
+  unsigned i = 0;
+  while (i < count){
+    // a cached copy may be newer than the disk
+    if (cached[i] != NULL){
+      gate_wait(&cached[i]->valid_gate);
+      blocking_lock_acquire(&cached[i]->lock);
+      memcpy(dest + i * cache->block_size, cached[i]->data, cache->block_size);
+      blocking_lock_release(&cached[i]->lock);
+      brelse(cache, cached[i]);
+      i++;
+      continue;
+    }
+
+    unsigned end = i + 1;
+    while (end < count && cached[end] == NULL){
+      end++;
+    }
+    int rc = sd_read_blocks(SD_DRIVE_1, (first_block + i) * cache->block_size / SD_SECTOR_SIZE_BYTES,
+      (end - i) * cache->block_size / SD_SECTOR_SIZE_BYTES, dest + i * cache->block_size);
+    assert(rc == 0, "bcache_read_run: failed to read filesystem blocks.\n");
+    __atomic_fetch_add(&cache->direct_blocks, (int)(end - i));
+    __atomic_fetch_add(&cache->direct_transfers, 1);
+    i = end;
+  }
+}
+
+void bcache_write_run(struct BlockCache* cache, unsigned first_block, unsigned count, char* src){
+  assert(count <= BCACHE_RUN_MAX, "bcache_write_run: run is too long.\n");
+  struct Buffer* cached[BCACHE_RUN_MAX];
+  bcache_pin_run(cache, first_block, count, cached);
+
+  // Cached copies take the new data and drop their dirty bit, since the
+  // transfer makes the disk current. Their locks stay held, in block order,
+  // until it completes, so a flush cannot write an older image after it.
+  for (unsigned i = 0; i < count; ++i){
+    if (cached[i] != NULL){
+      gate_wait(&cached[i]->valid_gate);
+      blocking_lock_acquire(&cached[i]->lock);
+      memcpy(cached[i]->data, src + i * cache->block_size, cache->block_size);
+      if (cached[i]->dirty){
+        cached[i]->dirty = false;
+        __atomic_fetch_add(&cache->dirty_count, -1);
       }
-    } else {
-      for (unsigned i = 0; i < BCACHE_SIZE; ++i){
-        cache->ages[i]++;
-        if (cache->ages[i] == BCACHE_SIZE) result = i;
+    }
+  }
+
+  int rc = sd_write_blocks(SD_DRIVE_1, first_block * cache->block_size / SD_SECTOR_SIZE_BYTES,
+    count * cache->block_size / SD_SECTOR_SIZE_BYTES, src);
+  assert(rc == 0, "bcache_write_run: failed to write filesystem blocks.\n");
+  __atomic_fetch_add(&cache->direct_blocks, (int)count);
+  __atomic_fetch_add(&cache->direct_transfers, 1);
+
+  for (unsigned i = 0; i < count; ++i){
+    if (cached[i] != NULL){
+      blocking_lock_release(&cached[i]->lock);
+      brelse(cache, cached[i]);
+    }
+  }
+}
+
+// Write one sorted run of referenced buffers with consecutive block numbers.
+// A lone buffer is written in place; longer runs are copied into the staging
+// area first. Caller holds flush_lock.
+static void bcache_flush_run(struct BlockCache* cache, struct Buffer** run, unsigned count){
+  if (count == 1){
+    bcache_write_back(cache, run[0]);
+    return;
+  }
+
+  // Clear each dirty bit while copying under the buffer lock. An update that
+  // lands after its copy dirties the buffer again for the next flush.
+  for (unsigned i = 0; i < count; ++i){
+    blocking_lock_acquire(&run[i]->lock);
+    if (run[i]->dirty){
+      run[i]->dirty = false;
+      __atomic_fetch_add(&cache->dirty_count, -1);
+    }
+    memcpy(cache->flush_staging + i * cache->block_size, run[i]->data, cache->block_size);
+    blocking_lock_release(&run[i]->lock);
+  }
+  bcache_write_blocks(cache, run[0]->block_num, count, cache->flush_staging);
+}
+
+// Sort referenced buffers by block number and write them back in runs of
+// consecutive blocks. Caller holds flush_lock.
+static void bcache_write_batch(struct BlockCache* cache, struct Buffer** batch, unsigned count){
+  unsigned run_limit = (FRAME_SIZE << BCACHE_FLUSH_ORDER) / cache->block_size;
+
+  // insertion sort by block number; batches are small
+  for (unsigned i = 1; i < count; ++i){
+    struct Buffer* buf = batch[i];
+    unsigned j = i;
+    while (j > 0 && batch[j - 1]->block_num > buf->block_num){
+      batch[j] = batch[j - 1];
+      j--;
+    }
+    batch[j] = buf;
+  }
+
+  unsigned start = 0;
+  while (start < count){
+    unsigned end = start + 1;
+    while (end < count && end - start < run_limit &&
+        batch[end]->block_num == batch[end - 1]->block_num + 1){
+      end++;
+    }
+    bcache_flush_run(cache, batch + start, end - start);
+    start = end;
+  }
+}
+
+unsigned bcache_flush(struct BlockCache* cache){
+  if (__atomic_load_n(&cache->dirty_count) == 0){
+    return 0;
+  }
+
+  blocking_lock_acquire(&cache->flush_lock);
+  struct Buffer** batch = cache->flush_batch;
+  unsigned written = 0;
+  unsigned next = 0;
+
+  // One pass over the buffer array. Buffers dirtied behind the pass are left
+  // for the next flush, so a steady writer cannot keep this loop going.
+  while (next < cache->buffer_count){
+    unsigned count = 0;
+
+    // the references keep each buffer's block number fixed until brelse()
+    blocking_lock_acquire(&cache->lock);
+    while (next < cache->buffer_count && count < BCACHE_FLUSH_BATCH){
+      struct Buffer* buf = &cache->buffers[next++];
+      if (buf->dirty){
+        bcache_ref_locked(cache, buf);
+        batch[count++] = buf;
       }
     }
+    blocking_lock_release(&cache->lock);
+
+    bcache_write_batch(cache, batch, count);
+    written += count;
+
+    for (unsigned i = 0; i < count; ++i){
+      brelse(cache, batch[i]);
+    }
+  }
+
+  blocking_lock_release(&cache->flush_lock);
+  return written;
+}
+
+void bcache_print_stats(struct BlockCache* cache){
+  int args[8] = {cache->hits, cache->misses, cache->evictions, cache->buffer_count,
+    cache->writebacks, cache->flush_writes, cache->direct_blocks, cache->direct_transfers};
+  say("| Block cache: hits=%d misses=%d evictions=%d buffers=%d writebacks=%d in %d writes"
+    " direct=%d in %d transfers\n", args);
+}
+
+void bcache_destroy(struct BlockCache* cache){
+  assert(cache != NULL, "bcache_destroy: cache is NULL.\n");
+  assert(cache->dirty_count == 0, "bcache_destroy: cache still holds dirty buffers.\n");
+  unsigned per_frame = FRAME_SIZE / cache->block_size;
+  for (unsigned i = 0; i < cache->buffer_count; ++i){
+    struct Buffer* buf = &cache->buffers[i];
+    assert(buf->refcount == 0, "bcache_destroy: buffer is still referenced.\n");
+    gate_destroy(&buf->valid_gate);
+    blocking_lock_destroy(&buf->lock);
+    if (i % per_frame == 0){
+      physmem_free(buf->data);
+    }
+  }
+  vfree(cache->buffers);
+  vfree(cache->buckets);
+  free(cache->flush_batch);
+  physmem_free_order(cache->flush_staging, BCACHE_FLUSH_ORDER);
+  cond_var_destroy(&cache->buffer_freed);
+  blocking_lock_destroy(&cache->flush_lock);
+  blocking_lock_destroy(&cache->lock);
+}
 
-    cache->ages[result] = 0;
-    cache->tags[result] = block_num;
+// string hash mixed with the directory inumber
+static unsigned dcache_hash(unsigned dir, char* name){
+  unsigned hash = dir * 2654435761u;
+  for (char* c = name; *c != 0; ++c){
+    hash = hash * 31 + (unsigned char)*c;
+  }
+  return hash;
+}
+
+static void dcache_lru_remove(struct DentryCache* cache, struct DcacheEntry* entry){
+  if (entry->lru_prev != NULL){
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    cache->lru_head = entry->lru_next;
+  }
+  if (entry->lru_next != NULL){
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    cache->lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void dcache_lru_push_head(struct DentryCache* cache, struct DcacheEntry* entry){
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head != NULL){
+    cache->lru_head->lru_prev = entry;
+  } else {
+    cache->lru_tail = entry;
+  }
+  cache->lru_head = entry;
+}
 
-    unsigned write_size = size >= (cache->block_size - offset) ? (cache->block_size - offset) : size;
-    // Keep the cached copy and the disk write buffer identical, then write the
-    // entire logical block back through to disk.
-    memcpy(cache->block_cache + result * cache->block_size + offset, src, write_size);
-    memcpy(block_buf, cache->block_cache + result * cache->block_size, cache->block_size);
+// find the entry for (dir, name), or NULL. Caller holds cache->lock
+static struct DcacheEntry* dcache_find_locked(struct DentryCache* cache, unsigned dir,
+    char* name, unsigned hash){
+  struct DcacheEntry* entry = cache->buckets[hash % DCACHE_BUCKETS];
+  while (entry != NULL){
+    if (entry->hash == hash && entry->dir == dir && streq(entry->name, name)){
+      return entry;
+    }
+    entry = entry->hash_next;
+  }
+  return NULL;
+}
 
-    // write back to sd
-    int rc = sd_write_blocks(SD_DRIVE_1, block_num * cache->block_size / SD_SECTOR_SIZE_BYTES,
-      cache->block_size / SD_SECTOR_SIZE_BYTES, block_buf);
-    assert(rc == 0, "bcache_set: failed to write filesystem block.\n");
+// unlink an entry from its chain and the LRU list. Caller holds cache->lock
+static void dcache_unlink_locked(struct DentryCache* cache, struct DcacheEntry* entry){
+  struct DcacheEntry** link = &cache->buckets[entry->hash % DCACHE_BUCKETS];
+  while (*link != entry){
+    link = &(*link)->hash_next;
+  }
+  *link = entry->hash_next;
+  dcache_lru_remove(cache, entry);
+  cache->count--;
+}
 
+static void dcache_free_entry(struct DcacheEntry* entry){
+  free(entry->name);
+  free(entry);
+}
+
+void dcache_init(struct DentryCache* cache){
+  for (unsigned i = 0; i < DCACHE_BUCKETS; ++i){
+    cache->buckets[i] = NULL;
+  }
+  cache->lru_head = NULL;
+  cache->lru_tail = NULL;
+  cache->count = 0;
+  cache->hits = 0;
+  cache->negative_hits = 0;
+  cache->misses = 0;
+  blocking_lock_init(&cache->lock);
+}
+
+bool dcache_lookup(struct DentryCache* cache, unsigned dir, char* name, unsigned* inumber){
+  unsigned hash = dcache_hash(dir, name);
+
+  blocking_lock_acquire(&cache->lock);
+  struct DcacheEntry* entry = dcache_find_locked(cache, dir, name, hash);
+  if (entry == NULL){
+    cache->misses++;
     blocking_lock_release(&cache->lock);
+    return false;
+  }
+
+  if (entry->inumber != 0){
+    cache->hits++;
+  } else {
+    cache->negative_hits++;
+  }
+  *inumber = entry->inumber;
+  dcache_lru_remove(cache, entry);
+  dcache_lru_push_head(cache, entry);
+  blocking_lock_release(&cache->lock);
+  return true;
+}
+
+void dcache_set(struct DentryCache* cache, unsigned dir, char* name, unsigned inumber){
+  unsigned hash = dcache_hash(dir, name);
+
+  // allocate before taking the lock; an update of an existing entry frees it again
+  unsigned name_len = strlen(name);
+  struct DcacheEntry* fresh = malloc(sizeof(struct DcacheEntry));
+  fresh->name = malloc(name_len + 1);
+  memcpy(fresh->name, name, name_len + 1);
+  fresh->dir = dir;
+  fresh->inumber = inumber;
+  fresh->hash = hash;
 
-    free(block_buf);
+  struct DcacheEntry* dropped = NULL;
 
+  blocking_lock_acquire(&cache->lock);
+  struct DcacheEntry* entry = dcache_find_locked(cache, dir, name, hash);
+  if (entry != NULL){
+    entry->inumber = inumber;
+    dcache_lru_remove(cache, entry);
+    dcache_lru_push_head(cache, entry);
+    blocking_lock_release(&cache->lock);
+    dcache_free_entry(fresh);
     return;
   }
 
-  // need to read block first so we can do a partial write without overwriting the rest of the block
-  int rc = sd_read_blocks(SD_DRIVE_1, block_num * cache->block_size / SD_SECTOR_SIZE_BYTES,
-    cache->block_size / SD_SECTOR_SIZE_BYTES, block_buf);
-  assert(rc == 0, "bcache_set: failed to read filesystem block before a partial write.\n");
-
-  // Install the freshly-read block into the chosen cache line before patching
-  // the requested byte range, so the cache retains a full coherent block image.
-  for (unsigned i = 0; i < BCACHE_SIZE; ++i){
-    cache->ages[i]++;
-    if (cache->ages[i] == BCACHE_SIZE) result = i;
+  if (cache->count == DCACHE_MAX_ENTRIES){
+    dropped = cache->lru_tail;
+    dcache_unlink_locked(cache, dropped);
   }
-  cache->ages[result] = 0;
-  cache->tags[result] = block_num;
 
-  unsigned write_size = size >= (cache->block_size - offset) ? (cache->block_size - offset) : size;
+  struct DcacheEntry** bucket = &cache->buckets[hash % DCACHE_BUCKETS];
+  fresh->hash_next = *bucket;
+  *bucket = fresh;
+  dcache_lru_push_head(cache, fresh);
+  cache->count++;
+  blocking_lock_release(&cache->lock);
 
-  memcpy(cache->block_cache + result * cache->block_size, block_buf, cache->block_size);  
-  memcpy(cache->block_cache + result * cache->block_size + offset, src, write_size);
-  memcpy(block_buf + offset, src, write_size);
+  if (dropped != NULL){
+    dcache_free_entry(dropped);
+  }
+}
 
-  rc = sd_write_blocks(SD_DRIVE_1, block_num * cache->block_size / SD_SECTOR_SIZE_BYTES,
-    cache->block_size / SD_SECTOR_SIZE_BYTES, block_buf);
-  assert(rc == 0, "bcache_set: failed to write filesystem block.\n");
+void dcache_purge_dir(struct DentryCache* cache, unsigned dir){
+  struct DcacheEntry* purged = NULL;
 
+  blocking_lock_acquire(&cache->lock);
+  for (unsigned i = 0; i < DCACHE_BUCKETS; ++i){
+    struct DcacheEntry* entry = cache->buckets[i];
+    while (entry != NULL){
+      struct DcacheEntry* next = entry->hash_next;
+      if (entry->dir == dir){
+        dcache_unlink_locked(cache, entry);
+        entry->hash_next = purged;
+        purged = entry;
+      }
+      entry = next;
+    }
+  }
   blocking_lock_release(&cache->lock);
 
-  free(block_buf);
+  while (purged != NULL){
+    struct DcacheEntry* next = purged->hash_next;
+    dcache_free_entry(purged);
+    purged = next;
+  }
 }
 
-void bcache_destroy(struct BlockCache* cache){
-  assert(cache != NULL, "bcache_destroy: cache is NULL.\n");
+void dcache_print_stats(struct DentryCache* cache){
+  int args[4] = {cache->hits, cache->negative_hits, cache->misses, cache->count};
+  say("| Dentry cache: hits=%d negative hits=%d misses=%d entries=%d\n", args);
+}
+
+void dcache_destroy(struct DentryCache* cache){
+  struct DcacheEntry* entry = cache->lru_head;
+  while (entry != NULL){
+    struct DcacheEntry* next = entry->lru_next;
+    dcache_free_entry(entry);
+    entry = next;
+  }
+  cache->lru_head = NULL;
+  cache->lru_tail = NULL;
+  cache->count = 0;
   blocking_lock_destroy(&cache->lock);
-  free(cache->block_cache);
 }
 
 void node_init(struct Node* node, struct CachedInode* cached, unsigned parent_inumber, struct Ext2* fs){
@@ -1825,7 +2738,7 @@ struct Node* node_clone(struct Node* node){
     return NULL;
   }
 
-  struct Node* clone = malloc(sizeof(struct Node));
+  struct Node* clone = kmem_cache_alloc(node_cache);
 
   *clone = *node;
 
@@ -1843,7 +2756,7 @@ void node_destroy(struct Node* node){
 void node_free(struct Node* node){
   if (node == NULL || node == &fs.root) return;
   node_destroy(node);
-  free(node);
+  kmem_cache_free(node_cache, node);
 }
 
 unsigned node_size_in_bytes(struct Node* node){
@@ -2065,14 +2978,19 @@ int node_delete(struct Node* dir, char* name){
     // The directory loses both the parent entry and its self-link once delete
     // commits. Reclaim the inode later, after every open wrapper releases it.
     node->cached->inode.links_count = 0;
+    // its "." and ".." entries are never removed one by one, and the inumber
+    // may name a new directory later
+    dcache_purge_dir(&dir->filesystem->dcache, node->cached->inumber);
   } else {
     assert(node->cached->inode.links_count > 0,
       "node_delete: file link count underflowed during delete.\n");
     node->cached->inode.links_count -= 1;
   }
 
+  bool delete_pending = false;
   if (node->cached->inode.links_count == 0){
     node->cached->delete_pending = true;
+    delete_pending = true;
   }
 
   node_sync_inode(node);
@@ -2081,7 +2999,14 @@ int node_delete(struct Node* dir, char* name){
 
   blocking_lock_release(&dir->cached->lock);
 
+  if (delete_pending){
+    // idle cached pages hold inode references; drop them so the final
+    // wrapper release can reclaim the inode
+    page_cache_invalidate_inode(&page_cache, node->cached);
+  }
+
   node_free(node);
+  return 0;
 }
 
 void read_sectors(struct Ext2* fs, unsigned index, char* buffer){
@@ -2102,25 +3027,33 @@ static void read_sectors_or_zero(struct Node* node, unsigned block_num, char* bu
   read_sectors(node->filesystem, block_num, buffer);
 }
 
+// Look up entry `index` of pointer block `block_num` through the block cache
+// without copying the pointer block out.
+static unsigned ext2_read_pointer(struct Ext2* fs, unsigned block_num, unsigned index){
+  struct Buffer* buf = bget(&fs->bcache, block_num);
+  unsigned pointer = ((unsigned*)buf->data)[index];
+  brelse(&fs->bcache, buf);
+  return pointer;
+}
+
 void node_print_dir(struct Node* node){
-  unsigned index = 0;
-  struct DirEntry entry;
-  
-  while (index < node_size_in_bytes(node)) {
-    int cnt = node_read_all(node, index, sizeof(struct DirEntry), (char*)&entry);
-    assert(cnt >= 4, "node_print_dir: failed to read directory entry.\n");
-    assert(entry.rec_len >= 8, "node_print_dir: invalid directory record length.\n");
-  
-    index += entry.rec_len;
-    if (entry.inode != 0) {
+  blocking_lock_acquire(&node->cached->lock);
+
+  struct DirIter it;
+  dir_iter_init(&it, node);
+  struct DirEntry* entry;
+  while ((entry = dir_iter_next(&it)) != NULL) {
+    if (entry->inode != 0) {
       // copy name into buf
-      char* name_buf = malloc(entry.name_len + 1);
-      strncpy(name_buf, (char*)entry.name, entry.name_len);
-      name_buf[entry.name_len] = '\0';
+      char* name_buf = malloc(entry->name_len + 1);
+      strncpy(name_buf, (char*)entry->name, entry->name_len);
+      name_buf[entry->name_len] = '\0';
       printf("***%s\n", &name_buf);
       free(name_buf);
     }
   }
+
+  blocking_lock_release(&node->cached->lock);
 }
 
 void read_direct_block(struct Node* node, unsigned index, char* buffer){
@@ -2129,59 +3062,106 @@ void read_direct_block(struct Node* node, unsigned index, char* buffer){
   read_sectors_or_zero(node, node->cached->inode.block[index], buffer);
 }
 
-void read_indirect_block(struct Node* node, unsigned index, char* buffer){
+// Find the single-indirect leaf that maps logical block `index`, which must be
+// past the direct blocks, and store the first logical block it covers in
+// *first. Returns 0 if the path to the leaf has a hole.
+static unsigned node_find_leaf(struct Node* node, unsigned index, unsigned* first){
   unsigned block_size = ext2_get_block_size(node->filesystem);
   unsigned entries_per_block = block_size / 4;
-  assert(index >= 12, "read_indirect_block: index out of bounds for indirect block.\n");
-  assert(index < 12 + entries_per_block, "read_indirect_block: index out of bounds for indirect block.\n");
+  unsigned single_limit = 12 + entries_per_block;
+  unsigned double_span = entries_per_block * entries_per_block;
+  unsigned double_limit = single_limit + double_span;
+  unsigned* block = node->cached->inode.block;
 
-  // Strip off the 12 direct blocks so the remaining index addresses one entry
-  // inside the single-indirect pointer block.
-  unsigned real_index = index - 12;
+  if (index < single_limit){
+    *first = 12;
+    return block[12];
+  }
 
-  unsigned* direct_pointers = malloc(block_size);
-  if (node->cached->inode.block[12] == 0){
-    memset(buffer, 0, block_size);
-    free(direct_pointers);
-    return;
+  // Split what is left after the shallower tiers into the slots on the path,
+  // as node_add_block() does when it builds the tree.
+  if (index < double_limit){
+    unsigned real_index = index - single_limit;
+    *first = index - real_index % entries_per_block;
+    if (block[13] == 0){
+      return 0;
+    }
+    return ext2_read_pointer(node->filesystem, block[13], real_index / entries_per_block);
   }
 
-  read_sectors(node->filesystem, node->cached->inode.block[12], (char*)direct_pointers);
-  read_sectors_or_zero(node, direct_pointers[real_index], buffer);
-  free(direct_pointers);
+  assert(index < double_limit + double_span * entries_per_block,
+    "node_find_leaf: logical block index exceeds this inode addressing implementation.\n");
+  unsigned real_index = index - double_limit;
+  *first = index - real_index % entries_per_block;
+  if (block[14] == 0){
+    return 0;
+  }
+  unsigned middle = ext2_read_pointer(node->filesystem, block[14], real_index / double_span);
+  if (middle == 0){
+    return 0;
+  }
+  return ext2_read_pointer(node->filesystem, middle, (real_index / entries_per_block) % entries_per_block);
 }
 
-void read_double_indirect_block(struct Node* node, unsigned index, char* buffer){
-  unsigned block_size = ext2_get_block_size(node->filesystem);
-  unsigned entries_per_block = block_size / 4;
-  assert(index >= 12 + entries_per_block, "read_double_indirect_block: index out of bounds for double indirect block.\n");
-  assert(index < 12 + entries_per_block * (1 + entries_per_block), "read_double_indirect_block: index out of bounds for double indirect block.\n");
+// Map logical block `index` to the filesystem block holding it, or 0 for a
+// hole. Past the direct blocks, the answer comes from the inode's block map
+// when it covers `index`; otherwise the leaf that does is copied into it, so
+// the following lookups in the same leaf skip the pointer tree.
+// Caller must hold node->cached->lock
+static unsigned node_map_block(struct Node* node, unsigned index){
+  struct CachedInode* cached = node->cached;
+  assert(cached->lock.is_held, "node_map_block: caller must hold the inode lock.\n");
 
-  // Skip past the direct and single-indirect ranges, then split the remaining
-  // index into the outer indirect slot and the final direct slot.
-  unsigned real_index = index - (12 + entries_per_block);
+  if (index < 12){
+    return cached->inode.block[index];
+  }
 
-  unsigned* indirect_pointers = malloc(block_size);
-  unsigned* direct_pointers = malloc(block_size);
-  if (node->cached->inode.block[13] == 0){
-    memset(buffer, 0, block_size);
-    free(indirect_pointers);
-    free(direct_pointers);
-    return;
+  // unsigned wraparound also rejects indices below block_map_first
+  if (index - cached->block_map_first < cached->block_map_count){
+    return cached->block_map[index - cached->block_map_first];
   }
 
-  read_sectors(node->filesystem, node->cached->inode.block[13], (char*)indirect_pointers);
-  if (indirect_pointers[real_index / entries_per_block] == 0){
-    memset(buffer, 0, block_size);
-    free(indirect_pointers);
-    free(direct_pointers);
-    return;
+  unsigned first;
+  unsigned leaf = node_find_leaf(node, index, &first);
+  if (leaf == 0){
+    return 0;
+  }
+
+  unsigned block_size = ext2_get_block_size(node->filesystem);
+  if (cached->block_map == NULL){
+    cached->block_map = malloc(block_size);
   }
+  bcache_get(&node->filesystem->bcache, leaf, (char*)cached->block_map);
+  cached->block_map_first = first;
+  cached->block_map_count = block_size / 4;
 
-  read_sectors(node->filesystem, indirect_pointers[real_index / entries_per_block], (char*)direct_pointers);
-  read_sectors_or_zero(node, direct_pointers[real_index % entries_per_block], buffer);
-  free(indirect_pointers);
-  free(direct_pointers);
+  return cached->block_map[index - first];
+}
+
+// node_add_block() only ever fills an empty leaf slot, so the rest of the
+// block map stays valid and only the new entry needs updating.
+static void node_block_map_set(struct CachedInode* cached, unsigned index, unsigned block_num){
+  if (index - cached->block_map_first < cached->block_map_count){
+    cached->block_map[index - cached->block_map_first] = block_num;
+  }
+}
+
+void read_indirect_block(struct Node* node, unsigned index, char* buffer){
+  unsigned block_size = ext2_get_block_size(node->filesystem);
+  unsigned entries_per_block = block_size / 4;
+  assert(index >= 12, "read_indirect_block: index out of bounds for indirect block.\n");
+  assert(index < 12 + entries_per_block, "read_indirect_block: index out of bounds for indirect block.\n");
+
+  read_sectors_or_zero(node, node_map_block(node, index), buffer);
+}
+
+void read_double_indirect_block(struct Node* node, unsigned index, char* buffer){
+  unsigned block_size = ext2_get_block_size(node->filesystem);
+  unsigned entries_per_block = block_size / 4;
+  assert(index >= 12 + entries_per_block, "read_double_indirect_block: index out of bounds for double indirect block.\n");
+  assert(index < 12 + entries_per_block * (1 + entries_per_block), "read_double_indirect_block: index out of bounds for double indirect block.\n");
+
+  read_sectors_or_zero(node, node_map_block(node, index), buffer);
 }
 
 void read_triple_indirect_block(struct Node* node, unsigned index, char* buffer){
@@ -2190,45 +3170,27 @@ void read_triple_indirect_block(struct Node* node, unsigned index, char* buffer)
   assert(index >= 12 + entries_per_block * (1 + entries_per_block), "read_triple_indirect_block: index out of bounds for triple indirect block.\n");
   assert(index < 12 + entries_per_block * (1 + entries_per_block * (1 + entries_per_block)), "read_triple_indirect_block: index out of bounds for triple indirect block.\n");
 
-  // Skip the shallower tiers, then decompose the remaining index into
-  // triple-indirect, double-indirect, and final direct offsets.
-  unsigned real_index = index - (12 + entries_per_block * (1 + entries_per_block));
-
-  unsigned* double_indirect_pointers = malloc(block_size);
-  unsigned* indirect_pointers = malloc(block_size);
-  unsigned* direct_pointers = malloc(block_size);
-  if (node->cached->inode.block[14] == 0){
-    memset(buffer, 0, block_size);
-    free(double_indirect_pointers);
-    free(indirect_pointers);
-    free(direct_pointers);
-    return;
-  }
-
-  read_sectors(node->filesystem, node->cached->inode.block[14], (char*)double_indirect_pointers);
-  if (double_indirect_pointers[real_index / (entries_per_block * entries_per_block)] == 0){
-    memset(buffer, 0, block_size);
-    free(double_indirect_pointers);
-    free(indirect_pointers);
-    free(direct_pointers);
-    return;
-  }
+  read_sectors_or_zero(node, node_map_block(node, index), buffer);
+}
 
-  read_sectors(node->filesystem, double_indirect_pointers[real_index / (entries_per_block * entries_per_block)], (char*)indirect_pointers);
-  if (indirect_pointers[(real_index / entries_per_block) % entries_per_block] == 0){
-    memset(buffer, 0, block_size);
-    free(double_indirect_pointers);
-    free(indirect_pointers);
-    free(direct_pointers);
-    return;
+// Count the logical blocks from `first` through `last` that sit at consecutive
+// filesystem blocks starting at `block_num`, the mapping of `first`, up to
+// BCACHE_RUN_MAX.
+// Caller must hold node->cached->lock
+static unsigned node_contiguous_blocks(struct Node* node, unsigned first, unsigned last, unsigned block_num){
+  unsigned run = 1;
+  while (run < BCACHE_RUN_MAX && first + run <= last &&
+      node_map_block(node, first + run) == block_num + run){
+    run++;
   }
+  return run;
+}
 
-  read_sectors(node->filesystem, indirect_pointers[(real_index / entries_per_block) % entries_per_block], (char*)direct_pointers);
-  read_sectors_or_zero(node, direct_pointers[real_index % entries_per_block], buffer);
-  
-  free(double_indirect_pointers);
-  free(indirect_pointers);
-  free(direct_pointers);
+// The SD engine transfers to and from physical addresses, which the kernel
+// image, heap, stacks and frames share with their virtual ones. vmalloc and
+// user memory have to go through the block cache.
+static bool ext2_can_dma(char* buf, unsigned size){
+  return ((unsigned)buf & 3) == 0 && (unsigned)buf + size <= FRAMES_ADDR_END;
 }
 
 // Caller must hold node->cached->lock
@@ -2275,43 +3237,22 @@ void write_indirect_block(struct Node* node, unsigned index, char* buffer, unsig
   assert(index >= 12, "write_indirect_block: index out of bounds for indirect block.\n");
   assert(index < 12 + entries_per_block, "write_indirect_block: index out of bounds for indirect block.\n");
 
-  // Strip off the direct region so the remaining index addresses one entry
-  // inside the single-indirect pointer block.
-  unsigned real_index = index - 12;
-
-  unsigned* direct_pointers = malloc(block_size);
-  assert(node->cached->inode.block[12] != 0,
-    "write_indirect_block: caller must materialize the indirect block before writing.\n");
-  read_sectors(node->filesystem, node->cached->inode.block[12], (char*)direct_pointers);
-  assert(direct_pointers[real_index] != 0,
+  unsigned data_block = node_map_block(node, index);
+  assert(data_block != 0,
     "write_indirect_block: caller must materialize sparse holes before writing.\n");
-  write_sectors(node->filesystem, direct_pointers[real_index], buffer, offset, size);
-  free(direct_pointers);
+  write_sectors(node->filesystem, data_block, buffer, offset, size);
 }
 
 void write_double_indirect_block(struct Node* node, unsigned index, char* buffer, unsigned offset, unsigned size){
   unsigned block_size = ext2_get_block_size(node->filesystem);
   unsigned entries_per_block = block_size / 4;
-  assert(index >= 12 + entries_per_block, "read_double_indirect_block: index out of bounds for double indirect block.\n");
-  assert(index < 12 + entries_per_block * (1 + entries_per_block), "read_double_indirect_block: index out of bounds for double indirect block.\n");
+  assert(index >= 12 + entries_per_block, "write_double_indirect_block: index out of bounds for double indirect block.\n");
+  assert(index < 12 + entries_per_block * (1 + entries_per_block), "write_double_indirect_block: index out of bounds for double indirect block.\n");
 
-  // Skip past the direct and single-indirect ranges, then split the remaining
-  // index into the outer indirect slot and the final direct slot.
-  unsigned real_index = index - (12 + entries_per_block);
-
-  unsigned* indirect_pointers = malloc(block_size);
-  unsigned* direct_pointers = malloc(block_size);
-  assert(node->cached->inode.block[13] != 0,
-    "write_double_indirect_block: caller must materialize the double-indirect root before writing.\n");
-  read_sectors(node->filesystem, node->cached->inode.block[13], (char*)indirect_pointers);
-  assert(indirect_pointers[real_index / entries_per_block] != 0,
-    "write_double_indirect_block: caller must materialize the indirect leaf before writing.\n");
-  read_sectors(node->filesystem, indirect_pointers[real_index / entries_per_block], (char*)direct_pointers);
-  assert(direct_pointers[real_index % entries_per_block] != 0,
+  unsigned data_block = node_map_block(node, index);
+  assert(data_block != 0,
     "write_double_indirect_block: caller must materialize sparse holes before writing.\n");
-  write_sectors(node->filesystem, direct_pointers[real_index % entries_per_block], buffer, offset, size);
-  free(indirect_pointers);
-  free(direct_pointers);
+  write_sectors(node->filesystem, data_block, buffer, offset, size);
 }
 
 void write_triple_indirect_block(struct Node* node, unsigned index, char* buffer, unsigned offset, unsigned size){
@@ -2320,29 +3261,10 @@ void write_triple_indirect_block(struct Node* node, unsigned index, char* buffer
   assert(index >= 12 + entries_per_block * (1 + entries_per_block), "write_triple_indirect_block: index out of bounds for triple indirect block.\n");
   assert(index < 12 + entries_per_block * (1 + entries_per_block * (1 + entries_per_block)), "write_triple_indirect_block: index out of bounds for triple indirect block.\n");
 
-  // Skip the shallower tiers, then decompose the remaining index into
-  // triple-indirect, double-indirect, and final direct offsets.
-  unsigned real_index = index - (12 + entries_per_block * (1 + entries_per_block));
-
-  unsigned* double_indirect_pointers = malloc(block_size);
-  unsigned* indirect_pointers = malloc(block_size);
-  unsigned* direct_pointers = malloc(block_size);
-  assert(node->cached->inode.block[14] != 0,
-    "write_triple_indirect_block: caller must materialize the triple-indirect root before writing.\n");
-  read_sectors(node->filesystem, node->cached->inode.block[14], (char*)double_indirect_pointers);
-  assert(double_indirect_pointers[real_index / (entries_per_block * entries_per_block)] != 0,
-    "write_triple_indirect_block: caller must materialize the double-indirect leaf before writing.\n");
-  read_sectors(node->filesystem, double_indirect_pointers[real_index / (entries_per_block * entries_per_block)], (char*)indirect_pointers);
-  assert(indirect_pointers[(real_index / entries_per_block) % entries_per_block] != 0,
-    "write_triple_indirect_block: caller must materialize the indirect leaf before writing.\n");
-  read_sectors(node->filesystem, indirect_pointers[(real_index / entries_per_block) % entries_per_block], (char*)direct_pointers);
-  assert(direct_pointers[real_index % entries_per_block] != 0,
+  unsigned data_block = node_map_block(node, index);
+  assert(data_block != 0,
     "write_triple_indirect_block: caller must materialize sparse holes before writing.\n");
-  write_sectors(node->filesystem, direct_pointers[real_index % entries_per_block], buffer, offset, size);
-  
-  free(double_indirect_pointers);
-  free(indirect_pointers);
-  free(direct_pointers);
+  write_sectors(node->filesystem, data_block, buffer, offset, size);
 }
 
 // Caller must hold node->cached->lock
@@ -2391,18 +3313,37 @@ static unsigned node_read_all_locked(struct Node* node, unsigned offset, unsigne
   unsigned end_block = (offset + size - 1) / block_size;
   unsigned bytes_copied = 0;
 
-  // Reads may start and end mid-block, so copy block-by-block and clamp the
-  // first and last block to just the requested byte range.
-  for (unsigned i = start_block; i <= end_block; ++i){
-    char* block_buf = malloc(block_size);
-    node_read_block_locked(node, i, block_buf);
-
+  // Reads may start and end mid-block, so clamp the first and last block to
+  // just the requested byte range. Whole blocks that sit next to each other on
+  // disk are read as one run.
+  unsigned i = start_block;
+  while (i <= end_block){
     unsigned block_offset = (i == start_block) ? offset % block_size : 0;
     unsigned copy_size = (i == end_block) ? ((offset + size - 1) % block_size) - block_offset + 1 : block_size - block_offset;
+    unsigned block_num = node_map_block(node, i);
+    unsigned run = 1;
+
+    if (copy_size == block_size && block_num != 0){
+      unsigned last_whole = (offset + size) % block_size == 0 ? end_block : end_block - 1;
+      run = node_contiguous_blocks(node, i, last_whole, block_num);
+    }
+
+    if (run >= EXT2_DIRECT_MIN_BLOCKS && ext2_can_dma(dest + bytes_copied, run * block_size)){
+      bcache_read_run(&node->filesystem->bcache, block_num, run, dest + bytes_copied);
+      copy_size = run * block_size;
+    } else if (block_num == 0){
+      // sparse hole
+      run = 1;
+      memset(dest + bytes_copied, 0, copy_size);
+    } else {
+      run = 1;
+      struct Buffer* buf = bget(&node->filesystem->bcache, block_num);
+      memcpy(dest + bytes_copied, buf->data + block_offset, copy_size);
+      brelse(&node->filesystem->bcache, buf);
+    }
 
-    memcpy(dest + bytes_copied, block_buf + block_offset, copy_size);
     bytes_copied += copy_size;
-    free(block_buf);
+    i += run;
   }
 
   return bytes_copied;
@@ -2418,19 +3359,15 @@ unsigned node_read_all(struct Node* node, unsigned offset, unsigned size, char*
   return cnt;
 }
 
-unsigned node_write_all(struct Node* node, unsigned offset, unsigned size, char* src){
-  if (size == 0) return 0;
-
+// write `size` bytes at `offset`, growing the file as needed. Caller holds
+// the inode lock, which serializes the full write path for one inode so block
+// growth, inode writeback, and data writes observe one consistent per-file state.
+static void node_write_all_locked(struct Node* node, unsigned offset, unsigned size, char* src){
   unsigned block_size = ext2_get_block_size(node->filesystem);
   unsigned start_block = offset / block_size;
   unsigned end_block = (offset + size - 1) / block_size;
   unsigned bytes_copied = 0;
 
-  // Serialize the full write path for one inode so block growth, inode writeback,
-  // and data writes observe one consistent per-file state without re-entering
-  // inode_lock through icache_set().
-  blocking_lock_acquire(&node->cached->lock);
-
   assert(node_is_file(node) || node_is_symlink(node), "node_write_all: can only write to regular files or symlinks.\n");
 
   // Host-built ext2 images may encode a trailing run of all-zero file blocks as
@@ -2448,13 +3385,58 @@ unsigned node_write_all(struct Node* node, unsigned offset, unsigned size, char*
 
   node_sync_inode(node);
 
-  for (unsigned i = start_block; i <= end_block; ++i){
+  // Partial blocks and lone whole blocks stay in the block cache for the
+  // flusher. Longer runs of whole blocks that are contiguous on disk go out
+  // straight from src with one transfer.
+  unsigned i = start_block;
+  while (i <= end_block){
     unsigned block_offset = (i == start_block) ? offset % block_size : 0;
     unsigned copy_size = (i == end_block) ? ((offset + size - 1) % block_size) - block_offset + 1 : block_size - block_offset;
-    node_write_block_locked(node, i, src + bytes_copied, block_offset, copy_size);
+    unsigned run = 1;
+
+    if (copy_size == block_size){
+      unsigned last_whole = (offset + size) % block_size == 0 ? end_block : end_block - 1;
+      unsigned block_num = node_map_block(node, i);
+      run = node_contiguous_blocks(node, i, last_whole, block_num);
+      if (run >= EXT2_DIRECT_MIN_BLOCKS && ext2_can_dma(src + bytes_copied, run * block_size)){
+        bcache_write_run(&node->filesystem->bcache, block_num, run, src + bytes_copied);
+        copy_size = run * block_size;
+      } else {
+        run = 1;
+      }
+    }
+
+    if (run == 1){
+      node_write_block_locked(node, i, src + bytes_copied, block_offset, copy_size);
+    }
 
     bytes_copied += copy_size;
+    i += run;
   }
+}
+
+unsigned node_write_all(struct Node* node, unsigned offset, unsigned size, char* src){
+  if (size == 0) return 0;
+
+  // Pages retained after their last release are found again by the next
+  // acquire without a read, so they are patched too. The cache lock is taken
+  // before the inode lock, as page-cache writeback does, and held until the
+  // pages are patched, so overlapping writers reach the disk and the cache in
+  // the same order.
+  page_cache_write_begin(&page_cache, node, offset, size);
+  blocking_lock_acquire(&node->cached->lock);
+  node_write_all_locked(node, offset, size, src);
+  page_cache_write_end(&page_cache, node, offset, size, src);
+  blocking_lock_release(&node->cached->lock);
+
+  return size;
+}
+
+unsigned node_write_back(struct Node* node, unsigned offset, unsigned size, char* src){
+  if (size == 0) return 0;
+
+  blocking_lock_acquire(&node->cached->lock);
+  node_write_all_locked(node, offset, size, src);
   blocking_lock_release(&node->cached->lock);
 
   return size;
@@ -2527,17 +3509,12 @@ unsigned node_entry_count(struct Node* node){
 
   blocking_lock_acquire(&node->cached->lock);
 
-  // get first directory entry
-  unsigned index = 0;
-  struct DirEntry entry;
   unsigned count = 0;
-
-  // traverse the linked list
-  while (index < node_size_in_bytes(node)){
-    node_read_all_locked(node, index, sizeof(struct DirEntry), (char*)&entry);
-    assert(entry.rec_len >= 8, "node_entry_count: invalid directory record length.\n");
-    index += entry.rec_len;
-    if (entry.inode != 0) count++;
+  struct DirIter it;
+  dir_iter_init(&it, node);
+  struct DirEntry* entry;
+  while ((entry = dir_iter_next(&it)) != NULL){
+    if (entry->inode != 0) count++;
   }
 
   blocking_lock_release(&node->cached->lock);
@@ -2547,8 +3524,8 @@ unsigned node_entry_count(struct Node* node){
 
 // Writes a linux_dirent structure from a DirEntry into the given buffer.
 // Returns number of bytes written.
-int write_dirent(struct Ext2* fs, struct DirEntry entry, char* buffer_start, unsigned remaining_size) {
-  unsigned reclen = sizeof(struct linux_dirent) + entry.name_len + 1; // +1 for d_type.
+int write_dirent(struct Ext2* fs, struct DirEntry* entry, char* buffer_start, unsigned remaining_size) {
+  unsigned reclen = sizeof(struct linux_dirent) + entry->name_len + 1; // +1 for d_type.
 
   // Align to 4 bytes.
   reclen = (reclen + 3) & ~3;
@@ -2557,14 +3534,14 @@ int write_dirent(struct Ext2* fs, struct DirEntry entry, char* buffer_start, uns
   }
 
   struct linux_dirent* dirent = (struct linux_dirent*) buffer_start;
-  dirent->d_ino = entry.inode;
+  dirent->d_ino = entry->inode;
   dirent->d_off = 0; // Unused.
   dirent->d_reclen = reclen;
-  memcpy(&dirent->d_name, entry.name, entry.name_len);
-  *(&dirent->d_name + entry.name_len) = 0; // Null-terminate name.
+  memcpy(&dirent->d_name, entry->name, entry->name_len);
+  *(&dirent->d_name + entry->name_len) = 0; // Null-terminate name.
 
   // d_type.
-  struct CachedInode* cached_inode = icache_get(&fs->icache, entry.inode);
+  struct CachedInode* cached_inode = icache_get(&fs->icache, entry->inode);
   char type = EXT2_DT_UNKNOWN;
   if (cached_inode != NULL) {
     unsigned short mode = cached_inode->inode.mode;
@@ -2605,22 +3582,17 @@ int node_getdents(struct Node* dir, unsigned offset, char* buffer, unsigned buff
 
   blocking_lock_acquire(&dir->cached->lock);
 
-  unsigned index = 0;
-  struct DirEntry entry;
-
   unsigned current_offset = 0;
   unsigned total_bytes_read = 0;
   char* buffer_pointer = buffer;
-  
-  while (index < node_size_in_bytes(dir)) {
-    int cnt = node_read_all_locked(dir, index, sizeof(struct DirEntry), (char*) &entry);
-    assert(cnt >= 4, "node_getdents: failed to read directory entry.\n");
-    assert(entry.rec_len >= 8, "node_getdents: invalid directory record length.\n");
-  
-    index += entry.rec_len;
-    if (entry.inode == 0 || current_offset + entry.rec_len <= offset) {
+
+  struct DirIter it;
+  dir_iter_init(&it, dir);
+  struct DirEntry* entry;
+  while ((entry = dir_iter_next(&it)) != NULL) {
+    if (entry->inode == 0 || current_offset + entry->rec_len <= offset) {
       // Empty entry or not at desired offset yet.
-      current_offset += entry.rec_len;
+      current_offset += entry->rec_len;
       continue;
     }
 
@@ -2628,13 +3600,14 @@ int node_getdents(struct Node* dir, unsigned offset, char* buffer, unsigned buff
     int bytes_written = write_dirent(dir->filesystem, entry, buffer_pointer, buffer_size - total_bytes_read);
     total_bytes_read += bytes_written;
     buffer_pointer += bytes_written;
-    current_offset += entry.rec_len;
+    current_offset += entry->rec_len;
 
     if (bytes_written == 0) {
       // Buffer full.
       break;
     }
   }
+  dir_iter_end(&it);
   blocking_lock_release(&dir->cached->lock);
   *new_offset = current_offset;
   return total_bytes_read;
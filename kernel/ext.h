@@ -8,13 +8,71 @@
 #include "hashmap.h"
 #include "blocking_lock.h"
 #include "gate.h"
-
-#define BCACHE_SIZE 32
+#include "cond_var.h"
+
+// The block cache gets 1/BCACHE_RAM_FRACTION of physical memory for block
+// data, but never fewer than BCACHE_MIN_BLOCKS buffers.
+#define BCACHE_RAM_FRACTION 64
+#define BCACHE_MIN_BLOCKS 32
+
+// A flush collects up to BCACHE_FLUSH_BATCH dirty buffers at a time, sorts
+// them by block number, and writes each run of consecutive blocks with one SD
+// transfer through a staging area of order BCACHE_FLUSH_ORDER.
+#define BCACHE_FLUSH_BATCH 64
+#define BCACHE_FLUSH_ORDER 3
+
+// node_read_all() and node_write_all() move runs of at least
+// EXT2_DIRECT_MIN_BLOCKS whole blocks that are contiguous on disk straight
+// between the caller's buffer and the disk, BCACHE_RUN_MAX blocks at a time.
+// Shorter pieces go through the block cache.
+#define EXT2_DIRECT_MIN_BLOCKS 2
+#define BCACHE_RUN_MAX 64
+
+// A miss looks at most this many buffers up from the cold end of the LRU list
+// for a clean one. If all of them are dirty, it writes them back itself as one
+// sorted batch and leaves them at the cold end.
+#define BCACHE_DIRTY_SCAN 16
+
+// The flusher thread writes dirty buffers and allocator metadata back this
+// many jiffies after they were first dirtied.
+#define EXT2_FLUSH_JIFFIES 100
+
+// The directory entry cache hashes (directory inumber, name) pairs into
+// DCACHE_BUCKETS chains and holds at most DCACHE_MAX_ENTRIES of them,
+// dropping the least recently used one to make room.
+#define DCACHE_BUCKETS 512
+#define DCACHE_MAX_ENTRIES 1024
+
+// Directories of at least this many blocks get an in-memory name index and
+// free-space map on their first scan. Smaller ones are scanned in place.
+#define EXT2_DIR_INDEX_MIN_BLOCKS 4
 
 #define SD_SECTOR_SIZE_BYTES 512
 
 struct Ext2;
 
+// one live record of an indexed directory
+struct DirIndexEntry {
+  unsigned hash;
+  unsigned offset; // byte offset of the record in the directory
+  unsigned inumber;
+  unsigned name_len;
+  char* name;
+  struct DirIndexEntry* next;
+};
+
+// In-memory index of a large directory: every live name hashed to its record,
+// and for every block the largest new record it could still take. Built by
+// the first scan that needs it and kept current by each entry add and remove.
+struct DirIndex {
+  struct DirIndexEntry** buckets;
+  unsigned bucket_mask; // bucket count is a power of two
+  unsigned entries;
+  unsigned* free_space; // bytes per logical block, see dir_block_free_space()
+  unsigned block_count;
+  unsigned block_capacity;
+};
+
 struct CachedInode {
   unsigned inumber;
   struct Inode inode;
@@ -25,12 +83,20 @@ struct CachedInode {
   // final wrapper releases it. That prevents inode-number reuse and block
   // reclamation from racing with still-live `struct Node*` users.
   bool delete_pending;
+  // Copy of the single-indirect leaf behind the last lookup past the direct
+  // blocks: block_map[i] maps logical block block_map_first + i. Empty while
+  // block_map_count is 0. Changes under `lock`.
+  unsigned* block_map;
+  unsigned block_map_first;
+  unsigned block_map_count;
+  // name index of a large directory, or NULL. Changes under `lock`.
+  struct DirIndex* dir_index;
   // Serializes inode size, block-tree, link-count, and delete-pending updates.
   struct BlockingLock lock;
   struct Gate valid_gate; // threads waiting for valid == true
 };
 
-// A simple write-through cache for inodes
+// A simple cache for inodes; updates are written through to the block cache
 // The cache entries are reference-counted so they can be shared across multiple nodes 
 // and safely released when no longer in use
 struct InodeCache {
@@ -39,14 +105,75 @@ struct InodeCache {
   struct BlockingLock lock;
 };
 
-// small write-through cache for ext2 logical blocks
+// One cached ext2 logical block. A reference from bget() keeps the buffer from
+// being reused, so `data` can be read in place until the matching brelse().
+struct Buffer {
+  unsigned block_num; // cached logical block number, or UINT_MAX when unused
+  unsigned refcount; // outstanding bget() references
+  bool valid; // false while the first read of block_num is in flight
+  bool dirty; // data is newer than the disk copy; changes under `lock`
+  char* data; // block_size bytes inside a physical frame, so SD IO can use it directly
+  struct Buffer* hash_next; // next buffer in the same hash bucket
+  // Unreferenced buffers sit on the LRU list, most recently released first.
+  // Referenced buffers are off the list and can never be picked for reuse.
+  struct Buffer* lru_prev;
+  struct Buffer* lru_next;
+  struct BlockingLock lock; // serializes updates with their disk writes
+  struct Gate valid_gate; // threads waiting for valid == true
+};
+
+// Write-back cache for ext2 logical blocks, hashed by block number
 struct BlockCache {
   struct Ext2* fs;
-  unsigned tags[BCACHE_SIZE]; // cached logical block numbers, or UINT_MAX when empty
-  unsigned char ages[BCACHE_SIZE]; // pseudo-LRU ages; 0 is most recently used
-  char* block_cache;
-  struct BlockingLock lock;
   unsigned block_size;
+  unsigned buffer_count;
+  struct Buffer* buffers;
+  struct Buffer** buckets;
+  unsigned bucket_mask; // bucket count is a power of two
+  struct Buffer* lru_head; // most recently released
+  struct Buffer* lru_tail; // next buffer to reuse
+  struct BlockingLock lock; // protects the hash chains, LRU list and refcounts
+  struct CondVar buffer_freed; // misses waiting for an unreferenced buffer
+  unsigned freed_waiters;
+  int dirty_count;
+  // one flush at a time owns the batch array and the staging area
+  struct BlockingLock flush_lock;
+  struct Buffer** flush_batch;
+  char* flush_staging;
+  int hits;
+  int misses;
+  int evictions;
+  int writebacks; // blocks written back
+  int flush_writes; // SD transfers issued for them
+  int direct_blocks; // blocks moved by bcache_read_run() and bcache_write_run()
+  int direct_transfers;
+};
+
+// One cached name lookup. `inumber` is 0 for a negative entry, which records
+// that `dir` has no live entry called `name`.
+struct DcacheEntry {
+  unsigned dir;
+  unsigned inumber;
+  unsigned hash;
+  char* name;
+  struct DcacheEntry* hash_next;
+  struct DcacheEntry* lru_prev;
+  struct DcacheEntry* lru_next;
+};
+
+// Name lookups shared by every path walk. An entry for (dir, name) changes
+// only while the directory's inode lock is held, by a scan of the directory
+// or by the entry update that makes the old answer stale, so an entry found
+// under that lock always agrees with the directory blocks.
+struct DentryCache {
+  struct DcacheEntry* buckets[DCACHE_BUCKETS];
+  struct DcacheEntry* lru_head; // most recently used
+  struct DcacheEntry* lru_tail; // next entry to drop
+  unsigned count;
+  struct BlockingLock lock; // protects the chains, the LRU list and the counters
+  int hits;
+  int negative_hits;
+  int misses;
 };
 
 // one wrapper around a cached inode plus traversal context
@@ -67,6 +194,7 @@ struct Ext2 {
   struct Superblock superblock;
   struct InodeCache icache;
   struct BlockCache bcache;
+  struct DentryCache dcache;
 
   unsigned num_block_groups;
 
@@ -79,8 +207,19 @@ struct Ext2 {
 
   struct Node root;
 
-  struct BlockingLock metadata_lock; // protects writes to BGD table, superblock, and bitmaps
-  struct BlockingLock inode_lock; // protects inode table
+  struct BlockingLock metadata_lock; // protects the BGD table, superblock, bitmaps and their dirty flags
+
+  // Allocator updates stay in memory until the next flush. The superblock and
+  // BGD table always change together, so they share one flag.
+  bool metadata_dirty;
+  char* inode_bitmap_dirty; // one flag per block group
+  char* block_bitmap_dirty;
+
+  // at most one flusher thread runs at a time, and only while something is dirty
+  struct BlockingLock flusher_lock;
+  bool flusher_running;
+  bool flusher_enabled;
+  bool flush_pending; // dirtied since the flusher last started a pass
 
   bool initialized;
 };
@@ -101,6 +240,14 @@ void ext2_destroy(struct Ext2* fs);
 // object itself. Callers must not use this for stack or global `struct Ext2`.
 void ext2_free(struct Ext2* fs);
 
+// Write every dirty block-cache buffer and all dirty allocator metadata back
+// to disk. Blocks until the writes are done.
+void ext2_sync(struct Ext2* fs);
+
+// Stop starting flusher threads. Called once at shutdown, when no flusher is
+// running; anything dirtied afterwards is written by `ext2_destroy(...)`.
+void ext2_flusher_stop(struct Ext2* fs);
+
 // Returns the ext2 logical block size decoded from the loaded superblock.
 // Valid only after `ext2_init(...)`.
 unsigned ext2_get_block_size(struct Ext2* fs);
@@ -130,8 +277,8 @@ struct CachedInode* icache_get(struct InodeCache* cache, unsigned inumber);
 // Inserts a newly created inode into the cache
 void icache_insert(struct InodeCache* cache, struct CachedInode* cached);
 
-// Writes the inode data in `inode` back to disk
-// Note: cache is write-through
+// Copies the inode data in `inode` into its inode-table block in the block
+// cache, which writes it back to disk on the next flush
 void icache_set(struct InodeCache* cache, struct CachedInode* inode);
 
 // decrement refcount, free if it hits 0
@@ -145,18 +292,73 @@ void icache_destroy(struct InodeCache* cache);
 void icache_free(struct InodeCache* cache);
 
 
-// Internal block-cache helpers. The block cache is write-through and keyed by
-// ext2 logical block number.
+// Internal block-cache helpers. The block cache is write-back and keyed by
+// ext2 logical block number. Dirty buffers reach the disk from the flusher
+// thread, ext2_sync(), or a miss that has to reuse them.
 void bcache_init(struct BlockCache* cache, unsigned block_size);
 
+// Return a referenced buffer holding `block_num`, reading it from disk on a
+// miss. The data stays valid until the caller passes the buffer to brelse().
+// Blocks while every buffer is referenced.
+struct Buffer* bget(struct BlockCache* cache, unsigned block_num);
+
+// drop a reference taken by bget()
+void brelse(struct BlockCache* cache, struct Buffer* buf);
+
+// Mark a referenced buffer dirty after the caller changed its data in place,
+// leaving the disk write to the flusher. The caller must hold the lock of the
+// inode that owns the block, so nobody else is updating it at the same time.
+void bdwrite(struct BlockCache* cache, struct Buffer* buf);
+
 // read one cached logical block into dest
 void bcache_get(struct BlockCache* cache, unsigned block_num, char* dest);
 
-// write one logical block range through the cache and out to disk
+// Read `count` consecutive blocks into dest, which the SD engine must be able
+// to reach. Cached blocks are copied from their buffers, since they may be
+// newer than the disk, and the rest are read with one transfer per gap.
+// Nothing new is cached. The caller must hold the lock of the inode that owns
+// the blocks.
+void bcache_read_run(struct BlockCache* cache, unsigned first_block, unsigned count, char* dest);
+
+// Write `count` consecutive blocks from src with one SD transfer, updating
+// any cached copies and marking them clean. The caller must hold the lock of
+// the inode that owns the blocks.
+void bcache_write_run(struct BlockCache* cache, unsigned first_block, unsigned count, char* src);
+
+// write one logical block range into the cache and mark the block dirty
 void bcache_set(struct BlockCache* cache, unsigned block_num, char* src, unsigned offset, unsigned size);
 
+// Write every dirty buffer back, sorted by block number, with one SD transfer
+// per run of consecutive blocks. Returns the number of blocks written.
+unsigned bcache_flush(struct BlockCache* cache);
+
+// print hit, miss, eviction and writeback counters
+void bcache_print_stats(struct BlockCache* cache);
+
 void bcache_destroy(struct BlockCache* cache);
 
+
+// Internal directory-entry-cache helpers. The cache maps (directory inumber,
+// name) to an inumber; lookups and updates for one directory must be made
+// under that directory's inode lock.
+void dcache_init(struct DentryCache* cache);
+
+// Look `name` up in directory `dir`. Returns false if the pair is not cached.
+// Otherwise stores the cached inumber, or 0 for a cached miss, in *inumber.
+bool dcache_lookup(struct DentryCache* cache, unsigned dir, char* name, unsigned* inumber);
+
+// Record that `name` in directory `dir` now refers to `inumber`, or to
+// nothing when `inumber` is 0, replacing any older entry for the pair.
+void dcache_set(struct DentryCache* cache, unsigned dir, char* name, unsigned inumber);
+
+// Drop every entry cached for directory `dir`, once it has been unlinked.
+void dcache_purge_dir(struct DentryCache* cache, unsigned dir);
+
+// print hit, negative-hit and miss counters
+void dcache_print_stats(struct DentryCache* cache);
+
+void dcache_destroy(struct DentryCache* cache);
+
 // Initializes one wrapper around a shared cached inode. Callers may create
 // multiple wrappers for one inode; ownership of the cached inode remains shared
 // through the inode cache reference count.
@@ -193,9 +395,14 @@ void node_write_block(struct Node* node, unsigned block_num, char* src, unsigned
 
 // Writes `size` bytes starting at `offset` and grows the inode if needed.
 // Supported only for regular files and symlinks. The returned count matches the
-// requested write size on success.
+// requested write size on success. Pages of the range already in the page
+// cache, idle or mapped, are updated to match.
 unsigned node_write_all(struct Node* node, unsigned offset, unsigned size, char* src);
 
+// node_write_all() without the page cache update, for the page cache's own
+// writeback, which runs with the cache lock held and writes the cached bytes
+unsigned node_write_back(struct Node* node, unsigned offset, unsigned size, char* src);
+
 // Shrinks a regular file to `target_size` bytes and writes the smaller inode
 // size back to disk. does not reclaim any blocks or clear truncated bytes.
 bool node_shrink(struct Node* node, unsigned target_size);
@@ -1,7 +1,17 @@
 #include "hashmap.h"
 #include "heap.h"
+#include "debug.h"
+
+// typed cache for the entries of every HashMap
+static struct KmemCache* entry_cache = NULL;
+
+void hash_map_global_init(void){
+  entry_cache = kmem_cache_create("hash_entry", sizeof(struct HashEntry), 4, NULL);
+}
 
 void hash_map_init(struct HashMap* hmap, unsigned num_buckets){
+  assert(entry_cache != NULL, "hash_map_init: hash_map_global_init() has not run.\n");
+
   struct HashEntry** arr = malloc(num_buckets * sizeof(struct HashEntry*));
 
   for (int i = 0; i < num_buckets; ++i){
@@ -14,7 +24,7 @@ void hash_map_init(struct HashMap* hmap, unsigned num_buckets){
 
 // allocate one detached bucket-chain entry
 static struct HashEntry* create_hash_entry(unsigned key, void* value){
-  struct HashEntry* entry = malloc(sizeof(struct HashEntry));
+  struct HashEntry* entry = kmem_cache_alloc(entry_cache);
 
   entry->key = key;
   entry->value = value;
@@ -131,7 +141,7 @@ static void* hash_entry_remove(struct HashEntry** head, unsigned key){
     if (entry->key == key){
       void* value = entry->value;
       *head = entry->next;
-      free(entry);
+      kmem_cache_free(entry_cache, entry);
       return value;
     }
 
@@ -155,7 +165,7 @@ void* hash_map_remove(struct HashMap* hmap, unsigned key){
 static void hash_entry_free(struct HashEntry* entry){
   while (entry != NULL){
     struct HashEntry* next = entry->next;
-    free(entry);
+    kmem_cache_free(entry_cache, entry);
     entry = next;
   }
 }
@@ -16,6 +16,10 @@ struct HashMap {
   struct HashEntry** arr;
 };
 
+// create the typed cache shared by every hash map's entries. Called once by
+// core 0 during boot, before any hash map is initialized
+void hash_map_global_init(void);
+
 // initialize a hash map with the given number of buckets
 void hash_map_init(struct HashMap* hmap, unsigned num_buckets);
 
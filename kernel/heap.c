@@ -7,13 +7,19 @@
 #include "per_core.h"
 #include "threads.h"
 #include "print.h"
+#include "machine.h"
 
-#define NUM_OBJECT_SIZES 9
+#define NUM_OBJECT_SIZES 17
 #define HEAP_LARGE_ALLOC_NONE 0xFF // byte sentinel; live orders are 0..PHYS_FRAME_MAX_ORDER
-unsigned OBJECT_SIZES[NUM_OBJECT_SIZES] = {4, 8, 16, 32, 64, 128, 256, 512, 1024};
+#define HEAP_SLAB_TAIL_FRAME 0x80 // plus frames back to the slab head, see below
+unsigned OBJECT_SIZES[NUM_OBJECT_SIZES] = {4, 8, 16, 32, 48, 64, 96, 128, 192, 256,
+  384, 512, 768, 1024, 1536, 2048, 3072};
 struct SlabCache slab_caches[NUM_OBJECT_SIZES];
 static bool heap_sync_initialized = false;
 
+// every typed cache made by kmem_cache_create(), newest first
+static struct KmemCache* kmem_caches = NULL;
+
 /*
  * Large allocation side table.
  *
@@ -28,14 +34,26 @@ static bool heap_sync_initialized = false;
  * - A non-NONE entry is present only at the first frame of an allocation.
  * - Live order values fit in one byte because PHYS_FRAME_MAX_ORDER is 14.
  * - Large allocations must be freed with the exact pointer returned by malloc().
+ *
+ * The same table marks every frame after the first of a multi-page slab with
+ * HEAP_SLAB_TAIL_FRAME + (frames back to the slab head), so free() can find
+ * the Slab header of an object that does not share a frame with it, and does
+ * not mistake a frame-aligned slab object for a large allocation.
  */
 static unsigned char large_allocation_orders[PHYS_FRAME_COUNT];
 static struct BlockingLock large_allocation_lock;
 
+// large-allocation usage, reported by heap_print_stats()
+static unsigned large_allocs = 0;
+static unsigned large_requested_bytes = 0;
+static unsigned large_allocated_bytes = 0;
+
 #ifdef HEAP_DEBUG
 unsigned n_malloc = 0;
 unsigned n_free = 0;
 unsigned n_leak = 0;
+unsigned n_slab_locks = 0;
+unsigned n_depot_locks = 0;
 #endif
 
 static bool heap_is_frame_aligned_phys_addr(unsigned addr) {
@@ -76,9 +94,17 @@ static void* large_alloc(unsigned size, bool leaked) {
   void* page = leaked ? physmem_leak_order(order) : physmem_alloc_order(order);
 
   large_allocation_mark(page, order);
+
+  __atomic_fetch_add((int*)&large_allocs, 1);
+  __atomic_fetch_add((int*)&large_requested_bytes, size);
+  __atomic_fetch_add((int*)&large_allocated_bytes, FRAME_SIZE << order);
   return page;
 }
 
+static bool is_slab_tail_frame(unsigned entry) {
+  return entry != HEAP_LARGE_ALLOC_NONE && entry >= HEAP_SLAB_TAIL_FRAME;
+}
+
 static bool large_free_if_tracked(void* obj) {
   unsigned addr = (unsigned)obj;
   if (!heap_is_frame_aligned_phys_addr(addr)) {
@@ -90,6 +116,11 @@ static bool large_free_if_tracked(void* obj) {
   if (heap_sync_initialized) blocking_lock_acquire(&large_allocation_lock);
 
   unsigned order = large_allocation_orders[frame_index];
+  if (is_slab_tail_frame(order)) {
+    // an object of a multi-page slab that happens to start on a frame
+    if (heap_sync_initialized) blocking_lock_release(&large_allocation_lock);
+    return false;
+  }
   if (order == HEAP_LARGE_ALLOC_NONE) {
     if (heap_sync_initialized) blocking_lock_release(&large_allocation_lock);
     int args[1] = { (int)obj };
@@ -106,31 +137,69 @@ static bool large_free_if_tracked(void* obj) {
   return true;
 }
 
+// Lay out the slabs of one size class: the smallest slab order, up to
+// HEAP_MAX_SLAB_ORDER, whose unused tail is at most 1/HEAP_SLAB_WASTE_DIVISOR
+// of the slab. A 1536-byte class wastes 2 KiB of every 4 KiB frame but only
+// 448 bytes of an 8 KiB slab.
+static void size_class_layout(struct SlabCache* cache, unsigned size) {
+  // objects keep the alignment of the largest power of two dividing their
+  // size, capped so large classes do not reserve a whole object for metadata
+  unsigned align = size & (~size + 1);
+  if (align > HEAP_MAX_OBJECT_ALIGN) {
+    align = HEAP_MAX_OBJECT_ALIGN;
+  }
+
+  int order = 0;
+  while (true) {
+    unsigned slab_bytes = FRAME_SIZE << order;
+    unsigned metadata = sizeof(struct Slab);
+    #ifdef HEAP_DEBUG
+    // replace the bitmap placeholder with one bit per object that could fit
+    metadata = metadata - 4 + ((slab_bytes - (sizeof(struct Slab) - 4)) / size + 7) / 8;
+    #endif
+    unsigned first_object = (metadata + align - 1) & ~(align - 1);
+    unsigned objects = (slab_bytes - first_object) / size;
+    unsigned unused = slab_bytes - first_object - objects * size;
+
+    cache->first_object_offset = first_object;
+    cache->objects_per_slab = objects;
+    cache->slab_order = order;
+
+    if (order == HEAP_MAX_SLAB_ORDER ||
+        (objects >= 2 && unused <= slab_bytes / HEAP_SLAB_WASTE_DIVISOR)) {
+      break;
+    }
+    order++;
+  }
+}
+
 void heap_init(){
   heap_large_alloc_init(large_allocation_orders,
     PHYS_FRAME_COUNT, HEAP_LARGE_ALLOC_NONE);
 
   for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
-    unsigned slab_size = sizeof(struct Slab);
-    #ifdef HEAP_DEBUG
-    // remove bitmap from size, we calculate the real size here
-    slab_size -= 4;
-
-    // add in bitmap size
-    slab_size += (FRAME_SIZE - (sizeof(struct Slab) - 4) + 8 * OBJECT_SIZES[i]) / (8 * OBJECT_SIZES[i] + 1);
-    #endif
-    unsigned metadata_objects = (slab_size + OBJECT_SIZES[i] - 1) / OBJECT_SIZES[i]; // Round up to nearest object size
-    slab_caches[i].objects_per_slab = (FRAME_SIZE / OBJECT_SIZES[i]) - metadata_objects;
+    slab_caches[i].object_size = OBJECT_SIZES[i];
+    slab_caches[i].link_offset = 0;
+    slab_caches[i].ctor = NULL;
+    size_class_layout(&slab_caches[i], OBJECT_SIZES[i]);
+    slab_caches[i].num_slabs = 0;
     slab_caches[i].full_slabs = NULL;
     slab_caches[i].partial_slabs = NULL;
     slab_caches[i].empty_slabs = NULL;
     slab_caches[i].num_empty_slabs = 0;
+    slab_caches[i].objects_out = 0;
+    slab_caches[i].peak_objects_out = 0;
+    slab_caches[i].depot_count = 0;
   }
 
   for (int i = 0; i < MAX_CORES; i++) {
     for (int j = 0; j < NUM_OBJECT_SIZES; j++) {
-      per_core_data[i].free_lists[j] = NULL;
-      per_core_data[i].free_list_sizes[j] = 0;
+      per_core_data[i].heap_magazines[j].loaded = NULL;
+      per_core_data[i].heap_magazines[j].loaded_count = 0;
+      per_core_data[i].heap_magazines[j].spare = NULL;
+      per_core_data[i].heap_magazines[j].spare_count = 0;
+      per_core_data[i].heap_allocs[j] = 0;
+      per_core_data[i].heap_requested_bytes[j] = 0;
     }
   }
 }
@@ -138,80 +207,125 @@ void heap_init(){
 void heap_sync_init(){
   for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
     blocking_lock_init(&slab_caches[i].lock);
+    blocking_lock_init(&slab_caches[i].depot_lock);
   }
   blocking_lock_init(&large_allocation_lock);
   heap_sync_initialized = true;
 }
 
-struct Slab* slab_create(unsigned object_size) {
-  struct Slab* slab = (struct Slab*)physmem_alloc();
+// true for the malloc() size classes, false for typed caches
+static bool is_size_class(struct SlabCache* cache) {
+  return cache >= &slab_caches[0] && cache < &slab_caches[NUM_OBJECT_SIZES];
+}
 
-  int i;
-  for (i = 0; i < NUM_OBJECT_SIZES; i++) {
-    if (object_size <= OBJECT_SIZES[i]) {
-      break;
-    }
+// the free-list link of a free object in this cache
+static struct FreeObject* slab_link(struct SlabCache* cache, void* obj) {
+  return (struct FreeObject*)((char*)obj + cache->link_offset);
+}
+
+// the slab holding obj; slabs are aligned to their own size
+static struct Slab* slab_of(struct SlabCache* cache, void* obj) {
+  return (struct Slab*)((unsigned)obj & ~((FRAME_SIZE << cache->slab_order) - 1));
+}
+
+// the slab holding a heap object of unknown cache. The side-table entry of a
+// live slab's frame only changes when the slab is destroyed, so no lock.
+static struct Slab* slab_containing(void* obj) {
+  unsigned frame = (unsigned)obj & ~(FRAME_SIZE - 1);
+  unsigned entry = large_allocation_orders[frame_index_from_address(frame)];
+  if (is_slab_tail_frame(entry)) {
+    frame -= (entry - HEAP_SLAB_TAIL_FRAME) * FRAME_SIZE;
+  }
+  return (struct Slab*)frame;
+}
+
+// mark (or unmark) the frames after the first of a multi-page slab
+static void slab_mark_tail_frames(struct Slab* slab, int order, bool live) {
+  unsigned first_frame = frame_index_from_address((unsigned)slab);
+
+  if (heap_sync_initialized) blocking_lock_acquire(&large_allocation_lock);
+  for (unsigned n = 1; n < (1u << order); n++) {
+    large_allocation_orders[first_frame + n] = live ?
+      HEAP_SLAB_TAIL_FRAME + n : HEAP_LARGE_ALLOC_NONE;
   }
-  assert(i < NUM_OBJECT_SIZES, "slab_create: object size exceeds max supported size\n");
+  if (heap_sync_initialized) blocking_lock_release(&large_allocation_lock);
+}
+
+static struct Slab* slab_create(struct SlabCache* cache) {
+  struct Slab* slab = cache->slab_order == 0 ?
+    (struct Slab*)physmem_alloc() : (struct Slab*)physmem_alloc_order(cache->slab_order);
+  unsigned object_size = cache->object_size;
 
-  unsigned metadata_objects = (FRAME_SIZE / object_size) - slab_caches[i].objects_per_slab;
+  if (cache->slab_order > 0) {
+    slab_mark_tail_frames(slab, cache->slab_order, true);
+  }
 
-  slab->free_list = (char*)slab + metadata_objects * object_size; // reserve objects for slab metadata
+  slab->free_list = (char*)slab + cache->first_object_offset; // reserve space for slab metadata
   slab->object_size = object_size;
-  slab->free_objects = (FRAME_SIZE / object_size) - metadata_objects; // Calculate how many objects can fit in the slab
+  slab->cache = cache;
+  slab->free_objects = cache->objects_per_slab;
   slab->next = NULL;
   slab->prev = NULL;
 
-  // Initialize the free list
-  struct FreeObject* current = (struct FreeObject*)slab->free_list;
-  for (unsigned i = 0; i < slab->free_objects - 1; i++) {
+  // Initialize the free list, constructing each object on the way
+  char* current = (char*)slab->free_list;
+  for (unsigned i = 0; i < slab->free_objects; i++) {
+    char* next = (i + 1 < slab->free_objects) ? current + object_size : NULL;
+
+    if (cache->ctor != NULL) {
+      cache->ctor(current);
+    }
+
     #ifdef HEAP_DEBUG
     // poison free objects in debug mode to make use-after-free more obvious
-    for (int i = 1; i < object_size / 4; i++) {
-      ((unsigned*)current)[i] = HEAP_POISON;
+    if (is_size_class(cache)) {
+      for (int j = 1; j < object_size / 4; j++) {
+        ((unsigned*)current)[j] = HEAP_POISON;
+      }
     }
     #endif
 
-    current->next = (struct FreeObject*)((char*)current + object_size);
-    current = current->next;
+    slab_link(cache, current)->next = (struct FreeObject*)next;
+    current = next;
   }
-  current->next = NULL; // Last object points to NULL
 
   #ifdef HEAP_DEBUG
-  // poison final object
-  for (int i = 1; i < object_size / 4; i++) {
-    ((unsigned*)current)[i] = HEAP_POISON;
-  }
-  #endif
-
-  #ifdef HEAP_DEBUG
-  // initialize allocation bitmap to all 0's (all free)
-  unsigned bitmap_size = (slab_caches[i].objects_per_slab + 7) / 8; // Round up to nearest byte
-  for (unsigned j = 0; j < bitmap_size; j++) {
-    slab->allocation_bitmap[j] = 0;
+  // initialize allocation bitmap to all 0's (all free); typed caches reserve
+  // no bitmap space and are not tracked
+  if (is_size_class(cache)) {
+    unsigned bitmap_size = (cache->objects_per_slab + 7) / 8; // Round up to nearest byte
+    for (unsigned j = 0; j < bitmap_size; j++) {
+      slab->allocation_bitmap[j] = 0;
+    }
   }
   #endif
 
+  cache->num_slabs++;
   return slab;
 }
 
+// give a slab's pages back to physmem
+static void slab_destroy(struct SlabCache* cache, struct Slab* slab) {
+  if (cache->slab_order == 0) {
+    physmem_free(slab);
+  } else {
+    slab_mark_tail_frames(slab, cache->slab_order, false);
+    physmem_free_order(slab, cache->slab_order);
+  }
+  cache->num_slabs--;
+}
+
 #ifdef HEAP_DEBUG
 void bitmap_alloc(struct Slab* slab, void* obj) {
   // find slab cache for this slab
-  struct SlabCache* cache = NULL;
-  for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
-    if (slab->object_size == OBJECT_SIZES[i]) {
-      cache = &slab_caches[i];
-      break;
-    }
-  }
-  if (cache == NULL) {
+  struct SlabCache* cache = slab->cache;
+  if (!is_size_class(cache)) {
     int args[4] = {(int)obj, (int)slab, (int)slab->object_size, (int)slab->free_objects};
     say("heap bitmap_alloc: obj=0x%X slab=0x%X object_size=%d free_objects=%d\n", args);
     panic("heap bitmap_alloc: object is not in a valid slab cache\n");
   }
 
-  unsigned metadata_end = (unsigned)slab + (FRAME_SIZE - cache->objects_per_slab * slab->object_size);
+  unsigned metadata_end = (unsigned)slab + cache->first_object_offset;
   unsigned obj_index = ((unsigned)obj - metadata_end) / slab->object_size;
   unsigned byte_index = obj_index / 8;
   unsigned bit_index = obj_index % 8;
@@ -229,26 +343,13 @@ void bitmap_alloc(struct Slab* slab, void* obj) {
 }
 #endif
 
-void* slab_alloc(unsigned size){
-  // Find the appropriate slab cache for the requested size
-  struct SlabCache* cache = NULL;
-  int i;
-  for (i = 0; i < NUM_OBJECT_SIZES; i++) {
-    if (size <= OBJECT_SIZES[i]) {
-      cache = &slab_caches[i];
-      break;
-    }
-  }
-
-  assert(cache != NULL, "requested allocation size exceeds max supported size\n");
-
-  if (heap_sync_initialized) blocking_lock_acquire(&cache->lock);
-
+// take one object from the cache; caller holds cache->lock
+static void* slab_alloc_locked(struct SlabCache* cache){
   if (cache->partial_slabs != NULL) {
     // Allocate from a partial slab
     struct Slab* slab = cache->partial_slabs;
     void* obj = slab->free_list;
-    slab->free_list = ((struct FreeObject*)obj)->next; // Update free list
+    slab->free_list = slab_link(cache, obj)->next; // Update free list
     slab->free_objects--;
 
     if (slab->free_objects == 0) {
@@ -268,8 +369,6 @@ void* slab_alloc(unsigned size){
       slab->prev = NULL;
       cache->full_slabs = slab;
     }
-
-    if (heap_sync_initialized) blocking_lock_release(&cache->lock);
     return obj;
   } else if (cache->empty_slabs != NULL) {
     // Move an empty slab to the partial slabs list
@@ -292,14 +391,12 @@ void* slab_alloc(unsigned size){
 
     // Allocate from the newly moved slab
     void* obj = slab->free_list;
-    slab->free_list = ((struct FreeObject*)obj)->next; // Update free list
+    slab->free_list = slab_link(cache, obj)->next; // Update free list
     slab->free_objects--;
-
-    if (heap_sync_initialized) blocking_lock_release(&cache->lock);
     return obj;
   } else {
     // No available slabs, create a new one
-    struct Slab* new_slab = slab_create(OBJECT_SIZES[i]);
+    struct Slab* new_slab = slab_create(cache);
 
     // Add the new slab to the partial slabs list
     if (cache->partial_slabs != NULL) {
@@ -311,144 +408,77 @@ void* slab_alloc(unsigned size){
 
     // Allocate from the new slab
     void* obj = new_slab->free_list;
-    new_slab->free_list = ((struct FreeObject*)obj)->next; // Update free list
+    new_slab->free_list = slab_link(cache, obj)->next; // Update free list
     new_slab->free_objects--;
-
-    if (heap_sync_initialized) blocking_lock_release(&cache->lock);
     return obj;
   }
 }
 
-static void* alloc(unsigned size, bool leaked) {
-  assert(size > 0, "tried to alloc 0 bytes?\n");
-
-  int i;
-  bool valid_size = false;
-  for (i = 0; i < NUM_OBJECT_SIZES; i++) {
-    if (size <= OBJECT_SIZES[i]) {
-      valid_size = true;
-      break;
-    }
-  }
+// build one magazine of PER_CORE_FREE_LIST_REFILL objects under a single slab
+// lock acquisition
+static struct FreeObject* slab_alloc_magazine(struct SlabCache* cache){
+  struct FreeObject* magazine = NULL;
 
-  if (!valid_size) {
-    return large_alloc(size, leaked);
-  }
-
-  int core_was = core_pin();
-  struct PerCore* core = get_per_core();
-
-  // need to disable preemption around modification to per-core free list
-  int preempt_was = preemption_disable();
-  if (core->free_list_sizes[i] <= MIN_PER_CORE_FREE_LIST) {
-    // per-core free list is empty, we should get some objects from the slab cache
-    while (core->free_list_sizes[i] <= PER_CORE_FREE_LIST_REFILL) {
-      preemption_restore(preempt_was);
-
-      // enable preemption around blocking call, but keep pinned to this core
-      void* obj = slab_alloc(OBJECT_SIZES[i]);
-      if (obj == NULL) {
-        preempt_was = preemption_disable(); // to match expected state at the end of the loop
-        break; // slab cache is out of memory, we have to return what we got so far
-      }
+  if (heap_sync_initialized) blocking_lock_acquire(&cache->lock);
+  #ifdef HEAP_DEBUG
+  __atomic_fetch_add((int*)&n_slab_locks, 1);
+  #endif
 
-      preempt_was = preemption_disable();
-      // Free to per-core free list
-      ((struct FreeObject*)obj)->next = core->free_lists[i];
-      core->free_lists[i] = obj;
-      core->free_list_sizes[i]++;
-    }
+  for (int n = 0; n < PER_CORE_FREE_LIST_REFILL; n++) {
+    void* obj = slab_alloc_locked(cache);
+    slab_link(cache, obj)->next = magazine;
+    magazine = obj;
   }
-
-  // alloc from per-core free list
-  void* obj = core->free_lists[i];
-  if (obj != NULL) {
-    core->free_lists[i] = ((struct FreeObject*)obj)->next; // Update free list
-    core->free_list_sizes[i]--;
+  cache->objects_out += PER_CORE_FREE_LIST_REFILL;
+  if (cache->objects_out > cache->peak_objects_out) {
+    cache->peak_objects_out = cache->objects_out;
   }
 
-  #ifdef HEAP_DEBUG
-  struct Slab* slab = (struct Slab*)((unsigned)obj & ~(FRAME_SIZE - 1)); // Align down to slab boundary
+  if (heap_sync_initialized) blocking_lock_release(&cache->lock);
+  return magazine;
+}
 
-  // update allocation bitmap
-  bitmap_alloc(slab, obj);
+// pop a full magazine from the cache's depot, or NULL if it has none
+static struct FreeObject* depot_pop(struct SlabCache* cache){
+  struct FreeObject* magazine = NULL;
 
-  // check the poison value is still there
-  for (int i = 1; i < slab->object_size / 4; i++) {
-    assert(((unsigned*)obj)[i] == HEAP_POISON,
-      "heap corruption detected: likely use after free\n");
-  }
+  if (heap_sync_initialized) blocking_lock_acquire(&cache->depot_lock);
+  #ifdef HEAP_DEBUG
+  __atomic_fetch_add((int*)&n_depot_locks, 1);
   #endif
+  if (cache->depot_count > 0) {
+    cache->depot_count--;
+    magazine = cache->depot[cache->depot_count];
+  }
+  if (heap_sync_initialized) blocking_lock_release(&cache->depot_lock);
 
-  preemption_restore(preempt_was);
-  core_unpin(core_was);
-
-  return obj;
+  return magazine;
 }
 
-void* malloc(unsigned size) {
-  #ifdef HEAP_DEBUG
-  __atomic_fetch_add((int*)&n_malloc, 1);
-  #endif
-  return alloc(size, false);
-}
+// push a full magazine to the cache's depot, returning false if full
+static bool depot_push(struct SlabCache* cache, struct FreeObject* magazine){
+  bool pushed = false;
 
-void* leak(unsigned size) {
+  if (heap_sync_initialized) blocking_lock_acquire(&cache->depot_lock);
   #ifdef HEAP_DEBUG
-  __atomic_fetch_add((int*)&n_leak, 1);
+  __atomic_fetch_add((int*)&n_depot_locks, 1);
   #endif
-  return alloc(size, true);
-}
-
-#ifdef HEAP_DEBUG
-void bitmap_free(struct Slab* slab, void* obj) {
-  struct SlabCache* cache = NULL;
-  for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
-    if (slab->object_size == OBJECT_SIZES[i]) {
-      cache = &slab_caches[i];
-      break;
-    }
+  if (cache->depot_count < HEAP_DEPOT_MAGAZINES) {
+    cache->depot[cache->depot_count] = magazine;
+    cache->depot_count++;
+    pushed = true;
   }
-  assert(cache != NULL, "found slab with no matching cache\n");
+  if (heap_sync_initialized) blocking_lock_release(&cache->depot_lock);
 
-  unsigned metadata_end = (unsigned)slab + (FRAME_SIZE - cache->objects_per_slab * slab->object_size);
-  unsigned obj_index = ((unsigned)obj - metadata_end) / slab->object_size;
-  unsigned byte_index = obj_index / 8;
-  unsigned bit_index = obj_index % 8;
-
-  if (heap_sync_initialized) blocking_lock_acquire(&cache->lock);
-
-  // assert that the bit is currently set (double free)
-  assert((slab->allocation_bitmap[byte_index] & (1u << bit_index)) != 0,
-    "double free detected in slab allocator\n");
-
-  // mark as free in bitmap
-  slab->allocation_bitmap[byte_index] &= ~(1u << bit_index);
-  if (heap_sync_initialized) blocking_lock_release(&cache->lock);
+  return pushed;
 }
-#endif
 
-void slab_free(void* obj) {
-  struct Slab* slab = (struct Slab*)((unsigned)obj & ~(FRAME_SIZE - 1)); // Align down to slab boundary
-
-  // Find the appropriate slab cache for the object's size
-  struct SlabCache* cache = NULL;
-  for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
-    // we don't need to lock the slab or anything to read object size, because
-    // the slab metadata is immutable after creation
-    // and the slab won't be destroyed because we know at least one object
-    // has not yet been freed back to it (the one we're freeing now)
-    if (slab->object_size == OBJECT_SIZES[i]) {
-      cache = &slab_caches[i];
-      break;
-    }
-  }
-
-  assert(cache != NULL, "found slab with no matching cache\n");
-  if (heap_sync_initialized) blocking_lock_acquire(&cache->lock);
+// return one object to its slab; caller holds cache->lock
+static void slab_free_locked(struct SlabCache* cache, void* obj) {
+  struct Slab* slab = slab_of(cache, obj);
 
   // Free the object back to the slab
-  ((struct FreeObject*)obj)->next = slab->free_list;
+  slab_link(cache, obj)->next = slab->free_list;
   slab->free_list = obj;
   slab->free_objects++;
 
@@ -465,7 +495,7 @@ void slab_free(void* obj) {
 
     if (cache->num_empty_slabs >= 2) {
       // If we already have 2 empty slabs, free this one back to physical memory
-      physmem_free(slab);
+      slab_destroy(cache, slab);
     } else {
       // Move slab from partial slabs list to empty slabs list
 
@@ -499,10 +529,199 @@ void slab_free(void* obj) {
     slab->prev = NULL;
     cache->partial_slabs = slab;
   }
+}
+
+// tear a magazine down into its slabs under a single slab lock acquisition
+static void slab_free_magazine(struct SlabCache* cache, struct FreeObject* magazine) {
+  if (heap_sync_initialized) blocking_lock_acquire(&cache->lock);
+  #ifdef HEAP_DEBUG
+  __atomic_fetch_add((int*)&n_slab_locks, 1);
+  #endif
+
+  while (magazine != NULL) {
+    struct FreeObject* next = slab_link(cache, magazine)->next;
+    slab_free_locked(cache, magazine);
+    cache->objects_out--;
+    magazine = next;
+  }
 
   if (heap_sync_initialized) blocking_lock_release(&cache->lock);
 }
 
+// hand a full magazine back, to the depot if it has room and to the slabs
+// otherwise. May block.
+static void magazine_release(struct SlabCache* cache, struct FreeObject* magazine) {
+  if (!depot_push(cache, magazine)) {
+    slab_free_magazine(cache, magazine);
+  }
+}
+
+// Pop one object from this core's magazines for `cache`, refilling them from
+// the depot or the slabs when both are empty. The caller is pinned to the core
+// that owns `mags`. Returns with preemption disabled and *preempt_was set, so
+// the caller can update its per-core counters before preemption_restore().
+static void* magazine_alloc(struct SlabCache* cache, struct Magazines* mags, int* preempt_was) {
+  // need to disable preemption around modification to per-core magazines
+  *preempt_was = preemption_disable();
+  struct FreeObject* leftover = NULL;
+  if (mags->loaded_count <= MIN_PER_CORE_FREE_LIST) {
+    if (mags->spare_count > 0) {
+      // loaded magazine is empty but the spare is full, swap them
+      mags->loaded = mags->spare;
+      mags->loaded_count = mags->spare_count;
+      mags->spare = NULL;
+      mags->spare_count = 0;
+    } else {
+      preemption_restore(*preempt_was);
+
+      // enable preemption around blocking call, but keep pinned to this core
+      struct FreeObject* magazine = depot_pop(cache);
+      if (magazine == NULL) {
+        magazine = slab_alloc_magazine(cache);
+      }
+
+      *preempt_was = preemption_disable();
+      // another thread on this core may have refilled the loaded magazine
+      // while we were blocked; keep ours as the spare or give it back
+      if (mags->loaded_count <= MIN_PER_CORE_FREE_LIST) {
+        mags->loaded = magazine;
+        mags->loaded_count = PER_CORE_FREE_LIST_REFILL;
+      } else if (mags->spare_count == 0) {
+        mags->spare = magazine;
+        mags->spare_count = PER_CORE_FREE_LIST_REFILL;
+      } else {
+        leftover = magazine;
+      }
+    }
+  }
+
+  void* obj = mags->loaded;
+  mags->loaded = slab_link(cache, obj)->next;
+  mags->loaded_count--;
+
+  if (leftover != NULL) {
+    // another thread on this core kept the magazines stocked while we were
+    // blocked, so the extra one goes back with preemption enabled
+    preemption_restore(*preempt_was);
+    magazine_release(cache, leftover);
+    *preempt_was = preemption_disable();
+  }
+
+  return obj;
+}
+
+// Push one object onto this core's magazines for `cache`, handing a full
+// magazine to the depot when both are full. The caller is pinned to the core
+// that owns `mags`. Returns with preemption disabled and *preempt_was set.
+static void magazine_free(struct SlabCache* cache, struct Magazines* mags, void* obj, int* preempt_was) {
+  *preempt_was = preemption_disable();
+
+  struct FreeObject* full = NULL;
+  if (mags->loaded_count >= PER_CORE_FREE_LIST_REFILL) {
+    // loaded magazine is full: make it the spare, and if the old spare
+    // was full too, send that one back to the depot below
+    if (mags->spare_count > 0) {
+      full = mags->spare;
+    }
+    mags->spare = mags->loaded;
+    mags->spare_count = mags->loaded_count;
+    mags->loaded = NULL;
+    mags->loaded_count = 0;
+  }
+
+  slab_link(cache, obj)->next = mags->loaded;
+  mags->loaded = obj;
+  mags->loaded_count++;
+
+  if (full != NULL) {
+    // enable preemption around blocking call, but keep pinned to this core
+    preemption_restore(*preempt_was);
+    magazine_release(cache, full);
+    *preempt_was = preemption_disable();
+  }
+}
+
+static void* alloc(unsigned size, bool leaked) {
+  assert(size > 0, "tried to alloc 0 bytes?\n");
+
+  int i;
+  bool valid_size = false;
+  for (i = 0; i < NUM_OBJECT_SIZES; i++) {
+    if (size <= OBJECT_SIZES[i]) {
+      valid_size = true;
+      break;
+    }
+  }
+
+  if (!valid_size) {
+    return large_alloc(size, leaked);
+  }
+
+  int core_was = core_pin();
+  struct PerCore* core = get_per_core();
+
+  int preempt_was;
+  void* obj = magazine_alloc(&slab_caches[i], &core->heap_magazines[i], &preempt_was);
+
+  // per-core so the fast path stays free of atomics; summed by heap_print_stats()
+  core->heap_allocs[i]++;
+  core->heap_requested_bytes[i] += size;
+
+  preemption_restore(preempt_was);
+  core_unpin(core_was);
+
+  #ifdef HEAP_DEBUG
+  struct Slab* slab = slab_of(&slab_caches[i], obj);
+
+  // update allocation bitmap
+  bitmap_alloc(slab, obj);
+
+  // check the poison value is still there
+  for (int i = 1; i < slab->object_size / 4; i++) {
+    assert(((unsigned*)obj)[i] == HEAP_POISON,
+      "heap corruption detected: likely use after free\n");
+  }
+  #endif
+
+  return obj;
+}
+
+void* malloc(unsigned size) {
+  #ifdef HEAP_DEBUG
+  __atomic_fetch_add((int*)&n_malloc, 1);
+  #endif
+  return alloc(size, false);
+}
+
+void* leak(unsigned size) {
+  #ifdef HEAP_DEBUG
+  __atomic_fetch_add((int*)&n_leak, 1);
+  #endif
+  return alloc(size, true);
+}
+
+#ifdef HEAP_DEBUG
+void bitmap_free(struct Slab* slab, void* obj) {
+  struct SlabCache* cache = slab->cache;
+  assert(is_size_class(cache), "found slab with no matching cache\n");
+
+  unsigned metadata_end = (unsigned)slab + cache->first_object_offset;
+  unsigned obj_index = ((unsigned)obj - metadata_end) / slab->object_size;
+  unsigned byte_index = obj_index / 8;
+  unsigned bit_index = obj_index % 8;
+
+  if (heap_sync_initialized) blocking_lock_acquire(&cache->lock);
+
+  // assert that the bit is currently set (double free)
+  assert((slab->allocation_bitmap[byte_index] & (1u << bit_index)) != 0,
+    "double free detected in slab allocator\n");
+
+  // mark as free in bitmap
+  slab->allocation_bitmap[byte_index] &= ~(1u << bit_index);
+  if (heap_sync_initialized) blocking_lock_release(&cache->lock);
+}
+#endif
+
 bool slab_free_sanity(void* obj){
   // check obj is within slab heap bounds
   if ((unsigned)obj < (unsigned)FRAMES_ADDR_START ||
@@ -533,13 +752,13 @@ void free(void* obj){
   }
 
   // find slab containing obj
-  struct Slab* slab = (struct Slab*)((unsigned)obj & ~(FRAME_SIZE - 1)); // Align down to slab boundary
+  struct Slab* slab = slab_containing(obj);
 
   #ifdef HEAP_DEBUG
   // check object size makes sense
   bool valid_size = false;
   for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
-    if (slab->object_size == OBJECT_SIZES[i]) {
+    if (slab->cache == &slab_caches[i] && slab->object_size == OBJECT_SIZES[i]) {
       valid_size = true;
       break;
     }
@@ -549,40 +768,17 @@ void free(void* obj){
     panic("attempting to free pointer with invalid object size\n");
   }
 
-  if ((unsigned)obj % slab->object_size != 0) {
+  unsigned first_object = (unsigned)slab + slab->cache->first_object_offset;
+  if ((unsigned)obj < first_object || ((unsigned)obj - first_object) % slab->object_size != 0) {
     say("invalid pointer passed to slab_free: %X\n", &obj);
     panic("attempting to free pointer that is not aligned to its object size\n");
   }
   #endif
 
-  int core_was = core_pin();
-  int preempt_was = preemption_disable();
-
-  struct PerCore* core = get_per_core();
+  // typed-cache objects land here only if passed to free() by mistake; their
+  // slabs point at a KmemCache, so they fall through to the panic below
   for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
-    if (slab->object_size == OBJECT_SIZES[i]) {
-      if (core->free_list_sizes[i] >= MAX_PER_CORE_FREE_LIST) {
-        // per-core free list is full, we should move some back to the slab cache
-        while (core->free_list_sizes[i] > PER_CORE_FREE_LIST_REFILL) {
-          void* free_obj = core->free_lists[i];
-          core->free_lists[i] = ((struct FreeObject*)free_obj)->next; // Update free list
-          core->free_list_sizes[i]--;
-
-          preemption_restore(preempt_was);
-          // enable preemption around blocking call, but keep pinned to this core
-
-          // Free back to slab cache
-          slab_free(free_obj);
-
-          preempt_was = preemption_disable();
-        }
-      }
-
-      // Free to per-core free list
-      ((struct FreeObject*)obj)->next = core->free_lists[i];
-      core->free_lists[i] = obj;
-      core->free_list_sizes[i]++;
-
+    if (slab->cache == &slab_caches[i]) {
       #ifdef HEAP_DEBUG
       bitmap_free(slab, obj);
 
@@ -592,6 +788,10 @@ void free(void* obj){
       }
       #endif
 
+      int core_was = core_pin();
+      struct PerCore* core = get_per_core();
+      int preempt_was;
+      magazine_free(&slab_caches[i], &core->heap_magazines[i], obj, &preempt_was);
       preemption_restore(preempt_was);
       core_unpin(core_was);
       return;
@@ -604,6 +804,205 @@ void free(void* obj){
   }
 }
 
+// return every slab on one list to physmem
+static void slab_list_release(struct SlabCache* cache, struct Slab* slab) {
+  while (slab != NULL) {
+    struct Slab* next = slab->next;
+    slab_destroy(cache, slab);
+    slab = next;
+  }
+}
+
+// return every slab of a cache to physmem, live objects included
+static void slab_cache_release_all(struct SlabCache* cache) {
+  slab_list_release(cache, cache->full_slabs);
+  slab_list_release(cache, cache->partial_slabs);
+  slab_list_release(cache, cache->empty_slabs);
+  cache->full_slabs = NULL;
+  cache->partial_slabs = NULL;
+  cache->empty_slabs = NULL;
+  cache->num_empty_slabs = 0;
+}
+
+struct KmemCache* kmem_cache_create(const char* name, unsigned size, unsigned align,
+    void (*ctor)(void* obj)) {
+  assert(size > 0, "kmem_cache_create: object size is 0.\n");
+  if (align < 4) {
+    align = 4;
+  }
+  assert((align & (align - 1)) == 0, "kmem_cache_create: alignment is not a power of two.\n");
+
+  struct KmemCache* kc = leak(sizeof(struct KmemCache));
+  struct SlabCache* cache = &kc->slabs;
+
+  // A constructed free object must keep every byte the constructor wrote, so
+  // its free-list link goes in an extra word after the object instead of
+  // overwriting the first word.
+  unsigned stride = (size + 3) & ~3;
+  cache->link_offset = 0;
+  if (ctor != NULL) {
+    cache->link_offset = stride;
+    stride += sizeof(struct FreeObject);
+  }
+  stride = (stride + align - 1) & ~(align - 1);
+
+  cache->object_size = stride;
+  cache->first_object_offset = (sizeof(struct Slab) + align - 1) & ~(align - 1);
+  cache->ctor = ctor;
+
+  // smallest slab order that holds enough objects to amortize its metadata
+  int order = 0;
+  while (order < KMEM_MAX_SLAB_ORDER &&
+      ((FRAME_SIZE << order) - cache->first_object_offset) / stride < KMEM_MIN_OBJECTS_PER_SLAB) {
+    order++;
+  }
+  cache->slab_order = order;
+  cache->objects_per_slab = ((FRAME_SIZE << order) - cache->first_object_offset) / stride;
+  assert(cache->objects_per_slab >= 2, "kmem_cache_create: object size too large for a typed cache.\n");
+
+  cache->num_slabs = 0;
+  cache->full_slabs = NULL;
+  cache->partial_slabs = NULL;
+  cache->empty_slabs = NULL;
+  cache->num_empty_slabs = 0;
+  cache->objects_out = 0;
+  cache->peak_objects_out = 0;
+  cache->depot_count = 0;
+  blocking_lock_init(&cache->lock);
+  blocking_lock_init(&cache->depot_lock);
+
+  kc->name = name;
+  kc->size = size;
+  for (int i = 0; i < MAX_CORES; i++) {
+    kc->per_core[i].mags.loaded = NULL;
+    kc->per_core[i].mags.loaded_count = 0;
+    kc->per_core[i].mags.spare = NULL;
+    kc->per_core[i].mags.spare_count = 0;
+    kc->per_core[i].allocs = 0;
+    kc->per_core[i].frees = 0;
+    kc->per_core[i].leaks = 0;
+  }
+
+  // caches are created during single-threaded subsystem init
+  kc->next = kmem_caches;
+  kmem_caches = kc;
+
+  return kc;
+}
+
+static void* kmem_cache_alloc_common(struct KmemCache* kc, bool leaked) {
+  assert(kc != NULL, "kmem_cache_alloc: cache is NULL.\n");
+
+  int core_was = core_pin();
+  struct KmemPerCore* pc = &kc->per_core[get_core_id()];
+
+  int preempt_was;
+  void* obj = magazine_alloc(&kc->slabs, &pc->mags, &preempt_was);
+  pc->allocs++;
+  if (leaked) {
+    pc->leaks++;
+  }
+
+  preemption_restore(preempt_was);
+  core_unpin(core_was);
+
+  return obj;
+}
+
+void* kmem_cache_alloc(struct KmemCache* kc) {
+  return kmem_cache_alloc_common(kc, false);
+}
+
+void* kmem_cache_leak(struct KmemCache* kc) {
+  return kmem_cache_alloc_common(kc, true);
+}
+
+void kmem_cache_free(struct KmemCache* kc, void* obj) {
+  assert(kc != NULL, "kmem_cache_free: cache is NULL.\n");
+  assert(obj != NULL, "kmem_cache_free: object is NULL.\n");
+
+  struct Slab* slab = slab_of(&kc->slabs, obj);
+  if (slab->cache != &kc->slabs) {
+    int args[2] = {(int)obj, (int)kc->name};
+    say("kmem_cache_free: 0x%X does not belong to cache %s\n", args);
+    panic("kmem_cache_free: object freed to the wrong cache.\n");
+  }
+
+  int core_was = core_pin();
+  struct KmemPerCore* pc = &kc->per_core[get_core_id()];
+
+  int preempt_was;
+  magazine_free(&kc->slabs, &pc->mags, obj, &preempt_was);
+  pc->frees++;
+
+  preemption_restore(preempt_was);
+  core_unpin(core_was);
+}
+
+// sum a typed cache's per-core counters
+static void kmem_cache_totals(struct KmemCache* kc, unsigned* allocs, unsigned* frees,
+    unsigned* leaks) {
+  *allocs = 0;
+  *frees = 0;
+  *leaks = 0;
+  for (int i = 0; i < MAX_CORES; i++) {
+    *allocs += kc->per_core[i].allocs;
+    *frees += kc->per_core[i].frees;
+    *leaks += kc->per_core[i].leaks;
+  }
+}
+
+void kmem_cache_print_stats(void) {
+  for (struct KmemCache* kc = kmem_caches; kc != NULL; kc = kc->next) {
+    unsigned allocs, frees, leaks;
+    kmem_cache_totals(kc, &allocs, &frees, &leaks);
+    // peak counts objects out of the slabs, in magazines or in use
+    int args[8] = {(int)kc->name, kc->size, kc->slabs.object_size, kc->slabs.num_slabs,
+      allocs - frees, kc->slabs.peak_objects_out, allocs, frees};
+    say("| kmem %s: size=%d stride=%d slabs=%d active=%d peak=%d allocs=%d frees=%d\n", args);
+  }
+}
+
+void heap_print_stats(void) {
+  unsigned total_requested = 0;
+  unsigned total_allocated = 0;
+  unsigned total_slab_bytes = 0;
+
+  for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
+    unsigned allocs = 0;
+    unsigned requested = 0;
+    for (int c = 0; c < MAX_CORES; c++) {
+      allocs += per_core_data[c].heap_allocs[i];
+      requested += per_core_data[c].heap_requested_bytes[i];
+    }
+    unsigned allocated = allocs * OBJECT_SIZES[i];
+    unsigned slab_bytes = slab_caches[i].num_slabs * (FRAME_SIZE << slab_caches[i].slab_order);
+
+    total_requested += requested;
+    total_allocated += allocated;
+    total_slab_bytes += slab_bytes;
+
+    if (allocs == 0) {
+      continue;
+    }
+    // waste as a percentage of allocated bytes, without overflowing allocated * 100
+    unsigned waste = allocated >= 100 ? (allocated - requested) / (allocated / 100) : 0;
+    int args[8] = {OBJECT_SIZES[i], FRAME_SIZE << slab_caches[i].slab_order,
+      slab_caches[i].objects_per_slab, slab_caches[i].num_slabs, allocs, requested, allocated, waste};
+    say("| heap class %d: slab=%d objects=%d slabs=%d allocs=%u requested=%u allocated=%u waste=%u%%\n", args);
+  }
+
+  if (large_allocs > 0) {
+    unsigned waste = large_allocated_bytes >= 100 ?
+      (large_allocated_bytes - large_requested_bytes) / (large_allocated_bytes / 100) : 0;
+    int args[4] = {large_allocs, large_requested_bytes, large_allocated_bytes, waste};
+    say("| heap large: allocs=%u requested=%u allocated=%u waste=%u%%\n", args);
+  }
+
+  int args[3] = {total_requested, total_allocated, total_slab_bytes};
+  say("| heap slab classes: requested=%u allocated=%u slab bytes held=%u\n", args);
+}
+
 void heap_destroy() {
   bool locks_initialized = heap_sync_initialized;
 
@@ -616,36 +1015,32 @@ void heap_destroy() {
   if (locks_initialized) {
     for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
       blocking_lock_destroy(&slab_caches[i].lock);
+      blocking_lock_destroy(&slab_caches[i].depot_lock);
     }
     blocking_lock_destroy(&large_allocation_lock);
-  }
-
-  for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
-    struct SlabCache* cache = &slab_caches[i];
-
-    // Free full slabs
-    struct Slab* slab = cache->full_slabs;
-    while (slab != NULL) {
-      struct Slab* next = slab->next;
-      physmem_free(slab);
-      slab = next;
+    for (struct KmemCache* kc = kmem_caches; kc != NULL; kc = kc->next) {
+      blocking_lock_destroy(&kc->slabs.lock);
+      blocking_lock_destroy(&kc->slabs.depot_lock);
     }
+  }
 
-    // Free partial slabs
-    slab = cache->partial_slabs;
-    while (slab != NULL) {
-      struct Slab* next = slab->next;
-      physmem_free(slab);
-      slab = next;
+  heap_print_stats();
+
+  // The KmemCache headers themselves live in size-class slabs, so the typed
+  // caches go first.
+  kmem_cache_print_stats();
+  for (struct KmemCache* kc = kmem_caches; kc != NULL; kc = kc->next) {
+    unsigned allocs, frees, leaks;
+    kmem_cache_totals(kc, &allocs, &frees, &leaks);
+    if (allocs - frees != leaks) {
+      int args[3] = {(int)kc->name, allocs - frees, leaks};
+      say("| Warning: kmem cache %s leak detected: active:%d leaked:%d\n", args);
     }
+    slab_cache_release_all(&kc->slabs);
+  }
 
-    // Free empty slabs
-    slab = cache->empty_slabs;
-    while (slab != NULL) {
-      struct Slab* next = slab->next;
-      physmem_free(slab);
-      slab = next;
-    }
+  for (int i = 0; i < NUM_OBJECT_SIZES; i++) {
+    slab_cache_release_all(&slab_caches[i]);
   }
 
   #ifdef HEAP_DEBUG
@@ -655,5 +1050,8 @@ void heap_destroy() {
     } else {
       say("| No heap malloc leaks detected: n_free:%d n_leak:%d n_malloc:%d\n", args);
     }
+
+    int lock_args[2] = {n_slab_locks, n_depot_locks};
+    say("| Heap: slab lock acquisitions=%d depot lock acquisitions=%d\n", lock_args);
   #endif
 }
@@ -2,12 +2,16 @@
 #define HEAP_H
 
 #include "blocking_lock.h"
+#include "config.h"
 
 #define HEAP_POISON 0xABCDEFAA
 
+struct SlabCache;
+
 struct Slab {
   void* free_list; // Pointer to the first free object in the slab
   unsigned object_size;
+  struct SlabCache* cache; // owning size class or typed cache
   unsigned free_objects;
   struct Slab* next;
   struct Slab* prev;
@@ -18,22 +22,92 @@ struct Slab {
   #endif
 };
 
+// full magazines kept per size class before they are torn down into slabs
+#define HEAP_DEPOT_MAGAZINES 8
+
 struct SlabCache {
   struct BlockingLock lock;
+
+  // slab layout, fixed when the cache is set up
+  unsigned object_size; // bytes from one object to the next
+  unsigned link_offset; // where a free object keeps its free-list link
+  unsigned first_object_offset; // objects start after the slab metadata
+  int slab_order; // each slab is one physmem block of this order
+  void (*ctor)(void* obj); // run once per object when its slab is created
+
   unsigned objects_per_slab;
+  unsigned num_slabs;
   struct Slab* full_slabs;
   struct Slab* partial_slabs;
   struct Slab* empty_slabs; // keep max of 2 empty slabs
   unsigned num_empty_slabs;
+
+  // objects handed out of the slabs, to magazines or callers; updated under lock
+  unsigned objects_out;
+  unsigned peak_objects_out;
+
+  // depot of full magazines, each a chain of PER_CORE_FREE_LIST_REFILL free
+  // objects that cores exchange whole without touching the slab lists
+  struct BlockingLock depot_lock;
+  struct FreeObject* depot[HEAP_DEPOT_MAGAZINES];
+  unsigned depot_count;
 };
 
 struct FreeObject {
   struct FreeObject* next;
 };
 
-#define NUM_OBJECT_SIZES 9
+// One core's magazines for one cache: the loaded magazine that allocations pop
+// from and frees push to, and a spare that is either empty or full. Only the
+// owning core touches them, with preemption disabled.
+struct Magazines {
+  struct FreeObject* loaded;
+  unsigned loaded_count;
+  struct FreeObject* spare;
+  unsigned spare_count;
+};
+
+// a typed cache's magazines and usage counters on one core
+struct KmemPerCore {
+  struct Magazines mags;
+  unsigned allocs;
+  unsigned frees;
+  unsigned leaks;
+};
+
+// Typed object cache, see kmem_cache_create(). Objects are packed at their
+// exact size instead of being rounded up to a malloc() size class.
+struct KmemCache {
+  struct SlabCache slabs;
+  const char* name;
+  unsigned size; // size requested at creation
+
+  // indexed by core id, summed by kmem_cache_print_stats()
+  struct KmemPerCore per_core[MAX_CORES];
+
+  struct KmemCache* next;
+};
+
+// typed caches grow their slabs up to this order until a slab holds at least
+// KMEM_MIN_OBJECTS_PER_SLAB objects
+#define KMEM_MAX_SLAB_ORDER 3
+#define KMEM_MIN_OBJECTS_PER_SLAB 8
+
+#define NUM_OBJECT_SIZES 17
 extern unsigned OBJECT_SIZES[NUM_OBJECT_SIZES];
 
+// size-class slabs grow up to this order until their unused tail is at most
+// 1/HEAP_SLAB_WASTE_DIVISOR of the slab
+#define HEAP_MAX_SLAB_ORDER 2
+#define HEAP_SLAB_WASTE_DIVISOR 8
+
+// size-class objects are aligned to the largest power of two dividing their
+// size, up to this many bytes
+#define HEAP_MAX_OBJECT_ALIGN 64
+
+// Each core holds a loaded and a spare magazine per size class. A magazine
+// holds PER_CORE_FREE_LIST_REFILL objects, so a core caches at most
+// MAX_PER_CORE_FREE_LIST objects of one size.
 #define MIN_PER_CORE_FREE_LIST 0
 #define MAX_PER_CORE_FREE_LIST 64
 #define PER_CORE_FREE_LIST_REFILL 32
@@ -53,4 +127,29 @@ void free(void* ptr);
 
 void heap_destroy();
 
+// Create a cache of objects of exactly `size` bytes aligned to `align` (a power
+// of two, at least 4). If `ctor` is not NULL it runs once on every object when
+// its slab is created, never on reuse: callers must hand objects back to
+// kmem_cache_free() in that constructed state. Slabs are released without a
+// destructor, so constructed state must not own other allocations.
+// Caches live until heap_destroy(), and `name` must outlive them.
+struct KmemCache* kmem_cache_create(const char* name, unsigned size, unsigned align,
+  void (*ctor)(void* obj));
+
+// allocate one object from the cache; panics if no frames remain
+void* kmem_cache_alloc(struct KmemCache* cache);
+
+// allocate one object intended to live until shutdown
+void* kmem_cache_leak(struct KmemCache* cache);
+
+// return an object to the cache it came from
+void kmem_cache_free(struct KmemCache* cache, void* obj);
+
+// print requested vs allocated bytes and slab usage per size class, plus the
+// large-allocation path, to tune OBJECT_SIZES against the real workload
+void heap_print_stats(void);
+
+// print per-cache object, slab and usage counters
+void kmem_cache_print_stats(void);
+
 #endif // HEAP_H
@@ -19,6 +19,8 @@
 #include "uart.h"
 #include "exc.h"
 #include "audio.h"
+#include "swap.h"
+#include "hashmap.h"
 
 extern void kernel_main(void);
 extern void boot_ipi_handler_(void);
@@ -56,6 +58,7 @@ void kernel_entry(void){
 
     say("| Initializing heap...\n", NULL);
     heap_init();
+    hash_map_global_init();
 
     // init idle thread clh nodes
     for (int i = 0; i < MAX_CORES; ++i){
@@ -80,6 +83,7 @@ void kernel_entry(void){
     audio_init();
     exc_init();
     sd_init();
+    swap_init();
     ps2_init();
 
     say("| Initializing ext2 filesystem...\n", NULL);
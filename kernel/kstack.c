@@ -0,0 +1,107 @@
+#include "kstack.h"
+#include "threads.h"
+#include "physmem.h"
+#include "atomic.h"
+#include "debug.h"
+
+static unsigned* stack_cache[KSTACK_CACHE_SIZE];
+static unsigned stack_cache_count;
+static struct SpinLock stack_cache_lock;
+
+static unsigned kstack_reclaim(unsigned frames);
+
+void kstack_init(void){
+  assert(TCB_STACK_SIZE == (FRAME_SIZE << KSTACK_ORDER),
+    "kstack_init: TCB_STACK_SIZE must be 2^KSTACK_ORDER frames.\n");
+  stack_cache_count = 0;
+  spin_lock_init(&stack_cache_lock);
+  physmem_register_reclaim(kstack_reclaim);
+}
+
+static void kstack_canary_fill(unsigned* stack){
+  for (int i = 0; i < KSTACK_CANARY_WORDS; i++){
+    stack[i] = KSTACK_CANARY_PATTERN;
+  }
+}
+
+static bool kstack_canary_intact(unsigned* stack){
+  for (int i = 0; i < KSTACK_CANARY_WORDS; i++){
+    if (stack[i] != KSTACK_CANARY_PATTERN){
+      return false;
+    }
+  }
+  return true;
+}
+
+unsigned* kstack_alloc(void){
+  unsigned* stack = NULL;
+
+  spin_lock_acquire(&stack_cache_lock);
+  if (stack_cache_count > 0){
+    stack = stack_cache[--stack_cache_count];
+  }
+  spin_lock_release(&stack_cache_lock);
+
+  if (stack == NULL){
+    stack = physmem_alloc_order(KSTACK_ORDER);
+  }
+
+  kstack_canary_fill(stack);
+  return stack;
+}
+
+unsigned* kstack_leak(void){
+  unsigned* stack = physmem_leak_order(KSTACK_ORDER);
+  kstack_canary_fill(stack);
+  return stack;
+}
+
+void kstack_free(unsigned* stack){
+  assert(kstack_canary_intact(stack), "kstack_free: kernel stack overflow detected.\n");
+
+  spin_lock_acquire(&stack_cache_lock);
+  if (stack_cache_count < KSTACK_CACHE_SIZE){
+    stack_cache[stack_cache_count++] = stack;
+    stack = NULL;
+  }
+  spin_lock_release(&stack_cache_lock);
+
+  if (stack != NULL){
+    physmem_free_order(stack, KSTACK_ORDER);
+  }
+}
+
+void kstack_check(struct TCB* tcb){
+  if (!kstack_canary_intact(tcb->stack)){
+    panic("kernel stack overflow: thread overwrote the canary at the bottom of its stack.\n");
+  }
+}
+
+// physmem reclaim hook: hand cached stacks back to the buddy allocator. Never
+// spins, because the allocating thread may be holding another spinlock.
+static unsigned kstack_reclaim(unsigned frames){
+  if (!spin_lock_try_acquire(&stack_cache_lock)){
+    return 0;
+  }
+
+  // take the stacks out under the lock, but free them after releasing it
+  // because physmem_free_order() may block
+  unsigned* stacks[KSTACK_CACHE_SIZE];
+  unsigned count = 0;
+  while (stack_cache_count > 0 && (count << KSTACK_ORDER) < frames){
+    stacks[count++] = stack_cache[--stack_cache_count];
+  }
+
+  spin_lock_release(&stack_cache_lock);
+
+  for (unsigned i = 0; i < count; i++){
+    physmem_free_order(stacks[i], KSTACK_ORDER);
+  }
+  return count << KSTACK_ORDER;
+}
+
+void kstack_drain(void){
+  while (stack_cache_count > 0){
+    physmem_free_order(stack_cache[--stack_cache_count], KSTACK_ORDER);
+  }
+}
@@ -0,0 +1,41 @@
+#ifndef KSTACK_H
+#define KSTACK_H
+
+#include "TCB.h"
+
+// Kernel thread stacks are TCB_STACK_SIZE bytes (2^KSTACK_ORDER frames) taken
+// straight from the buddy allocator. They stay physically addressed: traps,
+// including TLB misses, run on the current kernel stack, so a stack page that
+// could itself miss in the TLB would fault recursively.
+#define KSTACK_ORDER 2
+
+// Stacks have no unmapped guard page. Instead the lowest KSTACK_CANARY_WORDS
+// words hold KSTACK_CANARY_PATTERN as a canary. A thread that runs off the
+// bottom of its stack overwrites them, and the next check panics. The write
+// that did it is not trapped, so the block below may already be damaged.
+#define KSTACK_CANARY_WORDS 64
+#define KSTACK_CANARY_PATTERN 0xDEADF00D
+
+// stacks of exited threads kept for reuse before splitting new buddy blocks
+#define KSTACK_CACHE_SIZE 32
+
+// initialize the stack cache; called once from threads_init
+void kstack_init(void);
+
+// allocate a kernel stack with a fresh canary, returning its lowest address
+unsigned* kstack_alloc(void);
+
+// allocate a kernel stack with a fresh canary for a thread that never exits
+unsigned* kstack_leak(void);
+
+// check a stack's canary and return it to the stack cache
+void kstack_free(unsigned* stack);
+
+// panic if the thread has overflowed its kernel stack
+void kstack_check(struct TCB* tcb);
+
+// return every cached stack to physmem
+// to be called only from kernel_shutdown
+void kstack_drain(void);
+
+#endif // KSTACK_H
@@ -3,33 +3,270 @@
 #include "physmem.h"
 #include "print.h"
 #include "debug.h"
+#include "string.h"
+#include "threads.h"
+
+// the cache the physmem reclaim hook shrinks
+static struct PageCache* reclaim_cache = NULL;
+
+static unsigned page_cache_reclaim(unsigned frames);
+static void page_cache_mark_movable(unsigned first, unsigned count);
+static bool page_cache_move(void* frame, void* target);
+
+// typed cache for entries of every PageCache
+static struct KmemCache* entry_cache = NULL;
 
 // initialize the page cache
 void page_cache_init(struct PageCache* cache){
   static unsigned hash_map_size = 4096; // 16384 bytes
   cache->hash_map = physmem_leak_order(2); // 4096 entries * 4 bytes each = 16384 bytes = 2^2 pages
   cache->hash_map_size = hash_map_size;
+  // PHYS_FRAME_COUNT pointers fit in 2^5 pages
+  cache->frame_entries = physmem_leak_order(5);
+  for (unsigned i = 0; i < PHYS_FRAME_COUNT; i++){
+    cache->frame_entries[i] = NULL;
+  }
   blocking_lock_init(&cache->lock);
+  if (entry_cache == NULL){
+    entry_cache = kmem_cache_create("page_cache_entry", sizeof(struct PageCacheEntry), 4, NULL);
+  }
   for(unsigned i = 0; i < hash_map_size; i++){
     cache->hash_map[i] = NULL;
   }
+
+  cache->lru_head = NULL;
+  cache->lru_tail = NULL;
+  cache->reclaimed = NULL;
+  cache->resident_pages = 0;
+  cache->lru_pages = 0;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+  cache->writebacks = 0;
+  cache->ra_pages = 0;
+  cache->ra_hits = 0;
+  cache->ra_wasted = 0;
+  cache->ra_head = NULL;
+  cache->ra_tail = NULL;
+  cache->ra_running = false;
+  blocking_lock_init(&cache->ra_lock);
+  cond_var_init(&cache->filled);
+  cache->fill_waiters = 0;
+
+  reclaim_cache = cache;
+  physmem_register_reclaim(page_cache_reclaim);
+  physmem_register_mover(page_cache_mark_movable, page_cache_move);
 }
 
 // to be called only from kernel_shutdown
 void page_cache_destroy(struct PageCache* cache){
   assert(cache != NULL, "page_cache_destroy: cache is NULL.\n");
+  assert(cache->ra_head == NULL && !cache->ra_running,
+    "page_cache_destroy: readahead is still in progress.\n");
+  reclaim_cache = NULL;
+  cond_var_destroy(&cache->filled);
   blocking_lock_destroy(&cache->lock);
+  blocking_lock_destroy(&cache->ra_lock);
 }
 
-// lookup a page in the page cache by inode and page index, incrementing its reference count if found
-// does not lock the cache, 
-static struct PageCacheEntry* page_cache_lookup(struct PageCache* cache, struct Node* node, unsigned offset){
+// remove an unreferenced entry from the LRU list. caller holds cache lock
+static void lru_remove(struct PageCache* cache, struct PageCacheEntry* entry){
+  // only LRU entries are movable, see page_cache_move()
+  cache->frame_entries[frame_index_from_address((unsigned)entry->page_data)] = NULL;
+
+  if (entry->lru_prev){
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    cache->lru_head = entry->lru_next;
+  }
+  if (entry->lru_next){
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    cache->lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+  cache->lru_pages--;
+}
+
+// append a newly unreferenced entry as the most recently used. caller holds cache lock
+static void lru_push_tail(struct PageCache* cache, struct PageCacheEntry* entry){
+  entry->lru_next = NULL;
+  entry->lru_prev = cache->lru_tail;
+  if (cache->lru_tail){
+    cache->lru_tail->lru_next = entry;
+  } else {
+    cache->lru_head = entry;
+  }
+  cache->lru_tail = entry;
+  cache->lru_pages++;
+
+  // the page is movable until lru_remove(), see page_cache_move()
+  cache->frame_entries[frame_index_from_address((unsigned)entry->page_data)] = entry;
+}
+
+// unlink an entry from its hash chain. caller holds cache lock
+static void hash_remove(struct PageCache* cache, struct PageCacheEntry* entry){
+  unsigned hash = ((unsigned)(entry->key.inode) ^ entry->key.offset) % cache->hash_map_size;
+  struct PageCacheEntry* curr = cache->hash_map[hash];
+  struct PageCacheEntry* prev = NULL;
+  while (curr){
+    if (curr == entry){
+      if (prev){
+        prev->next = curr->next;
+      } else {
+        cache->hash_map[hash] = curr->next;
+      }
+      return;
+    }
+    prev = curr;
+    curr = curr->next;
+  }
+  panic("page cache: entry missing from its hash chain.\n");
+}
+
+// Remove one unreferenced entry from the cache, writing it back if needed and
+// freeing its frame. The metadata is parked on the reclaimed list so callers
+// can free it (and drop its inode pin) after releasing the cache lock.
+static void page_cache_evict_locked(struct PageCache* cache, struct PageCacheEntry* entry){
+  assert(entry->refcount == 0, "page cache: cannot evict a referenced page.\n");
+
+  hash_remove(cache, entry);
+  lru_remove(cache, entry);
+
+  if (entry->flags & PAGE_DIRTY){
+    node_write_back(entry->node, entry->key.offset, entry->file_bytes, entry->page_data);
+    entry->flags &= ~PAGE_DIRTY;
+    cache->writebacks++;
+  }
+
+  physmem_free(entry->page_data);
+  entry->page_data = NULL;
+
+  cache->resident_pages--;
+  cache->evictions++;
+  if (entry->flags & PAGE_READAHEAD){
+    cache->ra_wasted++;
+  }
+
+  entry->next = cache->reclaimed;
+  cache->reclaimed = entry;
+}
+
+// evict cold pages while the buddy allocator is running low. caller holds cache lock
+static void page_cache_shrink_locked(struct PageCache* cache){
+  while (cache->lru_head != NULL && physmem_free_frames() < PAGE_CACHE_LOW_WATERMARK){
+    page_cache_evict_locked(cache, cache->lru_head);
+  }
+}
+
+// detach the reclaimed list. caller holds cache lock
+static struct PageCacheEntry* page_cache_take_reclaimed(struct PageCache* cache){
+  struct PageCacheEntry* list = cache->reclaimed;
+  cache->reclaimed = NULL;
+  return list;
+}
+
+// free metadata for evicted entries. must not hold the cache lock
+static void page_cache_free_entries(struct PageCacheEntry* entry){
+  while (entry){
+    struct PageCacheEntry* next = entry->next;
+    node_free(entry->node);
+    kmem_cache_free(entry_cache, entry);
+    entry = next;
+  }
+}
+
+// physmem reclaim hook: give clean unreferenced pages back to the buddy
+// allocator. This can run underneath any allocation, including ones made while
+// this cache's lock is held, so it only ever try-acquires the lock and defers
+// every heap operation to the next normal cache call.
+static unsigned page_cache_reclaim(unsigned frames){
+  struct PageCache* cache = reclaim_cache;
+  if (cache == NULL || !blocking_lock_try_acquire(&cache->lock)){
+    return 0;
+  }
+
+  unsigned freed = 0;
+  struct PageCacheEntry* entry = cache->lru_head;
+  while (entry != NULL && freed < frames){
+    struct PageCacheEntry* next = entry->lru_next;
+    if (!(entry->flags & PAGE_DIRTY)){
+      hash_remove(cache, entry);
+      lru_remove(cache, entry);
+
+      physmem_free_uncached(entry->page_data);
+      entry->page_data = NULL;
+
+      cache->resident_pages--;
+      cache->evictions++;
+      if (entry->flags & PAGE_READAHEAD){
+        cache->ra_wasted++;
+      }
+
+      entry->next = cache->reclaimed;
+      cache->reclaimed = entry;
+      freed++;
+    }
+    entry = next;
+  }
+
+  blocking_lock_release(&cache->lock);
+  return freed;
+}
+
+// physmem compaction mover. Unreferenced pages are mapped by no PTE and only
+// reached through their entry under the cache lock, so one of them can move
+// to another frame. Runs with physmem's buddy lock held, so it only try-locks.
+// frame_entries already tracks the LRU pages, so only the window is read.
+static void page_cache_mark_movable(unsigned first, unsigned count){
+  struct PageCache* cache = reclaim_cache;
+  if (cache == NULL || !blocking_lock_try_acquire(&cache->lock)){
+    return;
+  }
+
+  for (unsigned index = first; index < first + count; index++){
+    if (cache->frame_entries[index] != NULL){
+      physmem_mark_movable((void*)address_from_frame_index(index));
+    }
+  }
+
+  blocking_lock_release(&cache->lock);
+}
+
+// move an unreferenced page into `target`; false if it was acquired, evicted
+// or the lock is busy since page_cache_mark_movable() saw it
+static bool page_cache_move(void* frame, void* target){
+  struct PageCache* cache = reclaim_cache;
+  if (cache == NULL || !blocking_lock_try_acquire(&cache->lock)){
+    return false;
+  }
+
+  // an entry in the table is still on the LRU list and still owns this
+  // frame, because lru_remove() clears its slot
+  unsigned index = frame_index_from_address((unsigned)frame);
+  struct PageCacheEntry* entry = cache->frame_entries[index];
+  bool moved = false;
+  if (entry != NULL){
+    copy_page(target, frame);
+    entry->page_data = target;
+    cache->frame_entries[index] = NULL;
+    cache->frame_entries[frame_index_from_address((unsigned)target)] = entry;
+    moved = true;
+  }
+
+  blocking_lock_release(&cache->lock);
+  return moved;
+}
+
+// find a page in the page cache by inode and page index, valid or not.
+// caller holds cache lock
+static struct PageCacheEntry* page_cache_find(struct PageCache* cache, struct Node* node, unsigned offset){
   unsigned hash = ((unsigned)(node->cached) ^ offset) % cache->hash_map_size;
   struct PageCacheEntry* entry = cache->hash_map[hash];
   // iterate linked list until we find a match
   while (entry){
     if(entry->key.inode == node->cached && entry->key.offset == offset){
-      entry->refcount++;
       return entry;
     }
     entry = entry->next;
@@ -37,49 +274,341 @@ static struct PageCacheEntry* page_cache_lookup(struct PageCache* cache, struct
   return NULL;
 }
 
-// insert a page into the page cache. should not be called if the page may already exist
-// in the cache. does not acquire cache lock
-static struct PageCacheEntry* page_cache_insert(struct PageCache* cache, struct Node* node, 
-    unsigned offset, unsigned file_bytes, void* page_data){
+// take a reference to a valid entry. caller holds cache lock
+static void page_cache_ref(struct PageCache* cache, struct PageCacheEntry* entry){
+  if (entry->refcount == 0){
+    // resident but idle page is live again
+    lru_remove(cache, entry);
+  }
+  if (entry->flags & PAGE_READAHEAD){
+    entry->flags &= ~PAGE_READAHEAD;
+    cache->ra_hits++;
+  }
+  entry->refcount++;
+}
+
+// find a page and take a reference to it, first waiting out any read of it
+// that is still in flight. caller holds cache lock, which the wait drops
+static struct PageCacheEntry* page_cache_lookup(struct PageCache* cache, struct Node* node, unsigned offset){
+  struct PageCacheEntry* entry = page_cache_find(cache, node, offset);
+  while (entry != NULL && !entry->valid){
+    cache->fill_waiters++;
+    cond_var_wait(&cache->filled, &cache->lock);
+    cache->fill_waiters--;
+    // the page may have been evicted again since it was published
+    entry = page_cache_find(cache, node, offset);
+  }
+  if (entry != NULL){
+    page_cache_ref(cache, entry);
+  }
+  return entry;
+}
+
+// Insert a page that is not valid yet, referenced once by the caller, who
+// reads it with the cache lock dropped and then calls page_cache_publish().
+// should not be called if the page may already exist in the cache. caller
+// holds cache lock
+static struct PageCacheEntry* page_cache_insert(struct PageCache* cache, struct Node* node,
+    unsigned offset, unsigned file_bytes){
   unsigned hash = ((unsigned)(node->cached) ^ offset) % cache->hash_map_size;
-  struct PageCacheEntry* new_entry = malloc(sizeof(struct PageCacheEntry));
+  struct PageCacheEntry* new_entry = kmem_cache_alloc(entry_cache);
   new_entry->key.inode = node->cached;
   new_entry->key.offset = offset;
-  new_entry->page_data = page_data;
+  new_entry->page_data = NULL;
+  new_entry->node = node_clone(node);
   new_entry->refcount = 1;
   new_entry->flags = 0;
+  new_entry->valid = false;
   new_entry->file_bytes = file_bytes;
+  new_entry->lru_prev = NULL;
+  new_entry->lru_next = NULL;
 
   new_entry->next = cache->hash_map[hash];
   cache->hash_map[hash] = new_entry;
 
+  cache->resident_pages++;
+
   return new_entry;
 }
 
+// make an inserted entry's data visible and wake its waiters. caller holds
+// cache lock
+static void page_cache_publish(struct PageCache* cache, struct PageCacheEntry* entry, void* page_data){
+  entry->page_data = page_data;
+  entry->valid = true;
+  if (cache->fill_waiters > 0){
+    cond_var_broadcast(&cache->filled, &cache->lock);
+  }
+}
+
 // lookup a page if it is in the cache, insert into cache if not
 struct PageCacheEntry* page_cache_acquire(struct PageCache* cache, struct Node* node, unsigned offset, unsigned file_bytes){
   blocking_lock_acquire(&cache->lock);
 
   struct PageCacheEntry* entry = page_cache_lookup(cache, node, offset);
   if (entry){
+    cache->hits++;
+
+    // A retained page may have been loaded while the file was shorter. Let
+    // later users that cover more of the page extend its writeback range.
+    if (file_bytes > entry->file_bytes){
+      entry->file_bytes = file_bytes;
+    }
+
+    struct PageCacheEntry* reclaimed = page_cache_take_reclaimed(cache);
     blocking_lock_release(&cache->lock);
+    page_cache_free_entries(reclaimed);
     return entry;
   }
 
+  cache->misses++;
+  page_cache_shrink_locked(cache);
+
+  // Claim the page with an entry that is not valid yet, so the frame
+  // allocation and the disk read below run without the cache lock, like a
+  // block cache miss in bget().
+  entry = page_cache_insert(cache, node, offset, file_bytes);
+
+  struct PageCacheEntry* reclaimed = page_cache_take_reclaimed(cache);
+  blocking_lock_release(&cache->lock);
+  page_cache_free_entries(reclaimed);
+
   void* page_data = physmem_alloc(); // allocate a new page
 
   // load the page from disk into the newly allocated page_data
   unsigned bytes_read = node_read_all(node, offset, FRAME_SIZE, page_data);
 
   // zero remaining bytes
-  for (int i = bytes_read; i < FRAME_SIZE; i++){
-    ((char*)page_data)[i] = 0;
+  memset((char*)page_data + bytes_read, 0, FRAME_SIZE - bytes_read);
+
+  blocking_lock_acquire(&cache->lock);
+  page_cache_publish(cache, entry, page_data);
+  blocking_lock_release(&cache->lock);
+
+  return entry;
+}
+
+/*
+  Readahead
+
+  Every reader of a file keeps a struct Readahead. Read() keeps one per open
+  file descriptor, and the fault handler keeps one per file-backed VME.
+  page_cache_readahead() calls an access sequential when it starts where the
+  previous one ended. A sequential access opens the window or doubles it, and
+  any other access except a reread of the same range closes it.
+
+  While the window is open, the reader keeps up to `window` pages past its
+  current position queued. A new request goes out once less than half a window
+  is still queued ahead, so a steady reader queues about one request per half
+  window instead of one per page.
+
+  Requests are served by a readahead thread that is started when the first
+  request is queued and exits when the queue is empty. It claims each run of
+  up to 2^PAGE_CACHE_RA_BATCH_ORDER pages that are not resident yet with
+  entries that are not valid, then drops the cache lock and reads the whole
+  run with one node_read_all() into contiguous frames. The pages are then
+  published as unreferenced entries on the LRU list, marked PAGE_READAHEAD
+  until someone looks them up. A reader that faults on one of them meanwhile
+  waits for the run instead of reading the page again. The thread stops early
+  when free frames run low, so readahead never evicts pages to make room for
+  itself.
+*/
+
+// Read the first run of missing pages in [offset, end) of a file of `size`
+// bytes, up to 2^PAGE_CACHE_RA_BATCH_ORDER pages, and leave them unreferenced
+// on the LRU list. Returns the offset after the pages it covered.
+static unsigned page_cache_fill(struct PageCache* cache, struct Node* node, unsigned offset,
+    unsigned end, unsigned size){
+  struct PageCacheEntry* run[1 << PAGE_CACHE_RA_BATCH_ORDER];
+  unsigned count = 0;
+
+  blocking_lock_acquire(&cache->lock);
+
+  // skip pages that are already resident or being read
+  while (offset < end && page_cache_find(cache, node, offset) != NULL){
+    offset += FRAME_SIZE;
+  }
+
+  // claim the missing pages that follow, up to the next resident one
+  while (count < (1u << PAGE_CACHE_RA_BATCH_ORDER) && offset + count * FRAME_SIZE < end){
+    unsigned page_offset = offset + count * FRAME_SIZE;
+    if (page_cache_find(cache, node, page_offset) != NULL){
+      break;
+    }
+    unsigned file_bytes = size - page_offset < FRAME_SIZE ? size - page_offset : FRAME_SIZE;
+    run[count] = page_cache_insert(cache, node, page_offset, file_bytes);
+    count++;
+  }
+
+  blocking_lock_release(&cache->lock);
+
+  if (count == 0){
+    return offset;
+  }
+
+  int order = 0;
+  while ((1u << order) < count){
+    order++;
+  }
+  char* frames = physmem_alloc_frames(order);
+  for (unsigned i = count; i < (1u << order); i++){
+    physmem_free(frames + i * FRAME_SIZE);
   }
 
-  entry = page_cache_insert(cache, node, offset, file_bytes, page_data);
+  unsigned bytes_read = node_read_all(node, offset, count * FRAME_SIZE, frames);
+  memset(frames + bytes_read, 0, count * FRAME_SIZE - bytes_read);
 
+  blocking_lock_acquire(&cache->lock);
+  for (unsigned i = 0; i < count; i++){
+    struct PageCacheEntry* entry = run[i];
+    page_cache_publish(cache, entry, frames + i * FRAME_SIZE);
+    entry->refcount--;
+    entry->flags |= PAGE_READAHEAD;
+    cache->ra_pages++;
+    if (entry->refcount == 0){
+      lru_push_tail(cache, entry);
+      // an unlinked file will never be looked up again, so stop pinning it
+      if (entry->key.inode->delete_pending){
+        page_cache_evict_locked(cache, entry);
+      }
+    }
+  }
+  struct PageCacheEntry* reclaimed = page_cache_take_reclaimed(cache);
   blocking_lock_release(&cache->lock);
+  page_cache_free_entries(reclaimed);
+
+  return offset + count * FRAME_SIZE;
+}
 
+static void page_cache_ra_thread(void* arg){
+  struct PageCache* cache = *(struct PageCache**)arg;
+
+  while (true){
+    blocking_lock_acquire(&cache->ra_lock);
+    struct ReadaheadRequest* request = cache->ra_head;
+    if (request == NULL){
+      cache->ra_running = false;
+      blocking_lock_release(&cache->ra_lock);
+      return;
+    }
+    cache->ra_head = request->next;
+    if (cache->ra_head == NULL){
+      cache->ra_tail = NULL;
+    }
+    blocking_lock_release(&cache->ra_lock);
+
+    unsigned size = node_size_in_bytes(request->node);
+    unsigned end = request->end < size ? request->end : size;
+    unsigned offset = request->offset;
+    while (offset < end){
+      // leave the frames near the watermark to real misses
+      if (physmem_free_frames() < 2 * PAGE_CACHE_LOW_WATERMARK ||
+          request->node->cached->delete_pending){
+        break;
+      }
+      offset = page_cache_fill(cache, request->node, offset, end, size);
+    }
+
+    node_free(request->node);
+    free(request);
+  }
+}
+
+static void page_cache_queue_readahead(struct PageCache* cache, struct Node* node,
+    unsigned offset, unsigned end){
+  struct ReadaheadRequest* request = malloc(sizeof(struct ReadaheadRequest));
+  request->node = node_clone(node);
+  request->offset = offset;
+  request->end = end;
+  request->next = NULL;
+
+  blocking_lock_acquire(&cache->ra_lock);
+  if (cache->ra_tail != NULL){
+    cache->ra_tail->next = request;
+  } else {
+    cache->ra_head = request;
+  }
+  cache->ra_tail = request;
+  bool start = !cache->ra_running;
+  cache->ra_running = true;
+  blocking_lock_release(&cache->ra_lock);
+
+  if (start){
+    // free_fun() frees the argument when the thread exits, so pass a copy
+    struct PageCache** arg = malloc(sizeof(struct PageCache*));
+    *arg = cache;
+    struct Fun* fun = malloc(sizeof(struct Fun));
+    fun->func = page_cache_ra_thread;
+    fun->arg = arg;
+    thread_(fun, NORMAL_PRIORITY, ANY_CORE);
+  }
+}
+
+void readahead_init(struct Readahead* ra, unsigned offset){
+  ra->start = offset;
+  ra->next = offset;
+  ra->ahead = offset;
+  ra->window = 0;
+}
+
+void page_cache_readahead(struct PageCache* cache, struct Readahead* ra, struct Node* node,
+    unsigned offset, unsigned pages){
+  unsigned end = offset + pages * FRAME_SIZE;
+
+  if (offset == ra->next){
+    ra->window = ra->window == 0 ? PAGE_CACHE_RA_MIN : ra->window * 2;
+    if (ra->window > PAGE_CACHE_RA_MAX){
+      ra->window = PAGE_CACHE_RA_MAX;
+    }
+  } else if (offset < ra->start || offset > ra->next){
+    ra->window = 0;
+  }
+  ra->start = offset;
+  if (end > ra->next || ra->window == 0){
+    ra->next = end;
+  }
+
+  if (ra->window == 0){
+    ra->ahead = ra->next;
+    return;
+  }
+
+  // nothing past the end of the file
+  unsigned size = node_size_in_bytes(node);
+  unsigned limit = ra->next + ra->window * FRAME_SIZE;
+  unsigned file_end = (size + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+  if (limit > file_end){
+    limit = file_end;
+  }
+
+  if (ra->ahead < ra->next){
+    ra->ahead = ra->next;
+  }
+  if (ra->ahead < limit && ra->ahead - ra->next < ra->window * FRAME_SIZE / 2){
+    page_cache_queue_readahead(cache, node, ra->ahead, limit);
+    ra->ahead = limit;
+  }
+}
+
+// reference a page only if it is already resident, never doing I/O
+struct PageCacheEntry* page_cache_acquire_resident(struct PageCache* cache, struct Node* node, unsigned offset, unsigned file_bytes){
+  blocking_lock_acquire(&cache->lock);
+
+  // a page whose read is still in flight counts as not resident
+  struct PageCacheEntry* entry = page_cache_find(cache, node, offset);
+  if (entry != NULL && !entry->valid){
+    entry = NULL;
+  }
+  if (entry != NULL){
+    page_cache_ref(cache, entry);
+    if (file_bytes > entry->file_bytes){
+      entry->file_bytes = file_bytes;
+    }
+  }
+
+  struct PageCacheEntry* reclaimed = page_cache_take_reclaimed(cache);
+  blocking_lock_release(&cache->lock);
+  page_cache_free_entries(reclaimed);
   return entry;
 }
 
@@ -102,37 +631,126 @@ void page_cache_mark_dirty(struct PageCache* cache, struct Node* node, unsigned
 }
 
 // release a page from the page cache
-// decrementing its reference count and freeing it if the count reaches zero
+// decrementing its reference count; the last release writes back dirty data
+// so the file is current, then leaves the clean page resident for later hits
 void page_cache_release(struct PageCache* cache, struct Node* node, unsigned offset){
   unsigned hash = ((unsigned)(node->cached) ^ offset) % cache->hash_map_size;
   blocking_lock_acquire(&cache->lock);
   struct PageCacheEntry* entry = cache->hash_map[hash];
-  struct PageCacheEntry* prev = NULL;
   while (entry){
     if (entry->key.inode == node->cached && entry->key.offset == offset){
-      if (entry->refcount > 1){
-        // still live reference, just decrement refcount
-        entry->refcount--;
-      } else {
-        // no more references, remove from hash map and free
-        if (prev){
-          prev->next = entry->next;
-        } else {
-          cache->hash_map[hash] = entry->next;
-        }
-
+      assert(entry->refcount > 0, "page_cache_release: page is not referenced.\n");
+      entry->refcount--;
+      if (entry->refcount == 0){
         // no need to write back clean pages
         if (entry->flags & PAGE_DIRTY){
-          node_write_all(node, offset, entry->file_bytes, entry->page_data);
+          node_write_back(node, offset, entry->file_bytes, entry->page_data);
+          entry->flags &= ~PAGE_DIRTY;
+          cache->writebacks++;
         }
 
-        physmem_free(entry->page_data);
-        free(entry);
+        lru_push_tail(cache, entry);
+
+        // an unlinked file will never be looked up again, so stop pinning it
+        if (entry->key.inode->delete_pending){
+          page_cache_evict_locked(cache, entry);
+        }
       }
       break;
     }
-    prev = entry;
     entry = entry->next;
   }
+
+  struct PageCacheEntry* reclaimed = page_cache_take_reclaimed(cache);
+  blocking_lock_release(&cache->lock);
+  page_cache_free_entries(reclaimed);
+}
+
+void page_cache_write_begin(struct PageCache* cache, struct Node* node, unsigned offset,
+    unsigned size){
+  unsigned end = offset + size;
+  blocking_lock_acquire(&cache->lock);
+
+  // A read in flight may miss the write and publish old bytes after the
+  // patch. Each wait drops the lock, so rescan the whole range after it.
+  unsigned page = offset - offset % FRAME_SIZE;
+  while (page < end){
+    struct PageCacheEntry* entry = page_cache_find(cache, node, page);
+    if (entry != NULL && !entry->valid){
+      cache->fill_waiters++;
+      cond_var_wait(&cache->filled, &cache->lock);
+      cache->fill_waiters--;
+      page = offset - offset % FRAME_SIZE;
+    } else {
+      page += FRAME_SIZE;
+    }
+  }
+}
+
+void page_cache_write_end(struct PageCache* cache, struct Node* node, unsigned offset,
+    unsigned size, char* src){
+  unsigned end = offset + size;
+  for (unsigned page = offset - offset % FRAME_SIZE; page < end; page += FRAME_SIZE){
+    struct PageCacheEntry* entry = page_cache_find(cache, node, page);
+    if (entry == NULL){
+      continue;
+    }
+
+    unsigned from = offset > page ? offset : page;
+    unsigned to = end < page + FRAME_SIZE ? end : page + FRAME_SIZE;
+    memcpy((char*)entry->page_data + (from - page), src + (from - offset), to - from);
+    if (to - page > entry->file_bytes){
+      entry->file_bytes = to - page;
+    }
+  }
   blocking_lock_release(&cache->lock);
 }
+
+void page_cache_sync(struct PageCache* cache, struct CachedInode* inode){
+  blocking_lock_acquire(&cache->lock);
+  for (unsigned i = 0; i < cache->hash_map_size; i++){
+    for (struct PageCacheEntry* entry = cache->hash_map[i]; entry; entry = entry->next){
+      if (!(entry->flags & PAGE_DIRTY) || (inode != NULL && entry->key.inode != inode)){
+        continue;
+      }
+      // dirty pages are mapped writable and can change again, so the flag
+      // stays set for the last release to write them back once more
+      node_write_back(entry->node, entry->key.offset, entry->file_bytes, entry->page_data);
+      cache->writebacks++;
+    }
+  }
+  blocking_lock_release(&cache->lock);
+}
+
+void page_cache_invalidate_inode(struct PageCache* cache, struct CachedInode* inode){
+  blocking_lock_acquire(&cache->lock);
+  struct PageCacheEntry* entry = cache->lru_head;
+  while (entry){
+    struct PageCacheEntry* next = entry->lru_next;
+    if (entry->key.inode == inode){
+      page_cache_evict_locked(cache, entry);
+    }
+    entry = next;
+  }
+  struct PageCacheEntry* reclaimed = page_cache_take_reclaimed(cache);
+  blocking_lock_release(&cache->lock);
+  page_cache_free_entries(reclaimed);
+}
+
+// to be called only from kernel_shutdown
+void page_cache_drain(struct PageCache* cache){
+  blocking_lock_acquire(&cache->lock);
+  while (cache->lru_head != NULL){
+    page_cache_evict_locked(cache, cache->lru_head);
+  }
+  struct PageCacheEntry* reclaimed = page_cache_take_reclaimed(cache);
+  blocking_lock_release(&cache->lock);
+  page_cache_free_entries(reclaimed);
+}
+
+void page_cache_print_stats(struct PageCache* cache){
+  int args[8] = {cache->hits, cache->misses, cache->evictions,
+    cache->writebacks, cache->resident_pages, cache->ra_pages, cache->ra_hits, cache->ra_wasted};
+  say("| Page cache: hits=%d misses=%d evictions=%d writebacks=%d resident=%d"
+    " readahead=%d used=%d wasted=%d\n", args);
+}
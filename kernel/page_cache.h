@@ -3,6 +3,8 @@
 
 #include "ext.h"
 #include "blocking_lock.h"
+#include "cond_var.h"
+#include "readahead.h"
 
 // Page Cache is indexed by inode and page index
 struct PageCacheKey {
@@ -11,19 +13,55 @@ struct PageCacheKey {
 };
 
 #define PAGE_DIRTY 0x1
+// read ahead of any request and not used since
+#define PAGE_READAHEAD 0x2
+
+// Unreferenced pages stay resident until free buddy frames drop below this
+// watermark, at which point misses evict from the cold end of the LRU list.
+#define PAGE_CACHE_LOW_WATERMARK 512
+
+// Readahead windows start at PAGE_CACHE_RA_MIN pages once access looks
+// sequential and double on every further sequential access, up to
+// PAGE_CACHE_RA_MAX.
+#define PAGE_CACHE_RA_MIN 4
+#define PAGE_CACHE_RA_MAX 32
+
+// The readahead thread reads up to 2^PAGE_CACHE_RA_BATCH_ORDER missing pages
+// with one node_read_all() into one block of contiguous frames.
+#define PAGE_CACHE_RA_BATCH_ORDER 3
+
+// a range of pages queued for the readahead thread
+struct ReadaheadRequest {
+  struct Node* node; // cloned wrapper that pins the inode until the request is done
+  unsigned offset;
+  unsigned end;
+  struct ReadaheadRequest* next;
+};
 
 // metadata for the page cache entry
 struct PageCacheEntry {
   struct PageCacheKey key;
   void* page_data;
 
+  // cloned wrapper that pins the inode while the page is resident, so the key
+  // cannot be reused by another inode and eviction can still write back
+  struct Node* node;
+
   unsigned refcount;
   unsigned flags;
 
+  // false while the first read of the page is in flight; the reader holds a
+  // reference, and everyone else waits on the cache's `filled` condition
+  bool valid;
+
   // how many bytes of the file this page actually contains
   unsigned file_bytes;
 
   struct PageCacheEntry* next;
+
+  // LRU list of resident pages with refcount 0, oldest at the head
+  struct PageCacheEntry* lru_prev;
+  struct PageCacheEntry* lru_next;
 };
 
 // page cache storing file pages
@@ -31,26 +69,107 @@ struct PageCache {
   struct PageCacheEntry** hash_map;
   unsigned hash_map_size;
 
+  struct PageCacheEntry* lru_head;
+  struct PageCacheEntry* lru_tail;
+
+  // entries evicted by the physmem reclaim hook; their frames are already
+  // freed, but the metadata and node wrappers are freed later from a context
+  // that is allowed to use the heap
+  struct PageCacheEntry* reclaimed;
+
+  unsigned resident_pages;
+  unsigned lru_pages;
+
+  unsigned hits;
+  unsigned misses;
+  unsigned evictions;
+  unsigned writebacks;
+
+  // pages read ahead, how many of them were used before eviction, and how
+  // many were evicted unused
+  unsigned ra_pages;
+  unsigned ra_hits;
+  unsigned ra_wasted;
+
   struct BlockingLock lock;
+
+  // entry owning each LRU page's frame, indexed by frame number. Set when the
+  // entry joins the LRU list and cleared when it leaves, so compaction marks
+  // and moves pages without walking the list.
+  struct PageCacheEntry** frame_entries;
+
+  // threads waiting for an entry to become valid
+  struct CondVar filled;
+  unsigned fill_waiters;
+
+  // requests for the readahead thread, which runs only while there are any
+  struct ReadaheadRequest* ra_head;
+  struct ReadaheadRequest* ra_tail;
+  bool ra_running;
+  struct BlockingLock ra_lock;
 };
 
+extern struct PageCache page_cache;
+
 // initialize the page cache
 void page_cache_init(struct PageCache* cache);
 
 // destroy page-cache synchronization after all mappings/cache users are gone
 void page_cache_destroy(struct PageCache* cache);
 
-// lookup a page if it is in the cache, insert into cache if not
-struct PageCacheEntry* page_cache_acquire(struct PageCache* cache, struct Node* node, 
+// lookup a page if it is in the cache, insert into cache if not. The disk read
+// of a miss runs without the cache lock; other users of that page wait for it.
+struct PageCacheEntry* page_cache_acquire(struct PageCache* cache, struct Node* node,
+    unsigned offset, unsigned file_bytes);
+
+// like page_cache_acquire, but only takes a reference if the page is already
+// resident and valid; returns NULL instead of reading it from disk or waiting
+// for another thread's read
+struct PageCacheEntry* page_cache_acquire_resident(struct PageCache* cache, struct Node* node,
     unsigned offset, unsigned file_bytes);
 
+// Note that a reader touched `pages` pages of `node` starting at page-aligned
+// `offset`. Continuing where the previous access ended grows the window, and
+// a jump elsewhere resets it. While the window is open, the pages up to
+// `window` past the access are queued for the readahead thread, which loads
+// them into the cache asynchronously. Never blocks on disk I/O.
+void page_cache_readahead(struct PageCache* cache, struct Readahead* ra, struct Node* node,
+    unsigned offset, unsigned pages);
+
 // Conservatively mark one cached page dirty. Shared writable mappings call this
 // when they expose a cache page directly to userspace because the ISA does not
 // currently provide a hardware dirty bit for later writeback decisions.
 void page_cache_mark_dirty(struct PageCache* cache, struct Node* node, unsigned offset);
 
 // release a page from the page cache
-// decrementing its reference count and freeing it if the count reaches zero
+// decrementing its reference count; when it reaches zero the page is written
+// back if dirty and kept resident on the LRU list until memory pressure
 void page_cache_release(struct PageCache* cache, struct Node* node, unsigned offset);
 
+// Bracket a direct node_write_all() of `size` bytes at `offset` of `node`.
+// write_begin waits out reads of those pages still in flight and returns with
+// the cache lock held, so no new read of them can start. write_end copies the
+// written bytes into every cached page they overlap, idle or mapped, and drops
+// the lock. The caller takes the inode lock in between, in the same order as
+// page-cache writeback.
+void page_cache_write_begin(struct PageCache* cache, struct Node* node, unsigned offset,
+    unsigned size);
+void page_cache_write_end(struct PageCache* cache, struct Node* node, unsigned offset,
+    unsigned size, char* src);
+
+// write back every dirty cached page of `inode`, or of every inode if it is
+// NULL, without waiting for the last release. Used by fsync() and sync().
+void page_cache_sync(struct PageCache* cache, struct CachedInode* inode);
+
+// drop every unreferenced cached page of `inode`. Called once an inode is
+// pending delete so the cache stops pinning it.
+void page_cache_invalidate_inode(struct PageCache* cache, struct CachedInode* inode);
+
+// write back and free every unreferenced cached page
+// to be called only from kernel_shutdown, before the filesystem is destroyed
+void page_cache_drain(struct PageCache* cache);
+
+// print hit/miss/eviction and readahead counters
+void page_cache_print_stats(struct PageCache* cache);
+
 #endif // PAGE_CACHE_H
@@ -29,8 +29,16 @@ struct PerCore {
   // allocator
   struct PhysmemLocalCache physmem_cache;
 
-  struct FreeObject* free_lists[NUM_OBJECT_SIZES];
-  unsigned free_list_sizes[NUM_OBJECT_SIZES];
+  // loaded and spare heap magazines per size class, see heap.c
+  struct Magazines heap_magazines[NUM_OBJECT_SIZES];
+
+  // heap allocations and requested bytes per size class, see heap_print_stats()
+  unsigned heap_allocs[NUM_OBJECT_SIZES];
+  unsigned heap_requested_bytes[NUM_OBJECT_SIZES];
+
+  // TLB flushes on this core: one per context switch, plus one in
+  // vmem_core_init(). 0 until the core starts. See vmalloc_purge().
+  unsigned tlb_flushes;
 };
 
 extern struct PerCore per_core_data[MAX_CORES];
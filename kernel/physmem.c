@@ -6,12 +6,32 @@
 #include "blocking_lock.h"
 #include "per_core.h"
 #include "threads.h"
+#include "string.h"
 
 static struct BlockingLock physmem_lock;
 
 static struct FreePageNode* free_page_list[PHYS_FRAME_MAX_ORDER_PLUS_ONE];
 static unsigned char free_page_bitmap[FREE_PAGE_BITMAP_SIZE];
 
+static unsigned free_frame_count = 0;
+
+static unsigned (*reclaimers[PHYSMEM_MAX_RECLAIMERS])(unsigned frames);
+static int num_reclaimers = 0;
+
+// owners of movable frames, see "Compaction" below
+static void (*mover_marks[PHYSMEM_MAX_MOVERS])(unsigned first, unsigned count);
+static bool (*mover_moves[PHYSMEM_MAX_MOVERS])(void* frame, void* target);
+static int num_movers = 0;
+
+// frames the movers reported as movable in the current compaction pass. Only
+// the bits of the pass's candidate window are cleared and filled.
+static unsigned char movable_bitmap[FREE_PAGE_BITMAP_SIZE];
+// frame where the next compaction pass starts looking for a candidate block
+static unsigned compact_cursor = 0;
+
+// frames of the compaction candidate that the pass already owns, by offset
+static bool compact_owned[PHYSMEM_COMPACT_MAX_FRAMES];
+
 static int frames_alloced = 0;
 static int frames_freed = 0;
 static int frames_leaked = 0;
@@ -22,6 +42,22 @@ static int order_leaks[PHYS_FRAME_MAX_ORDER_PLUS_ONE];
 
 static bool physmem_sync_initialized = false;
 
+// zero-pool counters, reported by physmem_print_stats()
+static int zeroed_hits = 0; // physmem_alloc_zeroed() served from the pool
+static int zeroed_misses = 0; // physmem_alloc_zeroed() zeroed synchronously
+static int zeroed_by_idle = 0; // frames zeroed by idle threads
+
+// compaction counters, reported by physmem_print_stats()
+static int compact_attempts = 0;
+static int compact_successes = 0; // passes that assembled a block
+static int compact_failures = 0; // no candidate, or a move was refused
+static int compact_moved = 0; // frames migrated
+static int compact_idle = 0; // blocks assembled by idle threads
+
+// free frame count after the last failed idle pass; idle threads retry only
+// once something was freed or allocated since
+static unsigned compact_idle_failed_at = UINT_MAX;
+
 // sanity check that something could be a frame address
 static bool physmem_is_frame_address(unsigned phys_addr) {
   if (phys_addr < FRAMES_ADDR_START || phys_addr >= FRAMES_ADDR_END) {
@@ -71,6 +107,7 @@ static void free_list_push(struct FreePageNode* block_addr, int order) {
 
   mark_block_free(block_index);
   node->free_order = order;
+  free_frame_count += (1u << order);
 }
 
 // remove and return block from head of free list for given order, or NULL if empty
@@ -92,6 +129,7 @@ static struct FreePageNode* free_list_pop(int order) {
 
   unsigned block_index = frame_index_from_address((unsigned)node);
   mark_block_allocated(block_index);
+  free_frame_count -= (1u << order);
 
   return node;
 }
@@ -116,6 +154,7 @@ static struct FreePageNode* free_list_remove(struct FreePageNode* node) {
 
   // mark block as allocated
   mark_block_allocated(block_index);
+  free_frame_count -= (1u << order);
 
   node->prev = NULL;
   node->next = NULL;
@@ -162,6 +201,11 @@ void physmem_init(void){
     for (int j = 0; j < LOCAL_CACHE_SIZE; j++) {
       per_core_data[i].physmem_cache.pages[j] = NULL;
     }
+    for (int j = 0; j < PHYSMEM_MAX_CACHED_ORDER; j++) {
+      per_core_data[i].physmem_cache.block_count[j] = 0;
+    }
+    per_core_data[i].physmem_cache.zeroed_count = 0;
+    per_core_data[i].physmem_cache.zeroed_demand = 0;
   }
 }
 
@@ -193,21 +237,37 @@ void physmem_destroy_locks(void){
   }
 }
 
-// allocate a physical page of given order
-// Panics if no free frames remain
-void* physmem_alloc_order(int order){
-  assert(order >= 0 && order <= PHYS_FRAME_MAX_ORDER, "physmem alloc: invalid order.\n");
+void physmem_register_reclaim(unsigned (*reclaim)(unsigned frames)){
+  assert(num_reclaimers < PHYSMEM_MAX_RECLAIMERS, "physmem: too many reclaim callbacks.\n");
+  reclaimers[num_reclaimers] = reclaim;
+  num_reclaimers++;
+}
 
-  if (physmem_sync_initialized) blocking_lock_acquire(&physmem_lock);
+// ask every registered reclaimer to give frames back, returning the total freed
+// must be called without physmem_lock held
+static unsigned physmem_reclaim(unsigned frames){
+  // Free frames parked in per-core caches cost nothing to give back, so take
+  // them before asking anyone to drop real data. A reclaimer whose frees land
+  // in a cache is picked up by the next drain when the caller rescans.
+  unsigned freed = physmem_drain_caches();
+  for (int i = 0; i < num_reclaimers && freed < frames; i++) {
+    freed += reclaimers[i](frames - freed);
+  }
+  return freed;
+}
 
-  __atomic_fetch_add(&order_allocs[order], 1);
+unsigned physmem_free_frames(void){
+  return __atomic_load_n(&free_frame_count);
+}
 
+// take one block of given order from the buddy lists, splitting a larger block
+// if needed; returns NULL if nothing large enough is free. caller holds
+// physmem_lock
+static void* buddy_take_locked(int order){
   // find smallest order large enough to satisfy the request
   int current_order = order;
   while (free_page_list[current_order] == NULL) {
     if (current_order >= PHYS_FRAME_MAX_ORDER) {
-      if (physmem_sync_initialized) blocking_lock_release(&physmem_lock);
-      panic("physmem alloc: out of physical pages.\n");
       return NULL;
     }
     current_order++;
@@ -225,8 +285,6 @@ void* physmem_alloc_order(int order){
     free_list_push(buddy, current_order);
   }
 
-  if (physmem_sync_initialized) blocking_lock_release(&physmem_lock);
-
   assert(
     physmem_is_frame_address((unsigned)node),
     "physmem alloc: free list returned an invalid frame address.\n"
@@ -235,28 +293,10 @@ void* physmem_alloc_order(int order){
   return node;
 }
 
-void* physmem_leak_order(int order){
-  void* page = physmem_alloc_order(order);
-  __atomic_fetch_add(&order_leaks[order], 1);
-  return page;
-}
-
-// free a physical page of given order
-void physmem_free_order(void* page, int order){
+// return one block of given order to the buddy lists, coalescing upward.
+// caller holds physmem_lock
+static void buddy_put_locked(void* page, int order){
   unsigned phys_addr = (unsigned)page;
-  assert(page != NULL, "physmem free: page is NULL.\n");
-  assert(
-    physmem_is_frame_address(phys_addr),
-    "physmem free: page is not a valid allocatable frame.\n"
-  );
-
-  assert(order >= 0 && order <= PHYS_FRAME_MAX_ORDER, "physmem free: invalid order.\n");
-  assert((frame_index_from_address(phys_addr) & ((1u << order) - 1)) == 0, 
-    "physmem free: page address is not aligned to its size.\n");
-
-  if (physmem_sync_initialized) blocking_lock_acquire(&physmem_lock);
-
-  __atomic_fetch_add(&order_frees[order], 1);
 
   // coalesce with buddy blocks if possible
   unsigned block_index = frame_index_from_address(phys_addr);
@@ -278,7 +318,7 @@ void physmem_free_order(void* page, int order){
     }
 
     // remove buddy from free list
-    struct FreePageNode* buddy = free_list_remove((struct FreePageNode*)buddy_addr);
+    free_list_remove(buddy_node);
 
     // update block index to the combined block
     if (buddy_index < block_index) {
@@ -291,8 +331,407 @@ void physmem_free_order(void* page, int order){
   // add the (possibly coalesced) block back to the free list
   unsigned block_addr = address_from_frame_index(block_index);
   free_list_push((struct FreePageNode*)block_addr, order);
+}
+
+/*
+ * Compaction.
+ *
+ * A high-order request can fail while thousands of order-0 frames are free,
+ * because a few allocated frames sit between them. Some of those frames are
+ * movable: their owner can copy the contents to another frame and swap its
+ * one pointer, because nothing else refers to the frame. Movers register a
+ * mark callback, which reports its movable frames inside a range of frame
+ * indices with physmem_mark_movable(), and a move callback.
+ *
+ * A pass only asks the movers about the window of blocks it is going to scan,
+ * so marking costs the size of the window, not the number of movable frames.
+ * It picks the aligned block of the requested order whose frames are all free
+ * or movable, with the fewest movable ones. It takes the free pieces out of
+ * the lists, so no replacement frame can land inside, and moves every other
+ * frame out. The whole pass runs under physmem_lock. Movers must therefore
+ * only try-lock and must never call into physmem from their callbacks.
+ *
+ * Frames mapped by a PTE are never movable. There is no reverse map to find the
+ * PTE, and TLB invalidation is core-local, so another core could keep writing
+ * to the old frame.
+ */
+
+static bool frame_movable(unsigned index){
+  return movable_bitmap[index / 8] & (1u << (index % 8));
+}
+
+void physmem_mark_movable(void* frame){
+  unsigned index = frame_index_from_address((unsigned)frame);
+  movable_bitmap[index / 8] |= (1u << (index % 8));
+}
+
+void physmem_register_mover(void (*mark)(unsigned first, unsigned count),
+    bool (*move)(void* frame, void* target)){
+  assert(num_movers < PHYSMEM_MAX_MOVERS, "physmem: too many compaction movers.\n");
+  mover_marks[num_movers] = mark;
+  mover_moves[num_movers] = move;
+  num_movers++;
+}
+
+// number of movable frames in the aligned block at `base`, or -1 if some frame
+// in it is neither free nor movable. No free block of `order` or larger
+// exists, so every free block met here lies entirely inside.
+static int compact_candidate_cost(unsigned base, unsigned size){
+  int moves = 0;
+  unsigned index = base;
+  while (index < base + size) {
+    if (is_block_free(index)) {
+      struct FreePageNode* node = (struct FreePageNode*)address_from_frame_index(index);
+      if ((1u << node->free_order) >= size) {
+        return -1; // a block this large is free, so nobody needs the pass
+      }
+      index += 1u << node->free_order;
+    } else if (frame_movable(index)) {
+      moves++;
+      index++;
+    } else {
+      return -1;
+    }
+  }
+  return moves;
+}
+
+// clear the movable bits of frames [first, first + count) and have every mover
+// report its movable frames there
+static void compact_mark(unsigned first, unsigned count) {
+  for (unsigned index = first; index < first + count; index++) {
+    movable_bitmap[index / 8] &= ~(1u << (index % 8));
+  }
+  for (int i = 0; i < num_movers; i++) {
+    mover_marks[i](first, count);
+  }
+}
+
+// ask each mover to migrate `frame` to `target`
+static bool compact_move(void* frame, void* target){
+  for (int i = 0; i < num_movers; i++) {
+    if (mover_moves[i](frame, target)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Try to assemble a free block of `order` by moving frames out of the way.
+// Returns the block, already out of the free lists, or NULL. caller holds
+// physmem_lock
+static void* physmem_compact_locked(int order){
+  if (num_movers == 0 || order < 1 || order > PHYSMEM_COMPACT_MAX_ORDER) {
+    return NULL;
+  }
+  compact_attempts++;
+
+  unsigned size = 1u << order;
+  unsigned blocks = PHYS_FRAME_COUNT / size;
+  unsigned scan = blocks < PHYSMEM_COMPACT_SCAN_BLOCKS ? blocks : PHYSMEM_COMPACT_SCAN_BLOCKS;
+  unsigned block = (compact_cursor / size) % blocks;
+
+  // the window of scanned blocks wraps at the last whole block
+  unsigned head = blocks - block < scan ? blocks - block : scan;
+  compact_mark(block * size, head * size);
+  if (head < scan) {
+    compact_mark(0, (scan - head) * size);
+  }
+  unsigned best = UINT_MAX;
+  int best_moves = 0;
+  for (unsigned n = 0; n < scan; n++) {
+    unsigned base = block * size;
+    block = (block + 1) % blocks;
+    int moves = compact_candidate_cost(base, size);
+    if (moves >= 0 && (best == UINT_MAX || moves < best_moves)) {
+      best = base;
+      best_moves = moves;
+      if (moves <= 1) {
+        break;
+      }
+    }
+  }
+  compact_cursor = block * size;
+  if (best == UINT_MAX) {
+    compact_failures++;
+    return NULL;
+  }
+
+  // isolate the free pieces so replacement frames come from elsewhere
+  for (unsigned i = 0; i < size; i++) {
+    compact_owned[i] = false;
+  }
+  unsigned index = best;
+  while (index < best + size) {
+    if (is_block_free(index)) {
+      struct FreePageNode* node = (struct FreePageNode*)address_from_frame_index(index);
+      unsigned piece = 1u << node->free_order;
+      free_list_remove(node);
+      for (unsigned i = 0; i < piece; i++) {
+        compact_owned[index - best + i] = true;
+      }
+      index += piece;
+    } else {
+      index++;
+    }
+  }
+
+  bool ok = true;
+  for (unsigned i = 0; i < size && ok; i++) {
+    if (compact_owned[i]) {
+      continue;
+    }
+    void* frame = (void*)address_from_frame_index(best + i);
+    void* target = buddy_take_locked(0);
+    if (target == NULL) {
+      ok = false;
+    } else if (!compact_move(frame, target)) {
+      // the owner took a reference since marking, or its lock is busy
+      buddy_put_locked(target, 0);
+      ok = false;
+    } else {
+      compact_owned[i] = true;
+      compact_moved++;
+    }
+  }
+
+  if (!ok) {
+    // give back what the pass owns; the buddy lists merge it again
+    for (unsigned i = 0; i < size; i++) {
+      if (compact_owned[i]) {
+        buddy_put_locked((void*)address_from_frame_index(best + i), 0);
+      }
+    }
+    compact_failures++;
+    return NULL;
+  }
+
+  compact_successes++;
+  return (void*)address_from_frame_index(best);
+}
+
+// take one block of given order from the buddy lists, splitting larger blocks
+// Panics if no free frames remain
+static void* buddy_alloc(int order){
+  if (physmem_sync_initialized) blocking_lock_acquire(&physmem_lock);
+
+  bool drained = false;
+  void* node = buddy_take_locked(order);
+  while (node == NULL) {
+    // Nothing large enough is free. Frames parked in per-core caches are the
+    // cheapest to get back, so drain those first. Then a high-order request
+    // tries to assemble a block by moving frames, and only after that do the
+    // reclaimers drop cached data.
+    if (drained) {
+      node = physmem_compact_locked(order);
+      if (node != NULL) {
+        break;
+      }
+    }
+
+    // Drop the buddy lock so the drain and reclaimers can free frames back to
+    // us, then rescan from the requested order.
+    if (physmem_sync_initialized) blocking_lock_release(&physmem_lock);
+    if (!drained) {
+      physmem_drain_caches();
+      drained = true;
+    } else if (physmem_reclaim(1u << order) == 0) {
+      panic("physmem alloc: out of physical pages.\n");
+      return NULL;
+    }
+    if (physmem_sync_initialized) blocking_lock_acquire(&physmem_lock);
+    node = buddy_take_locked(order);
+  }
+
+  if (physmem_sync_initialized) blocking_lock_release(&physmem_lock);
+  return node;
+}
+
+// return one block of given order to the buddy lists, coalescing upward
+static void buddy_free(void* page, int order){
+  if (physmem_sync_initialized) blocking_lock_acquire(&physmem_lock);
+  buddy_put_locked(page, order);
+  if (physmem_sync_initialized) blocking_lock_release(&physmem_lock);
+}
+
+// true if some free block has at least the given order
+static bool free_block_at_least(int order){
+  for (; order <= PHYS_FRAME_MAX_ORDER; order++) {
+    if (free_page_list[order] != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool physmem_compact_idle(void){
+  // unlocked peeks: nothing to do while a large enough block is free, or
+  // while nothing changed since the last pass failed
+  if (free_block_at_least(PHYSMEM_COMPACT_IDLE_ORDER) ||
+      __atomic_load_n(&free_frame_count) == compact_idle_failed_at) {
+    return false;
+  }
+
+  // the idle thread must never block
+  if (physmem_sync_initialized && !blocking_lock_try_acquire(&physmem_lock)) {
+    return false;
+  }
+
+  void* block = NULL;
+  if (!free_block_at_least(PHYSMEM_COMPACT_IDLE_ORDER)) {
+    block = physmem_compact_locked(PHYSMEM_COMPACT_IDLE_ORDER);
+  }
+  if (block != NULL) {
+    buddy_put_locked(block, PHYSMEM_COMPACT_IDLE_ORDER);
+    compact_idle++;
+  } else {
+    compact_idle_failed_at = free_frame_count;
+  }
 
   if (physmem_sync_initialized) blocking_lock_release(&physmem_lock);
+  return block != NULL;
+}
+
+// pop a block of order 1..PHYSMEM_MAX_CACHED_ORDER from this core's cache,
+// refilling it from the buddy lists if empty
+static void* physmem_cache_alloc(int order){
+  enum CoreAffinity prev = core_pin();
+  struct PhysmemLocalCache* cache = &get_per_core()->physmem_cache;
+
+  // protect against re-entrance, needed because buddy_alloc can block
+  if (physmem_sync_initialized) blocking_lock_acquire(&cache->lock);
+
+  unsigned slot = order - 1;
+  if (cache->block_count[slot] == 0) {
+    for (int i = 0; i < LOCAL_ORDER_CACHE_REFILL; i++) {
+      cache->blocks[slot][i] = buddy_alloc(order);
+    }
+    cache->block_count[slot] = LOCAL_ORDER_CACHE_REFILL;
+  }
+
+  cache->block_count[slot]--;
+  void* block = cache->blocks[slot][cache->block_count[slot]];
+
+  if (physmem_sync_initialized) blocking_lock_release(&cache->lock);
+  core_unpin(prev);
+
+  return block;
+}
+
+// push a block of order 1..PHYSMEM_MAX_CACHED_ORDER into this core's cache.
+// Only tries the cache lock: the caller may be a reclaimer running underneath
+// an allocation that already holds it, and the buddy lists are always a safe
+// place to put the block instead.
+static void physmem_cache_free(void* page, int order){
+  enum CoreAffinity prev = core_pin();
+  struct PhysmemLocalCache* cache = &get_per_core()->physmem_cache;
+
+  if (physmem_sync_initialized && !blocking_lock_try_acquire(&cache->lock)) {
+    core_unpin(prev);
+    buddy_free(page, order);
+    return;
+  }
+
+  // empty cache down to the refill mark if full, then free to cache
+  unsigned slot = order - 1;
+  if (cache->block_count[slot] == LOCAL_ORDER_CACHE_SIZE) {
+    while (cache->block_count[slot] > LOCAL_ORDER_CACHE_REFILL) {
+      cache->block_count[slot]--;
+      buddy_free(cache->blocks[slot][cache->block_count[slot]], order);
+    }
+  }
+
+  cache->blocks[slot][cache->block_count[slot]] = page;
+  cache->block_count[slot]++;
+
+  if (physmem_sync_initialized) blocking_lock_release(&cache->lock);
+  core_unpin(prev);
+}
+
+// allocate a physical page of given order
+// Panics if no free frames remain
+void* physmem_alloc_order(int order){
+  assert(order >= 0 && order <= PHYS_FRAME_MAX_ORDER, "physmem alloc: invalid order.\n");
+
+  __atomic_fetch_add(&order_allocs[order], 1);
+
+  if (order >= 1 && order <= PHYSMEM_MAX_CACHED_ORDER) {
+    return physmem_cache_alloc(order);
+  }
+  return buddy_alloc(order);
+}
+
+void* physmem_leak_order(int order){
+  void* page = physmem_alloc_order(order);
+  __atomic_fetch_add(&order_leaks[order], 1);
+  return page;
+}
+
+// free a physical page of given order
+void physmem_free_order(void* page, int order){
+  unsigned phys_addr = (unsigned)page;
+  assert(page != NULL, "physmem free: page is NULL.\n");
+  assert(
+    physmem_is_frame_address(phys_addr),
+    "physmem free: page is not a valid allocatable frame.\n"
+  );
+
+  assert(order >= 0 && order <= PHYS_FRAME_MAX_ORDER, "physmem free: invalid order.\n");
+  assert((frame_index_from_address(phys_addr) & ((1u << order) - 1)) == 0, 
+    "physmem free: page address is not aligned to its size.\n");
+
+  __atomic_fetch_add(&order_frees[order], 1);
+
+  if (order >= 1 && order <= PHYSMEM_MAX_CACHED_ORDER) {
+    physmem_cache_free(page, order);
+  } else {
+    buddy_free(page, order);
+  }
+}
+
+// flush one core's caches to the buddy lists; caller holds the cache lock
+static unsigned physmem_cache_flush(struct PhysmemLocalCache* cache){
+  unsigned frames = cache->count;
+  while (cache->count > 0) {
+    cache->count--;
+    buddy_free(cache->pages[cache->count], 0);
+  }
+
+  for (int order = 1; order <= PHYSMEM_MAX_CACHED_ORDER; order++) {
+    unsigned slot = order - 1;
+    frames += cache->block_count[slot] << order;
+    while (cache->block_count[slot] > 0) {
+      cache->block_count[slot]--;
+      buddy_free(cache->blocks[slot][cache->block_count[slot]], order);
+    }
+  }
+
+  frames += cache->zeroed_count;
+  while (cache->zeroed_count > 0) {
+    cache->zeroed_count--;
+    buddy_free(cache->zeroed[cache->zeroed_count], 0);
+  }
+
+  return frames;
+}
+
+unsigned physmem_drain_caches(void){
+  unsigned freed = 0;
+  for (int i = 0; i < MAX_CORES; i++) {
+    struct PhysmemLocalCache* cache = &per_core_data[i].physmem_cache;
+
+    // A busy cache belongs to a thread that is mid-refill or mid-flush, or
+    // to the caller itself; steal only from caches nobody is touching.
+    if (physmem_sync_initialized && !blocking_lock_try_acquire(&cache->lock)) {
+      continue;
+    }
+
+    freed += physmem_cache_flush(cache);
+
+    if (physmem_sync_initialized) blocking_lock_release(&cache->lock);
+  }
+
+  return freed;
 }
 
 // allocate a physical page from core-local cache
@@ -309,7 +748,7 @@ void* physmem_alloc(void){
   if (per_core->physmem_cache.count == 0) {
     // refill cache
     for (int i = 0; i < LOCAL_CACHE_REFILL; i++) {
-      per_core->physmem_cache.pages[i] = physmem_alloc_order(0);
+      per_core->physmem_cache.pages[i] = buddy_alloc(0);
     }
     per_core->physmem_cache.count = LOCAL_CACHE_REFILL;
   }
@@ -325,6 +764,104 @@ void* physmem_alloc(void){
   return page;
 }
 
+void* physmem_try_alloc_zeroed(void){
+  enum CoreAffinity prev = core_pin();
+  struct PhysmemLocalCache* cache = &get_per_core()->physmem_cache;
+  void* page = NULL;
+
+  if (physmem_sync_initialized) blocking_lock_acquire(&cache->lock);
+  if (cache->zeroed_demand < PHYSMEM_ZERO_POOL_SIZE) {
+    cache->zeroed_demand++;
+  }
+  if (cache->zeroed_count > 0) {
+    cache->zeroed_count--;
+    page = cache->zeroed[cache->zeroed_count];
+    __atomic_fetch_add(&frames_alloced, 1);
+  }
+  if (physmem_sync_initialized) blocking_lock_release(&cache->lock);
+  core_unpin(prev);
+
+  if (page != NULL) {
+    __atomic_fetch_add(&zeroed_hits, 1);
+  }
+  return page;
+}
+
+void* physmem_alloc_zeroed(void){
+  void* page = physmem_try_alloc_zeroed();
+  if (page != NULL) {
+    return page;
+  }
+
+  // pool empty: pay for the zeroing in the caller's latency
+  __atomic_fetch_add(&zeroed_misses, 1);
+  page = physmem_alloc();
+  clear_page(page);
+  return page;
+}
+
+bool physmem_zero_pool_refill(void){
+  struct PhysmemLocalCache* cache = &get_per_core()->physmem_cache;
+
+  // unlocked peek, so an idle core with nothing to zero never holds the lock
+  // and a cross-core drain never has to skip it
+  if (cache->zeroed_count >= PHYSMEM_ZERO_POOL_SIZE ||
+      (cache->count == 0 && cache->zeroed_demand == 0)) {
+    return false;
+  }
+
+  // the idle thread must never block, so skip a round if the cache is busy
+  if (physmem_sync_initialized && !blocking_lock_try_acquire(&cache->lock)) {
+    return false;
+  }
+
+  // Frames parked in this core's cache are used first. Once it is empty, a
+  // frame comes from the buddy lists, but only to replace one the pool has
+  // handed out since, so an idle core nobody asks for zeroed frames never
+  // drains the buddy lists. physmem_lock is only try-acquired. Zeroing
+  // happens under the cache lock, one frame per call, so a thread woken
+  // meanwhile waits for at most one frame's worth of stores.
+  void* page = NULL;
+  if (cache->zeroed_count < PHYSMEM_ZERO_POOL_SIZE) {
+    if (cache->count > 0) {
+      cache->count--;
+      page = cache->pages[cache->count];
+    } else if (cache->zeroed_demand > 0 &&
+               (!physmem_sync_initialized || blocking_lock_try_acquire(&physmem_lock))) {
+      page = buddy_take_locked(0);
+      if (physmem_sync_initialized) blocking_lock_release(&physmem_lock);
+      if (page != NULL) {
+        cache->zeroed_demand--;
+      }
+    }
+  }
+
+  bool worked = false;
+  if (page != NULL) {
+    clear_page(page);
+    cache->zeroed[cache->zeroed_count] = page;
+    cache->zeroed_count++;
+    __atomic_fetch_add(&zeroed_by_idle, 1);
+    worked = true;
+  }
+
+  if (physmem_sync_initialized) blocking_lock_release(&cache->lock);
+  return worked;
+}
+
+void* physmem_alloc_frames(int order){
+  assert(order >= 0 && order <= PHYS_FRAME_MAX_ORDER, "physmem alloc frames: invalid order.\n");
+
+  void* block = order >= 1 && order <= PHYSMEM_MAX_CACHED_ORDER ?
+    physmem_cache_alloc(order) : buddy_alloc(order);
+
+  // Only the block's first frame is a buddy list head, so freeing its frames
+  // one by one coalesces them back like any other order-0 frames. Account for
+  // them as order-0 allocations so physmem_check_leaks() matches the frees.
+  __atomic_fetch_add(&frames_alloced, 1u << order);
+  return block;
+}
+
 void* physmem_leak(void){
   __atomic_fetch_add(&frames_leaked, 1);
   return physmem_alloc();
@@ -350,7 +887,7 @@ void physmem_free(void* page){
   // empty cache if full, then free to cache
   if (per_core->physmem_cache.count == LOCAL_CACHE_SIZE) {
     while (per_core->physmem_cache.count >= LOCAL_CACHE_REFILL){
-      physmem_free_order(per_core->physmem_cache.pages[per_core->physmem_cache.count - 1], 0);
+      buddy_free(per_core->physmem_cache.pages[per_core->physmem_cache.count - 1], 0);
       per_core->physmem_cache.count--;
     }
   }
@@ -362,6 +899,25 @@ void physmem_free(void* page){
   core_unpin(prev);
 }
 
+void physmem_free_uncached(void* page){
+  assert(page != NULL, "physmem free uncached: page is NULL.\n");
+  assert(
+    physmem_is_frame_address((unsigned)page),
+    "physmem free uncached: page is not a valid order-0 allocatable frame.\n"
+  );
+  __atomic_fetch_add(&frames_freed, 1);
+  buddy_free(page, 0);
+}
+
+void physmem_print_stats(void){
+  int args[3] = {zeroed_hits, zeroed_misses, zeroed_by_idle};
+  say("| physmem zero pool: hits=%d misses=%d zeroed by idle=%d\n", args);
+  int compact_args[5] = {compact_attempts, compact_successes, compact_failures,
+    compact_moved, compact_idle};
+  say("| physmem compaction: attempts=%d succeeded=%d failed=%d frames moved=%d idle=%d\n",
+    compact_args);
+}
+
 void physmem_check_leaks(void){
   bool all_good = true;
 
@@ -371,8 +927,9 @@ void physmem_check_leaks(void){
     all_good = false;
   }
 
-  // skip order 0 because some frames may still be in caches
-  for (int order = 1; order <= PHYS_FRAME_MAX_ORDER; order++) {
+  // counted at the API, so blocks parked in per-core caches do not show up
+  // as leaks; order 0 here only covers direct physmem_alloc_order(0) callers
+  for (int order = 0; order <= PHYS_FRAME_MAX_ORDER; order++) {
     if (order_allocs[order] != order_frees[order] + order_leaks[order]) {
       int args[4] = {order, order_frees[order], order_leaks[order], order_allocs[order]};
       say("| Warning: physmem leak detected for order %d: (freed:%d + leaked:%d) != alloced:%d\n", args);
@@ -19,9 +19,49 @@
 #define LOCAL_CACHE_SIZE 64
 #define LOCAL_CACHE_REFILL 32
 
+// orders 1..PHYSMEM_MAX_CACHED_ORDER also get a small per-core cache each;
+// these serve heap large allocations and kernel stacks without physmem_lock
+#define PHYSMEM_MAX_CACHED_ORDER 3
+#define LOCAL_ORDER_CACHE_SIZE 8
+#define LOCAL_ORDER_CACHE_REFILL 4
+
+// pre-zeroed frames kept per core, refilled by the idle thread
+#define PHYSMEM_ZERO_POOL_SIZE 16
+
+// max number of subsystems that can give frames back under memory pressure
+#define PHYSMEM_MAX_RECLAIMERS 4
+
+// max number of subsystems whose frames compaction can move
+#define PHYSMEM_MAX_MOVERS 4
+
+// Compaction only assembles blocks up to this order, so one pass moves at most
+// PHYSMEM_COMPACT_MAX_FRAMES frames while holding physmem_lock.
+#define PHYSMEM_COMPACT_MAX_ORDER 6
+#define PHYSMEM_COMPACT_MAX_FRAMES 64
+
+// A pass examines at most this many candidate blocks, resuming where the
+// previous pass stopped, so its time under physmem_lock does not grow with
+// the size of memory.
+#define PHYSMEM_COMPACT_SCAN_BLOCKS 256
+
+// idle threads keep one free block of this order (kernel stacks) around
+#define PHYSMEM_COMPACT_IDLE_ORDER 2
+
 struct PhysmemLocalCache {
   void* pages[LOCAL_CACHE_SIZE];
   unsigned count;
+
+  // cached blocks of order 1..PHYSMEM_MAX_CACHED_ORDER, indexed by order - 1
+  void* blocks[PHYSMEM_MAX_CACHED_ORDER][LOCAL_ORDER_CACHE_SIZE];
+  unsigned block_count[PHYSMEM_MAX_CACHED_ORDER];
+
+  // frames already filled with zeros, see physmem_alloc_zeroed()
+  void* zeroed[PHYSMEM_ZERO_POOL_SIZE];
+  unsigned zeroed_count;
+  // requests for zeroed frames since the idle thread last took frames from
+  // the buddy lists for the pool, capped at PHYSMEM_ZERO_POOL_SIZE
+  unsigned zeroed_demand;
+
   struct BlockingLock lock;
 };
 
@@ -48,10 +88,13 @@ unsigned frame_index_from_address(unsigned phys_addr);
 unsigned address_from_frame_index(unsigned frame_index);
 
 // allocate a physical page of given order
-// Panics if no free frames remain
+// Orders 1..PHYSMEM_MAX_CACHED_ORDER are served from the per-core cache.
+// Panics if no free frames remain, even after draining every core's cache
 void* physmem_alloc_order(int order);
 
 // free a physical page of given order
+// Orders 1..PHYSMEM_MAX_CACHED_ORDER go to the per-core cache when its lock is
+// free, and straight to the buddy lists otherwise
 void physmem_free_order(void* page, int order);
 
 void* physmem_leak_order(int order);
@@ -62,9 +105,71 @@ void* physmem_leak(void);
 // Panics if no free frames remain
 void* physmem_alloc(void);
 
+// allocate a physical page filled with zeros, from this core's pre-zeroed
+// pool when it has one and by zeroing synchronously otherwise
+// Panics if no free frames remain
+void* physmem_alloc_zeroed(void);
+
+// take a frame from this core's pre-zeroed pool, or return NULL if the pool
+// is empty; never zeroes synchronously
+void* physmem_try_alloc_zeroed(void);
+
+// Zero one frame into this core's zero pool, taken from its cache or, while
+// the pool has unmet demand, from the buddy lists. Called by the idle thread
+// when nothing is runnable; never blocks. Returns false if there was no
+// work to do, so the caller can pause instead.
+bool physmem_zero_pool_refill(void);
+
+// Allocate 2^order contiguous frames that are then owned, and freed with
+// physmem_free(), one frame at a time. For callers that fill several pages
+// with one transfer but keep them apart afterwards.
+// Panics if no free frames remain
+void* physmem_alloc_frames(int order);
+
 // free a physical page
 void physmem_free(void* page);
 
+// Free an order-0 page obtained from physmem_alloc() straight to the buddy
+// lists, bypassing the per-core cache. Reclaim callbacks use this because they
+// may run underneath physmem_alloc() while it holds this core's cache lock.
+void physmem_free_uncached(void* page);
+
+// number of frames currently sitting in the global buddy free lists
+// (pages parked in per-core caches are not counted)
+unsigned physmem_free_frames(void);
+
+// Flush every per-core cache and zero pool whose lock is free back to the buddy lists,
+// returning the number of frames released. Caches that are busy are skipped,
+// so this never blocks on a cache lock the caller might already hold.
+unsigned physmem_drain_caches(void);
+
+// Register a callback that physmem_alloc_order() invokes before panicking on
+// exhaustion. The callback should try to release at least `frames` frames with
+// physmem_free_uncached()/physmem_free_order() and return how many it freed.
+// It may run with arbitrary allocator-adjacent locks held, so it must not block
+// on locks that an allocating thread could already own and must not allocate.
+void physmem_register_reclaim(unsigned (*reclaim)(unsigned frames));
+
+// Register an owner of movable frames for compaction. `mark` reports every
+// frame in [first, first + count) of frame indices the owner could move right
+// now with physmem_mark_movable(). `move`
+// copies `frame` into `target` and repoints the owner's only reference to it,
+// returning false if the frame is no longer movable. Both run with physmem's
+// buddy lock held, so they must only try-lock and must not call physmem.
+void physmem_register_mover(void (*mark)(unsigned first, unsigned count),
+    bool (*move)(void* frame, void* target));
+
+// report one movable frame; only valid inside a mover's `mark` callback
+void physmem_mark_movable(void* frame);
+
+// If no block of PHYSMEM_COMPACT_IDLE_ORDER or larger is free, run one
+// compaction pass to make one. Called by the idle thread; never blocks.
+// Returns true if it assembled a block.
+bool physmem_compact_idle(void);
+
+// print zero-pool and compaction counters
+void physmem_print_stats(void);
+
 // check for physical memory leaks
 void physmem_check_leaks(void);
 
@@ -0,0 +1,17 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+// Sequential-access state of one reader of a file: an open file descriptor,
+// or a file-backed VME. page_cache_readahead() updates it without a lock; a
+// race only misjudges the window once.
+struct Readahead {
+  unsigned start; // file offset of the last access
+  unsigned next; // file offset just past the last access
+  unsigned ahead; // file offset just past the pages already queued ahead
+  unsigned window; // pages to keep queued past `next`; 0 while access looks random
+};
+
+// start a reader's readahead state for a file read from `offset` onwards
+void readahead_init(struct Readahead* ra, unsigned offset);
+
+#endif // READAHEAD_H
@@ -18,10 +18,18 @@ bool strneq(char* str1, char* str2, unsigned n);
 // exactly one trailing NUL and leaves the rest of `dest` unchanged.
 char* strncpy(char* dest, char* src, unsigned n);
 
-// Copies `n` raw bytes from `src` into `dest`. Source and destination must not
-// overlap because this helper performs a simple forward byte copy.
+// Copies `n` raw bytes from `src` into `dest`. Buffers that share their offset
+// within a word are copied a word at a time after a bytewise head. Source and
+// destination must not overlap, except that `dest` below `src` is safe.
 void* memcpy(void* dest, void* src, unsigned n);
 
+// Copies `n` raw bytes from `src` into `dest`; the regions may overlap.
+void* memmove(void* dest, void* src, unsigned n);
+
+// Compares the first `n` bytes of `a` and `b`. Returns 0 if they are equal,
+// otherwise the difference of the first unequal bytes as unsigned chars.
+int memcmp(void* a, void* b, unsigned n);
+
 // Copies `n` raw bytes from `src` into `dest` two bytes at a time. Source and
 // destination must both be 2-byte aligned, `n` must be even, and the regions
 // must not overlap
@@ -35,4 +43,10 @@ void* memcpy4(void* dest, void* src, unsigned n);
 // Fills `n` bytes at `dest` with the low byte of `c`.
 void* memset(void* dest, int c, unsigned n);
 
+// Copies one FRAME_SIZE frame. Both pointers must be frame-aligned.
+void copy_page(void* dest, void* src);
+
+// Zeroes one FRAME_SIZE frame. The pointer must be frame-aligned.
+void clear_page(void* dest);
+
 #endif // STRING_H
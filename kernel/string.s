@@ -6,10 +6,66 @@ memcpy:
   # Purpose: copy `n` bytes from `src` into `dest` for raw kernel buffers.
   # Inputs: r1 = dest, r2 = src, r3 = byte count.
   # Outputs: r1 = original dest pointer.
-  # Preconditions: `src` and `dest` are valid for `n` bytes and do not overlap.
+  # Preconditions: `src` and `dest` are valid for `n` bytes. An overlap is
+  # only safe when `dest` is below `src`; memmove relies on that.
+  # Strategy:
+  # - when `dest` and `src` share the same offset within a word, copy bytes up
+  #   to the first word boundary, then 32 bytes per iteration with eight
+  #   `lwa`/`swa` pairs, then single words, then the tail bytes
+  # - short copies and mutually misaligned buffers stay bytewise, because
+  #   docs/ISA.md says misaligned word accesses round down
+  # - each 32-byte block is loaded completely before it is stored
   # ABI notes: uses only caller-saved temporaries (docs/abi.md Registers).
   mov  r4, r1
-memcpy_loop:
+  cmp  r3, 16
+  bb   memcpy_tail
+  xor  r5, r1, r2
+  and  r5, r5, 3
+  cmp  r5, 0
+  bnz  memcpy_tail
+memcpy_head:
+  and  r5, r1, 3
+  cmp  r5, 0
+  bz   memcpy_blocks
+  lba  r5, [r2]
+  sba  r5, [r1]
+  add  r1, r1, 1
+  add  r2, r2, 1
+  add  r3, r3, -1
+  jmp  memcpy_head
+memcpy_blocks:
+  cmp  r3, 32
+  bb   memcpy_words
+  lwa  r5, [r2, 0]
+  lwa  r6, [r2, 4]
+  lwa  r7, [r2, 8]
+  lwa  r8, [r2, 12]
+  lwa  r9, [r2, 16]
+  lwa  r10, [r2, 20]
+  lwa  r11, [r2, 24]
+  lwa  r12, [r2, 28]
+  swa  r5, [r1, 0]
+  swa  r6, [r1, 4]
+  swa  r7, [r1, 8]
+  swa  r8, [r1, 12]
+  swa  r9, [r1, 16]
+  swa  r10, [r1, 20]
+  swa  r11, [r1, 24]
+  swa  r12, [r1, 28]
+  add  r1, r1, 32
+  add  r2, r2, 32
+  add  r3, r3, -32
+  jmp  memcpy_blocks
+memcpy_words:
+  cmp  r3, 4
+  bb   memcpy_tail
+  lwa  r5, [r2]
+  swa  r5, [r1]
+  add  r1, r1, 4
+  add  r2, r2, 4
+  add  r3, r3, -4
+  jmp  memcpy_words
+memcpy_tail:
   cmp  r3, 0
   bz   memcpy_done
   lba  r5, [r2]
@@ -17,11 +73,150 @@ memcpy_loop:
   add  r1, r1, 1
   add  r2, r2, 1
   add  r3, r3, -1
-  jmp  memcpy_loop
+  jmp  memcpy_tail
 memcpy_done:
   mov  r1, r4
   ret
 
+  .global memmove
+memmove:
+  # Purpose: copy `n` bytes from `src` into `dest` where the regions may
+  # overlap.
+  # Inputs: r1 = dest, r2 = src, r3 = byte count.
+  # Outputs: r1 = original dest pointer.
+  # Strategy:
+  # - `dest` at or below `src`, or past the end of `src`, is a plain forward
+  #   memcpy
+  # - otherwise copy backward from the ends, with the same head/block/word/tail
+  #   split as memcpy mirrored. Each 32-byte block is loaded completely before
+  #   it is stored, so a store never clobbers source bytes not yet read.
+  # ABI notes: uses only caller-saved temporaries (docs/abi.md Registers).
+  cmp  r1, r2
+  bbe  memcpy
+  add  r5, r2, r3
+  cmp  r1, r5
+  bae  memcpy
+  mov  r4, r1
+  add  r1, r1, r3
+  add  r2, r2, r3
+  cmp  r3, 16
+  bb   memmove_tail
+  xor  r5, r1, r2
+  and  r5, r5, 3
+  cmp  r5, 0
+  bnz  memmove_tail
+memmove_head:
+  and  r5, r1, 3
+  cmp  r5, 0
+  bz   memmove_blocks
+  add  r1, r1, -1
+  add  r2, r2, -1
+  lba  r5, [r2]
+  sba  r5, [r1]
+  add  r3, r3, -1
+  jmp  memmove_head
+memmove_blocks:
+  cmp  r3, 32
+  bb   memmove_words
+  add  r1, r1, -32
+  add  r2, r2, -32
+  lwa  r5, [r2, 0]
+  lwa  r6, [r2, 4]
+  lwa  r7, [r2, 8]
+  lwa  r8, [r2, 12]
+  lwa  r9, [r2, 16]
+  lwa  r10, [r2, 20]
+  lwa  r11, [r2, 24]
+  lwa  r12, [r2, 28]
+  swa  r12, [r1, 28]
+  swa  r11, [r1, 24]
+  swa  r10, [r1, 20]
+  swa  r9, [r1, 16]
+  swa  r8, [r1, 12]
+  swa  r7, [r1, 8]
+  swa  r6, [r1, 4]
+  swa  r5, [r1, 0]
+  add  r3, r3, -32
+  jmp  memmove_blocks
+memmove_words:
+  cmp  r3, 4
+  bb   memmove_tail
+  add  r1, r1, -4
+  add  r2, r2, -4
+  lwa  r5, [r2]
+  swa  r5, [r1]
+  add  r3, r3, -4
+  jmp  memmove_words
+memmove_tail:
+  cmp  r3, 0
+  bz   memmove_done
+  add  r1, r1, -1
+  add  r2, r2, -1
+  lba  r5, [r2]
+  sba  r5, [r1]
+  add  r3, r3, -1
+  jmp  memmove_tail
+memmove_done:
+  mov  r1, r4
+  ret
+
+  .global memcmp
+memcmp:
+  # Purpose: compare the first `n` bytes of two buffers.
+  # Inputs: r1 = buffer a, r2 = buffer b, r3 = byte count.
+  # Outputs: r1 = 0 if equal, otherwise the difference of the first unequal
+  # bytes (a - b) as unsigned chars.
+  # Strategy: mutually aligned buffers are compared a word at a time after a
+  # bytewise head. A differing word falls back to the byte loop, which finds
+  # the first differing byte within it regardless of byte order.
+  # ABI notes: uses only caller-saved temporaries (docs/abi.md Registers).
+  cmp  r3, 16
+  bb   memcmp_bytes
+  xor  r5, r1, r2
+  and  r5, r5, 3
+  cmp  r5, 0
+  bnz  memcmp_bytes
+memcmp_head:
+  and  r5, r1, 3
+  cmp  r5, 0
+  bz   memcmp_words
+  lba  r5, [r1]
+  lba  r6, [r2]
+  cmp  r5, r6
+  bnz  memcmp_differ
+  add  r1, r1, 1
+  add  r2, r2, 1
+  add  r3, r3, -1
+  jmp  memcmp_head
+memcmp_words:
+  cmp  r3, 4
+  bb   memcmp_bytes
+  lwa  r5, [r1]
+  lwa  r6, [r2]
+  cmp  r5, r6
+  bnz  memcmp_bytes
+  add  r1, r1, 4
+  add  r2, r2, 4
+  add  r3, r3, -4
+  jmp  memcmp_words
+memcmp_bytes:
+  cmp  r3, 0
+  bz   memcmp_equal
+  lba  r5, [r1]
+  lba  r6, [r2]
+  cmp  r5, r6
+  bnz  memcmp_differ
+  add  r1, r1, 1
+  add  r2, r2, 1
+  add  r3, r3, -1
+  jmp  memcmp_bytes
+memcmp_differ:
+  sub  r1, r5, r6
+  ret
+memcmp_equal:
+  mov  r1, r0
+  ret
+
   .global memcpy2
 memcpy2:
   # Purpose: copy `n` bytes from `src` into `dest` using 2-byte load/store
@@ -85,15 +280,112 @@ memset:
   # Purpose: fill `n` bytes at `dest` with the low byte of `c`.
   # Inputs: r1 = dest, r2 = fill value, r3 = byte count.
   # Outputs: r1 = original dest pointer.
+  # Strategy: replicate the byte into a word, store bytes up to the first word
+  # boundary, then 32 bytes per iteration with eight `swa`, then single words,
+  # then the tail bytes. Short fills stay bytewise.
   # ABI notes: uses only caller-saved temporaries (docs/abi.md Registers).
   mov  r4, r1
-memset_loop:
+  and  r2, r2, 0xFF
+  lsl  r5, r2, 8
+  or   r2, r2, r5
+  lsl  r5, r2, 16
+  or   r2, r2, r5
+  cmp  r3, 16
+  bb   memset_tail
+memset_head:
+  and  r5, r1, 3
+  cmp  r5, 0
+  bz   memset_blocks
+  sba  r2, [r1]
+  add  r1, r1, 1
+  add  r3, r3, -1
+  jmp  memset_head
+memset_blocks:
+  cmp  r3, 32
+  bb   memset_words
+  swa  r2, [r1, 0]
+  swa  r2, [r1, 4]
+  swa  r2, [r1, 8]
+  swa  r2, [r1, 12]
+  swa  r2, [r1, 16]
+  swa  r2, [r1, 20]
+  swa  r2, [r1, 24]
+  swa  r2, [r1, 28]
+  add  r1, r1, 32
+  add  r3, r3, -32
+  jmp  memset_blocks
+memset_words:
+  cmp  r3, 4
+  bb   memset_tail
+  swa  r2, [r1]
+  add  r1, r1, 4
+  add  r3, r3, -4
+  jmp  memset_words
+memset_tail:
   cmp  r3, 0
   bz   memset_done
   sba  r2, [r1]
   add  r1, r1, 1
   add  r3, r3, -1
-  jmp  memset_loop
+  jmp  memset_tail
 memset_done:
   mov  r1, r4
   ret
+
+  .global copy_page
+copy_page:
+  # Purpose: copy one 4 KiB frame.
+  # Inputs: r1 = dest frame, r2 = src frame.
+  # Outputs: none.
+  # Preconditions: both pointers are 4 KiB aligned and the frames differ.
+  # Strategy: 128 iterations of eight `lwa`/`swa` pairs, with no alignment or
+  # length checks.
+  # ABI notes: uses only caller-saved temporaries (docs/abi.md Registers).
+  movi r3, 4096
+  add  r3, r1, r3
+copy_page_loop:
+  lwa  r5, [r2, 0]
+  lwa  r6, [r2, 4]
+  lwa  r7, [r2, 8]
+  lwa  r8, [r2, 12]
+  lwa  r9, [r2, 16]
+  lwa  r10, [r2, 20]
+  lwa  r11, [r2, 24]
+  lwa  r12, [r2, 28]
+  swa  r5, [r1, 0]
+  swa  r6, [r1, 4]
+  swa  r7, [r1, 8]
+  swa  r8, [r1, 12]
+  swa  r9, [r1, 16]
+  swa  r10, [r1, 20]
+  swa  r11, [r1, 24]
+  swa  r12, [r1, 28]
+  add  r1, r1, 32
+  add  r2, r2, 32
+  cmp  r1, r3
+  bnz  copy_page_loop
+  ret
+
+  .global clear_page
+clear_page:
+  # Purpose: zero one 4 KiB frame.
+  # Inputs: r1 = frame.
+  # Outputs: none.
+  # Preconditions: the pointer is 4 KiB aligned.
+  # Strategy: 128 iterations of eight `swa` stores of r0.
+  # ABI notes: uses only caller-saved temporaries (docs/abi.md Registers).
+  movi r3, 4096
+  add  r3, r1, r3
+clear_page_loop:
+  swa  r0, [r1, 0]
+  swa  r0, [r1, 4]
+  swa  r0, [r1, 8]
+  swa  r0, [r1, 12]
+  swa  r0, [r1, 16]
+  swa  r0, [r1, 20]
+  swa  r0, [r1, 24]
+  swa  r0, [r1, 28]
+  add  r1, r1, 32
+  cmp  r1, r3
+  bnz  clear_page_loop
+  ret
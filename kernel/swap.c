@@ -0,0 +1,196 @@
+#include "swap.h"
+#include "sd_driver.h"
+#include "physmem.h"
+#include "heap.h"
+#include "atomic.h"
+#include "blocking_lock.h"
+#include "config.h"
+#include "string.h"
+#include "debug.h"
+#include "print.h"
+
+/*
+ * Swap area.
+ *
+ * The area is a run of CONFIG.swap_blocks blocks on SD_DRIVE_0, starting at
+ * the first page-aligned block after the kernel image. The kernel's own boot
+ * header in block 0 says where the image ends (see mbr.s). Each slot holds one
+ * page and has a reference count, so fork() can share a swapped page without
+ * reading it back.
+ *
+ * Swap-out writes a whole cluster of pages with one SD transfer through a
+ * contiguous bounce buffer. Swap-in reads straight into the new frame.
+ */
+static bool swap_on;
+static unsigned swap_start_block;
+static unsigned swap_slots;
+
+// references per slot, 0 if free
+static unsigned short* slot_refs;
+static struct SpinLock slot_lock;
+
+// next-fit start, so consecutive clusters are written next to each other
+static unsigned slot_cursor;
+
+// physically contiguous staging area for one cluster
+static void* bounce;
+static struct BlockingLock bounce_lock;
+
+// counters reported by swap_print_stats()
+static unsigned slots_used;
+static unsigned slots_peak;
+static int pages_out;
+static int pages_in;
+static int cluster_writes;
+
+void swap_init(void){
+  swap_on = false;
+  slots_used = 0;
+  slots_peak = 0;
+  pages_out = 0;
+  pages_in = 0;
+  cluster_writes = 0;
+
+  swap_slots = CONFIG.swap_blocks / SWAP_SLOT_BLOCKS;
+  if (swap_slots > SWAP_MAX_SLOTS){
+    swap_slots = SWAP_MAX_SLOTS;
+  }
+  if (swap_slots == 0){
+    return;
+  }
+
+  bounce = physmem_leak_order(SWAP_CLUSTER_ORDER);
+  blocking_lock_init(&bounce_lock);
+
+  // words 0..8 of the boot header are (start_block, num_blocks, load_address)
+  // for text, data and rodata; bss is not stored on the drive
+  if (sd_read_blocks(SD_DRIVE_0, 0, 1, bounce) != 0){
+    say("| Warning: swap disabled, cannot read the SD0 boot header\n", NULL);
+    return;
+  }
+  unsigned* header = (unsigned*)bounce;
+  unsigned image_end = 0;
+  for (int section = 0; section < 3; section++){
+    unsigned end = header[section * 3] + header[section * 3 + 1];
+    if (end > image_end){
+      image_end = end;
+    }
+  }
+  swap_start_block = (image_end + SWAP_SLOT_BLOCKS - 1) & ~(SWAP_SLOT_BLOCKS - 1);
+
+  // an image that was not padded for swap fails here rather than on the
+  // first swap-out
+  unsigned last_block = swap_start_block + swap_slots * SWAP_SLOT_BLOCKS - 1;
+  if (sd_read_blocks(SD_DRIVE_0, last_block, 1, bounce) != 0){
+    int args[2] = {swap_slots, swap_start_block};
+    say("| Warning: swap disabled, SD0 cannot hold %d slots after block %d\n", args);
+    return;
+  }
+
+  slot_refs = leak(swap_slots * sizeof(unsigned short));
+  for (unsigned i = 0; i < swap_slots; i++){
+    slot_refs[i] = 0;
+  }
+  spin_lock_init(&slot_lock);
+  slot_cursor = 0;
+  swap_on = true;
+
+  int args[2] = {swap_slots, swap_start_block};
+  say("| Swap: %d pages on SD0 from block %d\n", args);
+}
+
+bool swap_enabled(void){
+  return swap_on;
+}
+
+int swap_alloc_slots(unsigned count, unsigned* got){
+  assert(swap_on, "swap_alloc_slots: swap is disabled.\n");
+  assert(count > 0 && count <= SWAP_CLUSTER_PAGES, "swap_alloc_slots: bad cluster size.\n");
+
+  spin_lock_acquire(&slot_lock);
+
+  // first free slot at or after the cursor, wrapping once
+  unsigned first = slot_cursor;
+  unsigned scanned = 0;
+  while (scanned < swap_slots && slot_refs[first] != 0){
+    first = (first + 1) % swap_slots;
+    scanned++;
+  }
+  if (scanned == swap_slots){
+    spin_lock_release(&slot_lock);
+    return -1;
+  }
+
+  // extend the run as far as the request and the free slots allow
+  unsigned run = 0;
+  while (run < count && first + run < swap_slots && slot_refs[first + run] == 0){
+    slot_refs[first + run] = 1;
+    run++;
+  }
+  slot_cursor = (first + run) % swap_slots;
+
+  slots_used += run;
+  if (slots_used > slots_peak){
+    slots_peak = slots_used;
+  }
+  spin_lock_release(&slot_lock);
+
+  *got = run;
+  return (int)first;
+}
+
+void swap_dup(unsigned slot){
+  assert(slot < swap_slots, "swap_dup: slot out of range.\n");
+  spin_lock_acquire(&slot_lock);
+  assert(slot_refs[slot] != 0, "swap_dup: slot is free.\n");
+  assert(slot_refs[slot] != 0xFFFF, "swap_dup: slot reference count overflow.\n");
+  slot_refs[slot]++;
+  spin_lock_release(&slot_lock);
+}
+
+void swap_free(unsigned slot){
+  assert(slot < swap_slots, "swap_free: slot out of range.\n");
+  spin_lock_acquire(&slot_lock);
+  assert(slot_refs[slot] != 0, "swap_free: slot is already free.\n");
+  if (--slot_refs[slot] == 0){
+    slots_used--;
+  }
+  spin_lock_release(&slot_lock);
+}
+
+int swap_write_cluster(unsigned first, unsigned count, void** frames){
+  assert(count > 0 && count <= SWAP_CLUSTER_PAGES, "swap_write_cluster: bad cluster size.\n");
+  assert(first + count <= swap_slots, "swap_write_cluster: slots out of range.\n");
+
+  blocking_lock_acquire(&bounce_lock);
+  for (unsigned i = 0; i < count; i++){
+    copy_page((char*)bounce + i * FRAME_SIZE, frames[i]);
+  }
+  int rc = sd_write_blocks(SD_DRIVE_0, swap_start_block + first * SWAP_SLOT_BLOCKS,
+    count * SWAP_SLOT_BLOCKS, bounce);
+  blocking_lock_release(&bounce_lock);
+
+  if (rc == 0){
+    __atomic_fetch_add(&pages_out, (int)count);
+    __atomic_fetch_add(&cluster_writes, 1);
+  }
+  return rc;
+}
+
+int swap_read(unsigned slot, void* frame){
+  assert(slot < swap_slots, "swap_read: slot out of range.\n");
+  int rc = sd_read_blocks(SD_DRIVE_0, swap_start_block + slot * SWAP_SLOT_BLOCKS,
+    SWAP_SLOT_BLOCKS, frame);
+  if (rc == 0){
+    __atomic_fetch_add(&pages_in, 1);
+  }
+  return rc;
+}
+
+void swap_print_stats(void){
+  if (!swap_on){
+    return;
+  }
+  int args[5] = {pages_out, cluster_writes, pages_in, slots_used, slots_peak};
+  say("| Swap: pages out=%d cluster writes=%d pages in=%d slots used=%d peak=%d\n", args);
+}
@@ -0,0 +1,55 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+#include "constants.h"
+
+// 512-byte SD blocks per swapped page
+#define SWAP_SLOT_BLOCKS 8
+
+// a swap PTE keeps the slot in its 20 frame-number bits
+#define SWAP_MAX_SLOTS 0x100000
+
+// Pages collected into one sd_write_blocks() call. The cluster is copied into
+// one physically contiguous bounce buffer of order SWAP_CLUSTER_ORDER first,
+// because the victims' frames are scattered and the SD engine writes from
+// physical memory.
+#define SWAP_CLUSTER_PAGES 8
+#define SWAP_CLUSTER_ORDER 3
+
+// A user fault that finds fewer free buddy frames than this pushes one
+// cluster of its own cold anonymous pages out first. Kept below
+// PAGE_CACHE_LOW_WATERMARK so clean cached file pages go before anything is
+// written to swap.
+#define SWAP_LOW_WATERMARK 256
+
+// Find the swap area on SD_DRIVE_0, right after the kernel image, and probe it.
+// CONFIG.swap_blocks sets its size; 0, or an image too short to hold it,
+// leaves swap disabled. Called once during boot, after sd_init().
+void swap_init(void);
+
+// true if swap_init() found a usable swap area
+bool swap_enabled(void);
+
+// Reserve a run of up to `count` consecutive free slots, preferring the next
+// ones after the previous run so clusters land next to each other. Stores the
+// run's length in *got and returns its first slot, or -1 if swap is full.
+int swap_alloc_slots(unsigned count, unsigned* got);
+
+// take one more reference to a slot; fork() shares swapped pages this way
+void swap_dup(unsigned slot);
+
+// drop one reference to a slot, freeing it after the last one
+void swap_free(unsigned slot);
+
+// Write `count` frames to the consecutive slots starting at `first` with one
+// SD transfer. Returns 0 on success or the SD driver's negative error. May block.
+int swap_write_cluster(unsigned first, unsigned count, void** frames);
+
+// Read one slot into a physical frame. Returns 0 on success or the SD driver's
+// negative error. May block.
+int swap_read(unsigned slot, void* frame);
+
+// print slot usage and I/O counters
+void swap_print_stats(void);
+
+#endif // SWAP_H
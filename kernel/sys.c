@@ -5,6 +5,7 @@
 #include "ivt.h"
 #include "constants.h"
 #include "vmem.h"
+#include "kstack.h"
 #include "elf.h"
 #include "pit.h"
 #include "vga.h"
@@ -16,6 +17,7 @@
 #include "synth_audio.h"
 #include "heap.h"
 #include "ext.h"
+#include "page_cache.h"
 #include "string.h"
 #include "scheduler.h"
 
@@ -68,13 +70,9 @@ static bool user_range_ok(struct TCB* tcb, void* user_ptr, unsigned n,
   while (true){
     // check that the current byte is covered by a user VME
 
-    struct VME* vme = tcb->vme_list;
-    while (vme != NULL && vme->end <= cur){
-      // find vme covering the current byte
-      vme = vme->next;
-    }
+    struct VME* vme = vme_find(tcb, cur);
 
-    if (vme == NULL || vme->start > cur || !(vme->flags & MMAP_USER)){
+    if (vme == NULL || !(vme->flags & MMAP_USER)){
       // no VME covers the current byte or it is not a user mapping
       return false;
     }
@@ -589,6 +587,11 @@ int handle_read(int fd, char* buf, unsigned count){
   char* kbuf = malloc(bytes_to_read);
   unsigned rounded_offset = (unsigned)offset & ~(FRAME_SIZE - 1);
   unsigned rounded_bytes = (bytes_to_read + ((unsigned)offset - rounded_offset) + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+
+  // queue the pages after this read before faulting this one in
+  page_cache_readahead(&page_cache, &tcb->file_descriptors[fd]->ra, file_node,
+    rounded_offset, rounded_bytes / FRAME_SIZE);
+
   char* mmapped_file = mmap(rounded_bytes, file_node, rounded_offset,
     MMAP_READ | MMAP_SHARED);
   memcpy(kbuf, mmapped_file + ((unsigned)offset - rounded_offset),
@@ -874,6 +877,28 @@ int handle_truncate(int fd, unsigned size){
   return 0;
 }
 
+// The file's pages dirtied through shared mappings are written back first.
+// The block cache does not track which inode owns a buffer, so fsync() then
+// writes back everything that is dirty, like sync().
+int handle_fsync(int fd){
+  int was = interrupts_disable();
+  struct TCB* tcb = get_current_tcb();
+  interrupts_restore(was);
+
+  if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS || tcb->file_descriptors[fd] == NULL){
+    return -1;
+  }
+
+  struct FileDescriptor* descriptor = tcb->file_descriptors[fd];
+  if (descriptor->type != FILE_DESCRIPTOR_NORMAL || descriptor->file == NULL){
+    return -1;
+  }
+
+  page_cache_sync(&page_cache, descriptor->file->cached);
+  ext2_sync(&fs);
+  return 0;
+}
+
 int handle_dup(int fd){
   int was = interrupts_disable();
   struct TCB* tcb = get_current_tcb();
@@ -1067,12 +1092,6 @@ int handle_mmap(int size, int fd, int offset, int flags){
     if (file_node == NULL){
       return -1;
     }
-  } else {
-    // anonymous mmap request
-    if (flags & MMAP_SHARED){
-      // shared anonymous mappings are not supported
-      return -1;
-    }
   }
 
   if (offset < 0) return -1;
@@ -1093,12 +1112,28 @@ int child_thread(unsigned* arg){
 }
 
 struct TCB* fork_tcb(struct TCB* parent, int child_desc, unsigned pc, unsigned sp){
-  struct TCB* child = malloc(sizeof(struct TCB));
-  memset(child, 0, sizeof(struct TCB));
+  // descriptor tables arrive empty from the cache and copy_descriptors()
+  // fills them, so only the remaining fields need setting here
+  struct TCB* child = kmem_cache_alloc(tcb_cache);
+
+  child->r20 = 0;
+  child->r21 = 0;
+  child->r22 = 0;
+  child->r23 = 0;
+  child->r24 = 0;
+  child->r25 = 0;
+  child->r26 = 0;
+  child->r27 = 0;
+  child->r28 = 0;
+  child->sp = 0;
 
   child->flags = 0;
   child->psr = 1;
   child->imr = DEFAULT_INTERRUPT_MASK;
+  child->fault_addr = 0;
+  child->fault_flags = 0;
+  child->uaccess_active = 0;
+  child->uaccess_err_addr = 0;
 
   child->can_preempt = parent->can_preempt;
   child->core_affinity = parent->core_affinity;
@@ -1108,7 +1143,7 @@ struct TCB* fork_tcb(struct TCB* parent, int child_desc, unsigned pc, unsigned s
   child->wakeup_jiffies = parent->wakeup_jiffies;
 
   // alloc new kernel stack
-  unsigned* the_stack = malloc(TCB_STACK_SIZE);
+  unsigned* the_stack = kstack_alloc();
   child->stack = the_stack;
   child->ksp = (unsigned)(&the_stack[TCB_STACK_SIZE / sizeof (unsigned) - 1]);
   child->bp = (unsigned)(&the_stack[TCB_STACK_SIZE / sizeof (unsigned) - 1]);
@@ -1127,6 +1162,7 @@ struct TCB* fork_tcb(struct TCB* parent, int child_desc, unsigned pc, unsigned s
   child->cwd = node_clone(parent->cwd);
 
   // copy cwd path
+  child->cwd_path = NULL;
   if (parent->cwd_path != NULL){
     unsigned cwd_path_bytes = strlen(parent->cwd_path) + 1;
     child->cwd_path = malloc(cwd_path_bytes);
@@ -1257,8 +1293,7 @@ int handle_exec(char* path, int argc, char** argv){
   }
 
   vmem_destroy_address_space(tcb);
-  free_vme_list(tcb->vme_list);
-  tcb->vme_list = NULL;
+  free_vme_list(tcb);
 
   unsigned new_pid = create_page_directory();
 
@@ -1812,6 +1847,14 @@ int trap_handler(unsigned code,
     case TRAP_REQUEST_PRIORITY: {
       return handle_request_priority(arg1);
     }
+    case TRAP_SYNC: {
+      page_cache_sync(&page_cache, NULL);
+      ext2_sync(&fs);
+      return 0;
+    }
+    case TRAP_FSYNC: {
+      return handle_fsync(arg1);
+    }
     default: {
       // bad syscall, program dies
       *return_to_user = false;
@@ -1834,9 +1877,8 @@ int run_user_program(struct Node* prog_node, int argc, char** argv){
 
   unsigned size = node_size_in_bytes(prog_node);
   unsigned* prog = mmap(size, prog_node, 0, MMAP_READ);
+  unsigned entry = elf_load(prog, prog_node);
   node_free(prog_node);
-  
-  unsigned entry = elf_load(prog);
 
   // The initial user stack grows downward, so reserve it from the top of the
   // user half and enter at the last word in that reservation.
@@ -1879,20 +1921,6 @@ void init_descriptors(struct TCB* tcb, bool init_stdio){
     blocking_lock_init(&tcb->file_descriptors[2]->offset_lock);
     tcb->file_descriptors[2]->type = FILE_DESCRIPTOR_STDERR;
     tcb->file_descriptors[2]->file = NULL;
-  } else {
-    tcb->file_descriptors[0] = NULL;
-    tcb->file_descriptors[1] = NULL;
-    tcb->file_descriptors[2] = NULL;
-  }
-
-  for (int i = 3; i < MAX_FILE_DESCRIPTORS; i++){
-    tcb->file_descriptors[i] = NULL;
-  }
-  for (int i = 0; i < MAX_SEM_DESCRIPTORS; i++){
-    tcb->sem_descriptors[i] = NULL;
-  }
-  for (int i = 0; i < MAX_CHILD_DESCRIPTORS; i++){
-    tcb->child_descriptors[i] = NULL;
   }
 }
 
@@ -1908,6 +1936,7 @@ int allocate_descriptor(struct TCB* tcb, enum DescriptorType type, bool fill){
             blocking_lock_init(&tcb->file_descriptors[i]->offset_lock);
             tcb->file_descriptors[i]->type = FILE_DESCRIPTOR_NORMAL;
             tcb->file_descriptors[i]->file = NULL;
+            readahead_init(&tcb->file_descriptors[i]->ra, 0);
           }
           return i;
         }
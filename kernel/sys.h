@@ -5,6 +5,7 @@
 #include "atomic.h"
 #include "blocking_ringbuf.h"
 #include "blocking_lock.h"
+#include "readahead.h"
 
 enum TrapCode {
   TRAP_EXIT = 0,
@@ -57,6 +58,8 @@ enum TrapCode {
   TRAP_KILL,
   TRAP_GET_SYNTH_AUDIO,
   TRAP_REQUEST_PRIORITY,
+  TRAP_SYNC,
+  TRAP_FSYNC,
 };
 
 #define SEEK_SET 0
@@ -99,6 +102,7 @@ struct FileDescriptor {
   struct BlockingLock offset_lock;
   enum FileDescriptorType type;
   int refcount;
+  struct Readahead ra; // sequential reads of a normal file, under offset_lock
 };
 
 struct SemDescriptor {
@@ -128,7 +132,8 @@ unsigned jump_to_user(unsigned entry, unsigned stack, unsigned r1, unsigned r2);
 // consumes the node, so the caller cannot use it after calling this function
 int run_user_program(struct Node* prog_node, int argc, char** argv);
 
-// initialize descriptor tables for one TCB.
+// initialize descriptor tables for one TCB whose tables are already empty,
+// as every TCB from tcb_cache is.
 // If init_stdio is true, install stdin/stdout/stderr in slots 0..2.
 // Kernel-only daemon threads that never enter the trap ABI can pass false so
 // their descriptor tables stay empty and do not allocate unused stdio state.
@@ -31,6 +31,10 @@
 #include "audio.h"
 #include "physmem.h"
 #include "sd_driver.h"
+#include "page_cache.h"
+#include "kstack.h"
+#include "vmalloc.h"
+#include "swap.h"
 
 struct SpinQueue global_ready_queue[PRIORITY_LEVELS][MLFQ_LEVELS];
 struct SpinQueue reaper_queue;
@@ -41,6 +45,8 @@ bool bootstrapping = true;
 
 int shutdown_barrier = 0;
 
+struct KmemCache* tcb_cache;
+
 unsigned DEFAULT_INTERRUPT_MASK = 
   GLOBAL_INT_ENABLE | 
   SD_0_INT_ENABLE | SD_1_INT_ENABLE | 
@@ -60,11 +66,11 @@ static void free_tcb(struct TCB* tcb) {
   assert(tcb != NULL, "trying to free resources of a NULL TCB.\n");
   assert(tcb->stack != NULL, "TCB stack is already NULL.\n");
   
-  free(tcb->stack);
+  kstack_free(tcb->stack);
   free_fun(tcb->thread_fun);
   
   vmem_destroy_address_space(tcb);
-  free_vme_list(tcb->vme_list);
+  free_vme_list(tcb);
 
   for (int i = 0; i < MAX_FILE_DESCRIPTORS; i++){
     if (tcb->file_descriptors[i]){
@@ -87,7 +93,7 @@ static void free_tcb(struct TCB* tcb) {
 
   free(tcb->my_node);
 
-  free(tcb);
+  kmem_cache_free(tcb_cache, tcb);
 
   __atomic_fetch_add(&n_active, -1);
 }
@@ -106,12 +112,27 @@ static void reaper(void){
   panic("reaper thread tried to exit\n");
 }
 
+// Descriptor tables are most of a TCB. free_tcb() closes every descriptor,
+// leaving each slot NULL, so a cached TCB only needs them cleared once.
+static void tcb_ctor(void* obj){
+  struct TCB* tcb = (struct TCB*)obj;
+  for (int i = 0; i < MAX_FILE_DESCRIPTORS; i++){
+    tcb->file_descriptors[i] = NULL;
+  }
+  for (int i = 0; i < MAX_SEM_DESCRIPTORS; i++){
+    tcb->sem_descriptors[i] = NULL;
+  }
+  for (int i = 0; i < MAX_CHILD_DESCRIPTORS; i++){
+    tcb->child_descriptors[i] = NULL;
+  }
+}
+
 // return a TCB struct
 // defaults to: preemption enabled, not pinned, normal priority
 // If init_stdio is false, leave the descriptor tables empty so kernel-only
 // daemon threads do not allocate stdio descriptors they can never consume.
 static struct TCB* make_tcb(bool is_daemon){
-  struct TCB* tcb = is_daemon ? leak(sizeof(struct TCB)) : malloc(sizeof(struct TCB));
+  struct TCB* tcb = is_daemon ? kmem_cache_leak(tcb_cache) : kmem_cache_alloc(tcb_cache);
 
   tcb->flags = 0;
 
@@ -136,6 +157,9 @@ static struct TCB* make_tcb(bool is_daemon){
   tcb->core_affinity = ANY_CORE;
   tcb->priority = NORMAL_PRIORITY;
   tcb->vme_list = NULL;
+  tcb->vme_root = NULL;
+  tcb->vme_cache = NULL;
+  tcb->swap_hand = USER_VMEM_START;
 
   tcb->cwd = &fs.root;
   tcb->cwd_path = is_daemon ? leak(2) : malloc(2);
@@ -172,7 +196,7 @@ void thread_(struct Fun* thread_fun,
   __atomic_fetch_add(&n_active, 1);
   __atomic_store_n(&bootstrapping, false);
 
-  unsigned* the_stack = malloc(TCB_STACK_SIZE);
+  unsigned* the_stack = kstack_alloc();
   assert(((unsigned)the_stack & 3) == 0, "stack not 4 byte aligned");
   assert(((unsigned)(&the_stack[1023]) & 3) == 0, "stack top not 4 byte aligned");
   tcb->ra = (unsigned)thread_entry;
@@ -201,7 +225,7 @@ void setup_thread(struct Fun* thread_fun, enum ThreadPriority priority, enum Cor
 
   __atomic_fetch_add(&n_active_others, 1);
 
-  unsigned* the_stack = leak(TCB_STACK_SIZE);
+  unsigned* the_stack = kstack_leak();
   assert(((unsigned)the_stack & 3) == 0, "stack not 4 byte aligned");
   assert(((unsigned)(&the_stack[1023]) & 3) == 0, "stack top not 4 byte aligned");
   tcb->ra = (unsigned)thread_entry;
@@ -222,6 +246,8 @@ void setup_thread(struct Fun* thread_fun, enum ThreadPriority priority, enum Cor
 // initialize thread structures; should only be called once on one core
 void threads_init(void){
   scheduler_init();
+  kstack_init();
+  tcb_cache = kmem_cache_create("tcb", sizeof(struct TCB), 4, tcb_ctor);
 
   shutdown_barrier = CONFIG.num_cores;
 
@@ -248,6 +274,10 @@ void block(unsigned was, void (*func)(void *), void *arg, bool run_with_interrup
 
   assert(me != idle, "threads block: idle thread attempted to block.\n");
 
+  kstack_check(me);
+
+  // context_switch() flushes the TLB, see vmalloc_purge()
+  __atomic_store_n(&core->tlb_flushes, core->tlb_flushes + 1);
   context_switch(me, idle, func, arg, &core->current_thread, was, run_with_interrupts);
 }
 
@@ -305,12 +335,31 @@ void kernel_shutdown(void){
       keys = next;
     }
 
+    // cached file pages pin inodes and may still need writeback
+    vmem_print_stats();
+    swap_print_stats();
+    physmem_print_stats();
+    page_cache_print_stats(&page_cache);
+    // the final writeback must not start a flusher thread that can never run
+    if (fs.initialized){
+      ext2_flusher_stop(&fs);
+    }
+    page_cache_drain(&page_cache);
+    if (fs.initialized){
+      ext2_sync(&fs);
+      bcache_print_stats(&fs.bcache);
+      dcache_print_stats(&fs.dcache);
+    }
+
     ext2_destroy(&fs);
+    vmalloc_print_stats();
+    vmalloc_destroy();
     ps2_destroy();
     audio_destroy();
     sd_destroy();
     vmem_global_destroy();
     scheduler_destroy();
+    kstack_drain();
     physmem_destroy_locks();
     heap_destroy();
 
@@ -368,8 +417,11 @@ void event_loop(void) {
     struct TCB* next = schedule_next_thread();
 
     if (next == NULL) {
-      // no work to do
-      pause();
+      // no work to do: pre-zero a frame for the next fault, else compact a
+      // free block for the next kernel stack, and pause once neither has work
+      if (!physmem_zero_pool_refill() && !physmem_compact_idle()) {
+        pause();
+      }
       continue;
     }
 
@@ -392,6 +444,7 @@ void event_loop(void) {
     }
 
     int was = interrupts_disable();
+    __atomic_store_n(&core->tlb_flushes, core->tlb_flushes + 1);
     context_switch(me, next, nothing, NULL, &core->current_thread, was, true);
   }
 
@@ -25,6 +25,9 @@
 extern struct SpinQueue global_ready_queue[PRIORITY_LEVELS][MLFQ_LEVELS];
 extern struct SpinQueue reaper_queue;
 
+// typed cache for every TCB except the per-core idle threads
+extern struct KmemCache* tcb_cache;
+
 extern int n_active;
 extern int n_active_others; // number of running threads not counted in n_active
 
@@ -0,0 +1,256 @@
+#include "vmalloc.h"
+#include "vmem.h"
+#include "physmem.h"
+#include "machine.h"
+#include "per_core.h"
+#include "threads.h"
+#include "blocking_lock.h"
+#include "config.h"
+#include "debug.h"
+#include "print.h"
+
+/*
+ * vmalloc window.
+ *
+ * The window's PTEs live in VMALLOC_PAGE_TABLES consecutive page tables, so
+ * they form one flat array indexed by page number in the window. Every page
+ * directory points its window slots at those tables (vmalloc_install()), so
+ * the assembly refill path in vmem.s serves window misses like any other
+ * valid PTE.
+ *
+ * Each area is followed by one unmapped guard page. An overrun hits the guard
+ * and panics instead of running into the next area. It also lets vfree() find
+ * an area's end from the PTEs alone.
+ *
+ * Freed areas are not reused at once, because other cores may still hold TLB
+ * entries for them and there is no cross-core shootdown. vfree() moves the
+ * pages to vmalloc_lazy. A purge runs only when the window is otherwise full.
+ * Every context switch clears the TLB and counts itself in the core's
+ * tlb_flushes, so the purge snapshots those counts, flushes its own core, and
+ * waits until every other core has switched once. The lazy pages are then
+ * free. A core that is running its idle thread counts as flushed, because it
+ * switched into the idle thread and flushes again before running anything
+ * else, and the idle thread only touches vmalloc memory during shutdown.
+ */
+static unsigned* vmalloc_ptes;
+
+// reserved window pages, including guards and lazily freed pages
+static unsigned vmalloc_used[VMALLOC_BITMAP_WORDS];
+
+// pages freed by vfree() that still wait for a purge
+static unsigned vmalloc_lazy[VMALLOC_BITMAP_WORDS];
+static unsigned vmalloc_lazy_pages;
+
+// next-fit search start, so freed ranges age before a purge needs them
+static unsigned vmalloc_cursor;
+
+static struct BlockingLock vmalloc_lock;
+
+// counters reported by vmalloc_print_stats()
+static unsigned vmalloc_live_areas;
+static unsigned vmalloc_live_pages;
+static unsigned vmalloc_peak_pages;
+static unsigned vmalloc_purges;
+
+void vmalloc_init(void){
+  vmalloc_ptes = physmem_leak_order(VMALLOC_PAGE_TABLE_ORDER);
+  for (int i = 0; i < VMALLOC_PAGES; i++){
+    vmalloc_ptes[i] = 0;
+  }
+  for (int i = 0; i < VMALLOC_BITMAP_WORDS; i++){
+    vmalloc_used[i] = 0;
+    vmalloc_lazy[i] = 0;
+  }
+  // 0 flushes means a core has not started, see vmalloc_purge()
+  for (int i = 0; i < MAX_CORES; i++){
+    per_core_data[i].tlb_flushes = 0;
+  }
+  vmalloc_lazy_pages = 0;
+  vmalloc_cursor = 0;
+  vmalloc_live_areas = 0;
+  vmalloc_live_pages = 0;
+  vmalloc_peak_pages = 0;
+  vmalloc_purges = 0;
+  blocking_lock_init(&vmalloc_lock);
+}
+
+void vmalloc_destroy(void){
+  if (vmalloc_live_areas != 0){
+    int args[2] = {vmalloc_live_areas, vmalloc_live_pages};
+    say("| Warning: vmalloc leak detected: areas:%d pages:%d\n", args);
+  }
+  blocking_lock_destroy(&vmalloc_lock);
+}
+
+void vmalloc_install(unsigned* pd){
+  for (int i = 0; i < VMALLOC_PAGE_TABLES; i++){
+    unsigned pt = (unsigned)vmalloc_ptes + i * FRAME_SIZE;
+    pd[VMALLOC_FIRST_PDE + i] = pt | VMEM_VALID | VMEM_READ | VMEM_WRITE;
+  }
+}
+
+bool vmalloc_owns_pde(unsigned index){
+  return index >= VMALLOC_FIRST_PDE && index < VMALLOC_FIRST_PDE + VMALLOC_PAGE_TABLES;
+}
+
+static bool page_used(unsigned page){
+  return (vmalloc_used[page / 32] >> (page % 32)) & 1;
+}
+
+static void mark_pages(unsigned* bitmap, unsigned first, unsigned count, bool set){
+  for (unsigned page = first; page < first + count; page++){
+    if (set){
+      bitmap[page / 32] |= 1u << (page % 32);
+    } else {
+      bitmap[page / 32] &= ~(1u << (page % 32));
+    }
+  }
+}
+
+// next-fit search for `count` free pages, or -1; caller holds vmalloc_lock
+static int vmalloc_find_range(unsigned count){
+  unsigned page = vmalloc_cursor;
+  unsigned run = 0;
+
+  // one full lap, plus enough to finish a run that started before the cursor
+  for (unsigned scanned = 0; scanned < VMALLOC_PAGES + count; scanned++, page++){
+    if (page == VMALLOC_PAGES){
+      // runs do not wrap: the guard must stay inside the window
+      page = 0;
+      run = 0;
+    }
+    if (page_used(page)){
+      run = 0;
+    } else if (++run == count){
+      return (int)(page + 1 - count);
+    }
+  }
+  return -1;
+}
+
+// make lazily freed pages reusable once no core can still translate them;
+// caller holds vmalloc_lock. Waits at most until each busy core's next
+// context switch, by yielding, so only thread context may end up here.
+static void vmalloc_purge(void){
+  unsigned seen[MAX_CORES];
+  for (int c = 0; c < CONFIG.num_cores; c++){
+    seen[c] = __atomic_load_n(&per_core_data[c].tlb_flushes);
+  }
+
+  int core_was = core_pin();
+  int me = get_core_id();
+  tlb_flush();
+  core_unpin(core_was);
+
+  for (int c = 0; c < CONFIG.num_cores; c++){
+    struct PerCore* core = &per_core_data[c];
+    // a core that has not started yet flushes in vmem_core_init()
+    while (c != me && seen[c] != 0 &&
+        __atomic_load_n(&core->tlb_flushes) == seen[c] &&
+        __atomic_load_n(&core->current_thread) != &core->idle_thread){
+      yield();
+    }
+  }
+
+  for (int i = 0; i < VMALLOC_BITMAP_WORDS; i++){
+    vmalloc_used[i] &= ~vmalloc_lazy[i];
+    vmalloc_lazy[i] = 0;
+  }
+  vmalloc_lazy_pages = 0;
+  vmalloc_purges++;
+}
+
+void* vmalloc(unsigned size){
+  assert(size > 0, "vmalloc: size is 0.\n");
+  assert(size <= VMALLOC_END - VMALLOC_START - FRAME_SIZE,
+    "vmalloc: size exceeds the vmalloc window.\n");
+
+  unsigned pages = (size + FRAME_SIZE - 1) / FRAME_SIZE;
+  unsigned span = pages + 1; // trailing guard page
+
+  blocking_lock_acquire(&vmalloc_lock);
+
+  int first = vmalloc_find_range(span);
+  if (first < 0 && vmalloc_lazy_pages > 0){
+    vmalloc_purge();
+    first = vmalloc_find_range(span);
+  }
+  if (first < 0){
+    int args[2] = {size, vmalloc_live_pages};
+    say("| vmalloc: no room for %d bytes, %d pages live\n", args);
+    panic("vmalloc: out of virtual address space.\n");
+  }
+
+  mark_pages(vmalloc_used, first, span, true);
+  vmalloc_cursor = (first + span) % VMALLOC_PAGES;
+
+  vmalloc_live_areas++;
+  vmalloc_live_pages += pages;
+  if (vmalloc_live_pages > vmalloc_peak_pages){
+    vmalloc_peak_pages = vmalloc_live_pages;
+  }
+
+  blocking_lock_release(&vmalloc_lock);
+
+  // the range is ours now; its PTEs are invalid until written here
+  for (unsigned i = 0; i < pages; i++){
+    unsigned frame = (unsigned)physmem_alloc();
+    vmalloc_ptes[first + i] = frame | VMEM_VALID | VMEM_READ | VMEM_WRITE;
+  }
+
+  return (void*)(VMALLOC_START + first * FRAME_SIZE);
+}
+
+void vfree(void* p){
+  unsigned addr = (unsigned)p;
+  assert(addr >= VMALLOC_START && addr < VMALLOC_END && (addr & (FRAME_SIZE - 1)) == 0,
+    "vfree: pointer is not in the vmalloc window.\n");
+
+  // guards keep areas apart, so an area starts at a valid PTE whose
+  // predecessor is invalid
+  unsigned first = (addr - VMALLOC_START) / FRAME_SIZE;
+  if (!(vmalloc_ptes[first] & VMEM_VALID) ||
+      (first > 0 && (vmalloc_ptes[first - 1] & VMEM_VALID))){
+    int args[1] = {addr};
+    say("| vfree: 0x%X is not the start of a live vmalloc area\n", args);
+    panic("vfree: invalid vmalloc pointer.\n");
+  }
+
+  unsigned pages = 0;
+  while (first + pages < VMALLOC_PAGES && (vmalloc_ptes[first + pages] & VMEM_VALID)){
+    unsigned pte = vmalloc_ptes[first + pages];
+    vmalloc_ptes[first + pages] = 0;
+    // other cores' entries age out until the next purge flushes them
+    tlb_invalidate((void*)(addr + pages * FRAME_SIZE));
+    physmem_free((void*)(pte & ~(FRAME_SIZE - 1)));
+    pages++;
+  }
+
+  blocking_lock_acquire(&vmalloc_lock);
+  mark_pages(vmalloc_lazy, first, pages + 1, true);
+  vmalloc_lazy_pages += pages + 1;
+  vmalloc_live_areas--;
+  vmalloc_live_pages -= pages;
+  blocking_lock_release(&vmalloc_lock);
+}
+
+bool vmalloc_handle_miss(unsigned addr){
+  if (addr < VMALLOC_START || addr >= VMALLOC_END){
+    return false;
+  }
+
+  unsigned pte = vmalloc_ptes[(addr - VMALLOC_START) / FRAME_SIZE];
+  if (!(pte & VMEM_VALID)){
+    int args[1] = {addr};
+    say("| vmalloc: access to unmapped window page 0x%X\n", args);
+    panic("vmalloc: access to a guard page or a freed area.\n");
+  }
+
+  tlb_write(addr, pte);
+  return true;
+}
+
+void vmalloc_print_stats(void){
+  int args[4] = {vmalloc_live_areas, vmalloc_live_pages, vmalloc_peak_pages, vmalloc_purges};
+  say("| vmalloc: live areas=%d live pages=%d peak pages=%d purges=%d\n", args);
+}
@@ -0,0 +1,50 @@
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include "constants.h"
+
+// The top 64 MiB of the kernel half is the vmalloc window. One set of page
+// tables maps it, and every page directory points at those same tables, so a
+// vmalloc() buffer has the same address in every address space.
+#define VMALLOC_START 0x7C000000
+#define VMALLOC_END   0x80000000 // exclusive
+#define VMALLOC_PAGES 16384
+#define VMALLOC_BITMAP_WORDS 512 // VMALLOC_PAGES / 32
+
+// the window's page tables: 16 consecutive frames from one order-4 block
+#define VMALLOC_PAGE_TABLES 16
+#define VMALLOC_PAGE_TABLE_ORDER 4
+#define VMALLOC_FIRST_PDE 496 // VMALLOC_START >> 22
+
+// set up the shared page tables; called once from vmem_global_init
+void vmalloc_init(void);
+
+// release vmalloc synchronization and warn about live areas
+// to be called only from kernel_shutdown, after every vmalloc() user is gone
+void vmalloc_destroy(void);
+
+// Allocate `size` bytes of virtually contiguous kernel memory, backed by
+// order-0 frames. The buffer is not physically contiguous, so it must never
+// be handed to DMA. Contents are uninitialized. Panics when frames or window
+// space run out. May block.
+void* vmalloc(unsigned size);
+
+// free a buffer returned by vmalloc(); `p` must be its exact start. May block.
+void vfree(void* p);
+
+// point the window's directory slots of a new page directory at the shared
+// page tables
+void vmalloc_install(unsigned* pd);
+
+// true if page directory slot `index` belongs to the window; such slots are
+// shared and must not be freed with the address space
+bool vmalloc_owns_pde(unsigned index);
+
+// Resolve a kernel TLB miss inside the window from the shared page tables.
+// Returns false if addr is outside the window; panics on an unmapped page.
+bool vmalloc_handle_miss(unsigned addr);
+
+// print live, peak and purge counters
+void vmalloc_print_stats(void);
+
+#endif // VMALLOC_H
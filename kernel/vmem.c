@@ -8,11 +8,51 @@
 #include "heap.h"
 #include "per_core.h"
 #include "page_cache.h"
+#include "blocking_lock.h"
 #include "string.h"
 #include "ivt.h"
+#include "vmalloc.h"
+#include "swap.h"
 
 struct PageCache page_cache;
 
+// TLB miss counters, reported by vmem_print_stats()
+static struct {
+  int misses; // misses the fast path could not refill
+  int faults; // misses that had to populate the faulting PTE
+  int misses_avoided; // neighbour PTEs populated ahead by fault-around
+  int zero_maps; // private anonymous pages mapped to the shared zero frame
+  int zero_breaks; // first writes that replaced the zero frame with a real one
+  int zero_pool_maps; // private anonymous user pages mapped to a pre-zeroed frame
+} vmem_stats;
+
+// misses resolved by the refill fast path in vmem.s without entering C
+int vmem_tlb_refills;
+
+static struct KmemCache* vme_cache;
+
+// One read-only frame of zeros shared by every untouched private anonymous
+// page, see vmem_populate_pte(). Its PTEs carry VMEM_COW, so the first write
+// takes the COW path and gets a private frame. Never freed and never counted
+// in frame_shares.
+static unsigned zero_page;
+
+// Extra mappers of each physical frame, indexed by frame index. Private pages
+// shared copy-on-write by vmem_fork() count here; 0 means the frame has exactly
+// one owner, so freshly faulted pages never need to touch the table.
+static int* frame_shares;
+static struct SpinLock frame_share_lock;
+
+// Backing store for one shared anonymous mapping. mmap() creates it and
+// vmem_fork() hands the same store to the child's VME, so every process that
+// inherited the mapping faults in the very same frames.
+struct SharedAnon {
+  int refcount; // VMEs pointing at this store
+  unsigned page_count;
+  unsigned* frames; // physical frame per page, 0 until first touched
+  struct BlockingLock lock;
+};
+
 static unsigned vmem_range_start(unsigned flags){
   return (flags & MMAP_USER) ? USER_VMEM_START : KERNEL_VMEM_START;
 }
@@ -51,6 +91,50 @@ void vmem_global_init(void){
   register_handler(tlb_miss_handler_, (void*)TLB_MISS_IVT_ENTRY);
 
   page_cache_init(&page_cache);
+  vmalloc_init();
+
+  vme_cache = kmem_cache_create("vme", sizeof(struct VME), 4, NULL);
+
+  zero_page = (unsigned)physmem_leak_order(0);
+  clear_page((void*)zero_page);
+
+  // PHYS_FRAME_COUNT ints fit in 2^5 frames
+  frame_shares = physmem_leak_order(5);
+  for (int i = 0; i < PHYS_FRAME_COUNT; i++){
+    frame_shares[i] = 0;
+  }
+  spin_lock_init(&frame_share_lock);
+}
+
+// record one more mapper of a private frame
+static void frame_share(unsigned paddr){
+  unsigned index = frame_index_from_address(paddr);
+  spin_lock_acquire(&frame_share_lock);
+  frame_shares[index]++;
+  spin_lock_release(&frame_share_lock);
+}
+
+// drop one mapper of a private frame, returning true if the caller was the
+// last one and now owns the frame outright
+static bool frame_unshare(unsigned paddr){
+  unsigned index = frame_index_from_address(paddr);
+  spin_lock_acquire(&frame_share_lock);
+  bool last = frame_shares[index] == 0;
+  if (!last){
+    frame_shares[index]--;
+  }
+  spin_lock_release(&frame_share_lock);
+  return last;
+}
+
+// release one mapping of a private frame, freeing it after the last mapper
+static void frame_put(unsigned paddr){
+  if (paddr == zero_page){
+    return;
+  }
+  if (frame_unshare(paddr)){
+    physmem_free((void*)paddr);
+  }
 }
 
 // to be called only by kernel_shutdown
@@ -61,6 +145,9 @@ void vmem_global_destroy(void){
 void vmem_core_init(void){
   tlb_flush();
   set_pid(0);
+  // marks the core as started for vmalloc purges
+  struct PerCore* core = get_per_core();
+  __atomic_store_n(&core->tlb_flushes, core->tlb_flushes + 1);
 }
 
 void tlb_invalidate_range(unsigned start, unsigned end){
@@ -72,32 +159,71 @@ void tlb_invalidate_range(unsigned start, unsigned end){
 
 // allocate a new page directory for a thread
 unsigned create_page_directory(void){
-  unsigned* pd = (unsigned*)physmem_alloc();
-  for (int i = 0; i < 1024; i++){
-    pd[i] = 0; // mark all entries invalid
-  }
+  unsigned* pd = (unsigned*)physmem_alloc_zeroed(); // all entries invalid
+  vmalloc_install(pd);
   return (unsigned)pd;
 }
 
 unsigned create_page_table(void){
-  unsigned* pt = (unsigned*)physmem_alloc();
-  for (int i = 0; i < 1024; i++){
-    pt[i] = 0; // mark all entries invalid
-  }
-  return (unsigned)pt;
+  return (unsigned)physmem_alloc_zeroed(); // all entries invalid
 }
 
 unsigned create_zeroed_page(void){
-  unsigned* page = (unsigned*)physmem_alloc();
-  for (int i = 0; i < FRAME_SIZE / sizeof(unsigned); i++){
-    page[i] = 0;
+  return (unsigned)physmem_alloc_zeroed();
+}
+
+// create the store for a new shared anonymous mapping, with no frames yet
+static struct SharedAnon* shared_anon_create(unsigned page_count){
+  struct SharedAnon* anon = malloc(sizeof(struct SharedAnon));
+  anon->refcount = 1;
+  anon->page_count = page_count;
+  anon->frames = malloc(page_count * sizeof(unsigned));
+  for (unsigned i = 0; i < page_count; i++){
+    anon->frames[i] = 0;
+  }
+  blocking_lock_init(&anon->lock);
+  return anon;
+}
+
+// take another reference to a shared anonymous store
+static struct SharedAnon* shared_anon_get(struct SharedAnon* anon){
+  __atomic_fetch_add(&anon->refcount, 1);
+  return anon;
+}
+
+// drop one reference, freeing the store and its frames after the last VME
+// lets go. Every PTE mapping those frames must already be gone.
+static void shared_anon_put(struct SharedAnon* anon){
+  if (__atomic_fetch_add(&anon->refcount, -1) != 1){
+    return;
+  }
+
+  for (unsigned i = 0; i < anon->page_count; i++){
+    if (anon->frames[i] != 0){
+      physmem_free((void*)anon->frames[i]);
+    }
   }
-  return (unsigned)page;
+  blocking_lock_destroy(&anon->lock);
+  free(anon->frames);
+  free(anon);
+}
+
+// find the frame backing one page of a shared anonymous mapping, zero-filling
+// it on first touch from any of the processes sharing it
+static unsigned shared_anon_page(struct SharedAnon* anon, unsigned index){
+  assert(index < anon->page_count, "shared_anon_page: page index out of range.\n");
+  blocking_lock_acquire(&anon->lock);
+  if (anon->frames[index] == 0){
+    anon->frames[index] = create_zeroed_page();
+  }
+  unsigned frame = anon->frames[index];
+  blocking_lock_release(&anon->lock);
+  return frame;
 }
 
 struct VME* vme_create(unsigned start, unsigned end, unsigned size,
     struct Node* file, unsigned file_offset, unsigned flags, unsigned paddr){
-  struct VME* vme = (struct VME*)malloc(sizeof(struct VME));
+  struct VME* vme = (struct VME*)kmem_cache_alloc(vme_cache);
 
   assert(start % FRAME_SIZE == 0, "vme create: start address must be page aligned.\n");
   assert(end % FRAME_SIZE == 0, "vme create: end address must be page aligned.\n");
@@ -116,12 +242,214 @@ struct VME* vme_create(unsigned start, unsigned end, unsigned size,
   vme->file_offset = file_offset;
   vme->size = size;
   vme->paddr = paddr;
+  vme->anon = NULL;
+  vme->fault_around = VMEM_FAULT_AROUND_DEFAULT;
+  readahead_init(&vme->ra, file_offset);
       
   return vme;
 }
 
-// Insert one VME into a thread's sorted, non-overlapping VME list
-void vme_insert(struct TCB* tcb, struct VME* prev, struct VME* vme){
+/*
+  VME index
+
+  Each address space keeps its VMEs twice: in the sorted `tcb->vme_list`, which
+  fork and teardown walk in order, and in an AVL tree rooted at `tcb->vme_root`
+  and keyed by `start`. Every tree node also records the free gap between the
+  previous VME's end and its own start, and the largest such gap in its
+  subtree, so lookups and first-fit placement both stay O(log n).
+*/
+
+static int vme_height(struct VME* vme){
+  return vme ? vme->tree_height : 0;
+}
+
+static unsigned vme_max_gap(struct VME* vme){
+  return vme ? vme->max_gap : 0;
+}
+
+// recompute a node's height and subtree gap from its children
+static void vme_tree_update(struct VME* vme){
+  int left = vme_height(vme->tree_left);
+  int right = vme_height(vme->tree_right);
+  vme->tree_height = 1 + (left > right ? left : right);
+
+  unsigned max_gap = vme->gap;
+  if (vme_max_gap(vme->tree_left) > max_gap) max_gap = vme_max_gap(vme->tree_left);
+  if (vme_max_gap(vme->tree_right) > max_gap) max_gap = vme_max_gap(vme->tree_right);
+  vme->max_gap = max_gap;
+}
+
+static struct VME* vme_rotate_right(struct VME* vme){
+  struct VME* left = vme->tree_left;
+  vme->tree_left = left->tree_right;
+  left->tree_right = vme;
+  vme_tree_update(vme);
+  vme_tree_update(left);
+  return left;
+}
+
+static struct VME* vme_rotate_left(struct VME* vme){
+  struct VME* right = vme->tree_right;
+  vme->tree_right = right->tree_left;
+  right->tree_left = vme;
+  vme_tree_update(vme);
+  vme_tree_update(right);
+  return right;
+}
+
+// restore the AVL invariant at one node after a child changed height
+static struct VME* vme_tree_balance(struct VME* vme){
+  vme_tree_update(vme);
+  int balance = vme_height(vme->tree_left) - vme_height(vme->tree_right);
+  if (balance > 1){
+    if (vme_height(vme->tree_left->tree_left) < vme_height(vme->tree_left->tree_right)){
+      vme->tree_left = vme_rotate_left(vme->tree_left);
+    }
+    return vme_rotate_right(vme);
+  }
+  if (balance < -1){
+    if (vme_height(vme->tree_right->tree_right) < vme_height(vme->tree_right->tree_left)){
+      vme->tree_right = vme_rotate_right(vme->tree_right);
+    }
+    return vme_rotate_left(vme);
+  }
+  return vme;
+}
+
+static struct VME* vme_tree_insert(struct VME* root, struct VME* vme){
+  if (root == NULL){
+    vme->tree_left = NULL;
+    vme->tree_right = NULL;
+    vme_tree_update(vme);
+    return vme;
+  }
+  if (vme->start < root->start){
+    root->tree_left = vme_tree_insert(root->tree_left, vme);
+  } else {
+    root->tree_right = vme_tree_insert(root->tree_right, vme);
+  }
+  return vme_tree_balance(root);
+}
+
+// unlink the leftmost node of a subtree, returning it through `min`
+static struct VME* vme_tree_remove_min(struct VME* root, struct VME** min){
+  if (root->tree_left == NULL){
+    *min = root;
+    return root->tree_right;
+  }
+  root->tree_left = vme_tree_remove_min(root->tree_left, min);
+  return vme_tree_balance(root);
+}
+
+static struct VME* vme_tree_remove(struct VME* root, struct VME* vme){
+  assert(root != NULL, "vme tree remove: VME missing from its address space index.\n");
+  if (vme->start < root->start){
+    root->tree_left = vme_tree_remove(root->tree_left, vme);
+  } else if (vme->start > root->start){
+    root->tree_right = vme_tree_remove(root->tree_right, vme);
+  } else {
+    assert(root == vme, "vme tree remove: two VMEs share a start address.\n");
+    if (vme->tree_left == NULL) return vme->tree_right;
+    if (vme->tree_right == NULL) return vme->tree_left;
+
+    struct VME* successor;
+    struct VME* right = vme_tree_remove_min(vme->tree_right, &successor);
+    successor->tree_left = vme->tree_left;
+    successor->tree_right = right;
+    root = successor;
+  }
+  return vme_tree_balance(root);
+}
+
+// recompute subtree gaps along the path to a node whose own gap changed
+static void vme_tree_refresh(struct VME* root, struct VME* vme){
+  if (root == vme){
+    vme_tree_update(root);
+    return;
+  }
+  vme_tree_refresh(vme->start < root->start ? root->tree_left : root->tree_right, vme);
+  vme_tree_update(root);
+}
+
+// last VME starting at or below `addr`
+static struct VME* vme_floor(struct TCB* tcb, unsigned addr){
+  struct VME* best = NULL;
+  struct VME* node = tcb->vme_root;
+  while (node){
+    if (node->start <= addr){
+      best = node;
+      node = node->tree_right;
+    } else {
+      node = node->tree_left;
+    }
+  }
+  return best;
+}
+
+// first VME ending above `addr`: the one containing it, or the next one up
+static struct VME* vme_ceiling(struct TCB* tcb, unsigned addr){
+  struct VME* best = NULL;
+  struct VME* node = tcb->vme_root;
+  while (node){
+    if (node->end > addr){
+      best = node;
+      node = node->tree_left;
+    } else {
+      node = node->tree_right;
+    }
+  }
+  return best;
+}
+
+// VME immediately before `vme` in address order
+static struct VME* vme_prev(struct TCB* tcb, struct VME* vme){
+  return vme->start == 0 ? NULL : vme_floor(tcb, vme->start - 1);
+}
+
+// leftmost VME starting above `after` whose gap is at least `size`
+static struct VME* vme_first_gap(struct VME* node, unsigned after, unsigned size){
+  if (node == NULL || node->max_gap < size){
+    return NULL;
+  }
+  if (node->start > after){
+    struct VME* found = vme_first_gap(node->tree_left, after, size);
+    if (found) return found;
+    if (node->gap >= size) return node;
+  }
+  return vme_first_gap(node->tree_right, after, size);
+}
+
+// rightmost VME starting in (after, upto] whose gap is at least `size`
+static struct VME* vme_last_gap(struct VME* node, unsigned after, unsigned upto, unsigned size){
+  if (node == NULL || node->max_gap < size){
+    return NULL;
+  }
+  if (node->start <= upto){
+    struct VME* found = vme_last_gap(node->tree_right, after, upto, size);
+    if (found) return found;
+    if (node->start <= after) return NULL;
+    if (node->gap >= size) return node;
+  }
+  return vme_last_gap(node->tree_left, after, upto, size);
+}
+
+struct VME* vme_find(struct TCB* tcb, unsigned addr){
+  struct VME* cached = tcb->vme_cache;
+  if (cached != NULL && addr >= cached->start && addr < cached->end){
+    return cached;
+  }
+
+  struct VME* vme = vme_floor(tcb, addr);
+  if (vme == NULL || addr >= vme->end){
+    return NULL;
+  }
+  tcb->vme_cache = vme;
+  return vme;
+}
+
+// Insert one VME into a thread's sorted, non-overlapping VME list and index
+void vme_insert(struct TCB* tcb, struct VME* vme){
+  struct VME* prev = vme_prev(tcb, vme);
   if (prev){
     vme->next = prev->next;
     prev->next = vme;
@@ -129,18 +457,80 @@ void vme_insert(struct TCB* tcb, struct VME* prev, struct VME* vme){
     vme->next = tcb->vme_list;
     tcb->vme_list = vme;
   }
+
+  vme->gap = vme->start - (prev ? prev->end : 0);
+  tcb->vme_root = vme_tree_insert(tcb->vme_root, vme);
+
+  // the next VME's gap now starts at this VME's end
+  if (vme->next){
+    vme->next->gap = vme->next->start - vme->end;
+    vme_tree_refresh(tcb->vme_root, vme->next);
+  }
 }
 
-// free all VMEs in the given list
-void free_vme_list(struct VME* vme){
+// unlink one VME from a thread's list and index; `prev` is its list predecessor
+static void vme_remove(struct TCB* tcb, struct VME* prev, struct VME* vme){
+  if (prev){
+    prev->next = vme->next;
+  } else {
+    tcb->vme_list = vme->next;
+  }
+
+  tcb->vme_root = vme_tree_remove(tcb->vme_root, vme);
+
+  // the next VME's gap grows to cover the freed range
+  if (vme->next){
+    vme->next->gap = vme->next->start - (prev ? prev->end : 0);
+    vme_tree_refresh(tcb->vme_root, vme->next);
+  }
+
+  if (tcb->vme_cache == vme){
+    tcb->vme_cache = NULL;
+  }
+}
+
+// First-fit search inside [range_start, range_end]. Returns the start of the
+// lowest gap that can hold `rounded_size` bytes; callers still range-check it
+// because the answer may fall past the end of the half when nothing fits.
+static unsigned vmem_first_fit(struct TCB* tcb, unsigned rounded_size, unsigned range_start,
+    unsigned range_end){
+  struct VME* first = vme_ceiling(tcb, range_start);
+  if (first == NULL || first->start > range_end){
+    return range_start;
+  }
+  assert(first->start >= range_start,
+    "mmap: VME list must stay sorted, non-overlapping, and stay within one address-space half.\n");
+  if (first->start - range_start >= rounded_size){
+    return range_start;
+  }
+
+  // every later VME's predecessor lies inside this half, so its stored gap
+  // is exactly the free space available to this search
+  struct VME* next = vme_first_gap(tcb->vme_root, first->start, rounded_size);
+  if (next == NULL){
+    return vme_floor(tcb, UINT_MAX)->end;
+  }
+  return vme_prev(tcb, next)->end;
+}
+
+// free all VMEs of an address space and reset its index
+void free_vme_list(struct TCB* tcb){
+  struct VME* vme = tcb->vme_list;
   while (vme){
     struct VME* next = vme->next;
     if (vme->file != NULL){
       node_free(vme->file);
     }
-    free(vme);
+    if (vme->anon != NULL){
+      shared_anon_put(vme->anon);
+    }
+    kmem_cache_free(vme_cache, vme);
     vme = next;
   }
+  tcb->vme_list = NULL;
+  tcb->vme_root = NULL;
+  tcb->vme_cache = NULL;
+  tcb->swap_hand = USER_VMEM_START;
 }
 
 // unmap all physical pages backing this VME and invalidate PTE entries
@@ -157,19 +547,28 @@ void unmap_vme(unsigned* pd, struct VME* vme){
 
     unsigned* pt = (unsigned*)(pde & ~(FRAME_SIZE - 1));
     unsigned pte = pt[page_table_index];
-    if (!(pte & VMEM_VALID)) continue;
+    if (!(pte & (VMEM_VALID | VMEM_SWAP))) continue;
     
-    if (vme->flags & MMAP_SHARED){
-      assert(vme->file != NULL, "cannot yet handle shared anonymous pages\n");
+    if (pte & VMEM_SWAP){
+      // a swapped-out private page only holds a slot reference
+      swap_free(pte >> 12);
+    } else if (vme->anon != NULL){
+      // shared anonymous frames belong to the store, which frees them once
+      // the last VME referencing it is gone
+    } else if (vme->flags & MMAP_SHARED){
       // shared mapping, release from page cache
       page_cache_release(&page_cache, vme->file, (vme->file_offset + (va - vme->start)));
     } else if (vme->paddr != 0){
       // Direct physmem mappings borrow an existing MMIO/physical window. The
       // unmap path must only drop the translation, not return that backing page
       // to the physmem allocator.
+    } else if (pte & VMEM_FILE_PAGE){
+      // private file page that was never written, still borrowed from the cache
+      page_cache_release(&page_cache, vme->file, (vme->file_offset + (va - vme->start)));
     } else {
-      // private mapping, just free the physical page
-      physmem_free((void*)(pte & ~(FRAME_SIZE - 1)));
+      // private mapping, free the physical page unless a forked address space
+      // still shares it copy-on-write
+      frame_put(pte & ~(FRAME_SIZE - 1));
     }
     
     pt[page_table_index] = 0;
@@ -179,7 +578,7 @@ void unmap_vme(unsigned* pd, struct VME* vme){
       // if page table is now empty, free it and invalidate the PDE
       bool empty = true;
       for (int i = 0; i < 1024; i++){
-        if (prev_pt[i] & VMEM_VALID){
+        if (prev_pt[i] & (VMEM_VALID | VMEM_SWAP)){
           empty = false;
           break;
         }
@@ -198,7 +597,7 @@ void unmap_vme(unsigned* pd, struct VME* vme){
   if (prev_pt != NULL){
     bool empty = true;
     for (int i = 0; i < 1024; i++){
-      if (prev_pt[i] & VMEM_VALID){
+      if (prev_pt[i] & (VMEM_VALID | VMEM_SWAP)){
         empty = false;
         break;
       }
@@ -238,15 +637,20 @@ static unsigned shared_vme_page_bytes(struct VME* vme, unsigned va){
 // copy a thread's page dir/page tables and vme_list from src to dst
 void vmem_fork(struct TCB* src, struct TCB* dst){
   dst->vme_list = NULL;
+  dst->vme_root = NULL;
+  dst->vme_cache = NULL;
+  dst->swap_hand = USER_VMEM_START;
 
   // copy vme list to dst tcb
-  struct VME* prev_vme = NULL;
   for (struct VME* vme = src->vme_list; vme != NULL; vme = vme->next){
     struct VME* new_vme = vme_create(vme->start, vme->end, vme->size,
                                      vme->file, vme->file_offset,
                                      vme->flags, vme->paddr);
-    vme_insert(dst, prev_vme, new_vme);
-    prev_vme = new_vme;
+    if (vme->anon != NULL){
+      new_vme->anon = shared_anon_get(vme->anon);
+    }
+    new_vme->fault_around = vme->fault_around;
+    vme_insert(dst, new_vme);
   }
 
   // copy page directory and page tables from src to dst
@@ -266,7 +670,7 @@ void vmem_fork(struct TCB* src, struct TCB* dst){
 
       unsigned* src_pt = (unsigned*)(pde & ~(FRAME_SIZE - 1));
       unsigned pte = src_pt[page_table_index];
-      if (!(pte & VMEM_VALID)) continue;
+      if (!(pte & (VMEM_VALID | VMEM_SWAP))) continue;
 
       unsigned* dst_pt;
       if (dst_pd[page_dir_index] & VMEM_VALID){
@@ -277,7 +681,15 @@ void vmem_fork(struct TCB* src, struct TCB* dst){
       }
 
       unsigned paddr = pte & ~(FRAME_SIZE - 1);
-      if (vme->flags & MMAP_SHARED){
+      if (pte & VMEM_SWAP){
+        // the child shares the swap slot; whichever side faults first reads
+        // its own copy back
+        swap_dup(pte >> 12);
+        dst_pt[page_table_index] = pte;
+      } else if (vme->anon != NULL){
+        // both VMEs reference the same store, so the frame stays shared
+        dst_pt[page_table_index] = pte;
+      } else if (vme->flags & MMAP_SHARED){
         unsigned page_offset = vme->file_offset + (va - vme->start);
         unsigned page_bytes = shared_vme_page_bytes(vme, va);
         struct PageCacheEntry* page = page_cache_acquire(&page_cache,
@@ -285,13 +697,81 @@ void vmem_fork(struct TCB* src, struct TCB* dst){
         assert((unsigned)page->page_data == paddr,
           "vmem_fork: shared source PTE must point at the page cache page.\n");
         dst_pt[page_table_index] = pte;
+      } else if (vme->paddr != 0){
+        // direct physmem windows are borrowed, never owned, so just alias them
+        dst_pt[page_table_index] = pte;
+      } else if (pte & VMEM_FILE_PAGE){
+        // the child borrows the same page-cache frame with its own reference
+        page_cache_acquire(&page_cache, vme->file,
+          vme->file_offset + (va - vme->start), 0);
+        dst_pt[page_table_index] = pte;
+      } else if (paddr == zero_page){
+        // already read-only and COW; the zero frame has no share count
+        dst_pt[page_table_index] = pte;
       } else {
-        unsigned* dst_page = physmem_alloc();
-        memcpy(dst_page, (void*)paddr, FRAME_SIZE);
-        dst_pt[page_table_index] = (unsigned)dst_page | (pte & 0xFFF);
+        // Share the private frame and make both copies read-only. The first
+        // write from either side faults and gets its own copy.
+        frame_share(paddr);
+        pte = (pte & ~VMEM_WRITE) | VMEM_COW;
+        src_pt[page_table_index] = pte;
+        dst_pt[page_table_index] = pte;
       }
     }
   }
+
+  // the parent may still have writable TLB entries for pages that are now COW
+  tlb_flush();
+}
+
+// Resolve a write to a copy-on-write page. Returns true if the fault was a COW
+// fault and the faulting access can be retried.
+static bool vmem_handle_cow_fault(struct VME* vme, unsigned fault_addr){
+  if (vme == NULL || !(vme->flags & MMAP_WRITE)){
+    return false;
+  }
+
+  unsigned* pd = get_pid();
+  unsigned pde = pd[(fault_addr >> 22) & 0x3FF];
+  if (!(pde & VMEM_VALID)){
+    return false;
+  }
+
+  unsigned* pt = (unsigned*)(pde & ~0xFFF);
+  unsigned page_table_index = (fault_addr >> 12) & 0x3FF;
+  unsigned pte = pt[page_table_index];
+  if (!(pte & VMEM_VALID) || !(pte & VMEM_COW)){
+    return false;
+  }
+
+  // A COW PTE carries every VME permission except write, so any protection
+  // fault on it from a writable VME is the deferred write.
+  unsigned paddr = pte & ~(FRAME_SIZE - 1);
+  if (paddr == zero_page){
+    // first write to an untouched anonymous page; nothing to copy
+    paddr = create_zeroed_page();
+    __atomic_fetch_add(&vmem_stats.zero_breaks, 1);
+  } else if (pte & VMEM_FILE_PAGE){
+    // first write to a private file page: copy it out of the page cache and
+    // give back the borrowed reference
+    unsigned copy = (unsigned)physmem_alloc();
+    copy_page((void*)copy, (void*)paddr);
+    page_cache_release(&page_cache, vme->file,
+      vme->file_offset + (fault_addr - vme->start));
+    paddr = copy;
+  } else if (!frame_unshare(paddr)){
+    // other address spaces still map the frame; take a private copy
+    unsigned copy = (unsigned)physmem_alloc();
+    copy_page((void*)copy, (void*)paddr);
+    paddr = copy;
+  }
+
+  pte = paddr | (pte & 0xFFF);
+  pte = (pte & ~(VMEM_COW | VMEM_FILE_PAGE)) | VMEM_WRITE | VMEM_REFERENCED;
+  pt[page_table_index] = pte;
+
+  tlb_invalidate((void*)fault_addr);
+  tlb_write(fault_addr, pte);
+  return true;
 }
 
 // free all physical pages mapped by the given address space, 
@@ -303,9 +783,10 @@ void vmem_destroy_address_space(struct TCB* tcb) {
     unmap_vme(pd, vme);
   }
 
-  // free any page tables and invalidate PDE entries
+  // free any page tables and invalidate PDE entries; the vmalloc window's
+  // tables are shared by every address space
   for (unsigned page_dir_index = 0; page_dir_index < 1024; page_dir_index++) {
-    if (pd[page_dir_index] & VMEM_VALID) {
+    if ((pd[page_dir_index] & VMEM_VALID) && !vmalloc_owns_pde(page_dir_index)) {
       physmem_free((void*)(pd[page_dir_index] & ~(FRAME_SIZE - 1)));
       pd[page_dir_index] = 0;
     }
@@ -328,32 +809,8 @@ void* mmap(unsigned size, struct Node* file, unsigned file_offset, unsigned flag
   struct TCB* tcb = get_current_tcb();
   interrupts_restore(was);
 
-  // Skip any mappings that end before the selected kernel/user half, 
-  // then do first-fit within that half
-  struct VME* prev = NULL;
-  struct VME* curr = tcb->vme_list;
-  while (curr && curr->end <= range_start){
-    prev = curr;
-    curr = curr->next;
-  }
-
-  unsigned last_end = range_start;
-  while (curr){
-    assert(curr->start >= last_end,
-      "mmap: VME list must stay sorted, non-overlapping, and stay within one address-space half.\n");
-
-    if (curr->start > range_end){
-      break;
-    }
-
-    if (curr->start - last_end >= rounded_size){
-      break;
-    }
-
-    last_end = curr->end;
-    prev = curr;
-    curr = curr->next;
-  }
+  // first-fit within the selected kernel/user half
+  unsigned last_end = vmem_first_fit(tcb, rounded_size, range_start, range_end);
 
   if (!vmem_range_can_hold(last_end, rounded_size, range_start, range_end)){
     if (flags & MMAP_USER){
@@ -368,8 +825,11 @@ void* mmap(unsigned size, struct Node* file, unsigned file_offset, unsigned flag
   unsigned end = start + rounded_size;
 
   struct VME* vme = vme_create(start, end, size, file, file_offset, flags, 0);
+  if ((flags & MMAP_SHARED) && file == NULL){
+    vme->anon = shared_anon_create(rounded_size / FRAME_SIZE);
+  }
 
-  vme_insert(tcb, prev, vme);
+  vme_insert(tcb, vme);
 
   return (void*)start;
 }
@@ -399,48 +859,35 @@ void* mmap_stack(unsigned size, unsigned flags){
   struct TCB* tcb = get_current_tcb();
   interrupts_restore(was);
 
-  // Walk the ascending VME list once and remember the highest gap that can fit
-  // the stack. The list stays globally sorted; we only consider the user half.
-  struct VME* prev = NULL;
-  struct VME* curr = tcb->vme_list;
-  while (curr && curr->end <= range_start){
-    prev = curr;
-    curr = curr->next;
-  }
-
-  unsigned gap_start = range_start;
+  // Take the highest gap in the user half that can fit the stack: the space
+  // above the last VME below the limit, else the highest fitting gap between
+  // two user VMEs, else the space below the lowest user VME.
   unsigned stack_start = 0;
-  struct VME* stack_prev = NULL;
   bool found = false;
 
-  while (curr){
-    assert(curr->start >= gap_start,
-      "mmap_stack: VME list must stay sorted, non-overlapping, and stay within one address-space half.\n");
-
-    unsigned gap_end = curr->start;
-    if (gap_end > range_limit){
-      gap_end = range_limit;
-    }
-
-    if (gap_end >= gap_start && (gap_end - gap_start) >= rounded_size){
-      stack_start = gap_end - rounded_size;
-      stack_prev = prev;
+  struct VME* first = vme_ceiling(tcb, range_start);
+  struct VME* last = vme_floor(tcb, range_limit - 1);
+  if (first == NULL || last == NULL || last->start < first->start){
+    // no user VMEs below the limit
+    if (range_limit - range_start >= rounded_size){
+      stack_start = range_limit - rounded_size;
       found = true;
     }
+  } else {
+    assert(first->start >= range_start && last->end <= range_limit,
+      "mmap_stack: VME list must stay sorted, non-overlapping, and stay within one address-space half.\n");
 
-    if (curr->start >= range_limit){
-      break;
+    struct VME* next;
+    if (range_limit - last->end >= rounded_size){
+      stack_start = range_limit - rounded_size;
+      found = true;
+    } else if ((next = vme_last_gap(tcb->vme_root, first->start, last->start, rounded_size)) != NULL){
+      stack_start = next->start - rounded_size;
+      found = true;
+    } else if (first->start - range_start >= rounded_size){
+      stack_start = first->start - rounded_size;
+      found = true;
     }
-
-    gap_start = curr->end;
-    prev = curr;
-    curr = curr->next;
-  }
-
-  if (gap_start <= range_limit && (range_limit - gap_start) >= rounded_size){
-    stack_start = range_limit - rounded_size;
-    stack_prev = prev;
-    found = true;
   }
 
   if (!found || !vmem_range_can_hold(stack_start, rounded_size, range_start, range_end)){
@@ -450,7 +897,7 @@ void* mmap_stack(unsigned size, unsigned flags){
 
   unsigned stack_end = stack_start + rounded_size;
   struct VME* vme = vme_create(stack_start, stack_end, size, NULL, 0, flags, 0);
-  vme_insert(tcb, stack_prev, vme);
+  vme_insert(tcb, vme);
 
   return (void*)stack_start;
 }
@@ -482,12 +929,7 @@ struct VME* mmap_at(unsigned size, struct Node* file, unsigned file_offset, unsi
 
   // Find the first VME whose range extends past the requested start address.
   // If that VME begins before `end`, the fixed-address mapping overlaps it.
-  struct VME* prev = NULL;
-  struct VME* curr = tcb->vme_list;
-  while (curr && curr->end <= start){
-    prev = curr;
-    curr = curr->next;
-  }
+  struct VME* curr = vme_ceiling(tcb, start);
 
   if (curr != NULL && curr->start < end){
     panic("mmap_at: requested mapping overlaps an existing VME.\n");
@@ -495,8 +937,11 @@ struct VME* mmap_at(unsigned size, struct Node* file, unsigned file_offset, unsi
   }
 
   struct VME* vme = vme_create(start, end, size, file, file_offset, flags, 0);
+  if ((flags & MMAP_SHARED) && file == NULL){
+    vme->anon = shared_anon_create(rounded_size / FRAME_SIZE);
+  }
 
-  vme_insert(tcb, prev, vme);
+  vme_insert(tcb, vme);
 
   return vme;
 }
@@ -514,32 +959,8 @@ void* mmap_physmem(unsigned size, unsigned paddr, unsigned flags){
   struct TCB* tcb = get_current_tcb();
   interrupts_restore(was);
 
-  // Skip any mappings that end before the selected kernel/user half, 
-  // then do first-fit within that half
-  struct VME* prev = NULL;
-  struct VME* curr = tcb->vme_list;
-  while (curr && curr->end <= range_start){
-    prev = curr;
-    curr = curr->next;
-  }
-
-  unsigned last_end = range_start;
-  while (curr){
-    assert(curr->start >= last_end,
-      "mmap: VME list must stay sorted, non-overlapping, and stay within one address-space half.\n");
-
-    if (curr->start > range_end){
-      break;
-    }
-
-    if (curr->start - last_end >= rounded_size){
-      break;
-    }
-
-    last_end = curr->end;
-    prev = curr;
-    curr = curr->next;
-  }
+  // first-fit within the selected kernel/user half
+  unsigned last_end = vmem_first_fit(tcb, rounded_size, range_start, range_end);
 
   if (!vmem_range_can_hold(last_end, rounded_size, range_start, range_end)){
     if (flags & MMAP_USER){
@@ -555,7 +976,7 @@ void* mmap_physmem(unsigned size, unsigned paddr, unsigned flags){
 
   struct VME* vme = vme_create(start, end, size, NULL, 0, flags, paddr);
 
-  vme_insert(tcb, prev, vme);
+  vme_insert(tcb, vme);
 
   return (void*)start;
 }
@@ -565,35 +986,37 @@ void munmap(void* p){
   struct TCB* tcb = get_current_tcb();
   interrupts_restore(was);
 
-  struct VME* prev = NULL;
-  struct VME* curr = tcb->vme_list;
-
-  while (curr){
-    // find VME corresponding to p
-    if ((void*)curr->start == p){
-      if (prev){
-        prev->next = curr->next;
-      } else {
-        tcb->vme_list = curr->next;
-      }
+  // find VME corresponding to p
+  struct VME* curr = vme_find(tcb, (unsigned)p);
+  if (curr == NULL || (void*)curr->start != p){
+    panic("munmap called with invalid address\n");
+  }
 
-      assert(!((curr->flags & MMAP_SHARED) && (curr->file == NULL)), 
-        "munmap: cannot yet unmap shared anonymous VME\n");
+  vme_remove(tcb, vme_prev(tcb, curr), curr);
 
-      // free any physical pages backing this VME
-      unmap_vme((unsigned*)tcb->pid, curr);
+  // free any physical pages backing this VME
+  unmap_vme((unsigned*)tcb->pid, curr);
 
-      if (curr->file != NULL){
-        node_free(curr->file);
-      }
-      free(curr);
-      return;
-    }
-    prev = curr;
-    curr = curr->next;
+  if (curr->file != NULL){
+    node_free(curr->file);
   }
+  if (curr->anon != NULL){
+    shared_anon_put(curr->anon);
+  }
+  kmem_cache_free(vme_cache, curr);
+}
 
-  panic("munmap called with invalid address\n");
+void vme_set_fault_around(struct VME* vme, unsigned pages){
+  vme->fault_around = pages > VMEM_FAULT_AROUND_MAX ? VMEM_FAULT_AROUND_MAX : pages;
+}
+
+void vmem_print_stats(void){
+  int args[4] = {vmem_tlb_refills, vmem_stats.misses, vmem_stats.faults,
+    vmem_stats.misses_avoided};
+  say("| VM: tlb refills=%d slow misses=%d faults=%d misses avoided=%d\n", args);
+  int zero_args[3] = {vmem_stats.zero_maps, vmem_stats.zero_breaks,
+    vmem_stats.zero_pool_maps};
+  say("| VM: zero-page maps=%d zero-page breaks=%d zero-pool maps=%d\n", zero_args);
 }
 
 void vme_change_perms(struct VME* vme, unsigned new_flags){
@@ -614,7 +1037,8 @@ void vme_change_perms(struct VME* vme, unsigned new_flags){
 
     pte &= ~(VMEM_READ | VMEM_WRITE | VMEM_EXEC);
     if (vme->flags & MMAP_READ) pte |= VMEM_READ;
-    if (vme->flags & MMAP_WRITE) pte |= VMEM_WRITE;
+    // COW pages only become writable through the write fault that copies them
+    if ((vme->flags & MMAP_WRITE) && !(pte & VMEM_COW)) pte |= VMEM_WRITE;
     if (vme->flags & MMAP_EXEC) pte |= VMEM_EXEC;
     if (vme->flags & MMAP_USER) pte |= VMEM_USER;
     pt[page_table_index] = pte;
@@ -623,6 +1047,331 @@ void vme_change_perms(struct VME* vme, unsigned new_flags){
   tlb_invalidate_range(vme->start, vme->end);
 }
 
+// PTE permission bits granted by a VME's mmap flags
+static unsigned vme_pte_perms(struct VME* vme){
+  unsigned perms = 0;
+  if (vme->flags & MMAP_READ) perms |= VMEM_READ;
+  if (vme->flags & MMAP_WRITE) perms |= VMEM_WRITE;
+  if (vme->flags & MMAP_EXEC) perms |= VMEM_EXEC;
+  if (vme->flags & MMAP_USER) perms |= VMEM_USER;
+  return perms;
+}
+
+// Build the PTE for one unmapped page of `vme`, acquiring or allocating its
+// backing frame. Fault-around passes `speculative`, which only maps pages that
+// need no disk I/O and returns 0 for anything else.
+static unsigned vmem_populate_pte(struct VME* vme, unsigned va, bool speculative){
+  unsigned phys_page = 0;
+  bool borrowed = false;
+  bool zero = false;
+  if (vme->file){
+    unsigned file_page_offset = vme->file_offset + (va - vme->start);
+    if (vme->flags & MMAP_SHARED){
+      // writable shared pages are marked dirty when mapped, so only map them
+      // once they are really touched
+      if (speculative && (vme->flags & MMAP_WRITE)){
+        return 0;
+      }
+
+      // this is intentional, so mmap can be used to extend files
+      unsigned bytes_in_page = shared_vme_page_bytes(vme, va);
+
+      // shared mapping points directly into page cache
+      struct PageCacheEntry* page = speculative ?
+        page_cache_acquire_resident(&page_cache, vme->file, file_page_offset, bytes_in_page) :
+        page_cache_acquire(&page_cache, vme->file, file_page_offset, bytes_in_page);
+      if (page == NULL){
+        return 0;
+      }
+      if (vme->flags & MMAP_WRITE){
+        page_cache_mark_dirty(&page_cache, vme->file, file_page_offset);
+      }
+      phys_page = (unsigned)page->page_data;
+    } else {
+      unsigned current_size = node_size_in_bytes(vme->file);
+      unsigned bytes_remaining = 0;
+      if (current_size > file_page_offset){
+        bytes_remaining = current_size - file_page_offset;
+      }
+
+      unsigned bytes_in_vme = (vme->size - (va - vme->start)) > FRAME_SIZE ?
+        FRAME_SIZE : (vme->size - (va - vme->start));
+      unsigned bytes_in_page = bytes_remaining < bytes_in_vme ?
+        bytes_remaining : bytes_in_vme;
+
+      // Private mappings borrow the page-cache frame read-only and keep the
+      // cache reference in the PTE. Only the first write copies the page,
+      // so read-only text and rodata stay shared between processes.
+      struct PageCacheEntry* page = speculative ?
+        page_cache_acquire_resident(&page_cache, vme->file, file_page_offset, bytes_in_page) :
+        page_cache_acquire(&page_cache, vme->file, file_page_offset, bytes_in_page);
+      if (page == NULL){
+        return 0;
+      }
+      
+      phys_page = (unsigned)page->page_data;
+      borrowed = true;
+    }
+  } else if (vme->paddr != 0){
+    // Physmem mappings reserve one contiguous physical window. Each faulting
+    // virtual page must therefore advance through that window page-for-page
+    // instead of aliasing every VME page back onto the first physical page.
+    phys_page = vme->paddr + (va - vme->start);
+  } else if (vme->anon != NULL){
+    // never let speculative zero-fill eat into the frames kept for real faults
+    if (speculative && physmem_free_frames() < PAGE_CACHE_LOW_WATERMARK){
+      return 0;
+    }
+
+    // every process sharing the mapping faults in the same frame
+    phys_page = shared_anon_page(vme->anon, (va - vme->start) / FRAME_SIZE);
+  } else if (!(vme->flags & MMAP_USER)){
+    // kernel scratch mappings are written before they are read, so the zero
+    // frame would only cost them a second fault. Fault-around only takes
+    // frames the idle thread has already zeroed.
+    void* frame = speculative ? physmem_try_alloc_zeroed() : physmem_alloc_zeroed();
+    if (frame == NULL){
+      return 0;
+    }
+    phys_page = (unsigned)frame;
+  } else {
+    // A miss does not say whether it was a read or a write. A writable page,
+    // faulting or faulted around, takes a frame straight from the zero pool
+    // when one is ready, since it is most likely about to be written.
+    // Otherwise the first touch maps the shared zero frame; a write then
+    // retries, takes a protection fault and gets a private frame in
+    // vmem_handle_cow_fault().
+    void* frame = (vme->flags & MMAP_WRITE) ? physmem_try_alloc_zeroed() : NULL;
+    if (frame != NULL){
+      phys_page = (unsigned)frame;
+      __atomic_fetch_add(&vmem_stats.zero_pool_maps, 1);
+    } else {
+      phys_page = zero_page;
+      zero = true;
+      __atomic_fetch_add(&vmem_stats.zero_maps, 1);
+    }
+  }
+  
+  unsigned entry = phys_page | VMEM_VALID | vme_pte_perms(vme);
+  if (borrowed) entry = (entry & ~VMEM_WRITE) | VMEM_COW | VMEM_FILE_PAGE;
+  if (zero) entry = (entry & ~VMEM_WRITE) | VMEM_COW;
+  return entry;
+}
+
+// Map up to vme->fault_around pages after `fault_addr` inside the same VME and
+// page table, and preload their translations into the TLB so a sequential walk
+// does not trap once per page. File pages are only mapped if already resident.
+// Returns how many pages after `fault_addr` are now mapped.
+static unsigned vmem_fault_around(struct VME* vme, unsigned* pt, unsigned fault_addr){
+  unsigned pages = vme->fault_around;
+  if (pages > VMEM_FAULT_AROUND_MAX){
+    pages = VMEM_FAULT_AROUND_MAX;
+  }
+
+  unsigned page_dir_index = (fault_addr >> 22) & 0x3FF;
+  unsigned va = fault_addr;
+  for (unsigned i = 0; i < pages; i++){
+    va += FRAME_SIZE;
+    if (va >= vme->end || ((va >> 22) & 0x3FF) != page_dir_index){
+      return i;
+    }
+
+    unsigned page_table_index = (va >> 12) & 0x3FF;
+    unsigned pte = pt[page_table_index];
+    if (pte & VMEM_SWAP){
+      // bringing a swapped page back needs disk I/O
+      return i;
+    }
+    if (!(pte & VMEM_VALID)){
+      pte = vmem_populate_pte(vme, va, true);
+      if (pte == 0){
+        // the rest of a sequential run is unlikely to be resident either
+        return i;
+      }
+      pt[page_table_index] = pte;
+      __atomic_fetch_add(&vmem_stats.misses_avoided, 1);
+    }
+
+    tlb_write(va, pte);
+  }
+
+  return pages;
+}
+
+/*
+  Anonymous swap
+
+  Only private anonymous pages of user VMEs are swapped, and only by the
+  thread that owns the address space: a user fault that finds fewer than
+  SWAP_LOW_WATERMARK free frames first writes one cluster of that process's
+  own cold pages out. Only the owning thread changes its page tables, and its
+  TLB entries only live on the current core, because every context switch
+  clears the TLB. So no other core can still translate a page once it is gone.
+
+  Victims are picked by a clock over the address space that starts at
+  tcb->swap_hand. The refill paths set VMEM_REFERENCED whenever they load a
+  translation. The clock clears the bit and drops the TLB entry, so a page is
+  written out only if nothing touched it again before the hand came back.
+*/
+
+struct SwapVictim {
+  unsigned va;
+  unsigned* pte; // the victim's slot in its page table
+};
+
+static bool vme_swappable(struct VME* vme){
+  return (vme->flags & MMAP_USER) && vme->file == NULL && vme->paddr == 0 &&
+    vme->anon == NULL;
+}
+
+// Advance the clock, collecting up to `want` unreferenced private frames.
+// Skips `keep_va`, the page whose fault is being handled.
+static unsigned vmem_swap_scan(struct TCB* tcb, struct SwapVictim* victims, unsigned want,
+    unsigned keep_va){
+  unsigned* pd = (unsigned*)tcb->pid;
+  unsigned found = 0;
+  unsigned va = tcb->swap_hand;
+  struct VME* vme = vme_ceiling(tcb, va < USER_VMEM_START ? USER_VMEM_START : va);
+  if (vme != NULL && va < vme->start){
+    va = vme->start;
+  }
+
+  // the lap that starts at the hand may only clear reference bits, so allow
+  // two more full laps before giving up
+  int wraps = 0;
+  while (found < want){
+    if (vme == NULL){
+      if (++wraps > 2){
+        break;
+      }
+      vme = vme_ceiling(tcb, USER_VMEM_START);
+      if (vme == NULL){
+        break;
+      }
+      va = vme->start;
+    }
+
+    while (vme_swappable(vme) && va < vme->end && found < want){
+      unsigned pde = pd[(va >> 22) & 0x3FF];
+      if (!(pde & VMEM_VALID)){
+        // nothing resident in this 4 MiB region
+        unsigned next = (va | 0x3FFFFF) + 1;
+        va = (next == 0 || next > vme->end) ? vme->end : next;
+        continue;
+      }
+
+      unsigned* pt = (unsigned*)(pde & ~(FRAME_SIZE - 1));
+      unsigned* pte = &pt[(va >> 12) & 0x3FF];
+      unsigned paddr = *pte & ~(FRAME_SIZE - 1);
+
+      // Only a fork of this very address space could share the frame, so an
+      // unlocked read of frame_shares is stable here. Shared frames stay.
+      if ((*pte & VMEM_VALID) && paddr != zero_page && va != keep_va &&
+          frame_shares[frame_index_from_address(paddr)] == 0){
+        if (*pte & VMEM_REFERENCED){
+          *pte &= ~VMEM_REFERENCED;
+          tlb_invalidate((void*)va);
+        } else {
+          victims[found].va = va;
+          victims[found].pte = pte;
+          found++;
+        }
+      }
+      va += FRAME_SIZE;
+    }
+
+    if (!vme_swappable(vme) || va >= vme->end){
+      vme = vme->next;
+      if (vme != NULL){
+        va = vme->start;
+      }
+    }
+  }
+
+  tcb->swap_hand = va;
+  return found;
+}
+
+// Write victims to consecutive swap slots with one SD transfer, then replace
+// their PTEs with swap entries and free the frames. Returns how many pages
+// went out; slot fragmentation can shorten the cluster.
+static unsigned vmem_swap_cluster(struct SwapVictim* victims, unsigned count){
+  unsigned got;
+  int first = swap_alloc_slots(count, &got);
+  if (first < 0){
+    return 0;
+  }
+
+  void* frames[SWAP_CLUSTER_PAGES];
+  for (unsigned i = 0; i < got; i++){
+    frames[i] = (void*)(*victims[i].pte & ~(FRAME_SIZE - 1));
+  }
+
+  // Only this thread can touch the pages, and it is here, so they cannot
+  // change between the copy and the unmap.
+  if (swap_write_cluster(first, got, frames) != 0){
+    say("| Warning: vmem: swap write failed, keeping pages resident\n", NULL);
+    for (unsigned i = 0; i < got; i++){
+      swap_free(first + i);
+    }
+    return 0;
+  }
+
+  for (unsigned i = 0; i < got; i++){
+    *victims[i].pte = ((first + i) << 12) | VMEM_SWAP;
+    tlb_invalidate((void*)victims[i].va);
+    physmem_free(frames[i]);
+  }
+  return got;
+}
+
+static unsigned vmem_swap_pages(struct TCB* tcb, unsigned pages, unsigned keep_va){
+  if (!swap_enabled()){
+    return 0;
+  }
+
+  struct SwapVictim victims[SWAP_CLUSTER_PAGES];
+  unsigned swapped = 0;
+  while (swapped < pages){
+    unsigned want = pages - swapped;
+    if (want > SWAP_CLUSTER_PAGES){
+      want = SWAP_CLUSTER_PAGES;
+    }
+
+    unsigned found = vmem_swap_scan(tcb, victims, want, keep_va);
+    if (found == 0){
+      break;
+    }
+    unsigned written = vmem_swap_cluster(victims, found);
+    if (written == 0){
+      break;
+    }
+    swapped += written;
+  }
+  return swapped;
+}
+
+unsigned vmem_swap_out(unsigned pages){
+  int was = interrupts_disable();
+  struct TCB* tcb = get_current_tcb();
+  interrupts_restore(was);
+
+  // page addresses are aligned, so UINT_MAX keeps nothing back
+  return vmem_swap_pages(tcb, pages, UINT_MAX);
+}
+
+// read a swapped-out page back into a fresh frame and build its PTE
+static unsigned vmem_swap_in(struct VME* vme, unsigned pte){
+  unsigned slot = pte >> 12;
+  unsigned frame = (unsigned)physmem_alloc();
+  if (swap_read(slot, (void*)frame) != 0){
+    panic("vmem: swap-in read failed.\n");
+  }
+  // the page is private again; a fork sibling keeps its own slot reference
+  swap_free(slot);
+  return frame | VMEM_VALID | vme_pte_perms(vme);
+}
+
 int tlb_miss_handler(void* vpn, unsigned flags, unsigned* epc_ptr, bool* return_to_user){
   // look up the VME corresponding to this faulting address
   int was = interrupts_disable();
@@ -635,7 +1384,25 @@ int tlb_miss_handler(void* vpn, unsigned flags, unsigned* epc_ptr, bool* return_
   bool was_user = get_cr0() == 1;
   *return_to_user = true; // default to resuming the faulting context via rfe
 
+  unsigned fault_addr = (unsigned)(vpn) << 12;
+  __atomic_fetch_add(&vmem_stats.misses, 1);
+
+  struct VME* curr = vme_find(tcb, fault_addr);
+
+  // keep frames in reserve for this fault and the next ones by pushing some
+  // of this process's cold pages out first
+  if (curr != NULL && (curr->flags & MMAP_USER) && swap_enabled() &&
+      physmem_free_frames() < SWAP_LOW_WATERMARK){
+    vmem_swap_pages(tcb, SWAP_CLUSTER_PAGES, fault_addr);
+  }
+
   if (flags != 0){
+    // writes to pages shared by fork fault here, from user code or from
+    // kernel uaccess helpers alike
+    if (vmem_handle_cow_fault(curr, fault_addr)){
+      return 0;
+    }
+
     if (was_user){
       // User code touched a mapped page without sufficient permissions. Abort
       // back to the kernel caller of `jump_to_user(...)`.
@@ -653,14 +1420,10 @@ int tlb_miss_handler(void* vpn, unsigned flags, unsigned* epc_ptr, bool* return_
     }
   }
 
-  unsigned fault_addr = (unsigned)(vpn) << 12;
-
-  struct VME* curr = tcb->vme_list;
-  while (curr){
-    if (fault_addr >= curr->start && fault_addr < curr->end){
-      break;
-    }
-    curr = curr->next;
+  // the vmalloc window has no VMEs; its shared PTEs are refilled in vmem.s
+  // unless this address space has no page directory
+  if (curr == NULL && !was_user && vmalloc_handle_miss(fault_addr)){
+    return 0;
   }
 
   if (curr == NULL){
@@ -684,13 +1447,6 @@ int tlb_miss_handler(void* vpn, unsigned flags, unsigned* epc_ptr, bool* return_
     }
   }
 
-  if ((curr->flags & MMAP_SHARED) && (curr->file == NULL)){
-    int args[3] = {fault_addr, flags, (int)*epc_ptr};
-    say("| vmem: tlb miss fault_addr=0x%X flags=0x%X epc=0x%X hit unsupported shared anonymous VME\n", args);
-    panic("vmem: shared anonymous TLB miss not supported yet.\n");
-    return -1;
-  }
-
   unsigned page_dir_index = ((unsigned)vpn >> 10) & 0x3FF;
   
   unsigned* pd = get_pid();
@@ -708,66 +1464,32 @@ int tlb_miss_handler(void* vpn, unsigned flags, unsigned* epc_ptr, bool* return_
   unsigned page_table_index = (unsigned)vpn & 0x3FF;
   unsigned pte = pt[page_table_index];
 
-  if (!(pte & VMEM_VALID)) {
+  // valid PTEs are normally refilled by the fast path in vmem.s before this
+  // handler runs, but a valid PTE found here is still simply reloaded
+  if (pte & VMEM_SWAP){
+    pte = vmem_swap_in(curr, pte);
+    pt[page_table_index] = pte;
+  } else if (!(pte & VMEM_VALID)) {
     // need to allocate a physical page and update the PTE
-    unsigned phys_page = 0;
-    if (curr->file){
-      if (curr->flags & MMAP_SHARED){
-        // this is intentional, so mmap can be used to extend files
-        unsigned bytes_in_page = shared_vme_page_bytes(curr, fault_addr);
-
-        // shared mapping points directly into page cache
-        struct PageCacheEntry* page = page_cache_acquire(&page_cache, curr->file, 
-          (curr->file_offset + (fault_addr - curr->start)), bytes_in_page);
-        if (curr->flags & MMAP_WRITE){
-          page_cache_mark_dirty(&page_cache, curr->file,
-            (curr->file_offset + (fault_addr - curr->start)));
-        }
-        phys_page = (unsigned)page->page_data;
-      } else {
-        unsigned file_page_offset = curr->file_offset + (fault_addr - curr->start);
-        unsigned current_size = node_size_in_bytes(curr->file);
-        unsigned bytes_remaining = 0;
-        if (current_size > file_page_offset){
-          bytes_remaining = current_size - file_page_offset;
-        }
-
-        unsigned bytes_in_vme = (curr->size - (fault_addr - curr->start)) > FRAME_SIZE ?
-          FRAME_SIZE : (curr->size - (fault_addr - curr->start));
-        unsigned bytes_in_page = bytes_remaining < bytes_in_vme ?
-          bytes_remaining : bytes_in_vme;
+    pte = vmem_populate_pte(curr, fault_addr, false);
+    pt[page_table_index] = pte;
+    __atomic_fetch_add(&vmem_stats.faults, 1);
 
-        // private mapping copies from page cache (TODO: COW)
-        struct PageCacheEntry* page = page_cache_acquire(&page_cache, curr->file, 
-          (curr->file_offset + (fault_addr - curr->start)), bytes_in_page);
-        
-        phys_page = (unsigned)physmem_alloc();
-        memcpy((void*)phys_page, page->page_data, FRAME_SIZE);
+    // a first touch is likely the start of a sequential walk. Preload the
+    // neighbours first so the faulting translation is the newest TLB entry.
+    unsigned mapped = vmem_fault_around(curr, pt, fault_addr);
 
-        page_cache_release(&page_cache, curr->file, 
-          (curr->file_offset + (fault_addr - curr->start)));
-      }
-    } else {
-      assert(!(curr->flags & MMAP_SHARED), "cannot yet handle shared anonymous pages\n");
-      
-      if (curr->paddr != 0){
-        // Physmem mappings reserve one contiguous physical window. Each faulting
-        // virtual page must therefore advance through that window page-for-page
-        // instead of aliasing every VME page back onto the first physical page.
-        phys_page = curr->paddr + (fault_addr - curr->start);
-      } else {
-        phys_page = create_zeroed_page();
-      }
+    // the next fault of a sequential walk lands just past the mapped run
+    if (curr->file != NULL){
+      page_cache_readahead(&page_cache, &curr->ra, curr->file,
+        curr->file_offset + (fault_addr - curr->start), 1 + mapped);
     }
-    
-    unsigned entry = phys_page | VMEM_VALID;
-
-    if (curr->flags & MMAP_READ) entry |= VMEM_READ;
-    if (curr->flags & MMAP_WRITE) entry |= VMEM_WRITE;
-    if (curr->flags & MMAP_EXEC) entry |= VMEM_EXEC;
-    if (curr->flags & MMAP_USER) entry |= VMEM_USER;
-    pt[page_table_index] = entry;
-    pte = entry;
+  }
+
+  // the page is in use again, see "Anonymous swap" above
+  if (!(pte & VMEM_REFERENCED)){
+    pte |= VMEM_REFERENCED;
+    pt[page_table_index] = pte;
   }
   
   tlb_write(fault_addr, pte);
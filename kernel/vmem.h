@@ -3,6 +3,7 @@
 
 #include "constants.h"
 #include "ext.h"
+#include "readahead.h"
 
 // flags to pass into mmap
 #define MMAP_NONE   0x00
@@ -21,16 +22,47 @@
 #define VMEM_VALID  0x20
 #define VMEM_DIRTY  0x40
 
-// begin vmem allocations from 0x10000000
+// software-only PTE bit: a private frame shared copy-on-write after fork.
+// VMEM_WRITE is withheld until the first write fault breaks the sharing.
+#define VMEM_COW    0x80
+
+// software-only PTE bit: a private file mapping borrowing a page-cache frame.
+// The PTE owns one page-cache reference instead of the frame itself.
+#define VMEM_FILE_PAGE 0x100
+
+// software-only PTE bit: set by the TLB refill paths when a page is used, and
+// cleared by the swap clock to give the page a second chance
+#define VMEM_REFERENCED 0x200
+
+// software-only PTE bit: an invalid PTE whose bits 31..12 hold the swap slot
+// of a private anonymous page, see "Anonymous Swap" in docs/vmem.md
+#define VMEM_SWAP   0x400
+
+// begin vmem allocations from 0x10000000; the kernel half above
+// KERNEL_VMEM_END is the vmalloc window, see vmalloc.h
 #define KERNEL_VMEM_START 0x10000000
-#define KERNEL_VMEM_END   0x7FFFFFFF
+#define KERNEL_VMEM_END   0x7BFFFFFF
 
 #define USER_VMEM_START 0x80000000
 #define USER_VMEM_END   0xFFFFFFFF
 
+struct SharedAnon;
+
+// Pages after a faulting page that one TLB miss maps and preloads into the TLB.
+// Capped well below the 16-entry TLB so a fault never evicts the whole working set.
+#define VMEM_FAULT_AROUND_DEFAULT 4
+#define VMEM_FAULT_AROUND_MAX     8
+
 struct VME {
   struct VME* next;
 
+  // AVL index keyed by start, see "VME index" in vmem.c
+  struct VME* tree_left;
+  struct VME* tree_right;
+  int tree_height;
+  unsigned gap; // free bytes between the previous VME's end and start
+  unsigned max_gap; // largest gap in this subtree
+
   unsigned start;
   unsigned end;
 
@@ -42,6 +74,17 @@ struct VME {
   unsigned file_offset;
 
   unsigned paddr; // 0 if this VME does not map physical memory directly
+
+  // frames of a shared anonymous mapping, shared by every VME that fork()
+  // copied from the original mmap(); NULL for all other mappings
+  struct SharedAnon* anon;
+
+  // pages to map ahead on each fault, see vme_set_fault_around()
+  unsigned fault_around;
+
+  // sequential faults on a file mapping read the file ahead, see
+  // page_cache_readahead()
+  struct Readahead ra;
 };
 
 // Initialize virtual memory structures
@@ -77,8 +120,12 @@ void* mmap_physmem(unsigned size, unsigned paddr, unsigned flags);
 // Unmap a previously mapped memory region
 void munmap(void* p);
 
-// free all VMEs in the given list
-void free_vme_list(struct VME* vme);
+// free all VMEs of an address space and reset its VME list and index
+void free_vme_list(struct TCB* tcb);
+
+// find the VME containing addr in O(log n), or NULL if none does. Remembers
+// the last hit, so repeated misses in one region skip the tree walk.
+struct VME* vme_find(struct TCB* tcb, unsigned addr);
 
 // copy a thread's page dir/page tables and vme_list from src to dst
 void vmem_fork(struct TCB* src, struct TCB* dst);
@@ -89,6 +136,18 @@ void vmem_destroy_address_space(struct TCB* tcb);
 
 void vme_change_perms(struct VME* vme, unsigned new_flags);
 
+// Set how many following pages a fault in this VME maps ahead. 0 disables
+// fault-around; values above VMEM_FAULT_AROUND_MAX are clamped.
+void vme_set_fault_around(struct VME* vme, unsigned pages);
+
+// Push up to `pages` of the current address space's cold private anonymous
+// user pages out to swap, returning how many went. The TLB miss handler calls
+// this itself under memory pressure. Returns 0 if swap is disabled. May block.
+unsigned vmem_swap_out(unsigned pages);
+
+// print TLB miss and fault-around counters
+void vmem_print_stats(void);
+
 extern void tlb_miss_handler_(void);
 
 extern void ipi_handler_(void);
@@ -3,6 +3,68 @@
 
   .global tlb_miss_handler_
 tlb_miss_handler_:
+  # Refill fast path: after a TLB flush or capacity eviction the PTE is often
+  # already valid and only the translation needs reloading. Walk PD -> PT
+  # here with three scratch registers and rfe straight back. Protection
+  # faults, missing page tables and invalid PTEs (including swap entries)
+  # take the C handler below.
+  push r1
+  push r2
+  push r3
+
+  mov  r1, tlbf
+  cmp  r1, r0
+  bnz  tlb_refill_slow
+
+  mov  r1, pid         # r1 = page directory
+  cmp  r1, r0
+  bz   tlb_refill_slow
+
+  mov  r2, tlba        # r2 = faulting virtual page number
+  lsr  r3, r2, 10      # page directory index * 4
+  lsl  r3, r3, 2
+  add  r1, r1, r3
+  lwa  r1, [r1]        # r1 = pde
+  and  r3, r1, 0x20    # VMEM_VALID
+  cmp  r3, r0
+  bz   tlb_refill_slow
+
+  lsr  r1, r1, 12      # r1 = page table
+  lsl  r1, r1, 12
+  lsl  r3, r2, 22      # page table index * 4
+  lsr  r3, r3, 20
+  add  r1, r1, r3      # r1 = pte address
+  lwa  r3, [r1]        # r3 = pte
+  and  r2, r3, 0x20    # VMEM_VALID
+  cmp  r2, r0
+  bz   tlb_refill_slow
+
+  # mark the page used for the swap clock; skip the store if already marked
+  and  r2, r3, 0x200   # VMEM_REFERENCED
+  cmp  r2, r0
+  bnz  tlb_refill_marked
+  or   r3, r3, 0x200
+  swa  r3, [r1]
+tlb_refill_marked:
+
+  mov  r2, tlba
+  lsl  r2, r2, 12      # r2 = faulting virtual address
+  tlbw r3, r2
+
+  adpc r1, vmem_tlb_refills
+  add  r2, r0, 1
+  fada r2, r2, [r1]
+
+  pop  r3
+  pop  r2
+  pop  r1
+  rfe
+
+tlb_refill_slow:
+  pop  r3
+  pop  r2
+  pop  r1
+
   # Save caller-saved registers.
   push  r1
   push  r2
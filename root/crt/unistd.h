@@ -40,5 +40,7 @@ int readlink(char* path, char* buffer, unsigned buffer_size);
 int seek(int fd, int offset, int whence);
 int fd_bytes_available(int fd);
 int truncate(int fd, unsigned size);
+int sync(void);
+int fsync(int fd);
 
 #endif // UNISTD_H
@@ -0,0 +1,158 @@
+/*
+ * ext2 block cache test.
+ *
+ * Validates:
+ * - bget() hands out references into the cached block itself, so two lookups
+ *   of one block share a buffer and see the bytes node reads return
+ * - brelse() drops exactly the references bget() took
+ * - repeated indirect-block reads are served from the cache without new misses
+ * - concurrent misses on one cold block install a single buffer and read the
+ *   block from disk once
+ *
+ * How:
+ * - grow a fresh file into the single-indirect range, then compare the cached
+ *   pointer block and first data block against the inode's view of them
+ * - re-read one indirect data block many times and compare miss counters
+ * - release several threads behind a barrier that all bget() the filesystem's
+ *   last block, then check they got the same buffer and caused one miss
+ */
+#include "../kernel/ext.h"
+#include "../kernel/print.h"
+#include "../kernel/debug.h"
+#include "../kernel/heap.h"
+#include "../kernel/string.h"
+#include "../kernel/threads.h"
+#include "../kernel/barrier.h"
+
+#define FILE_NAME "indirect.bin"
+#define FILE_BLOCKS 16
+#define REREADS 20
+#define CONCURRENT_READERS 6
+
+static struct Barrier start_barrier;
+static int finished = 0;
+static unsigned cold_block;
+static struct Buffer* seen[CONCURRENT_READERS];
+
+// Every block starts with its own logical index so reads can be told apart.
+static struct Node* make_indirect_file(unsigned block_size) {
+  struct Node* file = node_make_file(&fs.root, FILE_NAME);
+  assert(file != NULL, "ext_bcache: failed to create the test file.\n");
+
+  char* block = malloc(block_size);
+  for (unsigned i = 0; i < FILE_BLOCKS; ++i) {
+    memset(block, 'a' + i, block_size);
+    *(unsigned*)block = i;
+    unsigned cnt = node_write_all(file, i * block_size, block_size, block);
+    assert(cnt == block_size, "ext_bcache: short write while growing the file.\n");
+  }
+  free(block);
+
+  return file;
+}
+
+static void check_shared_references(struct Node* file, unsigned block_size) {
+  struct BlockCache* cache = &fs.bcache;
+  unsigned pointer_block = file->cached->inode.block[12];
+  assert(pointer_block != 0, "ext_bcache: file did not reach the single-indirect range.\n");
+
+  struct Buffer* first = bget(cache, pointer_block);
+  struct Buffer* second = bget(cache, pointer_block);
+  assert(first == second, "ext_bcache: two references to one block got different buffers.\n");
+  assert(first->refcount == 2, "ext_bcache: bget() did not count both references.\n");
+  assert(first->block_num == pointer_block, "ext_bcache: buffer holds the wrong block.\n");
+
+  // the pointer block lists the data blocks after the twelve direct ones
+  unsigned data_block = ((unsigned*)first->data)[0];
+  assert(data_block != 0, "ext_bcache: first single-indirect entry is empty.\n");
+
+  brelse(cache, second);
+  assert(first->refcount == 1, "ext_bcache: brelse() dropped the wrong number of references.\n");
+  brelse(cache, first);
+  assert(first->refcount == 0, "ext_bcache: buffer is still referenced after brelse().\n");
+
+  char* expected = malloc(block_size);
+  node_read_block(file, 12, expected);
+  struct Buffer* data = bget(cache, data_block);
+  assert(memcmp(data->data, expected, block_size) == 0,
+    "ext_bcache: cached data block differs from node_read_block().\n");
+  assert(*(unsigned*)data->data == 12, "ext_bcache: cached data block has the wrong marker.\n");
+  brelse(cache, data);
+  free(expected);
+
+  say("***Shared buffer references: ok\n", NULL);
+}
+
+static void check_cached_rereads(struct Node* file, unsigned block_size) {
+  char* block = malloc(block_size);
+
+  // the first read may miss; the rest must come from the cache
+  node_read_block(file, FILE_BLOCKS - 1, block);
+  int misses = __atomic_load_n(&fs.bcache.misses);
+  for (int i = 0; i < REREADS; ++i) {
+    node_read_block(file, FILE_BLOCKS - 1, block);
+    assert(*(unsigned*)block == FILE_BLOCKS - 1, "ext_bcache: reread returned the wrong block.\n");
+  }
+  assert(__atomic_load_n(&fs.bcache.misses) == misses,
+    "ext_bcache: rereading a cached indirect block missed the cache.\n");
+
+  free(block);
+  say("***Indirect rereads stay cached: ok\n", NULL);
+}
+
+static void cold_reader_thread(void* arg) {
+  unsigned slot = (unsigned)arg;
+
+  barrier_sync(&start_barrier);
+  seen[slot] = bget(&fs.bcache, cold_block);
+  __atomic_fetch_add(&finished, 1);
+}
+
+static void check_concurrent_misses(void) {
+  // nothing in this test reads the last block, so it starts out uncached
+  cold_block = fs.superblock.blocks_count - 1;
+  int misses = __atomic_load_n(&fs.bcache.misses);
+
+  barrier_init(&start_barrier, CONCURRENT_READERS + 1);
+  for (unsigned i = 0; i < CONCURRENT_READERS; ++i) {
+    struct Fun* fun = malloc(sizeof(struct Fun));
+    assert(fun != NULL, "ext_bcache: reader Fun allocation failed.\n");
+    fun->func = cold_reader_thread;
+    fun->arg = (void*)i;
+    thread(fun);
+  }
+  barrier_sync(&start_barrier);
+
+  while (__atomic_load_n(&finished) != CONCURRENT_READERS) {
+    yield();
+  }
+  barrier_destroy(&start_barrier);
+
+  for (unsigned i = 0; i < CONCURRENT_READERS; ++i) {
+    assert(seen[i] == seen[0], "ext_bcache: concurrent misses installed different buffers.\n");
+  }
+  assert(seen[0]->refcount == CONCURRENT_READERS,
+    "ext_bcache: concurrent misses lost a reference.\n");
+  assert(__atomic_load_n(&fs.bcache.misses) == misses + 1,
+    "ext_bcache: concurrent misses read the block more than once.\n");
+
+  for (unsigned i = 0; i < CONCURRENT_READERS; ++i) {
+    brelse(&fs.bcache, seen[i]);
+  }
+
+  say("***Concurrent misses share one read: ok\n", NULL);
+}
+
+int kernel_main(void) {
+  say("***Hello from ext2 block cache test!\n", NULL);
+
+  unsigned block_size = ext2_get_block_size(&fs);
+  struct Node* file = make_indirect_file(block_size);
+
+  check_shared_references(file, block_size);
+  check_cached_rereads(file, block_size);
+  check_concurrent_misses();
+
+  node_free(file);
+  return 0;
+}
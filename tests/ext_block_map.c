@@ -0,0 +1,68 @@
+/*
+ * ext2 per-inode block map test.
+ *
+ * Validates:
+ * - sequential reads in the single-indirect range return the right blocks
+ *   while looking up the pointer block at most once, so each data block costs
+ *   one block-cache access
+ * - a block appended after the map was filled is read back correctly, so
+ *   node_add_block() keeps the map in step with the pointer tree
+ *
+ * How:
+ * - grow a fresh file past the direct blocks, tagging each block with its
+ *   logical index, then read the indirect blocks back and count block-cache
+ *   hits plus misses
+ * - append one more block and read it back
+ */
+#include "../kernel/ext.h"
+#include "../kernel/print.h"
+#include "../kernel/debug.h"
+#include "../kernel/heap.h"
+#include "../kernel/string.h"
+
+#define FILE_NAME "mapped.bin"
+#define FILE_BLOCKS 40
+
+static void write_tagged_block(struct Node* file, unsigned index, unsigned block_size, char* block) {
+  memset(block, 'a' + index % 26, block_size);
+  *(unsigned*)block = index;
+  unsigned cnt = node_write_all(file, index * block_size, block_size, block);
+  assert(cnt == block_size, "ext_block_map: short write while growing the file.\n");
+}
+
+static int cache_lookups(void) {
+  return __atomic_load_n(&fs.bcache.hits) + __atomic_load_n(&fs.bcache.misses);
+}
+
+int kernel_main(void) {
+  say("***Hello from ext2 block map test!\n", NULL);
+
+  unsigned block_size = ext2_get_block_size(&fs);
+  char* block = malloc(block_size);
+
+  struct Node* file = node_make_file(&fs.root, FILE_NAME);
+  assert(file != NULL, "ext_block_map: failed to create the test file.\n");
+  for (unsigned i = 0; i < FILE_BLOCKS; ++i) {
+    write_tagged_block(file, i, block_size, block);
+  }
+
+  int lookups = cache_lookups();
+  for (unsigned i = 12; i < FILE_BLOCKS; ++i) {
+    node_read_block(file, i, block);
+    assert(*(unsigned*)block == i, "ext_block_map: indirect read returned the wrong block.\n");
+  }
+  int used = cache_lookups() - lookups;
+  assert(used <= FILE_BLOCKS - 12 + 1,
+    "ext_block_map: sequential reads walked the pointer block more than once.\n");
+  say("***Sequential indirect reads: ok\n", NULL);
+
+  write_tagged_block(file, FILE_BLOCKS, block_size, block);
+  memset(block, 0, block_size);
+  node_read_block(file, FILE_BLOCKS, block);
+  assert(*(unsigned*)block == FILE_BLOCKS, "ext_block_map: appended block read back wrong.\n");
+  say("***Appended blocks are mapped: ok\n", NULL);
+
+  node_free(file);
+  free(block);
+  return 0;
+}
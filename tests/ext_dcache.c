@@ -0,0 +1,83 @@
+/*
+ * ext2 directory entry cache test.
+ *
+ * Validates:
+ * - a repeated lookup of an existing name, and of a missing one, is answered
+ *   by the dentry cache without a block-cache access
+ * - creating, renaming and deleting names updates the cache, so a cached
+ *   miss or hit never outlives the directory entry it describes
+ * - a deleted directory's cached names do not leak into a new directory
+ *
+ * How:
+ * - look each name up twice and count block-cache hits plus misses around
+ *   the second lookup, keeping the first result open so the inode stays cached
+ * - create a name that was cached as missing, rename it, delete it, and look
+ *   it up after each step
+ * - remove a directory, make a new one with the same name, and look up a
+ *   name that only existed in the old one
+ */
+#include "../kernel/ext.h"
+#include "../kernel/print.h"
+#include "../kernel/debug.h"
+
+static int cache_lookups(void) {
+  return __atomic_load_n(&fs.bcache.hits) + __atomic_load_n(&fs.bcache.misses);
+}
+
+// look a path up twice; returns the block-cache accesses of the second lookup
+static int second_lookup_cost(char* path, bool expect_found) {
+  struct Node* first = node_find(&fs.root, path);
+  assert((first != NULL) == expect_found, "ext_dcache: first lookup gave the wrong answer.\n");
+
+  int lookups = cache_lookups();
+  struct Node* second = node_find(&fs.root, path);
+  int used = cache_lookups() - lookups;
+  assert((second != NULL) == expect_found, "ext_dcache: cached lookup gave the wrong answer.\n");
+
+  if (first != NULL) node_free(first);
+  if (second != NULL) node_free(second);
+  return used;
+}
+
+static bool exists(char* path) {
+  struct Node* node = node_find(&fs.root, path);
+  if (node == NULL) return false;
+  node_free(node);
+  return true;
+}
+
+int kernel_main(void) {
+  say("***Hello from ext2 dentry cache test!\n", NULL);
+
+  int args[2] = {second_lookup_cost("present.txt", true), second_lookup_cost("missing.txt", false)};
+  say("***Repeated lookups: hit cost=%d, miss cost=%d\n", args);
+
+  struct Node* file = node_make_file(&fs.root, "missing.txt");
+  assert(file != NULL, "ext_dcache: failed to create a name cached as missing.\n");
+  node_free(file);
+  assert(exists("missing.txt"), "ext_dcache: a created name is still cached as missing.\n");
+
+  node_rename(&fs.root, "missing.txt", "renamed.txt");
+  assert(!exists("missing.txt"), "ext_dcache: a renamed name is still found.\n");
+  assert(exists("renamed.txt"), "ext_dcache: the new name of a renamed file is not found.\n");
+
+  node_delete(&fs.root, "renamed.txt");
+  assert(!exists("renamed.txt"), "ext_dcache: a deleted name is still found.\n");
+  say("***Create, rename and delete: ok\n", NULL);
+
+  struct Node* dir = node_make_dir(&fs.root, "sub");
+  file = node_make_file(dir, "inner.txt");
+  node_free(file);
+  assert(exists("sub/inner.txt"), "ext_dcache: a file in a new directory is not found.\n");
+  node_delete(dir, "inner.txt");
+  node_free(dir);
+  node_delete(&fs.root, "sub");
+
+  dir = node_make_dir(&fs.root, "sub");
+  node_free(dir);
+  assert(!exists("sub/inner.txt"), "ext_dcache: a new directory shows a name from a deleted one.\n");
+  assert(exists("sub/.."), "ext_dcache: a new directory lost its parent entry.\n");
+  say("***Recreated directory: ok\n", NULL);
+
+  return 0;
+}
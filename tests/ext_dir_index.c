@@ -0,0 +1,94 @@
+/*
+ * ext2 directory index test.
+ *
+ * Validates:
+ * - a directory that grows past EXT2_DIR_INDEX_MIN_BLOCKS gets a name index
+ *   that agrees with the live entries on disk
+ * - a lookup the dentry cache cannot answer is answered by the index without
+ *   a block-cache access
+ * - removes keep the index and free-space map current, so creates fill the
+ *   holes they leave instead of growing the directory
+ *
+ * How:
+ * - create FILES files with long names in a fresh directory, so it spans at
+ *   least four blocks at every supported block size
+ * - count block-cache hits plus misses around a lookup of a name that was
+ *   never created
+ * - delete every other file, create the same names again, and check the
+ *   directory size and that every name resolves
+ */
+#include "../kernel/ext.h"
+#include "../kernel/print.h"
+#include "../kernel/debug.h"
+#include "../kernel/string.h"
+
+// Long names keep the file count within the smallest test image's inodes
+// while still spanning four 4 KiB blocks.
+#define FILES 200
+#define NAME_PREFIX "directory-index-test-entry-with-a-deliberately-long-name-" \
+  "so-that-each-record-takes-up-more-than-one-hundred-and-twenty-bytes-"
+
+static char name[sizeof(NAME_PREFIX) + 3];
+
+static char* file_name(unsigned i) {
+  unsigned prefix_len = strlen(NAME_PREFIX);
+  memcpy(name, NAME_PREFIX, prefix_len);
+  name[prefix_len] = '0' + i / 100;
+  name[prefix_len + 1] = '0' + i / 10 % 10;
+  name[prefix_len + 2] = '0' + i % 10;
+  name[prefix_len + 3] = 0;
+  return name;
+}
+
+static void make_file(struct Node* dir, unsigned i) {
+  struct Node* file = node_make_file(dir, file_name(i));
+  assert(file != NULL, "ext_dir_index: failed to create a file.\n");
+  node_free(file);
+}
+
+static int cache_lookups(void) {
+  return __atomic_load_n(&fs.bcache.hits) + __atomic_load_n(&fs.bcache.misses);
+}
+
+int kernel_main(void) {
+  say("***Hello from ext2 directory index test!\n", NULL);
+
+  struct Node* dir = node_make_dir(&fs.root, "big");
+  assert(dir != NULL, "ext_dir_index: failed to create the directory.\n");
+  for (unsigned i = 0; i < FILES; ++i) {
+    make_file(dir, i);
+  }
+
+  struct DirIndex* index = dir->cached->dir_index;
+  assert(index != NULL, "ext_dir_index: a large directory has no index.\n");
+  int args[2] = {(int)index->entries, (int)node_entry_count(dir)};
+  say("***Index built: entries=%d, on disk=%d\n", args);
+
+  int lookups = cache_lookups();
+  struct Node* missing = node_find(dir, "missing");
+  int cost = cache_lookups() - lookups;
+  assert(missing == NULL, "ext_dir_index: found a name that was never created.\n");
+  say("***Uncached miss cost=%d\n", &cost);
+
+  unsigned size = node_size_in_bytes(dir);
+  for (unsigned i = 0; i < FILES; i += 2) {
+    assert(node_delete(dir, file_name(i)) == 0, "ext_dir_index: failed to delete a file.\n");
+  }
+  assert(index->entries == FILES / 2 + 2, "ext_dir_index: removes did not update the index.\n");
+  for (unsigned i = 0; i < FILES; i += 2) {
+    make_file(dir, i);
+  }
+  assert(node_size_in_bytes(dir) == size, "ext_dir_index: creates grew the directory instead of reusing holes.\n");
+  say("***Holes reused: ok\n", NULL);
+
+  for (unsigned i = 0; i < FILES; ++i) {
+    struct Node* file = node_find(dir, file_name(i));
+    assert(file != NULL, "ext_dir_index: a created name is not found.\n");
+    node_free(file);
+  }
+  assert(node_entry_count(dir) == FILES + 2, "ext_dir_index: wrong number of live entries.\n");
+  say("***All names found: ok\n", NULL);
+
+  node_free(dir);
+  return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * ext2 write-back cache test.
+ *
+ * Validates:
+ * - file writes and block allocations dirty the block cache and the
+ *   allocator metadata without writing either to disk
+ * - ext2_sync() writes every dirty buffer and the superblock, leaving the
+ *   disk identical to the cache
+ * - a file's adjacent data blocks go out in fewer SD writes than blocks
+ *
+ * How:
+ * - hold the cache's flush_lock while writing a fresh file, so a flusher
+ *   thread started by the writes cannot run a pass yet
+ * - compare the raw SD copy of the first data block and the superblock
+ *   against the cached ones before and after ext2_sync()
+ */
+#include "../kernel/ext.h"
+#include "../kernel/sd_driver.h"
+#include "../kernel/print.h"
+#include "../kernel/debug.h"
+#include "../kernel/heap.h"
+#include "../kernel/string.h"
+
+#define FILE_NAME "delayed.bin"
+#define FILE_BLOCKS 8
+
+static void read_disk_block(unsigned block_num, unsigned block_size, char* dest) {
+  int rc = sd_read_blocks(SD_DRIVE_1, block_num * block_size / SD_SECTOR_SIZE_BYTES,
+    block_size / SD_SECTOR_SIZE_BYTES, dest);
+  assert(rc == 0, "ext_writeback: raw block read failed.\n");
+}
+
+static unsigned disk_free_blocks(void) {
+  // the superblock is the two sectors after the boot block
+  struct Superblock* superblock = malloc(2 * SD_SECTOR_SIZE_BYTES);
+  int rc = sd_read_blocks(SD_DRIVE_1, 2, 2, (char*)superblock);
+  assert(rc == 0, "ext_writeback: raw superblock read failed.\n");
+  unsigned free_blocks = superblock->free_blocks_count;
+  free(superblock);
+  return free_blocks;
+}
+
+int kernel_main(void) {
+  say("***Hello from ext2 write-back test!\n", NULL);
+
+  struct BlockCache* cache = &fs.bcache;
+  unsigned block_size = ext2_get_block_size(&fs);
+  char* block = malloc(block_size);
+  char* disk = malloc(block_size);
+
+  blocking_lock_acquire(&cache->flush_lock);
+
+  struct Node* file = node_make_file(&fs.root, FILE_NAME);
+  assert(file != NULL, "ext_writeback: failed to create the test file.\n");
+  for (unsigned i = 0; i < FILE_BLOCKS; ++i) {
+    memset(block, 'A' + i, block_size);
+    unsigned cnt = node_write_all(file, i * block_size, block_size, block);
+    assert(cnt == block_size, "ext_writeback: short write.\n");
+  }
+
+  unsigned first_block = file->cached->inode.block[0];
+  assert(__atomic_load_n(&cache->dirty_count) >= FILE_BLOCKS,
+    "ext_writeback: file writes did not leave dirty buffers.\n");
+  assert(fs.metadata_dirty, "ext_writeback: allocations did not dirty the metadata.\n");
+
+  read_disk_block(first_block, block_size, disk);
+  assert(disk[0] != 'A', "ext_writeback: a data block reached the disk before any flush.\n");
+  assert(disk_free_blocks() != fs.superblock.free_blocks_count,
+    "ext_writeback: the superblock reached the disk before any flush.\n");
+  say("***Writes stay in the cache: ok\n", NULL);
+
+  blocking_lock_release(&cache->flush_lock);
+
+  int writebacks = __atomic_load_n(&cache->writebacks);
+  int flush_writes = __atomic_load_n(&cache->flush_writes);
+  ext2_sync(&fs);
+
+  assert(__atomic_load_n(&cache->dirty_count) == 0, "ext_writeback: ext2_sync() left dirty buffers.\n");
+  assert(!fs.metadata_dirty, "ext_writeback: ext2_sync() left the metadata dirty.\n");
+
+  memset(block, 'A', block_size);
+  read_disk_block(first_block, block_size, disk);
+  assert(memcmp(disk, block, block_size) == 0, "ext_writeback: synced data block differs on disk.\n");
+  assert(disk_free_blocks() == fs.superblock.free_blocks_count,
+    "ext_writeback: synced superblock differs on disk.\n");
+  say("***Sync reaches the disk: ok\n", NULL);
+
+  int blocks = __atomic_load_n(&cache->writebacks) - writebacks;
+  int writes = __atomic_load_n(&cache->flush_writes) - flush_writes;
+  assert(blocks >= FILE_BLOCKS, "ext_writeback: ext2_sync() wrote too few blocks.\n");
+  assert(writes < blocks, "ext_writeback: adjacent dirty blocks were written one at a time.\n");
+  say("***Adjacent blocks coalesce: ok\n", NULL);
+
+  node_free(file);
+  free(block);
+  free(disk);
+  return 0;
+}
@@ -39,9 +39,10 @@ void kernel_main(void) {
   assert(size_class < NUM_OBJECT_SIZES,
     "slab heap double allocation negative: size class not found.\n");
 
-  ((struct FreeObject*)obj)->next = core->free_lists[size_class];
-  core->free_lists[size_class] = obj;
-  core->free_list_sizes[size_class]++;
+  struct Magazines* mags = &core->heap_magazines[size_class];
+  ((struct FreeObject*)obj)->next = mags->loaded;
+  mags->loaded = obj;
+  mags->loaded_count++;
 
   preemption_restore(preempt_was);
 
@@ -0,0 +1,75 @@
+/*
+ * Intermediate heap size class test.
+ *
+ * Validates:
+ * - requests between the power-of-two classes and from 1025 to 3072 bytes are
+ *   served by slabs, including classes whose slabs span several frames
+ * - free() finds the slab of an object that lives in a later frame of a
+ *   multi-page slab and returns it to the right size class
+ * - objects of neighbouring classes never overlap
+ *
+ * How:
+ * - allocate a batch of each size, stamp every byte with a per-object pattern,
+ *   verify all batches, free them in an interleaved order, then repeat so the
+ *   second round reuses the magazines and slabs built by the first
+ */
+
+#include "../kernel/heap.h"
+#include "../kernel/print.h"
+#include "../kernel/debug.h"
+
+#define NUM_SIZES 8
+#define BATCH 40
+
+static unsigned sizes[NUM_SIZES] = {40, 48, 520, 760, 1025, 1500, 2048, 3000};
+static unsigned char* objects[NUM_SIZES][BATCH];
+
+static unsigned char pattern(int s, int i, unsigned b) {
+  return (unsigned char)(s * 37 + i * 11 + b);
+}
+
+static bool round_trip(void) {
+  for (int s = 0; s < NUM_SIZES; s++) {
+    for (int i = 0; i < BATCH; i++) {
+      objects[s][i] = (unsigned char*)malloc(sizes[s]);
+      if (((unsigned)objects[s][i] & 3) != 0) {
+        int args[2] = { (int)objects[s][i], (int)sizes[s] };
+        say("***heap size classes FAIL obj=0x%X size=%d is not word aligned\n", args);
+        return false;
+      }
+      for (unsigned b = 0; b < sizes[s]; b++) {
+        objects[s][i][b] = pattern(s, i, b);
+      }
+    }
+  }
+
+  for (int s = 0; s < NUM_SIZES; s++) {
+    for (int i = 0; i < BATCH; i++) {
+      for (unsigned b = 0; b < sizes[s]; b++) {
+        if (objects[s][i][b] != pattern(s, i, b)) {
+          int args[3] = { (int)objects[s][i], (int)sizes[s], (int)b };
+          say("***heap size classes FAIL obj=0x%X size=%d byte=%d corrupted\n", args);
+          return false;
+        }
+      }
+    }
+  }
+
+  // interleave classes so frees hit every class's magazines in turn
+  for (int i = 0; i < BATCH; i++) {
+    for (int s = 0; s < NUM_SIZES; s++) {
+      free(objects[s][(i * 7) % BATCH]);
+    }
+  }
+  return true;
+}
+
+void kernel_main(void) {
+  say("***heap size classes start\n", NULL);
+
+  bool ok = round_trip() && round_trip();
+
+  if (ok) {
+    say("***heap size classes complete\n", NULL);
+  }
+}
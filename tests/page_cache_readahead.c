@@ -0,0 +1,72 @@
+/*
+ * Page-cache readahead test.
+ *
+ * Validates:
+ * - a reader that walks a file page by page misses only on the first page,
+ *   because page_cache_readahead() keeps the readahead thread ahead of it
+ * - every later page is found as a readahead page and holds the right bytes
+ * - the readahead thread exits once its queue is empty
+ *
+ * How:
+ * - write PAGES pages to a fresh file, tagging each page with its index, so
+ *   none of them is in the page cache yet
+ * - acquire the pages in order through one struct Readahead, reporting each
+ *   access, and wait for the readahead thread to go idle after each one so
+ *   the counts do not depend on scheduling
+ */
+#include "../kernel/page_cache.h"
+#include "../kernel/ext.h"
+#include "../kernel/physmem.h"
+#include "../kernel/threads.h"
+#include "../kernel/print.h"
+#include "../kernel/debug.h"
+#include "../kernel/heap.h"
+#include "../kernel/string.h"
+
+#define FILE_NAME "sequential.bin"
+#define PAGES 16
+
+static void wait_for_readahead(void) {
+  while (__atomic_load_n(&page_cache.ra_running)) {
+    yield();
+  }
+}
+
+int kernel_main(void) {
+  say("***Hello from page cache readahead test!\n", NULL);
+
+  char* page = malloc(FRAME_SIZE);
+  struct Node* file = node_make_file(&fs.root, FILE_NAME);
+  assert(file != NULL, "page_cache_readahead: failed to create the test file.\n");
+  for (unsigned i = 0; i < PAGES; ++i) {
+    memset(page, 'a' + i % 26, FRAME_SIZE);
+    *(unsigned*)page = i;
+    unsigned cnt = node_write_all(file, i * FRAME_SIZE, FRAME_SIZE, page);
+    assert(cnt == FRAME_SIZE, "page_cache_readahead: short write.\n");
+  }
+  free(page);
+
+  unsigned misses = page_cache.misses;
+  unsigned ra_hits = page_cache.ra_hits;
+
+  struct Readahead ra;
+  readahead_init(&ra, 0);
+  for (unsigned i = 0; i < PAGES; ++i) {
+    unsigned offset = i * FRAME_SIZE;
+    struct PageCacheEntry* entry = page_cache_acquire(&page_cache, file, offset, FRAME_SIZE);
+    char* data = (char*)entry->page_data;
+    if (*(unsigned*)data != i || data[FRAME_SIZE - 1] != 'a' + i % 26) {
+      int args[1] = {i};
+      say("***page %d FAIL: wrong contents\n", args);
+    }
+    page_cache_readahead(&page_cache, &ra, file, offset, 1);
+    page_cache_release(&page_cache, file, offset);
+    wait_for_readahead();
+  }
+
+  int args[2] = {page_cache.misses - misses, page_cache.ra_hits - ra_hits};
+  say("***Sequential read: misses=%d readahead hits=%d\n", args);
+
+  node_free(file);
+  return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Physical page compaction test.
+ *
+ * Validates:
+ * - a high-order allocation succeeds when every aligned block of that order
+ *   holds one allocated but movable frame, by moving that frame away instead
+ *   of panicking
+ * - the moved frame keeps its contents and its owner sees the new address
+ * - every frame comes back: after freeing everything and draining, the buddy
+ *   free count returns to its baseline
+ *
+ * How:
+ * - take every free frame with physmem_alloc_order(0)
+ * - in each aligned group of 2^ORDER frames that the test owns completely,
+ *   stamp the first frame and free the rest, so no free block of ORDER is left
+ * - register a mover that owns the stamped frames, then allocate one block of
+ *   ORDER; compaction must move one stamped frame out of a group
+ * - check every stamped frame's contents through the mover's table
+ *
+ * The test pins itself so every free lands in one core's cache.
+ */
+
+#include "../kernel/physmem.h"
+#include "../kernel/threads.h"
+#include "../kernel/string.h"
+#include "../kernel/print.h"
+#include "../kernel/debug.h"
+
+#define ORDER 3
+#define GROUP_FRAMES 8 // 1 << ORDER
+#define MAX_HELD 4055 // PHYS_FRAME_COUNT / GROUP_FRAMES, rounded up
+
+// frames the test took from the allocator, by frame index
+static unsigned char taken[FREE_PAGE_BITMAP_SIZE];
+
+// stamped frames kept while the rest of their group is free, and the index
+// each was stamped with
+static unsigned* held[MAX_HELD];
+static unsigned held_stamp[MAX_HELD];
+static unsigned held_count = 0;
+static unsigned moved = 0;
+
+static bool is_taken(unsigned index) {
+  return taken[index / 8] & (1u << (index % 8));
+}
+
+static void set_taken(unsigned index, bool value) {
+  if (value) {
+    taken[index / 8] |= (1u << (index % 8));
+  } else {
+    taken[index / 8] &= ~(1u << (index % 8));
+  }
+}
+
+static void test_mark(unsigned first, unsigned count) {
+  for (unsigned i = 0; i < held_count; i++) {
+    unsigned index = frame_index_from_address((unsigned)held[i]);
+    if (index >= first && index < first + count) {
+      physmem_mark_movable(held[i]);
+    }
+  }
+}
+
+static bool test_move(void* frame, void* target) {
+  for (unsigned i = 0; i < held_count; i++) {
+    if (held[i] == frame) {
+      copy_page(target, frame);
+      held[i] = target;
+      moved++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void kernel_main(void) {
+  say("***physmem compaction start\n", NULL);
+
+  core_pin();
+  physmem_drain_caches();
+  unsigned baseline = physmem_free_frames();
+
+  while (physmem_free_frames() > 0) {
+    void* frame = physmem_alloc_order(0);
+    set_taken(frame_index_from_address((unsigned)frame), true);
+  }
+
+  for (unsigned base = 0; base + GROUP_FRAMES <= PHYS_FRAME_COUNT; base += GROUP_FRAMES) {
+    bool whole = true;
+    for (unsigned i = 0; i < GROUP_FRAMES; i++) {
+      if (!is_taken(base + i)) {
+        whole = false;
+        break;
+      }
+    }
+    if (!whole) {
+      continue;
+    }
+
+    unsigned* keep = (unsigned*)address_from_frame_index(base);
+    for (unsigned w = 0; w < FRAME_SIZE / sizeof(unsigned); w++) {
+      keep[w] = base * 0x10001 + w;
+    }
+    held[held_count] = keep;
+    held_stamp[held_count] = base;
+    held_count++;
+
+    for (unsigned i = 0; i < GROUP_FRAMES; i++) {
+      set_taken(base + i, false);
+      if (i != 0) {
+        physmem_free_order((void*)address_from_frame_index(base + i), 0);
+      }
+    }
+  }
+
+  physmem_register_mover(test_mark, test_move);
+
+  bool ok = true;
+  void* block = physmem_alloc_order(ORDER);
+  if ((frame_index_from_address((unsigned)block) & (GROUP_FRAMES - 1)) != 0) {
+    int args[1] = { (int)block };
+    say("***physmem compaction FAIL block 0x%X is misaligned\n", args);
+    ok = false;
+  }
+  if (moved == 0) {
+    say("***physmem compaction FAIL no frame was moved\n", NULL);
+    ok = false;
+  }
+
+  for (unsigned i = 0; i < held_count && ok; i++) {
+    unsigned base = held_stamp[i];
+    for (unsigned w = 0; w < FRAME_SIZE / sizeof(unsigned); w++) {
+      if (held[i][w] != base * 0x10001 + w) {
+        int args[3] = { (int)base, (int)held[i], (int)w };
+        say("***physmem compaction FAIL frame from group %d at 0x%X lost word %d\n", args);
+        ok = false;
+        break;
+      }
+    }
+  }
+
+  physmem_free_order(block, ORDER);
+  unsigned count = held_count;
+  held_count = 0;
+  for (unsigned i = 0; i < count; i++) {
+    physmem_free_order(held[i], 0);
+  }
+  for (unsigned index = 0; index < PHYS_FRAME_COUNT; index++) {
+    if (is_taken(index)) {
+      set_taken(index, false);
+      physmem_free_order((void*)address_from_frame_index(index), 0);
+    }
+  }
+
+  physmem_drain_caches();
+  if (ok && physmem_free_frames() != baseline) {
+    int args[2] = { (int)physmem_free_frames(), (int)baseline };
+    say("***physmem compaction FAIL free frames %d, expected %d\n", args);
+    ok = false;
+  }
+
+  if (ok) {
+    say("***physmem compaction complete\n", NULL);
+  }
+}
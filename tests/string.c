@@ -8,6 +8,10 @@
  *   trailing NUL handling
  * - memcpy(), memcpy2(), memcpy4(), and memset() operate on raw bytes without
  *   touching bytes outside the requested range
+ * - the word-at-a-time paths of memcpy(), memmove(), memset(), and memcmp()
+ *   agree with a byte loop for every head/tail alignment, including
+ *   overlapping memmove() in both directions
+ * - copy_page() and clear_page() cover exactly one frame
  *
  * How:
  * - build small fixed byte arrays that cover empty strings, embedded NUL bytes,
@@ -15,9 +19,13 @@
  * - compare whole byte regions after strncpy(), memcpy(), memcpy2(),
  *   memcpy4(), and memset() so the test checks untouched bytes as well as the
  *   written range
+ * - sweep source/destination offsets 0-3 and lengths across the 16-byte
+ *   word-path threshold and the 32-byte block size, comparing against byte
+ *   loops over guarded buffers
  * - run each helper in a dedicated function so failures identify the exact API
  */
 #include "../kernel/string.h"
+#include "../kernel/physmem.h"
 #include "../kernel/print.h"
 #include "../kernel/debug.h"
 
@@ -309,6 +317,152 @@ static void check_memset(void) {
   say("***memset: ok\n", NULL);
 }
 
+#define SWEEP_BYTES 96
+#define SWEEP_MAX_LEN 80
+
+static unsigned char sweep_src[SWEEP_BYTES];
+static unsigned char sweep_dest[SWEEP_BYTES];
+static unsigned char sweep_expected[SWEEP_BYTES];
+
+static unsigned char sweep_byte(unsigned i) {
+  return (unsigned char)(i * 37 + 11);
+}
+
+// Reset both sweep buffers to distinct patterns so stray writes show up.
+static void sweep_reset(void) {
+  for (unsigned i = 0; i < SWEEP_BYTES; ++i){
+    sweep_src[i] = sweep_byte(i);
+    sweep_dest[i] = 0xEE;
+    sweep_expected[i] = 0xEE;
+  }
+}
+
+// Check memcpy() and memset() against byte loops for every alignment.
+static void check_mem_alignments(void) {
+  for (unsigned src_off = 0; src_off < 4; ++src_off){
+    for (unsigned dest_off = 0; dest_off < 4; ++dest_off){
+      for (unsigned n = 0; n <= SWEEP_MAX_LEN; ++n){
+        sweep_reset();
+        for (unsigned i = 0; i < n; ++i){
+          sweep_expected[dest_off + i] = sweep_src[src_off + i];
+        }
+        memcpy(sweep_dest + dest_off, sweep_src + src_off, n);
+        assert_byte_region(sweep_dest, sweep_expected, SWEEP_BYTES,
+          "string: memcpy should match a byte copy for every alignment and length.\n");
+      }
+    }
+  }
+
+  for (unsigned dest_off = 0; dest_off < 4; ++dest_off){
+    for (unsigned n = 0; n <= SWEEP_MAX_LEN; ++n){
+      sweep_reset();
+      for (unsigned i = 0; i < n; ++i){
+        sweep_expected[dest_off + i] = 0xC3;
+      }
+      memset(sweep_dest + dest_off, 0x5C3, n);
+      assert_byte_region(sweep_dest, sweep_expected, SWEEP_BYTES,
+        "string: memset should match a byte fill for every alignment and length.\n");
+    }
+  }
+
+  say("***mem alignments: ok\n", NULL);
+}
+
+// Check overlapping memmove() in both directions against a byte loop that
+// goes through a temporary copy.
+static void check_memmove(void) {
+  unsigned char temp[SWEEP_MAX_LEN];
+
+  for (unsigned src_off = 0; src_off < 8; ++src_off){
+    for (unsigned dest_off = 0; dest_off < 8; ++dest_off){
+      for (unsigned n = 0; n <= SWEEP_MAX_LEN; n += 3){
+        for (unsigned i = 0; i < SWEEP_BYTES; ++i){
+          sweep_dest[i] = sweep_byte(i);
+          sweep_expected[i] = sweep_byte(i);
+        }
+        for (unsigned i = 0; i < n; ++i){
+          temp[i] = sweep_expected[src_off + i];
+        }
+        for (unsigned i = 0; i < n; ++i){
+          sweep_expected[dest_off + i] = temp[i];
+        }
+
+        assert((unsigned char*)memmove(sweep_dest + dest_off, sweep_dest + src_off, n) ==
+          sweep_dest + dest_off,
+          "string: memmove should return the destination pointer.\n");
+        assert_byte_region(sweep_dest, sweep_expected, SWEEP_BYTES,
+          "string: memmove should copy overlapping regions as if through a temporary buffer.\n");
+      }
+    }
+  }
+
+  say("***memmove: ok\n", NULL);
+}
+
+// Check memcmp() ordering and that the first differing byte decides it, with
+// the difference placed at every position of the word path.
+static void check_memcmp(void) {
+  for (unsigned off = 0; off < 4; ++off){
+    for (unsigned n = 0; n <= SWEEP_MAX_LEN; ++n){
+      sweep_reset();
+      for (unsigned i = 0; i < SWEEP_BYTES; ++i){
+        sweep_dest[i] = sweep_src[i];
+      }
+      assert(memcmp(sweep_dest + off, sweep_src + off, n) == 0,
+        "string: memcmp should report equal buffers as equal.\n");
+
+      for (unsigned at = 0; at < n; ++at){
+        sweep_dest[off + at] = sweep_src[off + at] + 1;
+        if (at + 1 < n){
+          // a later byte that differs the other way must not decide the result
+          sweep_dest[off + at + 1] = sweep_src[off + at + 1] - 1;
+        }
+        assert(memcmp(sweep_dest + off, sweep_src + off, n) > 0,
+          "string: memcmp should order by the first differing byte.\n");
+        assert(memcmp(sweep_src + off, sweep_dest + off, n) < 0,
+          "string: memcmp should be antisymmetric.\n");
+        sweep_dest[off + at] = sweep_src[off + at];
+        if (at + 1 < n){
+          sweep_dest[off + at + 1] = sweep_src[off + at + 1];
+        }
+      }
+    }
+  }
+
+  unsigned char high = 0xF0;
+  unsigned char low = 0x10;
+  assert(memcmp(&high, &low, 1) > 0,
+    "string: memcmp should compare bytes as unsigned chars.\n");
+
+  say("***memcmp: ok\n", NULL);
+}
+
+// Check copy_page() and clear_page() on whole frames.
+static void check_page_helpers(void) {
+  unsigned* src = physmem_alloc();
+  unsigned* dest = physmem_alloc();
+  unsigned words = FRAME_SIZE / sizeof(unsigned);
+
+  for (unsigned i = 0; i < words; ++i){
+    src[i] = i * 2654435761u;
+    dest[i] = 0xFFFFFFFF;
+  }
+
+  copy_page(dest, src);
+  assert_byte_region((unsigned char*)dest, (unsigned char*)src, FRAME_SIZE,
+    "string: copy_page should copy every byte of the frame.\n");
+
+  clear_page(dest);
+  for (unsigned i = 0; i < words; ++i){
+    assert(dest[i] == 0, "string: clear_page should zero every word of the frame.\n");
+  }
+
+  physmem_free(src);
+  physmem_free(dest);
+
+  say("***page helpers: ok\n", NULL);
+}
+
 // Run the string helper checks one API at a time.
 int kernel_main(void) {
   check_strlen();
@@ -319,6 +473,10 @@ int kernel_main(void) {
   check_memcpy2();
   check_memcpy4();
   check_memset();
+  check_mem_alignments();
+  check_memmove();
+  check_memcmp();
+  check_page_helpers();
 
   say("***string helpers: ok\n", NULL);
   return 0;
@@ -0,0 +1,32 @@
+/*
+ * Kernel stack canary negative test.
+ *
+ * Validates:
+ * - block() notices that the current thread has written into the canary
+ *   at the bottom of its kernel stack and panics before switching away.
+ *
+ * How:
+ * - clobber the lowest canary word of kernel_main's own stack, standing in for
+ *   a deep call chain that ran off the end of the stack
+ * - yield(), which blocks through block(); the expected result is a kernel
+ *   panic before the idle thread ever runs
+ */
+
+#include "../kernel/debug.h"
+#include "../kernel/print.h"
+#include "../kernel/threads.h"
+#include "../kernel/per_core.h"
+#include "../kernel/interrupts.h"
+
+void kernel_main(void) {
+  say("***threads kernel stack overflow negative start\n", NULL);
+
+  int was = interrupts_disable();
+  struct TCB* me = get_current_tcb();
+  interrupts_restore(was);
+
+  me->stack[0] = 0;
+  yield();
+
+  say("***threads kernel stack overflow negative FAIL\n", NULL);
+}
@@ -0,0 +1,53 @@
+/*
+ * user_sync_fsync guest:
+ * - verify fsync(fd) returns 0 for an open regular file with dirty data, and
+ *   sync() returns 0
+ * - verify fsync rejects a closed descriptor, a negative descriptor, and one
+ *   past the descriptor table, each with -1
+ * - verify the synced data reads back after reopening the file
+ * - write a byte through a shared mapping that stays mapped, fsync and sync
+ *   it, and verify it reads back through a fresh descriptor
+ */
+
+#include "../../../root/crt/sys.h"
+
+int main(void){
+  char buf[8];
+
+  int fd = open("synced.txt");
+  test_syscall(fd >= 0);
+  test_syscall(write(fd, "SYNC!", 5));
+  test_syscall(fsync(fd));
+  test_syscall(sync());
+  test_syscall(close(fd));
+
+  test_syscall(fsync(fd));
+  test_syscall(fsync(-1));
+  test_syscall(fsync(1000));
+
+  fd = open("synced.txt");
+  test_syscall(fd >= 0);
+  test_syscall(read(fd, buf, 5));
+  test_syscall(buf[0]);
+  test_syscall(buf[4]);
+  test_syscall(close(fd));
+
+  fd = open("mapped.txt");
+  test_syscall(fd >= 0);
+  test_syscall(write(fd, "page", 4));
+  char* map = mmap(4, fd, 0, MMAP_READ | MMAP_WRITE | MMAP_SHARED);
+  test_syscall(map != 0 && (int)map != -1);
+  map[0] = 'M';
+  test_syscall(fsync(fd));
+  test_syscall(sync());
+  test_syscall(close(fd));
+
+  fd = open("mapped.txt");
+  test_syscall(fd >= 0);
+  test_syscall(read(fd, buf, 4));
+  test_syscall(buf[0]);
+  test_syscall(buf[1]);
+  test_syscall(close(fd));
+
+  return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Anonymous fault-around test.
+ *
+ * Validates:
+ * - the first write to a writable private anonymous mapping maps the
+ *   following pages ahead with pre-zeroed frames from the zero pool, writable
+ *   and not copy-on-write, so writing them takes no further trap
+ * - those frames read as zero and keep what is written to them
+ * - with the pool empty, fault-around falls back to the shared zero page
+ *   instead of zeroing frames itself
+ *
+ * How:
+ * - free a pool's worth of frames into this core's cache and sleep so the
+ *   idle thread zeroes them, then touch the first page of a fresh mapping and
+ *   inspect the neighbours' PTEs through the page tables
+ * - drain the caches, which empties the pool, and repeat on a second mapping
+ *
+ * The test pins itself so the pool it fills is the one the faults use.
+ */
+
+#include "../kernel/vmem.h"
+#include "../kernel/physmem.h"
+#include "../kernel/machine.h"
+#include "../kernel/threads.h"
+#include "../kernel/print.h"
+#include "../kernel/debug.h"
+
+#define PAGES (1 + VMEM_FAULT_AROUND_DEFAULT)
+
+static void* frames[PHYSMEM_ZERO_POOL_SIZE];
+
+static unsigned pte_of(unsigned va) {
+  unsigned* pd = get_pid();
+  unsigned pde = pd[(va >> 22) & 0x3FF];
+  if (!(pde & VMEM_VALID)) {
+    return 0;
+  }
+  unsigned* pt = (unsigned*)(pde & ~0xFFF);
+  return pt[(va >> 12) & 0x3FF];
+}
+
+// touch page 0 of a fresh mapping and check how its neighbours were mapped
+static bool check_neighbours(bool expect_pool) {
+  unsigned* base = (unsigned*)mmap(PAGES * FRAME_SIZE, NULL, 0,
+    MMAP_READ | MMAP_WRITE | MMAP_USER);
+  unsigned words = FRAME_SIZE / sizeof(unsigned);
+  bool ok = true;
+
+  base[0] = 0x5A5A0000;
+
+  for (int page = 1; page < PAGES && ok; page++) {
+    unsigned pte = pte_of((unsigned)(base + page * words));
+    bool pooled = (pte & VMEM_WRITE) && !(pte & VMEM_COW);
+    if (!(pte & VMEM_VALID) || pooled != expect_pool) {
+      int args[3] = { page, (int)pte, expect_pool };
+      say("***fault around zero FAIL page %d pte 0x%X, expected pooled=%d\n", args);
+      ok = false;
+      break;
+    }
+    if (base[page * words] != 0 || base[page * words + words - 1] != 0) {
+      int args[1] = { page };
+      say("***fault around zero FAIL page %d is not zero\n", args);
+      ok = false;
+      break;
+    }
+    base[page * words] = 0x5A5A0000 + page;
+  }
+
+  for (int page = 0; page < PAGES && ok; page++) {
+    if (base[page * words] != 0x5A5A0000 + page) {
+      int args[1] = { page };
+      say("***fault around zero FAIL page %d lost its write\n", args);
+      ok = false;
+    }
+  }
+
+  munmap(base);
+  return ok;
+}
+
+void kernel_main(void) {
+  say("***fault around zero start\n", NULL);
+
+  core_pin();
+
+  // give the idle thread frames to zero in this core's cache
+  for (int i = 0; i < PHYSMEM_ZERO_POOL_SIZE; i++) {
+    frames[i] = physmem_alloc();
+  }
+  for (int i = 0; i < PHYSMEM_ZERO_POOL_SIZE; i++) {
+    physmem_free(frames[i]);
+  }
+  sleep(20);
+
+  bool ok = check_neighbours(true);
+
+  physmem_drain_caches();
+  ok = ok && check_neighbours(false);
+
+  if (ok) {
+    say("***fault around zero complete\n", NULL);
+  }
+}
@@ -40,8 +40,20 @@ void private_file_backed_test(void){
 }
 
 void shared_anonymous_test(void){
-  // might be hard to test without processes
-  say("***    TODO: implement shared anonymous mmap test\n", NULL);
+  // sharing across processes needs fork; this covers fault, zero-fill and unmap
+  int* p = mmap(2 * FRAME_SIZE, NULL, 0, MMAP_READ | MMAP_WRITE | MMAP_SHARED);
+  say("***    mmap'd two shared pages at virtual address 0x%X\n", &p);
+
+  int zeros[2] = {p[0], p[FRAME_SIZE / sizeof(int)]};
+  say("***    first ints of both pages start as %d and %d\n", zeros);
+
+  p[0] = 42;
+  p[FRAME_SIZE / sizeof(int)] = 43;
+  int values[2] = {p[0], p[FRAME_SIZE / sizeof(int)]};
+  say("***    read back %d and %d\n", values);
+
+  munmap(p);
+  say("***    munmap'd the shared pages\n", NULL);
 }
 
 void shared_file_backed_test(void){